@@ -345,6 +345,34 @@ function unit_test() {
   if [[ $? -ne 0 ]]; then
     return 1
   fi
+  bazel_test //src:test_batcher     --define "malloc=jemalloc"
+  if [[ $? -ne 0 ]]; then
+    return 1
+  fi
+  bazel_test //src:test_sample      --define "malloc=jemalloc"
+  if [[ $? -ne 0 ]]; then
+    return 1
+  fi
+  bazel_test //src:test_sample_pool --define "malloc=jemalloc"
+  if [[ $? -ne 0 ]]; then
+    return 1
+  fi
+  bazel_test //src:test_admission   --define "malloc=jemalloc"
+  if [[ $? -ne 0 ]]; then
+    return 1
+  fi
+  bazel_test //src:test_score_cache --define "malloc=jemalloc"
+  if [[ $? -ne 0 ]]; then
+    return 1
+  fi
+  bazel_test //src:test_tracer --define "malloc=jemalloc"
+  if [[ $? -ne 0 ]]; then
+    return 1
+  fi
+  bazel_test //src:test_server      --define "malloc=jemalloc"
+  if [[ $? -ne 0 ]]; then
+    return 1
+  fi
 }
 
 function benchmark_test() {
@@ -353,11 +381,22 @@ function benchmark_test() {
     return 1
   fi
 
+  bazel_test //src:bm_mpmc_queue --define "malloc=jemalloc" --test_arg="--benchmark_format=console"
+  if [[ $? -ne 0 ]]; then
+    return 1
+  fi
+
   bazel_test //src:bm_tf_engine --define "malloc=jemalloc" --test_arg="--benchmark_format=console"
   if [[ $? -ne 0 ]]; then
     return 1
   fi
 
+  bazel_test //src:bm_tf2_engine --define "malloc=jemalloc" --test_arg="--benchmark_format=console" \
+    --test_env=MODEL_SERVER_TF2_SAVED_MODEL
+  if [[ $? -ne 0 ]]; then
+    return 1
+  fi
+
   bazel_test //src:bm_onnx_engine --define "malloc=jemalloc" --test_arg="--benchmark_format=console"
   if [[ $? -ne 0 ]]; then
     return 1
@@ -410,7 +449,7 @@ function clean() {
 
 function build_tools() {
   if [[ "${BUILD_TOOLS}" = true || "${DEFAULT_BUILD_TOOLS}" = true ]]; then
-    tools=("read_tf_trace")
+    tools=("read_tf_trace" "model_server" "perf_server_tf")
     for tool in ${tools[@]}; do
       bazel_build //src:${tool} --define "malloc=jemalloc"
       if [[ $? -ne 0 ]]; then
@@ -0,0 +1,27 @@
+# Copyright (C) 2023 zh.luxu1986@gmail.com
+
+from absl import app
+from absl import flags
+from absl import logging
+
+from onnxruntime.quantization import quantize_dynamic, QuantType
+
+FLAGS = flags.FLAGS
+
+flags.DEFINE_string("input", None, "fp32 ONNX graph file path")
+flags.DEFINE_string("output", None, "int8 ONNX graph file path")
+flags.DEFINE_bool("per_channel", False, "Quantize weights per output channel")
+
+def main(_):
+  # Weights become int8 once here, activations are quantized by ORT on every run
+  quantize_dynamic(
+    FLAGS.input,
+    FLAGS.output,
+    weight_type = QuantType.QInt8,
+    per_channel = FLAGS.per_channel,
+  )
+  logging.info("Quantized %s into %s", FLAGS.input, FLAGS.output)
+
+if __name__ == '__main__':
+  flags.mark_flags_as_required(['input', 'output'])
+  app.run(main)
@@ -0,0 +1,103 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>  // NOLINT
+#include <vector>
+#include "BShoshany/BS_thread_pool.hpp"
+#include "benchmark/benchmark.h"
+#include "model_server/src/util/functional/mpmc_queue.h"
+
+// Both benchmarks hand kItems small requests from N producer threads to N consumer threads,
+// an iteration ends once every request has been consumed.
+static const int64_t kItems = 1 << 20;
+static const size_t kQueueCapacity = 4096;
+static const size_t kPopBatch = 16;
+
+static void bm_mpmc_queue_handoff(benchmark::State& state) {  // NOLINT
+  const int32_t num_threads = state.range(0);
+  model_server::MPMCQueue<int64_t> queue(kQueueCapacity);
+  std::atomic<bool> stopped(false);
+  std::atomic<int64_t> consumed(0);
+
+  std::vector<std::thread> consumers;
+  for (int32_t i = 0; i < num_threads; ++i) {
+    consumers.emplace_back([&]() {
+      int64_t values[kPopBatch];
+      while (!stopped.load(std::memory_order_relaxed)) {
+        const size_t count = queue.try_pop_batch(values, kPopBatch);
+        if (0 == count) {
+          std::this_thread::yield();
+          continue;
+        }
+        for (size_t j = 0; j < count; ++j) {
+          benchmark::DoNotOptimize(values[j]);
+        }
+        consumed.fetch_add(count, std::memory_order_relaxed);
+      }
+    });
+  }
+
+  for (auto _ : state) {
+    consumed = 0;
+    std::vector<std::thread> producers;
+    for (int32_t i = 0; i < num_threads; ++i) {
+      producers.emplace_back([&queue, num_threads]() {
+        for (int64_t j = 0; j < kItems / num_threads; ++j) {
+          while (!queue.try_push(j)) {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    for (auto& producer : producers) {
+      producer.join();
+    }
+    while (consumed.load(std::memory_order_relaxed) < kItems / num_threads * num_threads) {
+      std::this_thread::yield();
+    }
+  }
+
+  stopped = true;
+  for (auto& consumer : consumers) {
+    consumer.join();
+  }
+  state.SetItemsProcessed(state.iterations() * kItems);
+}
+
+static void bm_thread_pool_handoff(benchmark::State& state) {  // NOLINT
+  const int32_t num_threads = state.range(0);
+  BS::thread_pool workers(num_threads);
+
+  for (auto _ : state) {
+    std::vector<std::thread> producers;
+    for (int32_t i = 0; i < num_threads; ++i) {
+      producers.emplace_back([&workers, num_threads]() {
+        for (int64_t j = 0; j < kItems / num_threads; ++j) {
+          workers.push_task([j]() {
+            benchmark::DoNotOptimize(j);
+          });
+        }
+      });
+    }
+    for (auto& producer : producers) {
+      producer.join();
+    }
+    workers.wait_for_tasks();
+  }
+  state.SetItemsProcessed(state.iterations() * kItems);
+}
+
+BENCHMARK(bm_mpmc_queue_handoff)
+  ->RangeMultiplier(2)
+  ->Range(1, 64)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+BENCHMARK(bm_thread_pool_handoff)
+  ->RangeMultiplier(2)
+  ->Range(1, 64)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+BENCHMARK_MAIN();
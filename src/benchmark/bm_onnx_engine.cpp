@@ -1,81 +1,74 @@
 // Copyright (C) 2021 zh.luxu1986@gmail.com
 
+#include <memory>
 #include <vector>
 #include "absl/log/log.h"
+#include "absl/log/globals.h"
 #include "benchmark/benchmark.h"
 #include "model_server/src/engine/sample.h"
 #include "model_server/src/engine/onnx_engine.h"
-#include "model_server/src/population/model_spec.h"
-#include "model_server/src/population/sample_gen.h"
 
 const int32_t kTestDataSize = 20;
-const int32_t kBatchSize = 128;
-static std::vector<model_server::Sample> g_samples;
 
 static void do_setup(const benchmark::State& state) {
-  FLAGS_logbufsecs = 0;
-  FLAGS_minloglevel = google::ERROR;
-  FLAGS_logtostdout = true;
-
-  std::string meta_file = "data/models/model_2/model_conf.json";
-  model_server::ModelMeta model_meta;
-  model_meta.load(meta_file);
-  model_server::random_sample_gen(model_meta, &g_samples, kTestDataSize, kBatchSize);
+  absl::SetMinLogLevel(absl::LogSeverityAtLeast::kError);
 }
 
 static void do_teardown(const benchmark::State& state) {
 }
 
+// Runs model_1 by name, by slot and by slot through IoBinding, at the batch size of the second arg
 static void bm_onnx_engine(benchmark::State& state) {  // NOLINT
+  const int64_t path = state.range(0);
+  const int32_t batch_size = static_cast<int32_t>(state.range(1));
   model_server::EngineConf engine_conf {
-    .name = "model_2",
+    .name = "model_1",
     .version = "1.0.0",
-    .graph_file_loc = "data/models/model_2/1/graph.onnx",
-    .input_nodes = {"dense", "onehot", "sparse_input_folded", "sparse_input_unfolded"},
+    .graph_file_loc = "data/models/model_1/2/graph.onnx",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
     .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
-    .opt_level = static_cast<int32_t>(state.range(0)),
-    .jit_level = static_cast<int32_t>(state.range(1)),
-    .inter_op_parallelism_threads = static_cast<int32_t>(state.range(2)),
-    .intra_op_parallelism_threads = static_cast<int32_t>(state.range(3))
+    .opt_level = 1,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1,
+    .ort_use_io_binding = 2 == path
   };
-  std::unique_ptr<model_server::ONNXEngine> engine(new model_server::ONNXEngine(engine_conf));
+  std::unique_ptr<model_server::Engine> engine(model_server::ONNXEngineFactory::instance()->create(engine_conf));
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, kTestDataSize, batch_size, true);
 
   for (auto _ : state) {
-    for (auto& sample : g_samples) {
-      engine->infer(&sample.instance, &sample.score);
+    for (auto& sample : samples) {
+      if (0 == path) {
+        engine->infer(&sample.instance, &sample.score);
+      } else {
+        engine->infer_bound(&sample.instance, &sample.score);
+      }
       benchmark::ClobberMemory();
     }
   }
+  state.SetItemsProcessed(state.iterations() * kTestDataSize * batch_size);
 }
 
 BENCHMARK(bm_onnx_engine)
-  ->Args({0, 0, 1, 1})
-  ->Args({0, 0, 1, 8})
-  ->Args({0, 0, 8, 1})
-  ->Args({0, 0, 8, 8})
-  ->Args({0, 1, 1, 1})
-  ->Args({0, 1, 1, 8})
-  ->Args({0, 1, 8, 1})
-  ->Args({0, 1, 8, 8})
-  ->Args({0, 2, 1, 1})
-  ->Args({0, 2, 1, 8})
-  ->Args({0, 2, 8, 1})
-  ->Args({0, 2, 8, 8})
-  ->Args({1, 0, 1, 1})
-  ->Args({1, 0, 1, 8})
-  ->Args({1, 0, 8, 1})
-  ->Args({1, 0, 8, 8})
-  ->Args({1, 1, 1, 1})
-  ->Args({1, 1, 1, 8})
-  ->Args({1, 1, 8, 1})
-  ->Args({1, 1, 8, 8})
-  ->Args({1, 2, 1, 1})
-  ->Args({1, 2, 1, 8})
-  ->Args({1, 2, 8, 1})
-  ->Args({1, 2, 8, 8})
+  ->Args({0, 1})
+  ->Args({1, 1})
+  ->Args({2, 1})
+  ->Args({0, 8})
+  ->Args({1, 8})
+  ->Args({2, 8})
+  ->Args({0, 32})
+  ->Args({1, 32})
+  ->Args({2, 32})
+  ->Args({0, 128})
+  ->Args({1, 128})
+  ->Args({2, 128})
+  ->Args({0, 512})
+  ->Args({1, 512})
+  ->Args({2, 512})
   ->Setup(do_setup)
   ->Teardown(do_teardown)
-  ->Unit(benchmark::kMillisecond)
+  ->Unit(benchmark::kMicrosecond)
   ->UseRealTime();
 
 BENCHMARK_MAIN();
@@ -0,0 +1,68 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <stdlib.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "absl/log/log.h"
+#include "absl/log/globals.h"
+#include "benchmark/benchmark.h"
+#include "model_server/src/engine/sample.h"
+#include "model_server/src/engine/tf2_engine.h"
+
+const int32_t kTestDataSize = 20;
+const int32_t kBatchSize = 128;
+
+static void do_setup(const benchmark::State& state) {
+  absl::SetMinLogLevel(absl::LogSeverityAtLeast::kError);
+}
+
+static void do_teardown(const benchmark::State& state) {
+}
+
+// Runs model_1 by name and through a callable, the SavedModel is exported out of tree
+static void bm_tf2_engine(benchmark::State& state) {  // NOLINT
+  const char *saved_model_dir = getenv("MODEL_SERVER_TF2_SAVED_MODEL");
+  if (nullptr == saved_model_dir) {
+    state.SkipWithError("MODEL_SERVER_TF2_SAVED_MODEL is not set");
+    return;
+  }
+  model_server::EngineConf engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = saved_model_dir,
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 1,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = static_cast<int32_t>(state.range(1)),
+    .intra_op_parallelism_threads = static_cast<int32_t>(state.range(2)),
+    .tf_use_callable = 0 != state.range(0)
+  };
+  std::unique_ptr<model_server::Engine> engine(model_server::TF2EngineFactory::instance()->create(engine_conf));
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, kTestDataSize, kBatchSize, true);
+
+  for (auto _ : state) {
+    for (auto& sample : samples) {
+      engine->infer(&sample.instance, &sample.score);
+      benchmark::ClobberMemory();
+    }
+  }
+}
+
+BENCHMARK(bm_tf2_engine)
+  ->Args({0, 1, 1})
+  ->Args({1, 1, 1})
+  ->Args({0, 1, 8})
+  ->Args({1, 1, 8})
+  ->Args({0, 8, 1})
+  ->Args({1, 8, 1})
+  ->Args({0, 8, 8})
+  ->Args({1, 8, 8})
+  ->Setup(do_setup)
+  ->Teardown(do_teardown)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+BENCHMARK_MAIN();
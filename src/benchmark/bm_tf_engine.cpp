@@ -1,26 +1,18 @@
 // Copyright (C) 2021 zh.luxu1986@gmail.com
 
+#include <memory>
 #include <vector>
 #include "absl/log/log.h"
+#include "absl/log/globals.h"
 #include "benchmark/benchmark.h"
 #include "model_server/src/engine/sample.h"
 #include "model_server/src/engine/tf_engine.h"
-#include "model_server/src/population/model_spec.h"
-#include "model_server/src/population/sample_gen.h"
 
 const int32_t kTestDataSize = 20;
 const int32_t kBatchSize = 128;
-static std::vector<model_server::Sample> g_samples;
 
 static void do_setup(const benchmark::State& state) {
-  FLAGS_logbufsecs = 0;
-  FLAGS_minloglevel = google::ERROR;
-  FLAGS_logtostdout = true;
-
-  std::string meta_file = "data/models/model_1/model_conf.json";
-  model_server::ModelMeta model_meta;
-  model_meta.load(meta_file);
-  model_server::random_sample_gen(model_meta, &g_samples, kTestDataSize, kBatchSize);
+  absl::SetMinLogLevel(absl::LogSeverityAtLeast::kError);
 }
 
 static void do_teardown(const benchmark::State& state) {
@@ -38,10 +30,12 @@ static void bm_tf_engine(benchmark::State& state) {  // NOLINT
     .inter_op_parallelism_threads = static_cast<int32_t>(state.range(2)),
     .intra_op_parallelism_threads = static_cast<int32_t>(state.range(3))
   };
-  std::unique_ptr<model_server::TFEngine> engine(new model_server::TFEngine(engine_conf));
+  std::unique_ptr<model_server::Engine> engine(model_server::TFEngineFactory::instance()->create(engine_conf));
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, kTestDataSize, kBatchSize, true);
 
   for (auto _ : state) {
-    for (auto& sample : g_samples) {
+    for (auto& sample : samples) {
       engine->infer(&sample.instance, &sample.score);
       benchmark::ClobberMemory();
     }
@@ -0,0 +1,105 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/util/functional/timer.h"
+#include "model_server/src/config/gflags.h"
+#include "model_server/src/engine/sample.h"
+#include "model_server/src/engine/engine.h"
+#include "model_server/src/engine/admission.h"
+#include "model_server/src/server/client.h"
+#include "select_engine.h"  // NOLINT
+
+// Replays the samples of the perf binary against a running server, so both report the same PerfIndex
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  try {
+    const std::string& host = absl::GetFlag(FLAGS_host).empty() ? "127.0.0.1" : absl::GetFlag(FLAGS_host);
+    const int32_t port = absl::GetFlag(FLAGS_port);
+    const std::string& model = absl::GetFlag(FLAGS_model_name);
+    const int32_t concurrency = absl::GetFlag(FLAGS_number_of_consumers);
+    const int32_t batch_size = absl::GetFlag(FLAGS_batch_size);
+    const int64_t timeout_us = absl::GetFlag(FLAGS_request_timeout_us);
+    const absl::Duration timeout = timeout_us > 0 ? absl::Microseconds(timeout_us) : absl::InfiniteDuration();
+
+    // The local engine only describes the inputs and outputs of the model to generate samples
+    std::vector<model_server::Sample> samples;
+    {
+      std::unique_ptr<model_server::Engine> engine(create_demo_engine_3());
+      if (nullptr == engine.get()) {
+        LOG(ERROR) << "Failed to create engine";
+        return -1;
+      }
+      engine->random_sample_gen(&samples, absl::GetFlag(FLAGS_number_of_test_cases), batch_size);
+    }
+    if (samples.empty()) {
+      LOG(ERROR) << "No sample to send";
+      return -1;
+    }
+
+    // warmup
+    {
+      model_server::Client client(host, port);
+      model_server::Sample sample = samples[0];
+      client.call(model, &(sample.instance), &(sample.score));
+    }
+
+    std::vector<double> cost_ms(samples.size());
+    std::atomic<int32_t> next(0);
+    std::atomic<int32_t> rejections(0);
+    std::atomic<int32_t> failures(0);
+    std::vector<std::thread> callers;
+    model_server::Timer timer;
+    for (int32_t i = 0; i < concurrency; ++i) {
+      callers.emplace_back([&]() {
+        model_server::Client client(host, port);
+        for (int32_t j = next.fetch_add(1); j < static_cast<int32_t>(samples.size()); j = next.fetch_add(1)) {
+          model_server::Timer call_timer;
+          try {
+            client.call(model, &(samples[j].instance), &(samples[j].score), timeout);
+          } catch (const model_server::AdmissionRejected& e) {
+            rejections.fetch_add(1);
+          } catch (const std::exception& e) {
+            LOG(ERROR) << e.what();
+            failures.fetch_add(1);
+          }
+          cost_ms[j] = call_timer.f64_elapsed_ms();
+        }
+      });
+    }
+    for (auto& caller : callers) {
+      caller.join();
+    }
+    double total_cost_sec = timer.f64_elapsed_sec();
+
+    // cpu and memory belong to the server process, only the client side view is reported here.
+    // Throughput counts answered requests only, shed ones are the price of keeping it.
+    const int32_t answered = static_cast<int32_t>(samples.size()) - rejections.load() - failures.load();
+    model_server::PerfIndex perf_index;
+    std::sort(cost_ms.begin(), cost_ms.end());
+    perf_index.set_cost_avg_ms(std::accumulate(cost_ms.begin(), cost_ms.end(), 0.0) / cost_ms.size());
+    perf_index.set_cost_p99_ms(cost_ms[static_cast<int32_t>(cost_ms.size() * 0.99)]);
+    perf_index.set_throughput(static_cast<double>(answered) / total_cost_sec * batch_size);
+    LOG(INFO) << "Rejections: " << rejections.load() << ", failures: " << failures.load()
+              << ", summary:\n" << perf_index.DebugString();
+  } catch (const std::exception& e) {
+    LOG(ERROR) << e.what();
+  } catch (...) {
+    LOG(ERROR) << "Unknown exception";
+  }
+  LOG(INFO) << "Done";
+
+  return 0;
+}
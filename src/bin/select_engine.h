@@ -57,7 +57,13 @@ model_server::Engine *create_demo_engine_2() {
     .inter_op_parallelism_threads = cpu_core_num,
     .intra_op_parallelism_threads = cpu_core_num,
     .use_global_thread_pool = false,
-    .ort_parrallel_execution = false
+    .ort_parrallel_execution = false,
+    .ort_model_cache_dir = absl::GetFlag(FLAGS_engine_ort_model_cache_dir),
+    .ort_quantize_dynamic = absl::GetFlag(FLAGS_engine_ort_quantize_dynamic),
+    .ort_quantize_script = absl::GetFlag(FLAGS_engine_ort_quantize_script),
+    .tf_prune_graph = absl::GetFlag(FLAGS_engine_tf_prune_graph),
+    .zero_copy_output = absl::GetFlag(FLAGS_engine_zero_copy_output),
+    .trace_every_n = absl::GetFlag(FLAGS_engine_trace_every_n)
   };
 
 #ifdef USE_TF_ENGINE
@@ -100,7 +106,13 @@ model_server::Engine *create_demo_engine_3() {
     .inter_op_parallelism_threads = cpu_core_num,
     .intra_op_parallelism_threads = cpu_core_num,
     .use_global_thread_pool = false,
-    .ort_parrallel_execution = false
+    .ort_parrallel_execution = false,
+    .ort_model_cache_dir = absl::GetFlag(FLAGS_engine_ort_model_cache_dir),
+    .ort_quantize_dynamic = absl::GetFlag(FLAGS_engine_ort_quantize_dynamic),
+    .ort_quantize_script = absl::GetFlag(FLAGS_engine_ort_quantize_script),
+    .tf_prune_graph = absl::GetFlag(FLAGS_engine_tf_prune_graph),
+    .zero_copy_output = absl::GetFlag(FLAGS_engine_zero_copy_output),
+    .trace_every_n = absl::GetFlag(FLAGS_engine_trace_every_n)
   };
 
 #ifdef USE_TF_ENGINE
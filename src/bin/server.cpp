@@ -0,0 +1,93 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <signal.h>
+#include <stdint.h>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>  // NOLINT
+
+#include "absl/log/log.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/config/gflags.h"
+#include "model_server/src/engine/sample.h"
+#include "model_server/src/population/population.h"
+#include "model_server/src/server/server.h"
+
+static const int32_t kEvolveIntervalSec = 60;
+
+static std::atomic<bool> stopping(false);
+
+static void stop_handler(int32_t signal) {
+  stopping = true;
+}
+
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  // Let SIGINT and SIGTERM drain the server instead of exiting on the spot
+  signal(SIGINT, &stop_handler);
+  signal(SIGTERM, &stop_handler);
+
+  try {
+    model_server::Population population(
+      absl::GetFlag(FLAGS_local_model_dir), absl::GetFlag(FLAGS_pin_workers_to_numa)
+    );  // NOLINT
+    population.evolve();
+
+    model_server::ServerConf server_conf {
+      .host = absl::GetFlag(FLAGS_host),
+      .port = absl::GetFlag(FLAGS_port),
+      .num_io_threads = absl::GetFlag(FLAGS_number_of_producers),
+      .num_workers = absl::GetFlag(FLAGS_number_of_inference_workers),
+      .pin_workers_to_numa = absl::GetFlag(FLAGS_pin_workers_to_numa)
+    };
+    model_server::Server server(
+      server_conf,
+      [&population](
+        const std::string& model, absl::Time deadline, model_server::Priority priority,
+        model_server::Instance *instance, model_server::Score *score
+      ) {  // NOLINT
+        std::shared_ptr<model_server::Lifecycle> lifecycle = population.summon(model);
+        if (nullptr == lifecycle) {
+          throw std::runtime_error("Model " + model + " not found");
+        }
+        lifecycle->undertake(instance, score, deadline, priority);
+      },
+      // Requests are decoded into samples of the model's pool, so their tensors reuse its buffers
+      [&population](const std::string& model) {
+        std::shared_ptr<model_server::Lifecycle> lifecycle = population.summon(model);
+        return nullptr == lifecycle ? model_server::SamplePool::Handle() : lifecycle->acquire_sample();
+      }
+    );  // NOLINT
+    server.start();
+
+    absl::Time last_evolve = absl::Now();
+    while (!stopping) {
+      absl::SleepFor(absl::Milliseconds(100));
+      if (absl::Now() - last_evolve < absl::Seconds(kEvolveIntervalSec)) {
+        continue;
+      }
+      last_evolve = absl::Now();
+      try {
+        population.evolve();
+      } catch (const std::exception& e) {
+        LOG(ERROR) << e.what();
+      }
+    }
+    server.stop();
+  } catch (const std::exception& e) {
+    LOG(ERROR) << e.what();
+    return -1;
+  } catch (...) {
+    LOG(ERROR) << "Unknown exception";
+    return -1;
+  }
+  LOG(INFO) << "Done";
+
+  return 0;
+}
@@ -5,8 +5,11 @@
 
 ABSL_FLAG(std::string, host, "", "Host");
 ABSL_FLAG(int32_t, port, 8610, "Port");
+ABSL_FLAG(std::string, model_name, "model_3", "Model requested by the server perf client");
+ABSL_FLAG(int64_t, request_timeout_us, 0, "Deadline of every request sent by the server perf client, 0 means none");
 
 ABSL_FLAG(int32_t, number_of_inference_workers, 16, "The number of inference workers");
+ABSL_FLAG(bool, pin_workers_to_numa, false, "Pin inference workers to NUMA nodes round robin");
 ABSL_FLAG(int32_t, batch_size, 128, "Batch size");
 
 ABSL_FLAG(std::string, local_model_dir, "", "Local model directory");
@@ -20,3 +23,9 @@ ABSL_FLAG(int32_t, engine_inter_op_parallelism_threads, 16, "Inter op parallelis
 ABSL_FLAG(int32_t, engine_intra_op_parallelism_threads, 16, "Intra op parallelism threads");
 ABSL_FLAG(bool, engin_use_global_thread_pool, true, "Use global thread pool");
 ABSL_FLAG(bool, engine_ort_parrallel_execution, false, "ORT parallel execution");
+ABSL_FLAG(bool, engine_zero_copy_output, false, "Targets hold engine output tensors instead of a copy");
+ABSL_FLAG(int32_t, engine_trace_every_n, 0, "Trace 1 in every n requests, 0 disables tracing");
+ABSL_FLAG(std::string, engine_ort_model_cache_dir, "", "Cache of ORT optimized models, empty disables it");
+ABSL_FLAG(bool, engine_ort_quantize_dynamic, false, "ORT serves a dynamically int8 quantized variant of the graph");
+ABSL_FLAG(std::string, engine_ort_quantize_script, "script/ort_quantize_dynamic.py", "Builds the ORT int8 variant");
+ABSL_FLAG(bool, engine_tf_prune_graph, false, "TF prunes the graph to the inputs and outputs before importing it");
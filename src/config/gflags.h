@@ -10,8 +10,11 @@
 
 ABSL_DECLARE_FLAG(std::string, host);
 ABSL_DECLARE_FLAG(int32_t, port);
+ABSL_DECLARE_FLAG(std::string, model_name);
+ABSL_DECLARE_FLAG(int64_t, request_timeout_us);
 
 ABSL_DECLARE_FLAG(int32_t, number_of_inference_workers);
+ABSL_DECLARE_FLAG(bool, pin_workers_to_numa);
 ABSL_DECLARE_FLAG(int32_t, batch_size);
 
 ABSL_DECLARE_FLAG(std::string, local_model_dir);
@@ -25,5 +28,11 @@ ABSL_DECLARE_FLAG(int32_t, engine_inter_op_parallelism_threads);
 ABSL_DECLARE_FLAG(int32_t, engine_intra_op_parallelism_threads);
 ABSL_DECLARE_FLAG(bool, engin_use_global_thread_pool);
 ABSL_DECLARE_FLAG(bool, engine_ort_parrallel_execution);
+ABSL_DECLARE_FLAG(bool, engine_zero_copy_output);
+ABSL_DECLARE_FLAG(int32_t, engine_trace_every_n);
+ABSL_DECLARE_FLAG(std::string, engine_ort_model_cache_dir);
+ABSL_DECLARE_FLAG(bool, engine_ort_quantize_dynamic);
+ABSL_DECLARE_FLAG(std::string, engine_ort_quantize_script);
+ABSL_DECLARE_FLAG(bool, engine_tf_prune_graph);
 
 #endif  // MODEL_SERVER_SRC_CONFIG_GFLAGS_H_
@@ -0,0 +1,89 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/engine/admission.h"
+#include <algorithm>
+#include <string>
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+
+namespace model_server {
+
+// Weight of the newest sample in the latency moving average
+static const double kLatencyEwmaAlpha = 0.1;
+
+Admission::Admission(const AdmissionConf& admission_conf) noexcept(false) :
+  conf_(admission_conf),
+  mtx_(),
+  limit_(0.0),
+  inflight_(0),
+  latency_ewma_(absl::ZeroDuration()),
+  last_backoff_(absl::InfinitePast()) {
+  if (conf_.max_limit < 0 || conf_.target_latency_us <= 0 || conf_.backoff_ratio <= 0.0 || conf_.backoff_ratio >= 1.0
+    || (conf_.max_limit > 0 && (conf_.min_limit <= 0 || conf_.min_limit > conf_.max_limit))) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Invalid admission conf: " + conf_.detail();
+    throw std::runtime_error(err_msg);
+  }
+  if (conf_.max_limit > 0) {
+    limit_ = std::clamp(conf_.initial_limit, conf_.min_limit, conf_.max_limit);
+  }
+}
+
+void Admission::admit(absl::Time deadline) noexcept(false) {
+  const absl::Time now = absl::Now();
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (now + latency_ewma_ > deadline) {
+    const absl::Duration expected = latency_ewma_;
+    // Only admitted requests refresh the estimate, so every rejection decays it. After a latency
+    // spike requests are let through again as probes, instead of the model being shut out for good.
+    latency_ewma_ = latency_ewma_ * (1.0 - kLatencyEwmaAlpha);
+    throw AdmissionRejected(absl::StrFormat(
+      "Deadline can not be met, %s left but %s expected",
+      absl::FormatDuration(deadline - now), absl::FormatDuration(expected)
+    ));  // NOLINT
+  }
+  if (conf_.max_limit > 0 && inflight_ >= static_cast<int32_t>(limit_)) {
+    throw AdmissionRejected(absl::StrFormat("Concurrency limit %d reached", static_cast<int32_t>(limit_)));
+  }
+  ++inflight_;
+}
+
+void Admission::release(absl::Duration latency, bool succeeded) noexcept {
+  const absl::Time now = absl::Now();
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  --inflight_;
+  if (succeeded) {
+    latency_ewma_ = absl::ZeroDuration() == latency_ewma_
+      ? latency : latency_ewma_ + (latency - latency_ewma_) * kLatencyEwmaAlpha;
+  }
+  if (0 == conf_.max_limit) {
+    return;
+  }
+
+  if (succeeded && latency <= absl::Microseconds(conf_.target_latency_us)) {
+    limit_ = std::min(limit_ + 1.0 / limit_, static_cast<double>(conf_.max_limit));
+  } else if (now - last_backoff_ >= latency_ewma_) {
+    // Requests admitted before the last backoff finish slow too, they must not shrink the limit again
+    limit_ = std::max(limit_ * conf_.backoff_ratio, static_cast<double>(conf_.min_limit));
+    last_backoff_ = now;
+  }
+}
+
+int32_t Admission::limit() const noexcept {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return static_cast<int32_t>(limit_);
+}
+
+int32_t Admission::inflight() const noexcept {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return inflight_;
+}
+
+absl::Duration Admission::expected_latency() const noexcept {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return latency_ewma_;
+}
+
+}  // namespace model_server
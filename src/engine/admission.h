@@ -0,0 +1,71 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_ENGINE_ADMISSION_H_
+#define MODEL_SERVER_SRC_ENGINE_ADMISSION_H_
+
+#include <stdint.h>
+#include <mutex>  // NOLINT
+#include <stdexcept>
+#include <string>
+#include "absl/time/time.h"
+
+namespace model_server {
+
+struct AdmissionConf {
+  int32_t initial_limit     = 16;
+  int32_t min_limit         = 1;
+  int32_t max_limit         = 0;  // 0 disables the concurrency limit, deadlines are enforced anyway
+  int64_t target_latency_us = 20000;
+  double  backoff_ratio     = 0.9;
+
+  std::string detail() const noexcept {
+    return "initial_limit: " + std::to_string(initial_limit)
+      + ", min_limit: " + std::to_string(min_limit)
+      + ", max_limit: " + std::to_string(max_limit)
+      + ", target_latency_us: " + std::to_string(target_latency_us)
+      + ", backoff_ratio: " + std::to_string(backoff_ratio);
+  }
+};
+
+// Thrown when a request is shed, it has not touched the engine yet
+class AdmissionRejected : public std::runtime_error {
+ public:
+  explicit AdmissionRejected(const std::string& what) : std::runtime_error(what) {}
+};
+
+// Decides whether a request of one model may run now. A request is rejected when its
+// deadline is closer than the observed latency, or when the model already runs as many
+// requests as the concurrency limit. The latency estimate decays on every deadline rejection,
+// so a spike does not lock the model out. The limit follows AIMD on the observed latency:
+// it grows by one per limit requests finished within target and shrinks by backoff_ratio,
+// at most once per latency period, when they are not.
+class Admission {
+ public:
+  explicit Admission(const AdmissionConf& admission_conf) noexcept(false);
+  virtual ~Admission() {}
+
+  Admission() = delete;
+  Admission& operator=(const Admission&) = delete;
+  Admission(const Admission&) = delete;
+
+  // Take a slot or throw AdmissionRejected, a granted slot must be given back by release
+  void admit(absl::Time deadline) noexcept(false);
+  void release(absl::Duration latency, bool succeeded) noexcept;
+
+  int32_t limit() const noexcept;
+  int32_t inflight() const noexcept;
+  absl::Duration expected_latency() const noexcept;
+
+ private:
+  AdmissionConf conf_;
+
+  mutable std::mutex mtx_;
+  double             limit_;
+  int32_t            inflight_;
+  absl::Duration     latency_ewma_;
+  absl::Time         last_backoff_;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_ENGINE_ADMISSION_H_
@@ -0,0 +1,353 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/engine/batcher.h"
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "absl/log/log.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+
+namespace model_server {
+
+Batcher::Batcher(Engine *engine, const BatcherConf& batcher_conf) noexcept(false) :
+  engine_(engine),
+  conf_(batcher_conf),
+  stopped_(false),
+  queued_rows_(0),
+  queue_(),
+  queue_mtx_(),
+  queue_cv_(),
+  workers_() {
+  if (nullptr == engine_) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Engine is nullptr";
+    throw std::runtime_error(err_msg);
+  }
+  if (conf_.max_batch_size <= 0 || conf_.max_queue_delay_us < 0 || conf_.num_batch_threads <= 0) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Invalid batcher conf: " + conf_.detail();
+    throw std::runtime_error(err_msg);
+  }
+
+  for (int32_t i = 0; i < conf_.num_batch_threads; ++i) {
+    workers_.emplace_back(&Batcher::flush_loop, this);
+  }
+  LOG(INFO) << "[" << conf_.detail() << "] Batcher started";
+}
+
+Batcher::~Batcher() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    stopped_ = true;
+  }
+  queue_cv_.notify_all();
+  for (auto& worker : workers_) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  // Fail whatever is still queued, callers are blocked on it or wait for their callback
+  for (auto& pending : queue_) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Batcher stopped";
+    complete(pending, std::make_exception_ptr(std::runtime_error(err_msg)));
+  }
+  queue_.clear();
+}
+
+void Batcher::infer(Instance *instance, Score *score, Priority priority) noexcept(false) {
+  Pending pending;
+  prepare(instance, score, priority, &pending);
+
+  // Large requests gain nothing from waiting for company
+  if (pending.rows >= conf_.max_batch_size) {
+    run_engine(instance, score, priority);
+    return;
+  }
+
+  enqueue(&pending);
+  pending.done.WaitForNotification();
+  if (pending.error) {
+    std::rethrow_exception(pending.error);
+  }
+}
+
+void Batcher::infer_async(
+  Instance *instance, Score *score, Engine::InferCallback callback, Priority priority
+) noexcept(false) {  // NOLINT
+  std::unique_ptr<Pending> pending(new Pending());
+  prepare(instance, score, priority, pending.get());
+  pending->callback = std::move(callback);
+  enqueue(pending.get());
+  pending.release();
+}
+
+void Batcher::prepare(Instance *instance, Score *score, Priority priority, Pending *pending) noexcept(false) {
+  pending->instance     = instance;
+  pending->score        = score;
+  pending->rows         = rows_of(*instance);
+  pending->priority     = priority;
+  pending->enqueue_time = absl::Now();
+  // Merging trusts the rows and row splits, a bad request fails here rather than its whole batch
+  for (const auto& feature : instance->features) {
+    if (feature.batch_size <= 0 || feature.batch_size != pending->rows) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Feature %s has batch size %d, the instance %d", feature.name, feature.batch_size,
+          pending->rows);
+      throw std::invalid_argument(err_msg);
+    }
+    // Split cuts dense features into equal rows, a remainder would shift every request after it
+    if (!feature.ragged() && 0 != feature.size() % pending->rows) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Feature %s has %d values, not a multiple of its %d rows", feature.name, feature.size(),
+          pending->rows);
+      throw std::invalid_argument(err_msg);
+    }
+    check_ragged(feature);
+  }
+}
+
+void Batcher::enqueue(Pending *pending) noexcept(false) {
+  bool batch_full = false;
+  {
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    if (stopped_) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + "Batcher stopped";
+      throw std::runtime_error(err_msg);
+    }
+    queue_.push_back(pending);
+    queued_rows_ += pending->rows;
+    batch_full = queued_rows_ >= conf_.max_batch_size;
+  }
+  if (batch_full) {
+    queue_cv_.notify_all();
+  } else {
+    queue_cv_.notify_one();
+  }
+}
+
+void Batcher::complete(Pending *pending, std::exception_ptr error) noexcept {
+  if (!pending->callback) {
+    pending->error = error;
+    pending->done.Notify();
+    return;
+  }
+  std::unique_ptr<Pending> owned(pending);
+  try {
+    owned->callback(error);
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "Inference callback failed: " << e.what();
+  } catch (...) {
+    LOG(ERROR) << "Inference callback failed";
+  }
+}
+
+void Batcher::flush_loop() noexcept {
+  // Reused for every batch of this worker, merging refills buffers that already fit
+  std::vector<Pending*> batch;
+  Sample merged;
+  std::unique_lock<std::mutex> lock(queue_mtx_);
+  while (true) {
+    queue_cv_.wait(lock, [this]() { return stopped_ || !queue_.empty(); });
+    if (stopped_) {
+      break;
+    }
+
+    // Wait for the batch to fill up or for the oldest request to run out of patience
+    const absl::Time deadline = queue_.front()->enqueue_time + absl::Microseconds(conf_.max_queue_delay_us);
+    queue_cv_.wait_until(lock, absl::ToChronoTime(deadline), [this]() {
+      return stopped_ || queue_.empty() || queued_rows_ >= conf_.max_batch_size;
+    });
+    if (stopped_) {
+      break;
+    }
+    if (queue_.empty()) {
+      continue;
+    }
+    if (queued_rows_ < conf_.max_batch_size
+      && absl::Now() < queue_.front()->enqueue_time + absl::Microseconds(conf_.max_queue_delay_us)) {
+      // Another worker took the old head, start over with the new one
+      continue;
+    }
+
+    batch.clear();
+    int64_t batch_rows = queue_.front()->rows;
+    batch.push_back(queue_.front());
+    queue_.pop_front();
+    while (!queue_.empty()
+      && batch_rows + queue_.front()->rows <= conf_.max_batch_size
+      && compatible(*batch.front(), *queue_.front())) {
+      batch_rows += queue_.front()->rows;
+      batch.push_back(queue_.front());
+      queue_.pop_front();
+    }
+    queued_rows_ -= batch_rows;
+
+    lock.unlock();
+    run_batch(batch, &merged);
+    lock.lock();
+  }
+}
+
+void Batcher::run_batch(const std::vector<Pending*>& batch, Sample *merged) noexcept {
+  std::exception_ptr error = nullptr;
+  try {
+    if (1 == batch.size()) {
+      run_engine(batch.front()->instance, batch.front()->score, batch.front()->priority);
+    } else {
+      merge(batch, &merged->instance, &merged->score);
+      // Merged features and targets keep the order of the requests, which compatible made equal
+      run_engine(&merged->instance, &merged->score, batch.front()->priority);
+      split(merged->score, batch);
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  // The caller owns the pending entry, it must not be touched after notification
+  for (auto& pending : batch) {
+    complete(pending, error);
+  }
+}
+
+void Batcher::run_engine(Instance *instance, Score *score, Priority priority) noexcept(false) {
+  if (engine_->signature().bound(*instance, *score)) {
+    engine_->infer_bound(instance, score, priority);
+  } else {
+    engine_->infer(instance, score, priority);
+  }
+}
+
+int64_t Batcher::rows_of(const Instance& instance) noexcept(false) {
+  if (instance.features.empty()) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Instance has no feature";
+    throw std::runtime_error(err_msg);
+  }
+  return instance.features.front().batch_size;
+}
+
+bool Batcher::compatible(const Pending& lhs, const Pending& rhs) noexcept {
+  // The merged sample is bound as the head is, which the others must agree with
+  if (lhs.priority != rhs.priority || lhs.instance->signature_id != rhs.instance->signature_id) {
+    return false;
+  }
+  const auto& lhs_features = lhs.instance->features;
+  const auto& rhs_features = rhs.instance->features;
+  if (lhs_features.size() != rhs_features.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs_features.size(); ++i) {
+    if (lhs_features[i].name != rhs_features[i].name || lhs_features[i].dtype != rhs_features[i].dtype
+      || lhs_features[i].ragged() != rhs_features[i].ragged()) {
+      return false;
+    }
+    // Rows of ragged features differ in length anyway, the engine pads them all alike
+    if (!lhs_features[i].ragged()
+      && lhs_features[i].data.size() * rhs.rows != rhs_features[i].data.size() * lhs.rows) {
+      return false;
+    }
+  }
+
+  const auto& lhs_targets = lhs.score->targets;
+  const auto& rhs_targets = rhs.score->targets;
+  if (lhs_targets.size() != rhs_targets.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs_targets.size(); ++i) {
+    if (lhs_targets[i].name != rhs_targets[i].name) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Batcher::merge(const std::vector<Pending*>& batch, Instance *instance, Score *score) noexcept(false) {
+  int64_t batch_rows = 0;
+  for (const auto& pending : batch) {
+    batch_rows += pending->rows;
+  }
+
+  const auto& head_features = batch.front()->instance->features;
+  instance->signature_id = batch.front()->instance->signature_id;
+  instance->features.resize(head_features.size());
+  for (size_t i = 0; i < head_features.size(); ++i) {
+    auto& feature = instance->features[i];
+    feature.name = head_features[i].name;
+    feature.dtype = head_features[i].dtype;
+    feature.batch_size = batch_rows;
+
+    size_t data_size = 0;
+    for (const auto& pending : batch) {
+      data_size += pending->instance->features[i].data.size();
+    }
+    feature.data.clear();
+    feature.data.reserve(data_size);
+    for (const auto& pending : batch) {
+      const auto& data = pending->instance->features[i].data;
+      feature.data.append(data.data(), data.size());
+    }
+
+    // Ragged rows are stacked as they are, the splits of each request shift by the values before it
+    feature.row_splits.clear();
+    if (head_features[i].ragged()) {
+      feature.row_splits.push_back(0);
+      int64_t offset = 0;
+      for (const auto& pending : batch) {
+        const auto& row_splits = pending->instance->features[i].row_splits;
+        for (size_t j = 1; j < row_splits.size(); ++j) {
+          feature.row_splits.push_back(offset + row_splits[j]);
+        }
+        offset += row_splits.back();
+      }
+    }
+  }
+
+  const auto& head_targets = batch.front()->score->targets;
+  score->targets.resize(head_targets.size());
+  for (size_t i = 0; i < head_targets.size(); ++i) {
+    score->targets[i].name = head_targets[i].name;
+    score->targets[i].batch_size = batch_rows;
+  }
+}
+
+void Batcher::split(const Score& score, const std::vector<Pending*>& batch) noexcept(false) {
+  int64_t batch_rows = 0;
+  for (const auto& pending : batch) {
+    batch_rows += pending->rows;
+  }
+
+  if (batch_rows <= 0) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + absl::StrFormat("Batch of %d rows can not be split", batch_rows);
+    throw std::runtime_error(err_msg);
+  }
+
+  for (size_t i = 0; i < score.targets.size(); ++i) {
+    const auto& data = score.targets[i].data;
+    if (0 != score.targets[i].size() % batch_rows) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Target %s of %d values is not divisible by %d rows",
+          score.targets[i].name, score.targets[i].size(), batch_rows);
+      throw std::runtime_error(err_msg);
+    }
+
+    const size_t row_size = data.size() / batch_rows;
+    size_t offset = 0;
+    for (const auto& pending : batch) {
+      auto& target = pending->score->targets[i];
+      const size_t data_size = row_size * pending->rows;
+      target.batch_size = pending->rows;
+      target.dtype = score.targets[i].dtype;
+      target.data.assign(data.data() + offset, data_size);
+      offset += data_size;
+    }
+  }
+}
+
+}  // namespace model_server
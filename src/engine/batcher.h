@@ -0,0 +1,97 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_ENGINE_BATCHER_H_
+#define MODEL_SERVER_SRC_ENGINE_BATCHER_H_
+
+#include <stdint.h>
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <exception>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "model_server/src/engine/sample.h"
+#include "model_server/src/engine/engine.h"
+
+namespace model_server {
+
+struct BatcherConf {
+  int32_t max_batch_size     = 128;
+  int64_t max_queue_delay_us = 1000;
+  int32_t num_batch_threads  = 1;
+
+  std::string detail() const noexcept {
+    return "max_batch_size: " + std::to_string(max_batch_size)
+      + ", max_queue_delay_us: " + std::to_string(max_queue_delay_us)
+      + ", num_batch_threads: " + std::to_string(num_batch_threads);
+  }
+};
+
+// Gathers concurrent small requests of one model into a single Engine::infer call.
+// A batch is flushed once it holds max_batch_size rows or its oldest request has
+// waited max_queue_delay_us, and the score rows are split back to each caller.
+class Batcher {
+ public:
+  Batcher(Engine *engine, const BatcherConf& batcher_conf) noexcept(false);
+  virtual ~Batcher();
+
+  Batcher() = delete;
+  Batcher& operator=(const Batcher&) = delete;
+  Batcher(const Batcher&) = delete;
+
+  // Enqueue the instance and block until its score has been filled. Requests are only batched
+  // with others of the same priority, which the batch then runs at.
+  void infer(Instance *instance, Score *score, Priority priority = Priority::kNormal) noexcept(false);
+
+  // Enqueue the instance and return, the callback runs on a batch thread once its score has been
+  // filled. Throws for a malformed request, which is never queued. Large requests queue up too.
+  void infer_async(
+    Instance *instance, Score *score, Engine::InferCallback callback, Priority priority = Priority::kNormal
+  ) noexcept(false);  // NOLINT
+
+ private:
+  struct Pending {
+    Instance          *instance;
+    Score             *score;
+    int64_t            rows;
+    Priority           priority;
+    absl::Time         enqueue_time;
+    std::exception_ptr error;
+    absl::Notification done;
+    // Set for asynchronous requests, which the batcher owns until it is called
+    Engine::InferCallback callback;
+  };
+
+  // Validate the request into the pending entry, merging trusts what is checked here
+  static void prepare(Instance *instance, Score *score, Priority priority, Pending *pending) noexcept(false);
+  void enqueue(Pending *pending) noexcept(false);
+  // Hand the outcome to the caller, the entry must not be touched afterwards
+  static void complete(Pending *pending, std::exception_ptr error) noexcept;
+
+  void flush_loop() noexcept;
+  void run_batch(const std::vector<Pending*>& batch, Sample *merged) noexcept;
+  // Samples laid out by the engine's signature take its bound path, the others are served by name
+  void run_engine(Instance *instance, Score *score, Priority priority) noexcept(false);
+
+  static int64_t rows_of(const Instance& instance) noexcept(false);
+  static bool compatible(const Pending& lhs, const Pending& rhs) noexcept;
+  static void merge(const std::vector<Pending*>& batch, Instance *instance, Score *score) noexcept(false);
+  static void split(const Score& score, const std::vector<Pending*>& batch) noexcept(false);
+
+  Engine     *engine_;
+  BatcherConf conf_;
+
+  bool                     stopped_;
+  int64_t                  queued_rows_;
+  std::deque<Pending*>     queue_;
+  std::mutex               queue_mtx_;
+  std::condition_variable  queue_cv_;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_ENGINE_BATCHER_H_
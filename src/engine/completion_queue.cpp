@@ -0,0 +1,53 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/engine/completion_queue.h"
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace model_server {
+
+CompletionQueue::CompletionQueue(Engine *engine, const EngineConf& engine_conf) noexcept :
+  engine_(engine),
+  // A batch runs as soon as a thread is free, requests arriving while it runs make up the next one
+  batcher_conf_{
+    .max_batch_size = engine_conf.async_max_batch_size,
+    .max_queue_delay_us = 0,
+    .num_batch_threads = engine_conf.async_threads
+  },
+  batcher_mtx_(),
+  stopped_(false),
+  batcher_(nullptr) {
+}
+
+CompletionQueue::~CompletionQueue() {
+  stop();
+}
+
+void CompletionQueue::push(
+  Instance *instance, Score *score, Engine::InferCallback callback, Priority priority
+) noexcept(false) {  // NOLINT
+  // Held while queueing, which only takes the batcher's own lock, so stop can not free it meanwhile
+  std::lock_guard<std::mutex> lock(batcher_mtx_);
+  if (stopped_) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Completion queue stopped";
+    throw std::runtime_error(err_msg);
+  }
+  if (nullptr == batcher_) {
+    batcher_.reset(new Batcher(engine_, batcher_conf_));
+  }
+  batcher_->infer_async(instance, score, std::move(callback), priority);
+}
+
+void CompletionQueue::stop() noexcept {
+  std::unique_ptr<Batcher> batcher;
+  {
+    std::lock_guard<std::mutex> lock(batcher_mtx_);
+    stopped_ = true;
+    batcher.swap(batcher_);
+  }
+  // Joined outside the lock, callbacks may push again and are failed rather than blocked
+}
+
+}  // namespace model_server
@@ -0,0 +1,43 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_ENGINE_COMPLETION_QUEUE_H_
+#define MODEL_SERVER_SRC_ENGINE_COMPLETION_QUEUE_H_
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>  // NOLINT
+#include "model_server/src/engine/sample.h"
+#include "model_server/src/engine/engine.h"
+#include "model_server/src/engine/batcher.h"
+
+namespace model_server {
+
+// Serves Engine::infer_async for runtimes without an asynchronous run. Requests queue up and a few
+// threads run whatever has gathered meanwhile as one merged batch, so thousands of requests in
+// flight cost a handful of blocking runs rather than a thread each. Threads start with the first
+// request.
+class CompletionQueue {
+ public:
+  CompletionQueue(Engine *engine, const EngineConf& engine_conf) noexcept;
+  virtual ~CompletionQueue();
+
+  CompletionQueue() = delete;
+  CompletionQueue& operator=(const CompletionQueue&) = delete;
+  CompletionQueue(const CompletionQueue&) = delete;
+
+  void push(Instance *instance, Score *score, Engine::InferCallback callback, Priority priority) noexcept(false);
+
+  // Fail what is still queued and join the threads, engines call it before tearing their runtime down
+  void stop() noexcept;
+
+ private:
+  Engine                  *engine_;
+  BatcherConf              batcher_conf_;
+  std::mutex               batcher_mtx_;
+  bool                     stopped_;
+  std::unique_ptr<Batcher> batcher_;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_ENGINE_COMPLETION_QUEUE_H_
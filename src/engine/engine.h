@@ -4,14 +4,23 @@
 #define MODEL_SERVER_SRC_ENGINE_ENGINE_H_
 
 #include <stdint.h>
+#include <string.h>
+#include <condition_variable>  // NOLINT
+#include <exception>
+#include <functional>
+#include <future>  // NOLINT
 #include <memory>
+#include <mutex>  // NOLINT
+#include <stdexcept>
 #include <vector>
 #include <string>
+#include <utility>
 #include <algorithm>
 #include "absl/log/log.h"
 #include "absl/cleanup/cleanup.h"
 #include "absl/random/random.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
 #include "BShoshany/BS_thread_pool.hpp"
 #include "model_server/src/util/functional/timer.h"
 #include "model_server/src/util/os/resource_used.h"
@@ -43,6 +52,34 @@ struct EngineConf {
 
   bool use_global_thread_pool           = true;
   bool ort_parrallel_execution          = false;
+  // TF2 runs through a callable made once for the fixed feeds and fetches instead of by name
+  bool tf_use_callable                  = true;
+  // ORT runs bound samples through a per-thread IoBinding with outputs bound over the targets
+  bool ort_use_io_binding               = true;
+  // ORT keeps the graphs it optimized here and later starts load them as is, empty disables it
+  std::string ort_model_cache_dir       = "";
+  // ORT sessions of the same graph in the process share the weights they prepack, e.g. for GEMMs
+  bool ort_share_prepacked_weights      = true;
+  // ORT serves a dynamically quantized variant, int8 weights and fp32 activations, built once by the
+  // script and kept in the model cache dir, else beside the graph. A variant whose outputs are off
+  // the fp32 ones by more than the tolerance on the check after building is dropped for fp32.
+  bool ort_quantize_dynamic             = false;
+  std::string ort_quantize_script       = "script/ort_quantize_dynamic.py";
+  float ort_quantize_tolerance          = 0.01f;
+  // TF prunes the graph to what the inputs and outputs need before importing it
+  bool tf_prune_graph                   = false;
+  // Targets hold the output tensors of the engine instead of a copy, engines without support copy
+  bool zero_copy_output                 = false;
+  // Trace 1 in every n requests into the tracer, 0 disables it
+  int32_t trace_every_n                 = 0;
+  // ORT ends a profile, which takes building a fresh profiling session, once it holds this many
+  // sampled runs or is this old, whichever comes first
+  int32_t ort_profile_max_runs          = 1000;
+  int32_t ort_profile_max_age_ms        = 60000;
+  // infer_async of runtimes without an asynchronous run goes through a completion queue of this
+  // many threads, each running up to this many rows of queued requests at once
+  int32_t async_threads                 = 2;
+  int32_t async_max_batch_size          = 128;
 
   std::string detail() noexcept {
     return "name: " + name + ", version: " + version + ", graph_file_loc: " + graph_file_loc
@@ -52,7 +89,21 @@ struct EngineConf {
       + ", inter_op_parallelism_threads: " + std::to_string(inter_op_parallelism_threads)
       + ", intra_op_parallelism_threads: " + std::to_string(intra_op_parallelism_threads)
       + ", use_global_thread_pool: " + std::to_string(use_global_thread_pool)
-      + ", ort_parrallel_execution: " + std::to_string(ort_parrallel_execution);
+      + ", ort_parrallel_execution: " + std::to_string(ort_parrallel_execution)
+      + ", tf_use_callable: " + std::to_string(tf_use_callable)
+      + ", ort_use_io_binding: " + std::to_string(ort_use_io_binding)
+      + ", ort_model_cache_dir: " + ort_model_cache_dir
+      + ", ort_share_prepacked_weights: " + std::to_string(ort_share_prepacked_weights)
+      + ", ort_quantize_dynamic: " + std::to_string(ort_quantize_dynamic)
+      + ", ort_quantize_script: " + ort_quantize_script
+      + ", ort_quantize_tolerance: " + std::to_string(ort_quantize_tolerance)
+      + ", tf_prune_graph: " + std::to_string(tf_prune_graph)
+      + ", zero_copy_output: " + std::to_string(zero_copy_output)
+      + ", trace_every_n: " + std::to_string(trace_every_n)
+      + ", ort_profile_max_runs: " + std::to_string(ort_profile_max_runs)
+      + ", ort_profile_max_age_ms: " + std::to_string(ort_profile_max_age_ms)
+      + ", async_threads: " + std::to_string(async_threads)
+      + ", async_max_batch_size: " + std::to_string(async_max_batch_size);
   }
 
   std::string brief() noexcept {
@@ -60,9 +111,120 @@ struct EngineConf {
   }
 };
 
+// Inputs and outputs of an engine by slot, compiled once at initialization. A sample bound to it
+// holds feature i for input slot i and target j for output slot j, so the engine reaches its
+// tensors by position instead of hashing names on every request.
+struct BoundSignature {
+  std::vector<std::string> input_names;
+  std::vector<DataType>    input_data_types;
+  std::vector<std::string> output_names;
+  // Hash of the slots, so replicas and versions of a model with the same slots share it. Set by seal,
+  // 0 while empty.
+  uint64_t                 id = 0;
+
+  bool empty() const noexcept {
+    return input_names.empty() && output_names.empty();
+  }
+
+  // Compute id once the slots are filled
+  void seal() noexcept {
+    std::vector<int32_t> data_types;
+    for (const auto& data_type : input_data_types) {
+      data_types.push_back(static_cast<int32_t>(data_type));
+    }
+    id = empty() ? 0 : absl::HashOf(input_names, data_types, output_names) | 1;
+  }
+
+  // Whether bind or arrange laid the sample out by this signature, no name is compared. The counts
+  // are checked still, so dropping a tensor afterwards fails instead of reading past the slots.
+  bool bound(const Instance& instance, const Score& score) const noexcept {
+    return 0 != id && instance.signature_id == id && instance.features.size() == input_names.size()
+      && score.targets.size() == output_names.size();
+  }
+
+  // Lay the sample out by slot, batch sizes and data are left to the caller
+  void bind(Sample *sample) const noexcept(false) {
+    sample->instance.features.resize(input_names.size());
+    for (size_t i = 0; i < input_names.size(); ++i) {
+      sample->instance.features[i].name = input_names[i];
+      sample->instance.features[i].dtype = input_data_types[i];
+    }
+    sample->score.targets.resize(output_names.size());
+    for (size_t i = 0; i < output_names.size(); ++i) {
+      sample->score.targets[i].name = output_names[i];
+    }
+    sample->instance.signature_id = id;
+  }
+
+  // Whether the features and targets are the slots in order, one name compare per slot
+  bool matches(const Instance& instance, const Score& score) const noexcept {
+    if (empty() || instance.features.size() != input_names.size() || score.targets.size() != output_names.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < input_names.size(); ++i) {
+      if (instance.features[i].name != input_names[i]) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < output_names.size(); ++i) {
+      if (score.targets[i].name != output_names[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Put the features and targets of a sample holding exactly the slots into slot order and mark it
+  // bound, so it fits infer_bound. This is the one place names are compared on the way of a request.
+  // A sample holding other tensors is left as it came, unbound, and false returned, it is served by
+  // name instead.
+  bool arrange(Instance *instance, Score *score) const noexcept {
+    instance->signature_id = 0;
+    if (matches(*instance, *score)) {
+      instance->signature_id = id;
+      return true;
+    }
+    if (empty() || !holds(input_names, instance->features) || !holds(output_names, score->targets)) {
+      return false;
+    }
+    reorder(input_names, &instance->features);
+    reorder(output_names, &score->targets);
+    instance->signature_id = id;
+    return true;
+  }
+
+ private:
+  // Names of a signature are unique, so as many tensors holding each of them are a permutation
+  static bool holds(const std::vector<std::string>& names, const std::vector<Tensor>& tensors) noexcept {
+    if (tensors.size() != names.size()) {
+      return false;
+    }
+    for (const auto& name : names) {
+      if (tensors.end() == std::find_if(tensors.begin(), tensors.end(), [&name](const Tensor& tensor) {
+        return tensor.name == name;
+      })) {  // NOLINT
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static void reorder(const std::vector<std::string>& names, std::vector<Tensor> *tensors) noexcept {
+    for (size_t i = 0; i < names.size(); ++i) {
+      for (size_t j = i; j < tensors->size(); ++j) {
+        if ((*tensors)[j].name == names[i]) {
+          std::swap((*tensors)[i], (*tensors)[j]);
+          break;
+        }
+      }
+    }
+  }
+};
+
 class Engine {
  public:
-  explicit Engine(const EngineConf& engine_conf) noexcept(false) : conf_(engine_conf), inited_(false) {}
+  explicit Engine(const EngineConf& engine_conf) noexcept(false) :
+    conf_(engine_conf), inited_(false), signature_() {}
   virtual ~Engine() {}
 
   Engine() = delete;
@@ -80,6 +242,55 @@ class Engine {
   // Perform inference
   virtual void infer(Instance *instance, Score *score) noexcept(false) = 0;
 
+  // Perform inference on a sample laid out by signature().bind() or arrange(), no tensor is looked up by name.
+  // Engines without a bound path serve it by name, which a bound sample still carries.
+  virtual void infer_bound(Instance *instance, Score *score) noexcept(false) {
+    infer(instance, score);
+  }
+
+  // Perform inference in a priority class, the overloads above run as Priority::kNormal
+  virtual void infer(Instance *instance, Score *score, Priority priority) noexcept(false) {
+    infer(instance, score);
+  }
+  virtual void infer_bound(Instance *instance, Score *score, Priority priority) noexcept(false) {
+    infer_bound(instance, score);
+  }
+
+  // Callback of an asynchronous inference, error is nullptr on success
+  using InferCallback = std::function<void(std::exception_ptr error)>;
+
+  // Perform inference without holding the calling thread, the callback runs on a runtime or completion
+  // queue thread once the score has been filled. Instance and score must stay alive until then, and
+  // the engine until every callback has run. Throws for a request that could not be started.
+  virtual void infer_async(
+    Instance *instance, Score *score, InferCallback callback, Priority priority = Priority::kNormal
+  ) noexcept(false) {  // NOLINT
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Asynchronous inference not supported by " + brand();
+    throw std::runtime_error(err_msg);
+  }
+
+  // Perform inference asynchronously, the future rethrows inference errors on get()
+  std::future<void> infer_async(
+    Instance *instance, Score *score, Priority priority = Priority::kNormal
+  ) noexcept(false) {  // NOLINT
+    auto promise = std::make_shared<std::promise<void>>();
+    std::future<void> future = promise->get_future();
+    infer_async(instance, score, [promise](std::exception_ptr error) {
+      if (nullptr != error) {
+        promise->set_exception(error);
+      } else {
+        promise->set_value();
+      }
+    }, priority);
+    return future;
+  }
+
+  // Slot layout of the inputs and outputs, empty until the engine is initialized
+  const BoundSignature& signature() const noexcept {
+    return signature_;
+  }
+
   // Perform inference with trace
   virtual void trace(Instance *instance, Score *score) noexcept(false) = 0;
 
@@ -93,17 +304,16 @@ class Engine {
     absl::flat_hash_map<std::string, std::vector<int64_t>> *output_shapes
   ) noexcept(false) = 0;  // NOLINT
 
+  // Get input name and data type, inputs left out are float
+  virtual void get_input_name_and_data_type(
+    absl::flat_hash_map<std::string, DataType> *input_data_types
+  ) noexcept(false) {}  // NOLINT
+
+  // Requests are kept in flight through infer_async, up to concurrency at once, so the engine's
+  // own threads or completion queue carry them instead of a thread per request
   void perf(
     int32_t concurrency, int32_t sample_count, int32_t batch_size, PerfIndex *perf_index, bool fill_input = false
   ) noexcept(false) {  // NOLINT
-    auto infer_with_timer = [](Engine *engine, Sample *sample, double *cost_ms) {
-      Timer timer;
-      auto timer_cleanup = absl::MakeCleanup([&]() {
-        *cost_ms = timer.f64_elapsed_ms();
-      });
-      engine->infer(&(sample->instance), &(sample->score));
-    };
-
     std::vector<Sample> samples;
     random_sample_gen(&samples, sample_count, batch_size, fill_input);
 
@@ -116,24 +326,52 @@ class Engine {
       this->warmup(&(samples[0].instance), &(samples[0].score));
     }
 
-    // trace
     std::vector<double> cost_ms(samples.size());
-    BS::thread_pool works(concurrency);
-    for (int32_t i = 0; i < static_cast<int32_t>(samples.size()); ++i) {
-      works.push_task(infer_with_timer, this, &(samples.at(i)), &(cost_ms[i]));
-      if (static_cast<int32_t>(samples.size()) >> 1 == i) {
-        this->trace(&(samples[0].instance), &(samples[0].score));
+    std::mutex in_flight_mtx;
+    std::condition_variable in_flight_cv;
+    int32_t in_flight = 0;
+    std::exception_ptr first_error = nullptr;
+    auto run_all = [&](bool traced) {
+      for (int32_t i = 0; i < static_cast<int32_t>(samples.size()); ++i) {
+        {
+          std::unique_lock<std::mutex> lock(in_flight_mtx);
+          in_flight_cv.wait(lock, [&]() { return in_flight < concurrency; });
+          ++in_flight;
+        }
+        Timer timer;
+        auto done = [&, i, timer](std::exception_ptr error) {
+          cost_ms[i] = timer.f64_elapsed_ms();
+          std::lock_guard<std::mutex> lock(in_flight_mtx);
+          if (nullptr != error && nullptr == first_error) {
+            first_error = error;
+          }
+          --in_flight;
+          in_flight_cv.notify_all();
+        };
+        try {
+          infer_async(&(samples[i].instance), &(samples[i].score), done, Priority::kNormal);
+        } catch (...) {
+          done(std::current_exception());
+        }
+        if (traced && static_cast<int32_t>(samples.size()) >> 1 == i) {
+          Sample sample = samples[0];
+          this->trace(&(sample.instance), &(sample.score));
+        }
       }
-    }
-    works.wait_for_tasks();
+      std::unique_lock<std::mutex> lock(in_flight_mtx);
+      in_flight_cv.wait(lock, [&]() { return 0 == in_flight; });
+      if (nullptr != first_error) {
+        std::rethrow_exception(first_error);
+      }
+    };
+
+    // trace
+    run_all(true);
 
     struct ResourceUsed resource_base, resource_curr;
     get_process_resource_used(&resource_base);
     Timer timer;
-    for (int32_t i = 0; i < samples.size(); ++i) {
-      works.push_task(infer_with_timer, this, &(samples.at(i)), &(cost_ms[i]));
-    }
-    works.wait_for_tasks();
+    run_all(false);
     double total_cost_sec = timer.f64_elapsed_sec();
     get_process_resource_used(&resource_curr);
 
@@ -153,42 +391,81 @@ class Engine {
   ) noexcept(false) {  // NOLINT
     absl::flat_hash_map<std::string, std::vector<int64_t>> input_shapes;
     get_input_name_and_shape(&input_shapes);
+    absl::flat_hash_map<std::string, DataType> input_data_types;
+    get_input_name_and_data_type(&input_data_types);
     absl::flat_hash_map<std::string, std::vector<int64_t>> output_shapes;
     get_output_name_and_shape(&output_shapes);
 
+    // Samples are laid out by slot when the engine has a signature, so they fit infer_bound
+    std::vector<std::string> input_names = signature_.input_names;
+    if (input_names.empty()) {
+      for (const auto& input : input_shapes) {
+        input_names.push_back(input.first);
+      }
+    }
+    std::vector<std::string> output_names = signature_.output_names;
+    if (output_names.empty()) {
+      for (const auto& output : output_shapes) {
+        output_names.push_back(output.first);
+      }
+    }
+
+    const uint64_t signature_id = input_names == signature_.input_names && output_names == signature_.output_names
+      ? signature_.id : 0;
+
     samples->resize(sample_count);
     std::random_device rd;
     absl::BitGen bitgen;
     BS::thread_pool works(16);
     for (auto& sample : *samples) {
       works.push_task([&]() {
-        sample.instance.features.resize(input_shapes.size());
+        sample.instance.features.resize(input_names.size());
         int32_t i = 0;
-        for (const auto& input : input_shapes) {
+        for (const auto& input_name : input_names) {
+          const auto& input_shape = input_shapes.at(input_name);
           auto& feature = sample.instance.features[i++];
           feature.batch_size = batch_size;
           int64_t data_size = batch_size;
-          for (int32_t i = 1; i < static_cast<int32_t>(input.second.size()); ++i) {
-            data_size *= input.second[i];
+          for (int32_t i = 1; i < static_cast<int32_t>(input_shape.size()); ++i) {
+            data_size *= input_shape[i];
           }
-          feature.name = input.first;
-          feature.data.resize(data_size);
+          feature.name = input_name;
+          const auto data_type = input_data_types.find(input_name);
+          feature.dtype = input_data_types.end() == data_type ? DataType::kFloat : data_type->second;
+          feature.resize(data_size);
+          memset(feature.data.data(), 0, feature.data.size());
 
-          // fill random data
+          // fill random data, ids are drawn from a small vocabulary
           if (fill_input) {
-            for (auto& data : feature.data) {
-              data = absl::Uniform(absl::IntervalClosedClosed, bitgen, 0.0f, 1.0f);;
+            for (int64_t k = 0; k < data_size; ++k) {
+              switch (feature.dtype) {
+                case DataType::kFloat:
+                  feature.values<float>()[k] = absl::Uniform(absl::IntervalClosedClosed, bitgen, 0.0f, 1.0f);
+                  break;
+                case DataType::kInt32:
+                  feature.values<int32_t>()[k] = absl::Uniform<int32_t>(bitgen, 0, 1000);
+                  break;
+                case DataType::kInt64:
+                  feature.values<int64_t>()[k] = absl::Uniform<int64_t>(bitgen, 0, 1000);
+                  break;
+                case DataType::kBool:
+                  feature.values<bool>()[k] = absl::Bernoulli(bitgen, 0.5);
+                  break;
+                default:
+                  break;
+              }
             }
           }
         }
 
-        sample.score.targets.resize(output_shapes.size());
+        sample.score.targets.resize(output_names.size());
         int32_t j = 0;
-        for (const auto& output : output_shapes) {
+        for (const auto& output_name : output_names) {
           auto& target = sample.score.targets[j++];
-          target.name = output.first;
+          target.name = output_name;
           target.batch_size = batch_size;
         }
+        sample.instance.signature_id = signature_id;
       });
     }
     works.wait_for_tasks();
@@ -201,6 +478,7 @@ class Engine {
     set_session_options();
     create_session();
     sub_init();
+    signature_.seal();
     inited_ = true;
   }
 
@@ -220,8 +498,28 @@ class Engine {
   // Personalized initialization for subclasses
   virtual void sub_init() {}
 
+  // Throws unless the sample was bound to the signature, bound paths call it once per sample
+  void check_bound_sample(const Instance& instance, const Score& score) noexcept(false) {
+    if (signature_.bound(instance, score)) {
+      return;
+    }
+    std::string names;
+    for (const auto& feature : instance.features) {
+      names += " " + feature.name;
+    }
+    names += " ->";
+    for (const auto& target : score.targets) {
+      names += " " + target.name;
+    }
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Bound sample does not match the signature:" + names;
+    throw std::runtime_error(err_msg);
+  }
+
   EngineConf conf_;
   bool inited_;
+  // Filled by sub_init of engines serving infer_bound
+  BoundSignature signature_;
 };
 
 class EngineFactory {
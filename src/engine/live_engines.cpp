@@ -0,0 +1,31 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/engine/live_engines.h"
+
+namespace model_server {
+
+uint64_t LiveEngines::acquire() noexcept(false) {
+  static uint64_t next_id = 1;
+  std::lock_guard<std::mutex> lock(mtx());
+  const uint64_t id = next_id++;
+  ids().insert(id);
+  return id;
+}
+
+void LiveEngines::release(uint64_t id) noexcept {
+  std::lock_guard<std::mutex> lock(mtx());
+  ids().erase(id);
+}
+
+std::mutex& LiveEngines::mtx() noexcept {
+  // Leaked, engines may be released by static destructors
+  static std::mutex *mtx = new std::mutex();
+  return *mtx;
+}
+
+absl::flat_hash_set<uint64_t>& LiveEngines::ids() noexcept {
+  static absl::flat_hash_set<uint64_t> *ids = new absl::flat_hash_set<uint64_t>();
+  return *ids;
+}
+
+}  // namespace model_server
@@ -0,0 +1,42 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_ENGINE_LIVE_ENGINES_H_
+#define MODEL_SERVER_SRC_ENGINE_LIVE_ENGINES_H_
+
+#include <stdint.h>
+#include <mutex>  // NOLINT
+#include "absl/container/flat_hash_set.h"
+
+namespace model_server {
+
+// Ids of the engines alive in the process. Ids are never reused, so per-thread state keyed by
+// them can not be mistaken for that of a destroyed engine, and prune drops such state once its
+// engine is gone.
+class LiveEngines {
+ public:
+  // A fresh id, alive until released
+  static uint64_t acquire() noexcept(false);
+  static void release(uint64_t id) noexcept;
+
+  // Erase the entries of a map keyed by engine id whose engine is gone. Meant for the slow path
+  // of the map, where it grows, so a thread serving engines that come and go stays bounded.
+  template <typename Map>
+  static void prune(Map *map) noexcept {
+    std::lock_guard<std::mutex> lock(mtx());
+    for (auto it = map->begin(); it != map->end();) {
+      if (ids().contains(it->first)) {
+        ++it;
+      } else {
+        map->erase(it++);
+      }
+    }
+  }
+
+ private:
+  static std::mutex& mtx() noexcept;
+  static absl::flat_hash_set<uint64_t>& ids() noexcept;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_ENGINE_LIVE_ENGINES_H_
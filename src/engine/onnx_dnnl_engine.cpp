@@ -31,7 +31,7 @@ void ONNXDNNLEngine::set_session_options() {
 std::unique_ptr<ONNXDNNLEngineFactory> ONNXDNNLEngineFactory::instance_ = nullptr;
 EngineFactory *ONNXDNNLEngineFactory::instance() {
   if (nullptr == instance_) {
-    instance_.reset(new ONNXDNNLEngineFactory();
+    instance_.reset(new ONNXDNNLEngineFactory());
   }
   return instance_.get();
 }
@@ -1,40 +1,188 @@
 // Copyright (C) 2023 zh.luxu1986@gmail.com
 
 #include "model_server/src/engine/onnx_engine.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <thread>  // NOLINT
 #include <utility>
 #include <memory>
 #include <vector>
+#include "absl/cleanup/cleanup.h"
 #include "absl/log/log.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/match.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "nlohmann/json.hpp"
+#include "onnxruntime/onnxruntime_session_options_config_keys.h"
+#include "model_server/src/util/comm.h"
+#include "model_server/src/util/functional/timer.h"
+#include "model_server/src/util/os/resource_used.h"
+#include "model_server/src/engine/live_engines.h"
 
 namespace model_server {
 
+static ONNXTensorElementDataType to_onnx_data_type(DataType data_type) noexcept(false) {
+  switch (data_type) {
+    case DataType::kFloat:    return ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+    case DataType::kInt32:    return ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32;
+    case DataType::kInt64:    return ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64;
+    case DataType::kHalf:     return ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+    case DataType::kBFloat16: return ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16;
+    case DataType::kBool:     return ONNX_TENSOR_ELEMENT_DATA_TYPE_BOOL;
+  }
+  const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+    + "Unsupported data type " + data_type_name(data_type);
+  throw std::runtime_error(err_msg);
+}
+
+static DataType from_onnx_data_type(ONNXTensorElementDataType onnx_data_type) noexcept(false) {
+  switch (onnx_data_type) {
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT:    return DataType::kFloat;
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32:    return DataType::kInt32;
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64:    return DataType::kInt64;
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:  return DataType::kHalf;
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16: return DataType::kBFloat16;
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_BOOL:     return DataType::kBool;
+    default:                                     break;
+  }
+  const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+    + "Unsupported ONNX data type " + std::to_string(static_cast<int32_t>(onnx_data_type));
+  throw std::runtime_error(err_msg);
+}
+
+// FNV-1a, continued from hash so a key can span several buffers
+static uint64_t fnv1a(const char *data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) noexcept {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Folds the kernel events of an ORT profile, a JSON array of chrome trace events, into op_timings.
+// Kernel events are of cat Node, named <node>_kernel_time, with the op type in args.op_name.
+static void aggregate_profile(
+  const std::string& profile, absl::flat_hash_map<std::string, ONNXOpTiming> *op_timings
+) noexcept {  // NOLINT
+  const nlohmann::json events = nlohmann::json::parse(profile, nullptr, false);
+  if (!events.is_array()) {
+    LOG(WARNING) << "Malformed ORT profile of " << profile.size() << " bytes";
+    return;
+  }
+  try {
+    for (const auto& event : events) {
+      if (!event.is_object() || "Node" != event.value("cat", "") || !event.contains("args")
+        || !event["args"].is_object() || !absl::EndsWith(event.value("name", ""), "_kernel_time")) {
+        continue;
+      }
+      const std::string& op_name = event["args"].value("op_name", "");
+      if (op_name.empty()) {
+        continue;
+      }
+      const int64_t dur_us = event.value("dur", static_cast<int64_t>(0));
+      ONNXOpTiming& op_timing = (*op_timings)[op_name];
+      op_timing.calls += 1;
+      op_timing.total_us += dur_us;
+    }
+  } catch (const nlohmann::json::exception& e) {
+    LOG(WARNING) << "Malformed ORT profile: " << e.what();
+  }
+}
+
+ONNXRunContext::ONNXRunContext(Ort::Session *session, size_t num_outputs) noexcept(false) :
+  binding(*session),
+  // Nothing is bound until the first request
+  output_data(num_outputs, nullptr),
+  output_batch_sizes(num_outputs, -1) {
+}
+
+// Run tag by Priority
+static const char *const kPriorityRunTags[kNumPriorities] = {"interactive", "normal", "bulk"};
+
+// Marks an int8 variant that failed its accuracy check
+static const char kQuantizeRejectedSuffix[] = ".rejected";
+// What the int8 variant is checked on
+static const int32_t kQuantizeCheckSamples   = 8;
+static const int32_t kQuantizeCheckBatchSize = 32;
+
 ONNXEngine::ONNXEngine(const EngineConf& engine_conf) noexcept(false) :
   Engine(engine_conf),
   // engine_mtx_(),
   session_opts_(nullptr),
   env_(nullptr),
-  session_(nullptr) {
+  session_(nullptr),
+  graph_file_(),
+  prepacked_weights_(nullptr),
+  quantized_path_(),
+  quantized_unchecked_(false),
+  memory_info_(Ort::MemoryInfo::CreateCpu(OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault)),
+  run_opts_(),
+  id_(LiveEngines::acquire()),
+  run_contexts_mtx_(),
+  run_contexts_(),
+  trace_sampler_(engine_conf.trace_every_n),
+  trace_once_(),
+  trace_mtx_(),
+  trace_session_opts_(),
+  trace_session_(),
+  trace_runs_(0),
+  trace_session_born_(),
+  trace_collector_id_(0),
+  native_async_(true),
+  async_runs_(0),
+  completion_queue_(this, engine_conf),
+  op_timings_mtx_(),
+  op_timings_() {
+  for (int32_t i = 0; i < kNumPriorities; ++i) {
+    run_opts_[i].SetRunTag(kPriorityRunTags[i]);
+  }
 }
 
 ONNXEngine::~ONNXEngine() {
+  // Threads drop their contexts of this engine the next time they create one
+  LiveEngines::release(id_);
+  completion_queue_.stop();
+  // Their tensors and callbacks belong to the session
+  while (async_runs_.load() > 0) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
   try {
     // std::unique_lock<std::shared_mutex> engine_lock(engine_mtx_);
     inited_ = false;
 
+    // The collector may be swapping the profiling session, which needs the env
+    if (0 != trace_collector_id_) {
+      Tracer::instance()->remove_collector(trace_collector_id_);
+      trace_collector_id_ = 0;
+    }
+    if (nullptr != trace_session_) {
+      if (trace_runs_.load() > 0) {
+        submit_profile(trace_session_.get());
+      }
+      trace_session_.reset();
+      LOG(INFO) << "[" << conf_.brief() << "] Trace session deleted";
+    }
+
+    // Bindings refer to the session
+    run_contexts_.clear();
+
     if (nullptr != session_) {
       delete session_;
       session_ = nullptr;
       LOG(INFO) << "[" << conf_.brief() << "] Session deleted";
     }
 
-    if (nullptr != env_) {
-      delete env_;
-      env_ = nullptr;
-      LOG(INFO) << "[" << conf_.brief() << "] Env deleted";
-    }
-
     if (nullptr != session_opts_) {
       delete session_opts_;
       session_opts_ = nullptr;
@@ -53,6 +201,10 @@ std::string ONNXEngine::brand() noexcept {
 
   // Perform inference using the ONNX runtime
 void ONNXEngine::infer(Instance *instance, Score *score) noexcept(false) {
+  infer(instance, score, Priority::kNormal);
+}
+
+void ONNXEngine::infer(Instance *instance, Score *score, Priority priority) noexcept(false) {
   // std::shared_lock<std::shared_mutex> engine_lock(engine_mtx_);
   if (!inited_) {
     const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
@@ -60,15 +212,46 @@ void ONNXEngine::infer(Instance *instance, Score *score) noexcept(false) {
     throw std::runtime_error(err_msg);
   }
 
-  run_session(instance, score, session_);
+  if (trace_sampler_.sample() && run_traced(instance, score, false, priority)) {
+    return;
+  }
+  run_session(instance, score, session_, priority);
 }
 
-void ONNXEngine::run_session(Instance *instance, Score *score, Ort::Session *session) noexcept(false) {
-  // Create memory info
-  Ort::MemoryInfo info = Ort::MemoryInfo::CreateCpu(
-    OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault
-  );  // NOLINT
+void ONNXEngine::infer_bound(Instance *instance, Score *score) noexcept(false) {
+  infer_bound(instance, score, Priority::kNormal);
+}
+
+void ONNXEngine::infer_bound(Instance *instance, Score *score, Priority priority) noexcept(false) {
+  if (!inited_) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Engine not initialized";
+    throw std::runtime_error(err_msg);
+  }
+
+  if (trace_sampler_.sample() && run_traced(instance, score, true, priority)) {
+    return;
+  }
+  if (conf_.ort_use_io_binding) {
+    run_io_binding(instance, score, priority);
+  } else {
+    run_bound_session(instance, score, session_, priority);
+  }
+}
+
+const Ort::RunOptions& ONNXEngine::run_opts(Priority priority) noexcept(false) {
+  const int32_t priority_index = static_cast<int32_t>(priority);
+  if (priority_index < 0 || priority_index >= kNumPriorities) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Unknown priority " + std::to_string(priority_index);
+    throw std::runtime_error(err_msg);
+  }
+  return run_opts_[priority_index];
+}
 
+void ONNXEngine::run_session(
+  Instance *instance, Score *score, Ort::Session *session, Priority priority
+) noexcept(false) {  // NOLINT
   // Prepare input tensors
   std::vector<const char*> input_names;
   std::vector<Ort::Value> input_tensors;
@@ -78,11 +261,7 @@ void ONNXEngine::run_session(Instance *instance, Score *score, Ort::Session *ses
     const std::string& feature_name = feature.name + ":0";
     const auto it = onnx_model_meta_.input_metas.find(feature_name);
     if (onnx_model_meta_.input_metas.end() != it) {
-      std::vector<int64_t> tensor_shape = it->second.shape;
-      tensor_shape[0] = feature.batch_size;
-      input_tensors.push_back(Ort::Value::CreateTensor<float>(
-        info, feature.data.data(), feature.data.size(), tensor_shape.data(), tensor_shape.size()
-      ));  // NOLINT
+      input_tensors.push_back(feature_to_tensor(memory_info_, &feature, it->second));
       input_names.push_back(it->second.name.c_str());
     }
   }
@@ -106,25 +285,134 @@ void ONNXEngine::run_session(Instance *instance, Score *score, Ort::Session *ses
       // throw std::runtime_error(err_msg);
       continue;
     }
-
-    std::vector<int64_t> tensor_shape = it->second.shape;
-    tensor_shape[0] = target.batch_size;
-    target.data.resize(it->second.instance_size * target.batch_size);
-    output_tensors.push_back(Ort::Value::CreateTensor<float>(
-      info, target.data.data(), target.data.size(), tensor_shape.data(), tensor_shape.size()
-    ));  // NOLINT
+    output_tensors.push_back(target_to_tensor(memory_info_, &target, it->second));
     output_names.push_back(it->second.name.c_str());
   }
 
   // Run inference using the ONNX runtime
-  Ort::RunOptions run_options;
   session->Run(
-    run_options,
+    run_opts(priority),
     input_names.data(), input_tensors.data(), input_names.size(),
     output_names.data(), output_tensors.data(), output_names.size()
   );  // NOLINT
 }
 
+void ONNXEngine::run_bound_session(
+  Instance *instance, Score *score, Ort::Session *session, Priority priority
+) noexcept(false) {  // NOLINT
+  check_bound_sample(*instance, *score);
+  const auto& input_slots = onnx_model_meta_.input_slots;
+  const auto& output_slots = onnx_model_meta_.output_slots;
+
+  // Names were resolved at sub_init, slot i is passed as is
+  std::vector<Ort::Value> input_tensors;
+  input_tensors.reserve(input_slots.size());
+  for (size_t i = 0; i < input_slots.size(); ++i) {
+    input_tensors.push_back(feature_to_tensor(memory_info_, &(instance->features[i]), input_slots[i]));
+  }
+  std::vector<Ort::Value> output_tensors;
+  output_tensors.reserve(output_slots.size());
+  for (size_t i = 0; i < output_slots.size(); ++i) {
+    output_tensors.push_back(target_to_tensor(memory_info_, &(score->targets[i]), output_slots[i]));
+  }
+
+  session->Run(
+    run_opts(priority),
+    onnx_model_meta_.input_slot_names.data(), input_tensors.data(), input_tensors.size(),
+    onnx_model_meta_.output_slot_names.data(), output_tensors.data(), output_tensors.size()
+  );  // NOLINT
+}
+
+void ONNXEngine::run_io_binding(Instance *instance, Score *score, Priority priority) noexcept(false) {
+  check_bound_sample(*instance, *score);
+  const auto& input_slots = onnx_model_meta_.input_slots;
+  const auto& output_slots = onnx_model_meta_.output_slots;
+  ONNXRunContext *run_context = this->run_context();
+  Ort::IoBinding& binding = run_context->binding;
+
+  // Binding an input by a name already bound replaces it, the value only wraps the feature's memory
+  for (size_t i = 0; i < input_slots.size(); ++i) {
+    binding.BindInput(
+      input_slots[i].name.c_str(), feature_to_tensor(memory_info_, &(instance->features[i]), input_slots[i])
+    );  // NOLINT
+  }
+  // ORT wants a bound output to have the exact shape it produces. A target sized for its batch that
+  // sits where the last one was bound is written through the old binding, else it is rebound.
+  for (size_t i = 0; i < output_slots.size(); ++i) {
+    Tensor& target = score->targets[i];
+    target.dtype = output_slots[i].data_type;
+    target.resize(output_slots[i].instance_size * target.batch_size);
+    if (run_context->output_data[i] != target.data.data()
+        || run_context->output_batch_sizes[i] != target.batch_size) {
+      binding.BindOutput(output_slots[i].name.c_str(), target_to_tensor(memory_info_, &target, output_slots[i]));
+      run_context->output_data[i] = target.data.data();
+      run_context->output_batch_sizes[i] = target.batch_size;
+    }
+  }
+
+  session_->Run(run_opts(priority), binding);
+}
+
+ONNXRunContext *ONNXEngine::run_context() noexcept(false) {
+  // Contexts are owned by their engine, entries of destroyed engines are pruned where the map grows
+  static thread_local absl::flat_hash_map<uint64_t, ONNXRunContext*> run_contexts;
+  auto it = run_contexts.find(id_);
+  if (run_contexts.end() != it) {
+    return it->second;
+  }
+  LiveEngines::prune(&run_contexts);
+
+  auto run_context = std::make_unique<ONNXRunContext>(session_, onnx_model_meta_.output_slots.size());
+  ONNXRunContext *ptr = run_context.get();
+  {
+    std::lock_guard<std::mutex> lock(run_contexts_mtx_);
+    run_contexts_.push_back(std::move(run_context));
+  }
+  run_contexts.emplace(id_, ptr);
+  return ptr;
+}
+
+Ort::Value ONNXEngine::feature_to_tensor(
+  const Ort::MemoryInfo& info, Tensor *feature, const ONNXTensorMeta& onnx_tensor_meta
+) noexcept(false) {  // NOLINT
+  if (onnx_tensor_meta.data_type != feature->dtype) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Feature data type mismatch: " + feature->name + " is "
+      + data_type_name(feature->dtype) + ", graph wants " + data_type_name(onnx_tensor_meta.data_type);
+    throw std::runtime_error(err_msg);
+  }
+  absl::InlinedVector<int64_t, 8> tensor_shape(onnx_tensor_meta.shape.begin(), onnx_tensor_meta.shape.end());
+  tensor_shape[0] = feature->batch_size;
+  // Graph inputs are dense, a ragged feature is padded to the width of its input in a tensor ORT owns,
+  // the caller's feature is left as it came
+  if (feature->ragged()) {
+    check_ragged(*feature);
+    Ort::AllocatorWithDefaultOptions allocator;
+    Ort::Value tensor = Ort::Value::CreateTensor(
+      allocator, tensor_shape.data(), tensor_shape.size(), to_onnx_data_type(feature->dtype)
+    );  // NOLINT
+    densify(*feature, onnx_tensor_meta.instance_size, tensor.GetTensorMutableData<char>());
+    return tensor;
+  }
+  return Ort::Value::CreateTensor(
+    info, feature->data.data(), feature->data.size(), tensor_shape.data(), tensor_shape.size(),
+    to_onnx_data_type(feature->dtype)
+  );  // NOLINT
+}
+
+Ort::Value ONNXEngine::target_to_tensor(
+  const Ort::MemoryInfo& info, Tensor *target, const ONNXTensorMeta& onnx_tensor_meta
+) noexcept(false) {  // NOLINT
+  absl::InlinedVector<int64_t, 8> tensor_shape(onnx_tensor_meta.shape.begin(), onnx_tensor_meta.shape.end());
+  tensor_shape[0] = target->batch_size;
+  target->dtype = onnx_tensor_meta.data_type;
+  target->resize(onnx_tensor_meta.instance_size * target->batch_size);
+  return Ort::Value::CreateTensor(
+    info, target->data.data(), target->data.size(), tensor_shape.data(), tensor_shape.size(),
+    to_onnx_data_type(target->dtype)
+  );  // NOLINT
+}
+
 void ONNXEngine::trace(Instance *instance, Score *score) noexcept(false) {
   // std::shared_lock<std::shared_mutex> engine_lock(engine_mtx_);
   if (!inited_) {
@@ -133,28 +421,346 @@ void ONNXEngine::trace(Instance *instance, Score *score) noexcept(false) {
     throw std::runtime_error(err_msg);
   }
 
-  std::unique_ptr<Ort::SessionOptions> session_opts(new Ort::SessionOptions());
-  session_opts->EnableProfiling(conf_.name.c_str());
-  session_opts->SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
-  session_opts->SetIntraOpNumThreads(conf_.intra_op_parallelism_threads);
-  session_opts->SetInterOpNumThreads(conf_.inter_op_parallelism_threads);
-  std::unique_ptr<Ort::Env> env(new Ort::Env(OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, conf_.name.c_str()));
-  std::unique_ptr<Ort::Session> session(new Ort::Session(*env, conf_.graph_file_loc.c_str(), *session_opts));
+  std::call_once(trace_once_, &ONNXEngine::start_tracing, this);
+  if (!run_traced(instance, score, false, Priority::kNormal)) {
+    run_session(instance, score, session_, Priority::kNormal);
+  }
+}
 
-  run_session(instance, score, session.get());
+void ONNXEngine::infer_async(
+  Instance *instance, Score *score, InferCallback callback, Priority priority
+) noexcept(false) {  // NOLINT
+  if (!inited_) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Engine not initialized";
+    throw std::runtime_error(err_msg);
+  }
+  if (!native_async_.load(std::memory_order_relaxed)) {
+    completion_queue_.push(instance, score, std::move(callback), priority);
+    return;
+  }
+
+  std::unique_ptr<ONNXAsyncRun> run(new ONNXAsyncRun());
+  prepare_async_run(instance, score, run.get());
+  run->runs = &async_runs_;
+  async_runs_.fetch_add(1);
+  try {
+    session_->RunAsync(
+      run_opts(priority),
+      run->input_names.data(), run->input_tensors.data(), run->input_names.size(),
+      run->output_names.data(), run->output_tensors.data(), run->output_names.size(),
+      &ONNXEngine::on_async_run_done, run.get()
+    );  // NOLINT
+  } catch (const Ort::Exception& e) {
+    async_runs_.fetch_sub(1);
+    // Only the thread pool makes ORT refuse a run it has not started, which does not change later
+    LOG(WARNING) << "[" << conf_.brief() << "] RunAsync refused, serving infer_async by the completion queue: "
+      << e.what();
+    native_async_.store(false, std::memory_order_relaxed);
+    completion_queue_.push(instance, score, std::move(run->callback), priority);
+    return;
+  }
+  run.release();
+}
 
-  static std::mutex trace_data_mtx;
-  static std::atomic<int> trace_data_index = 0;
-  std::lock_guard<std::mutex> lock(trace_data_mtx);
-  trace_data_index.fetch_add(1);
+void ONNXEngine::prepare_async_run(Instance *instance, Score *score, ONNXAsyncRun *run) noexcept(false) {
+  if (signature_.bound(*instance, *score)) {
+    const auto& input_slots = onnx_model_meta_.input_slots;
+    const auto& output_slots = onnx_model_meta_.output_slots;
+    run->input_names = onnx_model_meta_.input_slot_names;
+    run->output_names = onnx_model_meta_.output_slot_names;
+    for (size_t i = 0; i < input_slots.size(); ++i) {
+      run->input_tensors.push_back(feature_to_tensor(memory_info_, &(instance->features[i]), input_slots[i]));
+    }
+    for (size_t i = 0; i < output_slots.size(); ++i) {
+      run->output_tensors.push_back(target_to_tensor(memory_info_, &(score->targets[i]), output_slots[i]));
+    }
+    return;
+  }
+
+  for (auto& feature : instance->features) {
+    const auto it = onnx_model_meta_.input_metas.find(feature.name + ":0");
+    if (onnx_model_meta_.input_metas.end() != it) {
+      run->input_tensors.push_back(feature_to_tensor(memory_info_, &feature, it->second));
+      run->input_names.push_back(it->second.name.c_str());
+    }
+  }
+  if (score->targets.size() != onnx_model_meta_.output_metas.size()) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Output size mismatch";
+    throw std::runtime_error(err_msg);
+  }
+  for (auto& target : score->targets) {
+    const auto it = onnx_model_meta_.output_metas.find(target.name + ":0");
+    if (onnx_model_meta_.output_metas.end() != it) {
+      run->output_tensors.push_back(target_to_tensor(memory_info_, &target, it->second));
+      run->output_names.push_back(it->second.name.c_str());
+    }
+  }
+}
+
+void ONNXEngine::on_async_run_done(void *user_data, OrtValue **outputs, size_t num_outputs, OrtStatusPtr status) {
+  // Outputs were bound over the targets, ORT has written them in place
+  std::unique_ptr<ONNXAsyncRun> run(static_cast<ONNXAsyncRun*>(user_data));
+  std::exception_ptr error = nullptr;
+  if (nullptr != status) {
+    error = std::make_exception_ptr(std::runtime_error(Ort::GetApi().GetErrorMessage(status)));
+    Ort::GetApi().ReleaseStatus(status);
+  }
+  try {
+    run->callback(error);
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "Inference callback failed: " << e.what();
+  } catch (...) {
+    LOG(ERROR) << "Inference callback failed";
+  }
+  std::atomic<int64_t> *runs = run->runs;
+  run.reset();
+  runs->fetch_sub(1);
+}
+
+bool ONNXEngine::run_traced(Instance *instance, Score *score, bool bound, Priority priority) noexcept(false) {
+  // A request never waits for the profiling session, it runs untraced while the session is swapped
+  std::shared_lock<std::shared_mutex> lock(trace_mtx_, std::try_to_lock);
+  if (!lock.owns_lock() || nullptr == trace_session_) {
+    return false;
+  }
+  if (bound) {
+    run_bound_session(instance, score, trace_session_.get(), priority);
+  } else {
+    run_session(instance, score, trace_session_.get(), priority);
+  }
+  trace_runs_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void ONNXEngine::start_tracing() noexcept(false) {
+  trace_session_opts_.reset(new Ort::SessionOptions(session_opts_->Clone()));
+  trace_session_opts_->EnableProfiling(("trace_" + conf_.name).c_str());
+  {
+    std::unique_ptr<Ort::Session> session(new_session(*trace_session_opts_));
+    std::unique_lock<std::shared_mutex> lock(trace_mtx_);
+    trace_session_.swap(session);
+  }
+  trace_session_born_ = absl::Now();
+  trace_collector_id_ = Tracer::instance()->add_collector([this]() { collect_trace(); });
+  LOG(INFO) << "[" << conf_.brief() << "] Tracing started";
+}
+
+void ONNXEngine::collect_trace() noexcept(false) {
+  // Building a session costs as much as loading the model, so a profile is not ended every flush
+  const int64_t runs = trace_runs_.load(std::memory_order_relaxed);
+  if (0 == runs || (runs < conf_.ort_profile_max_runs
+      && absl::Now() - trace_session_born_ < absl::Milliseconds(conf_.ort_profile_max_age_ms))) {
+    return;
+  }
+  // ORT writes a profile only when it ends, which also ends profiling for that session. A fresh
+  // session takes over first, sampled requests profile into the old one meanwhile.
+  std::unique_ptr<Ort::Session> session(new_session(*trace_session_opts_));
+  {
+    std::unique_lock<std::shared_mutex> lock(trace_mtx_);
+    trace_session_.swap(session);
+    trace_runs_.store(0, std::memory_order_relaxed);
+  }
+  trace_session_born_ = absl::Now();
+  submit_profile(session.get());
+}
+
+void ONNXEngine::submit_profile(Ort::Session *session) noexcept(false) {
   Ort::AllocatorWithDefaultOptions allocator;
   auto profile_file = session->EndProfilingAllocated(allocator);
-  if (std::string(profile_file.get()) != std::string()) {
-      LOG(INFO) << "ONNX profiling file has dump to " << std::string(profile_file.get());
+  const std::string profile_path(profile_file.get());
+  if (profile_path.empty()) {
+    return;
+  }
+  std::ifstream ifs(profile_path, std::ios::binary);
+  std::stringstream profile;
+  profile << ifs.rdbuf();
+  ifs.close();
+  remove(profile_path.c_str());
+  const std::string& payload = profile.str();
+  {
+    std::lock_guard<std::mutex> lock(op_timings_mtx_);
+    aggregate_profile(payload, &op_timings_);
   }
+  Tracer::instance()->submit(std::unique_ptr<TraceRecord>(new TraceRecord{
+    .model = conf_.brief(),
+    .extension = "json",
+    .payload = payload
+  }));
+}
+
+absl::flat_hash_map<std::string, ONNXOpTiming> ONNXEngine::op_timings() noexcept(false) {
+  std::lock_guard<std::mutex> lock(op_timings_mtx_);
+  return op_timings_;
+}
+
+Ort::Session *ONNXEngine::new_session(const Ort::SessionOptions& session_opts) noexcept(false) {
+  // ORT copies what it needs while loading, the pages are dropped until the next session is made
+  graph_file_.advise_sequential();
+  auto release_cleanup = absl::MakeCleanup([this]() { graph_file_.release_pages(); });
+  if (nullptr == prepacked_weights_) {
+    return new Ort::Session(*env_, graph_file_.data(), graph_file_.size(), session_opts);
+  }
+  return new Ort::Session(*env_, graph_file_.data(), graph_file_.size(), session_opts, *prepacked_weights_);
 }
 
 void ONNXEngine::load() {
+  // Mapped once, so the profiling sessions made later do not read the file again
+  const std::string& graph_file = conf_.graph_file_loc;
+  if (!graph_file_.open(graph_file)) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Failed to map graph file: " + graph_file + ", " + strerror(errno);
+    throw std::runtime_error(err_msg);
+  }
+  LOG(INFO) << "[" << conf_.brief() << "] Graph file mapped: " << graph_file << ", " << graph_file_.size() << " bytes";
+
+  if (conf_.ort_quantize_dynamic) {
+    quantize();
+  }
+}
+
+void ONNXEngine::quantize() noexcept(false) {
+  const std::string& graph_file = conf_.graph_file_loc;
+  const std::string& dir = !conf_.ort_model_cache_dir.empty() ? conf_.ort_model_cache_dir
+    : (std::string::npos == graph_file.rfind('/') ? "." : graph_file.substr(0, graph_file.rfind('/')));
+  // A new ORT build or script may quantize differently, so neither a variant nor the verdict on it
+  // is taken over from before them
+  std::string deps = "int8_dynamic|" + std::string(OrtGetApiBase()->GetVersionString()) + "|";
+  MappedFile script;
+  if (script.open(conf_.ort_quantize_script)) {
+    deps.append(script.data(), script.size());
+  }
+  graph_file_.advise_sequential();
+  const uint64_t hash = fnv1a(deps.data(), deps.size(), fnv1a(graph_file_.data(), graph_file_.size()));
+  const std::string& path = dir + "/" + conf_.name + "_" + absl::StrFormat("%016x", hash) + "_int8.onnx";
+  if (0 == access((path + kQuantizeRejectedSuffix).c_str(), F_OK)) {
+    LOG(WARNING) << "[" << conf_.brief() << "] Int8 variant failed its accuracy check before, serving fp32";
+    return;
+  }
+
+  if (0 != access(path.c_str(), R_OK)) {
+    if (0 != mkdir(dir.c_str(), 0755) && EEXIST != errno) {
+      LOG(WARNING) << "[" << conf_.brief() << "] Failed to create " << dir << ", " << strerror(errno)
+        << ", serving fp32";
+      return;
+    }
+    // Written aside and renamed, like the optimized models
+    const std::string& tmp_path = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(id_);
+    // Paths go to the script as arguments, never through a shell
+    const std::vector<std::string> args = {
+      "python3", conf_.ort_quantize_script, "--input=" + graph_file, "--output=" + tmp_path
+    };  // NOLINT
+    std::string err;
+    Timer timer;
+    if (!execute_argv(args, &err) || 0 != rename(tmp_path.c_str(), path.c_str())) {
+      remove(tmp_path.c_str());
+      LOG(WARNING) << "[" << conf_.brief() << "] Failed to quantize by " << conf_.ort_quantize_script
+        << ", serving fp32: " << err;
+      return;
+    }
+    quantized_unchecked_ = true;
+    LOG(INFO) << "[" << conf_.brief() << "] Int8 variant built in " << timer.f64_elapsed_ms() << " ms: " << path;
+  }
+
+  map_graph(path);
+  quantized_path_ = path;
+  LOG(INFO) << "[" << conf_.brief() << "] Int8 variant mapped: " << path << ", " << graph_file_.size() << " bytes";
+}
+
+void ONNXEngine::check_quantized() noexcept(false) {
+  // Where the served variant is cached optimized, computed while it is mapped
+  const std::string& int8_cache_path = optimized_model_path();
+  std::unique_ptr<Ort::Session> int8_session(session_);
+  session_ = nullptr;
+
+  // Made as a start without quantization makes it, through the optimized model cache and the
+  // prepacked weights, so it is served as is if the variant is rejected
+  map_graph(conf_.graph_file_loc);
+  reset_optimization_level();
+  open_session(conf_.graph_file_loc);
+  std::unique_ptr<Ort::Session> fp32_session(session_);
+  session_ = int8_session.release();
+
+  std::vector<Sample> samples;
+  random_sample_gen(&samples, kQuantizeCheckSamples, kQuantizeCheckBatchSize, true);
+  std::vector<Sample> fp32_samples = samples;
+  // The first pass warms both sessions up, the second is timed
+  double int8_ms = 0.0;
+  double fp32_ms = 0.0;
+  for (int32_t pass = 0; pass < 2; ++pass) {
+    Timer int8_timer;
+    for (auto& sample : samples) {
+      run_bound_session(&sample.instance, &sample.score, session_, Priority::kNormal);
+    }
+    int8_ms = int8_timer.f64_elapsed_ms();
+    Timer fp32_timer;
+    for (auto& sample : fp32_samples) {
+      run_bound_session(&sample.instance, &sample.score, fp32_session.get(), Priority::kNormal);
+    }
+    fp32_ms = fp32_timer.f64_elapsed_ms();
+  }
+
+  // Outputs not compared within the tolerance must come out the same, or the variant is rejected
+  float max_error = 0.0f;
+  int32_t mismatches = 0;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    for (size_t j = 0; j < samples[i].score.targets.size(); ++j) {
+      const Tensor& int8_target = samples[i].score.targets[j];
+      const Tensor& fp32_target = fp32_samples[i].score.targets[j];
+      if (int8_target.dtype != fp32_target.dtype || int8_target.data.size() != fp32_target.data.size()) {
+        ++mismatches;
+        continue;
+      }
+      if (DataType::kFloat != fp32_target.dtype) {
+        mismatches += int8_target.data == fp32_target.data ? 0 : 1;
+        continue;
+      }
+      for (size_t k = 0; k < fp32_target.size(); ++k) {
+        max_error = std::max(max_error, std::abs(int8_target.values<float>()[k] - fp32_target.values<float>()[k]));
+      }
+    }
+  }
+  LOG(INFO) << "[" << conf_.brief() << "] Int8 variant against fp32 on " << samples.size() << " batches of "
+    << kQuantizeCheckBatchSize << ": max abs error " << max_error << ", " << mismatches << " outputs mismatched, "
+    << int8_ms / samples.size() << " vs " << fp32_ms / samples.size() << " ms per batch";
+  if (max_error <= conf_.ort_quantize_tolerance && 0 == mismatches) {
+    // Profiling sessions are made from the mapped graph, which is the variant again
+    if (!int8_cache_path.empty() && 0 == access(int8_cache_path.c_str(), R_OK)) {
+      map_graph(int8_cache_path);
+      session_opts_->SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+    } else {
+      map_graph(quantized_path_);
+      reset_optimization_level();
+    }
+    return;
+  }
+
+  // Remembered, so later starts serve fp32 without building the variant again
+  LOG(WARNING) << "[" << conf_.brief() << "] Int8 variant exceeds tolerance " << conf_.ort_quantize_tolerance
+    << " or mismatches fp32, serving fp32";
+  std::ofstream(quantized_path_ + kQuantizeRejectedSuffix).close();
+  remove(quantized_path_.c_str());
+  quantized_path_.clear();
+  delete session_;
+  session_ = fp32_session.release();
+}
+
+void ONNXEngine::map_graph(const std::string& path) noexcept(false) {
+  graph_file_.close();
+  if (!graph_file_.open(path)) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Failed to map graph file: " + path + ", " + strerror(errno);
+    throw std::runtime_error(err_msg);
+  }
+}
+
+void ONNXEngine::reset_optimization_level() noexcept(false) {
+  if (0 == conf_.opt_level) {
+    session_opts_->SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+  } else {
+    session_opts_->SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+  }
 }
 
 void ONNXEngine::build() {
@@ -169,11 +775,7 @@ void ONNXEngine::set_session_options() {
   session_opts_->SetIntraOpNumThreads(conf_.intra_op_parallelism_threads);
   session_opts_->EnableCpuMemArena();
   // session_opts_->EnableOrtCustomOps();
-  if (0 == conf_.opt_level) {
-    session_opts_->SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
-  } else {
-    session_opts_->SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
-  }
+  reset_optimization_level();
   if (conf_.ort_parrallel_execution) {
     session_opts_->SetExecutionMode(ExecutionMode::ORT_PARALLEL);
   } else {
@@ -186,19 +788,142 @@ void ONNXEngine::set_session_options() {
   LOG(INFO) << "[" << conf_.detail() << "] Session options set";
 }
 
+Ort::Env *ONNXEngine::shared_env() noexcept(false) {
+  // One global pool pair sized to the physical cores serves every session made with
+  // use_global_thread_pool, so each model loaded adds no threads. Sessions made without it keep
+  // their own pools. Never deleted, sessions destroyed during exit may still need it.
+  static Ort::Env *env = []() {
+    const int32_t num_threads = std::max(static_cast<int32_t>(std::thread::hardware_concurrency() >> 1), 1);
+    Ort::ThreadingOptions threading_opts;
+    threading_opts.SetGlobalInterOpNumThreads(num_threads);
+    threading_opts.SetGlobalIntraOpNumThreads(num_threads);
+    threading_opts.SetGlobalSpinControl(1);
+    Ort::Env *env = new Ort::Env(&(*threading_opts), OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, "model_server");
+    LOG(INFO) << "Shared ORT env created, global inter/intra op threads: " << num_threads;
+    return env;
+  }();
+  return env;
+}
+
+std::shared_ptr<Ort::PrepackedWeightsContainer> ONNXEngine::shared_prepacked_weights(
+  const std::string& graph_file_loc
+) noexcept(false) {  // NOLINT
+  // Keyed by path, so replicas and their profiling sessions share one container while every
+  // version rolled out gets its own and frees it with its last engine. ORT keys the weights in a
+  // container by their content, a graph replaced under the same path is still served correctly.
+  static std::mutex mtx;
+  static absl::flat_hash_map<std::string, std::weak_ptr<Ort::PrepackedWeightsContainer>> containers;
+  std::lock_guard<std::mutex> lock(mtx);
+  absl::erase_if(containers, [](const auto& entry) { return entry.second.expired(); });
+  std::weak_ptr<Ort::PrepackedWeightsContainer>& weak_container = containers[graph_file_loc];
+  std::shared_ptr<Ort::PrepackedWeightsContainer> container = weak_container.lock();
+  if (nullptr == container) {
+    container = std::make_shared<Ort::PrepackedWeightsContainer>();
+    weak_container = container;
+  }
+  return container;
+}
+
 void ONNXEngine::create_session() {
   // create session
+  const absl::Time start = absl::Now();
+  ResourceUsed resource_used;
+  const double start_rss_mb = get_process_resource_used(&resource_used) ? resource_used.resident_mb : 0.0;
+  env_ = shared_env();
   if (conf_.use_global_thread_pool) {
-    Ort::ThreadingOptions threading_opts;
-    threading_opts.SetGlobalInterOpNumThreads(conf_.inter_op_parallelism_threads);
-    threading_opts.SetGlobalIntraOpNumThreads(conf_.intra_op_parallelism_threads);
-    threading_opts.SetGlobalSpinControl(1);
-    env_ = new Ort::Env(&(*threading_opts), OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, conf_.name.c_str());
-  } else {
-    env_ = new Ort::Env(OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, conf_.name.c_str());
+    LOG(INFO) << "[" << conf_.brief() << "] Global thread pool used, per model thread counts are ignored";
+  }
+  if (conf_.ort_share_prepacked_weights) {
+    prepacked_weights_ = shared_prepacked_weights(conf_.graph_file_loc);
+  }
+  const std::string& cache_state = open_session(quantized_path_.empty() ? conf_.graph_file_loc : quantized_path_);
+  const double rss_mb = get_process_resource_used(&resource_used) ? resource_used.resident_mb : 0.0;
+  LOG(INFO) << "[" << conf_.brief() << "] Session created in " << absl::ToDoubleMilliseconds(absl::Now() - start)
+    << " ms, RSS +" << rss_mb - start_rss_mb << " MB, optimized model cache " << cache_state
+    << ", prepacked weights " << (nullptr == prepacked_weights_ ? "private" : "shared");
+}
+
+std::string ONNXEngine::optimized_model_path() noexcept(false) {
+  if (conf_.ort_model_cache_dir.empty() || 0 == conf_.opt_level) {
+    return "";
+  }
+  // Besides the graph, the result depends on the optimizer of this ORT build, the level, the
+  // execution provider, the session options and the vector width the CPU layouts are chosen for
+  std::string deps = std::string(OrtGetApiBase()->GetVersionString()) + "|" + brand()
+    + "|" + std::to_string(conf_.opt_level) + (conf_.ort_parrallel_execution ? "|parallel" : "|sequential");
+  // Config entries the optimizers read, whoever set them, a subclass for its provider included
+  static const char *const kGraphConfigKeys[] = {
+    kOrtSessionOptionsDisableQuantQDQ,
+    kOrtSessionOptionsDisableDoubleQDQRemover,
+    kOrtSessionOptionsEnableGeluApproximation,
+    kOrtSessionOptionsQDQIsInt8Allowed,
+    kOrtSessionOptionsAvx2PrecisionMode
+  };
+  for (const char *key : kGraphConfigKeys) {
+    if (session_opts_->HasConfigEntry(key)) {
+      deps += std::string("|") + key + "=" + session_opts_->GetConfigEntry(key);
+    }
+  }
+#if defined(__x86_64__)
+  deps += __builtin_cpu_supports("avx512f") ? "|avx512f" : (__builtin_cpu_supports("avx2") ? "|avx2" : "|sse");
+#endif
+  graph_file_.advise_sequential();
+  const uint64_t hash = fnv1a(deps.data(), deps.size(), fnv1a(graph_file_.data(), graph_file_.size()));
+  return conf_.ort_model_cache_dir + "/" + conf_.name + "_" + absl::StrFormat("%016x", hash) + ".onnx";
+}
+
+std::string ONNXEngine::open_session(const std::string& graph_path) noexcept(false) {
+  const std::string& cache_path = optimized_model_path();
+  if (cache_path.empty()) {
+    session_ = new_session(*session_opts_);
+    return "off";
+  }
+  if (load_optimized_model(cache_path, graph_path)) {
+    return "warm";
+  }
+  save_optimized_model(cache_path);
+  return "cold";
+}
+
+bool ONNXEngine::load_optimized_model(const std::string& path, const std::string& graph_path) noexcept(false) {
+  if (0 != access(path.c_str(), R_OK)) {
+    return false;
+  }
+  graph_file_.close();
+  try {
+    if (!graph_file_.open(path)) {
+      throw std::runtime_error("Failed to map graph file, " + std::string(strerror(errno)));
+    }
+    // Already optimized, so no session of the engine, the profiling ones included, optimizes it again
+    session_opts_->SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+    session_ = new_session(*session_opts_);
+    return true;
+  } catch (const std::exception& e) {
+    LOG(WARNING) << "[" << conf_.brief() << "] Dropping optimized model " << path << ": " << e.what();
+  }
+  remove(path.c_str());
+  reset_optimization_level();
+  map_graph(graph_path);
+  return false;
+}
+
+void ONNXEngine::save_optimized_model(const std::string& path) noexcept(false) {
+  if (0 != mkdir(conf_.ort_model_cache_dir.c_str(), 0755) && EEXIST != errno) {
+    LOG(WARNING) << "[" << conf_.brief() << "] Failed to create " << conf_.ort_model_cache_dir << ", "
+      << strerror(errno);
+    session_ = new_session(*session_opts_);
+    return;
+  }
+  // Written aside and renamed, so no start ever loads a partial file, replicas of the model
+  // in this process included
+  const std::string& tmp_path = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(id_);
+  Ort::SessionOptions session_opts = session_opts_->Clone();
+  session_opts.SetOptimizedModelFilePath(tmp_path.c_str());
+  session_ = new_session(session_opts);
+  if (0 != rename(tmp_path.c_str(), path.c_str())) {
+    LOG(WARNING) << "[" << conf_.brief() << "] Failed to cache optimized model " << path << ", " << strerror(errno);
+    remove(tmp_path.c_str());
   }
-  session_ = new Ort::Session(*env_, conf_.graph_file_loc.c_str(), *session_opts_);
-  LOG(INFO) << "[" << conf_.brief() << "] Session created";
 }
 
 void ONNXEngine::sub_init() {
@@ -208,7 +933,10 @@ void ONNXEngine::sub_init() {
   size_t num_input_nodes = session_->GetInputCount();
   for (int32_t i = 0; i < static_cast<int32_t>(num_input_nodes); ++i) {
     std::string input_name = std::string(session_->GetInputNameAllocated(i, allocator).get());
-    auto tensor_shape = session_->GetInputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+    // The shape info is a view into the type info, which has to outlive it
+    Ort::TypeInfo type_info = session_->GetInputTypeInfo(i);
+    auto tensor_info = type_info.GetTensorTypeAndShapeInfo();
+    auto tensor_shape = tensor_info.GetShape();
 
     size_t instance_size = 1;
     std::vector<int64_t> shape;
@@ -224,7 +952,8 @@ void ONNXEngine::sub_init() {
       .num_dims      = static_cast<int32_t>(tensor_shape.size()),
       .shape         = shape,
       .instance_size = instance_size,
-      .index         = i
+      .index         = i,
+      .data_type     = from_onnx_data_type(tensor_info.GetElementType())
     };
   }
 
@@ -232,7 +961,9 @@ void ONNXEngine::sub_init() {
   size_t num_output_nodes = session_->GetOutputCount();
   for (int32_t i = 0; i < static_cast<int32_t>(num_output_nodes); ++i) {
     std::string output_name = std::string(session_->GetOutputNameAllocated(i, allocator).get());
-    auto tensor_shape = session_->GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+    Ort::TypeInfo type_info = session_->GetOutputTypeInfo(i);
+    auto tensor_info = type_info.GetTensorTypeAndShapeInfo();
+    auto tensor_shape = tensor_info.GetShape();
 
     size_t instance_size = 1;
     std::vector<int64_t> shape;
@@ -248,11 +979,49 @@ void ONNXEngine::sub_init() {
       .num_dims      = static_cast<int32_t>(tensor_shape.size()),
       .shape         = shape,
       .instance_size = instance_size,
-      .index         = i
+      .index         = i,
+      .data_type     = from_onnx_data_type(tensor_info.GetElementType())
     };
   }
 
+  // Bind the signature in session order, under the names without the output index
+  auto& meta = onnx_model_meta_;
+  meta.input_slots.resize(meta.input_metas.size());
+  signature_.input_names.resize(meta.input_metas.size());
+  signature_.input_data_types.resize(meta.input_metas.size());
+  for (const auto& tensor_info : meta.input_metas) {
+    const int32_t slot = tensor_info.second.index;
+    meta.input_slots[slot] = tensor_info.second;
+    signature_.input_names[slot] = tensor_info.first.substr(0, tensor_info.first.find(":"));
+    signature_.input_data_types[slot] = tensor_info.second.data_type;
+  }
+  meta.output_slots.resize(meta.output_metas.size());
+  signature_.output_names.resize(meta.output_metas.size());
+  for (const auto& tensor_info : meta.output_metas) {
+    const int32_t slot = tensor_info.second.index;
+    meta.output_slots[slot] = tensor_info.second;
+    signature_.output_names[slot] = tensor_info.first.substr(0, tensor_info.first.find(":"));
+  }
+  for (const auto& slot : meta.input_slots) {
+    meta.input_slot_names.push_back(slot.name.c_str());
+  }
+  for (const auto& slot : meta.output_slots) {
+    meta.output_slot_names.push_back(slot.name.c_str());
+  }
+  // init seals it after sub_init, the int8 check below already runs bound samples
+  signature_.seal();
+
   LOG(INFO) << onnx_model_meta_.to_string();
+
+  // Before tracing starts, so the profiling sessions are made from the graph finally served
+  if (quantized_unchecked_) {
+    quantized_unchecked_ = false;
+    check_quantized();
+  }
+
+  if (trace_sampler_.enabled()) {
+    std::call_once(trace_once_, &ONNXEngine::start_tracing, this);
+  }
 }
 
 void ONNXEngine::get_input_name_and_shape(
@@ -270,6 +1039,21 @@ void ONNXEngine::get_input_name_and_shape(
   }
 }
 
+void ONNXEngine::get_input_name_and_data_type(
+  absl::flat_hash_map<std::string, DataType> *input_data_types
+) {
+  if (nullptr == input_data_types) {
+    std::string err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Input data types is nullptr";
+    throw std::runtime_error(err_msg);
+  }
+
+  for (const auto& tensor_info : onnx_model_meta_.input_metas) {
+    std::string input_name = tensor_info.first.substr(0, tensor_info.first.find(":"));
+    (*input_data_types)[input_name] = tensor_info.second.data_type;
+  }
+}
+
 void ONNXEngine::get_output_name_and_shape(
   absl::flat_hash_map<std::string, std::vector<int64_t>> *output_shapes
 ) {
@@ -288,8 +1072,8 @@ void ONNXEngine::get_output_name_and_shape(
 std::string ONNXTensorMeta::to_string() {
   std::string message;
   absl::StrAppendFormat(&message,
-    "  num_dims: %d\n  instance_size: %llu\n  index: %d\n  shape: %s",
-    num_dims, instance_size, index, absl::StrJoin(shape, ", ").c_str()
+    "  num_dims: %d\n  instance_size: %llu\n  index: %d\n  data_type: %s\n  shape: %s",
+    num_dims, instance_size, index, data_type_name(data_type).c_str(), absl::StrJoin(shape, ", ").c_str()
   );  // NOLINT
 
   return message;
@@ -3,13 +3,20 @@
 #ifndef MODEL_SERVER_SRC_ENGINE_ONNX_ENGINE_H_
 #define MODEL_SERVER_SRC_ENGINE_ONNX_ENGINE_H_
 
+#include <stdint.h>
+#include <atomic>
 #include <memory>
+#include <mutex>  // NOLINT
 #include <vector>
 #include <string>
 #include <shared_mutex>
 #include "absl/container/flat_hash_map.h"
+#include "absl/time/time.h"
 #include "onnxruntime/onnxruntime_cxx_api.h"
 #include "model_server/src/engine/engine.h"
+#include "model_server/src/engine/completion_queue.h"
+#include "model_server/src/engine/tracer.h"
+#include "model_server/src/util/os/mapped_file.h"
 
 namespace model_server {
 
@@ -19,6 +26,7 @@ struct ONNXTensorMeta {
   std::vector<int64_t> shape;
   size_t               instance_size;
   int32_t              index;
+  DataType             data_type;
 
   std::string to_string();
 };
@@ -26,10 +34,49 @@ struct ONNXTensorMeta {
 struct ONNXModelMeta {
   absl::flat_hash_map<std::string, ONNXTensorMeta> input_metas;
   absl::flat_hash_map<std::string, ONNXTensorMeta> output_metas;
+  // Metas by slot of the bound signature, which is their session index
+  std::vector<ONNXTensorMeta> input_slots;
+  std::vector<ONNXTensorMeta> output_slots;
+  // Point into the names of the slots, as Session::Run takes them
+  std::vector<const char*>    input_slot_names;
+  std::vector<const char*>    output_slot_names;
 
   std::string to_string();
 };
 
+// Time spent in the kernels of one op type, summed over the profiled runs
+struct ONNXOpTiming {
+  int64_t calls    = 0;
+  int64_t total_us = 0;
+};
+
+// What one thread needs to run one engine through IoBinding. Outputs are bound over the targets
+// and only rebound when a target moves or its batch size changes, as pooled samples keep theirs,
+// a request mostly rebinds just its inputs and ORT writes straight into the targets.
+struct ONNXRunContext {
+  Ort::IoBinding       binding;
+  // Where each output is bound and for which batch size
+  std::vector<char*>   output_data;
+  std::vector<int64_t> output_batch_sizes;
+
+  ONNXRunContext(Ort::Session *session, size_t num_outputs) noexcept(false);
+  virtual ~ONNXRunContext() = default;
+
+  ONNXRunContext() = delete;
+  ONNXRunContext& operator=(const ONNXRunContext&) = delete;
+  ONNXRunContext(const ONNXRunContext&) = delete;
+};
+
+// Tensors of one asynchronous run, ORT reads the inputs and writes the outputs until its callback
+struct ONNXAsyncRun {
+  std::vector<const char*> input_names;
+  std::vector<Ort::Value>  input_tensors;
+  std::vector<const char*> output_names;
+  std::vector<Ort::Value>  output_tensors;
+  Engine::InferCallback    callback;
+  std::atomic<int64_t>    *runs;  // the engine's count of runs in flight
+};
+
 class ONNXEngine : public Engine {
  public:
   explicit ONNXEngine(const EngineConf& engine_conf) noexcept(false);
@@ -45,9 +92,23 @@ class ONNXEngine : public Engine {
   // Perform inference using the ONNX runtime
   void infer(Instance *instance, Score *score) noexcept(false) override;
 
+  // Perform inference on a bound sample using the ONNX runtime
+  void infer_bound(Instance *instance, Score *score) noexcept(false) override;
+
+  // ORT has no scheduling priorities, the run of each class is only tagged with it for its logs and profiles
+  void infer(Instance *instance, Score *score, Priority priority) noexcept(false) override;
+  void infer_bound(Instance *instance, Score *score, Priority priority) noexcept(false) override;
+
   // Perform inference with trace using the ONNX runtime
   void trace(Instance *instance, Score *score) noexcept(false) override;
 
+  // Run by Session::RunAsync, the callback runs on an intra-op thread. ORT refuses it without an
+  // intra-op pool of two threads or more, then the completion queue serves the engine from there on.
+  void infer_async(
+    Instance *instance, Score *score, InferCallback callback, Priority priority = Priority::kNormal
+  ) noexcept(false) override;  // NOLINT
+  using Engine::infer_async;
+
   // Get input name and shape
   void get_input_name_and_shape(
     absl::flat_hash_map<std::string, std::vector<int64_t>> *input_shapes
@@ -58,6 +119,14 @@ class ONNXEngine : public Engine {
     absl::flat_hash_map<std::string, std::vector<int64_t>> *output_shapes
   ) noexcept(false) override;  // NOLINT
 
+  // Get input name and data type
+  void get_input_name_and_data_type(
+    absl::flat_hash_map<std::string, DataType> *input_data_types
+  ) noexcept(false) override;  // NOLINT
+
+  // Kernel time by op type of every profile collected so far
+  absl::flat_hash_map<std::string, ONNXOpTiming> op_timings() noexcept(false);
+
  protected:
   // Load the TensorFlow graph from the .pb file
   void load() override;
@@ -74,17 +143,108 @@ class ONNXEngine : public Engine {
   // Sub initialization
   void sub_init() override;
 
-  void run_session(Instance *instance, Score *score, Ort::Session *session) noexcept(false);
+  // ORT environment of the process, shared by every ONNX engine
+  static Ort::Env *shared_env() noexcept(false);
+  // Prepacked weights of the graph, shared by the engines serving it until the last one is gone
+  static std::shared_ptr<Ort::PrepackedWeightsContainer> shared_prepacked_weights(
+    const std::string& graph_file_loc
+  ) noexcept(false);  // NOLINT
+
+  void run_session(Instance *instance, Score *score, Ort::Session *session, Priority priority) noexcept(false);
+  // Tensors over the sample's buffers, by slot for a bound sample and else by name
+  void prepare_async_run(Instance *instance, Score *score, ONNXAsyncRun *run) noexcept(false);
+  static void on_async_run_done(void *user_data, OrtValue **outputs, size_t num_outputs, OrtStatusPtr status);
+  // Run on the profiling session, false if it is being swapped or tracing never started
+  bool run_traced(Instance *instance, Score *score, bool bound, Priority priority) noexcept(false);
+  // Create the profiling session and register its collector with the tracer
+  void start_tracing() noexcept(false);
+  // On the tracer's flusher: once the profile is full or old enough, swap in a fresh profiling
+  // session and submit the profile of the old one
+  void collect_trace() noexcept(false);
+  void submit_profile(Ort::Session *session) noexcept(false);
+  // From the mapped graph, sharing the prepacked weights of the sessions made before with the graph.
+  // Only prepacked weights are shared, the session still holds its own copy of the other initializers.
+  Ort::Session *new_session(const Ort::SessionOptions& session_opts) noexcept(false);
+  // Where the optimized graph is cached, keyed by the graph and what its optimization depends on,
+  // empty when the cache is off
+  std::string optimized_model_path() noexcept(false);
+  // Create session_ from the mapped graph at graph_path, through the optimized model cache when it is
+  // on. Tells whether the cache was off, warm or cold.
+  std::string open_session(const std::string& graph_path) noexcept(false);
+  // Create the session from the cached graph, false if there is none or it fails to load, then
+  // graph_path is mapped again
+  bool load_optimized_model(const std::string& path, const std::string& graph_path) noexcept(false);
+  // Create the session from the raw graph and cache what ORT optimized
+  void save_optimized_model(const std::string& path) noexcept(false);
+  // Map the int8 variant of the graph in place of it, building the variant first if it is not cached
+  void quantize() noexcept(false);
+  // Score random samples with the int8 variant and the fp32 graph, and serve fp32 from then on
+  // if they differ by more than the tolerance or in the type or size of any output
+  void check_quantized() noexcept(false);
+  // Map the graph file in place of the one mapped, throws if it can not
+  void map_graph(const std::string& path) noexcept(false);
+  // The level of opt_level, which a session over an optimized model overrides
+  void reset_optimization_level() noexcept(false);
+  void run_bound_session(
+    Instance *instance, Score *score, Ort::Session *session, Priority priority
+  ) noexcept(false);  // NOLINT
+  void run_io_binding(Instance *instance, Score *score, Priority priority) noexcept(false);
+  // Options of the priority class, throws for an unknown one
+  const Ort::RunOptions& run_opts(Priority priority) noexcept(false);
+  // Context of the calling thread, created on its first request
+  ONNXRunContext *run_context() noexcept(false);
+
+  Ort::Value feature_to_tensor(
+    const Ort::MemoryInfo& info, Tensor *feature, const ONNXTensorMeta& onnx_tensor_meta
+  ) noexcept(false);  // NOLINT
+  Ort::Value target_to_tensor(
+    const Ort::MemoryInfo& info, Tensor *target, const ONNXTensorMeta& onnx_tensor_meta
+  ) noexcept(false);  // NOLINT
 
  protected:
   // Preventing from distructing during inference, should be gurranteed by caller
   // std::shared_mutex engine_mtx_;
 
-  Ort::Env            *env_;
-  Ort::Session        *session_;
-  Ort::SessionOptions *session_opts_;
+  Ort::Env                                        *env_;  // shared_env(), not owned
+  Ort::Session                                    *session_;
+  Ort::SessionOptions                             *session_opts_;
+  MappedFile                                       graph_file_;
+  // Outlives the sessions, which are deleted by the destructor
+  std::shared_ptr<Ort::PrepackedWeightsContainer>  prepacked_weights_;
+  // The int8 variant mapped instead of the graph, empty when fp32 is served
+  std::string                                      quantized_path_;
+  // Built by this start, so checked once the session is up
+  bool                                             quantized_unchecked_;
 
   ONNXModelMeta onnx_model_meta_;
+
+  // Shared by every run, creating them per request costs an allocation each. Run options are
+  // kept per priority class.
+  Ort::MemoryInfo memory_info_;
+  Ort::RunOptions run_opts_[kNumPriorities];
+
+  // From LiveEngines, threads key their run contexts by it and prune those of destroyed engines
+  uint64_t                                     id_;
+  std::mutex                                   run_contexts_mtx_;
+  std::vector<std::unique_ptr<ONNXRunContext>> run_contexts_;
+
+  // Sampled requests run on a sibling session with profiling enabled. Its weights other than the
+  // prepacked ones are a second copy of the serving session's, for as long as tracing is on.
+  TraceSampler                         trace_sampler_;
+  std::once_flag                       trace_once_;
+  std::shared_mutex                    trace_mtx_;
+  std::unique_ptr<Ort::SessionOptions> trace_session_opts_;
+  std::unique_ptr<Ort::Session>        trace_session_;
+  std::atomic<int64_t>                 trace_runs_;
+  absl::Time                           trace_session_born_;  // only touched by the flusher once started
+  uint64_t                             trace_collector_id_;
+  // Cleared once ORT refuses RunAsync, runs in flight are waited for on destruction
+  std::atomic<bool>    native_async_;
+  std::atomic<int64_t> async_runs_;
+  CompletionQueue      completion_queue_;
+  // Collected profiles folded by op type, the JSON itself goes to the tracer
+  std::mutex                                     op_timings_mtx_;
+  absl::flat_hash_map<std::string, ONNXOpTiming> op_timings_;
 };
 
 class ONNXEngineFactory : public EngineFactory {
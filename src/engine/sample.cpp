@@ -0,0 +1,201 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/engine/sample.h"
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace model_server {
+
+size_t data_type_size(DataType data_type) noexcept(false) {
+  switch (data_type) {
+    case DataType::kFloat:    return sizeof(float);
+    case DataType::kInt32:    return sizeof(int32_t);
+    case DataType::kInt64:    return sizeof(int64_t);
+    case DataType::kHalf:     return sizeof(Half);
+    case DataType::kBFloat16: return sizeof(BFloat16);
+    case DataType::kBool:     return sizeof(bool);
+  }
+  const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+    + "Unknown data type " + std::to_string(static_cast<int32_t>(data_type));
+  throw std::invalid_argument(err_msg);
+}
+
+std::string data_type_name(DataType data_type) noexcept(false) {
+  switch (data_type) {
+    case DataType::kFloat:    return "float32";
+    case DataType::kInt32:    return "int32";
+    case DataType::kInt64:    return "int64";
+    case DataType::kHalf:     return "float16";
+    case DataType::kBFloat16: return "bfloat16";
+    case DataType::kBool:     return "bool";
+  }
+  return "unknown(" + std::to_string(static_cast<int32_t>(data_type)) + ")";
+}
+
+TensorBuffer::~TensorBuffer() {
+  release();
+}
+
+void TensorBuffer::release() noexcept {
+  if (owned_ && nullptr != data_) {
+    ::operator delete[](data_, std::align_val_t(kTensorAlignment));
+  }
+  if (nullptr != releaser_) {
+    releaser_(release_context_);
+  }
+  data_ = nullptr;
+  capacity_ = 0;
+  owned_ = false;
+  releaser_ = nullptr;
+  release_context_ = nullptr;
+}
+
+void TensorBuffer::borrow(char *data, size_t capacity) noexcept {
+  release();
+  data_ = data;
+  size_ = 0;
+  capacity_ = capacity;
+}
+
+void TensorBuffer::adopt(char *data, size_t size, size_t capacity, Releaser releaser, void *context) noexcept {
+  release();
+  data_ = data;
+  size_ = size;
+  capacity_ = capacity;
+  releaser_ = releaser;
+  release_context_ = context;
+}
+
+TensorBuffer::TensorBuffer(const TensorBuffer& other) noexcept(false) : TensorBuffer() {
+  assign(other.data_, other.size_);
+}
+
+TensorBuffer& TensorBuffer::operator=(const TensorBuffer& other) noexcept(false) {
+  if (this != &other) {
+    assign(other.data_, other.size_);
+  }
+  return *this;
+}
+
+TensorBuffer::TensorBuffer(TensorBuffer&& other) noexcept :
+  data_(std::exchange(other.data_, nullptr)),
+  size_(std::exchange(other.size_, 0)),
+  capacity_(std::exchange(other.capacity_, 0)),
+  owned_(std::exchange(other.owned_, false)),
+  releaser_(std::exchange(other.releaser_, nullptr)),
+  release_context_(std::exchange(other.release_context_, nullptr)) {}
+
+TensorBuffer& TensorBuffer::operator=(TensorBuffer&& other) noexcept {
+  if (this != &other) {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(owned_, other.owned_);
+    std::swap(releaser_, other.releaser_);
+    std::swap(release_context_, other.release_context_);
+    other.clear();
+  }
+  return *this;
+}
+
+void TensorBuffer::reserve(size_t capacity) noexcept(false) {
+  // Adopted memory belongs to the engine's runtime, which may still hand it to others
+  if (capacity <= capacity_ && nullptr == releaser_) {
+    return;
+  }
+  // Round to whole alignment blocks, so growing by a few bytes does not reallocate every time.
+  // Moving out of adopted memory only needs room for what it holds.
+  capacity = std::max(capacity, nullptr == releaser_ ? capacity_ * 2 : size_);
+  capacity = (capacity + kTensorAlignment - 1) / kTensorAlignment * kTensorAlignment;
+  char *data = static_cast<char*>(::operator new[](capacity, std::align_val_t(kTensorAlignment)));
+  if (nullptr != data_) {
+    memcpy(data, data_, size_);
+  }
+  release();
+  data_ = data;
+  capacity_ = capacity;
+  owned_ = true;
+}
+
+void TensorBuffer::resize(size_t size) noexcept(false) {
+  reserve(size);
+  size_ = size;
+}
+
+void TensorBuffer::assign(const void *data, size_t size) noexcept(false) {
+  size_ = 0;
+  append(data, size);
+}
+
+void TensorBuffer::append(const void *data, size_t size) noexcept(false) {
+  if (0 == size) {
+    return;
+  }
+  reserve(size_ + size);
+  memcpy(data_ + size_, data, size);
+  size_ += size;
+}
+
+bool TensorBuffer::operator==(const TensorBuffer& other) const noexcept {
+  return size_ == other.size_ && (0 == size_ || 0 == memcmp(data_, other.data_, size_));
+}
+
+void check_ragged(const Tensor& tensor) noexcept(false) {
+  if (!tensor.ragged()) {
+    return;
+  }
+  const auto& row_splits = tensor.row_splits;
+  if (row_splits.size() != static_cast<size_t>(tensor.batch_size) + 1 || 0 != row_splits.front()
+    || static_cast<size_t>(row_splits.back()) != tensor.size()) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Tensor " + tensor.name + " of " + std::to_string(tensor.size()) + " values has "
+      + std::to_string(row_splits.size()) + " row splits for " + std::to_string(tensor.batch_size) + " rows";
+    throw std::invalid_argument(err_msg);
+  }
+  for (size_t i = 1; i < row_splits.size(); ++i) {
+    if (row_splits[i] < row_splits[i - 1]) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + "Tensor " + tensor.name + " has decreasing row splits at " + std::to_string(i);
+      throw std::invalid_argument(err_msg);
+    }
+  }
+}
+
+void densify(const Tensor& tensor, int64_t row_width, char *dense) noexcept(false) {
+  check_ragged(tensor);
+  const size_t value_size = data_type_size(tensor.dtype);
+  const size_t row_size = row_width * value_size;
+  for (int64_t row = 0; row < tensor.batch_size; ++row) {
+    const size_t begin = tensor.row_splits[row] * value_size;
+    const size_t copy_size = std::min(tensor.row_splits[row + 1] * value_size - begin, row_size);
+    memcpy(dense, tensor.data.data() + begin, copy_size);
+    memset(dense + copy_size, 0, row_size - copy_size);
+    dense += row_size;
+  }
+}
+
+void densify(Tensor *tensor, int64_t row_width) noexcept(false) {
+  if (!tensor->ragged()) {
+    return;
+  }
+  // Validated before anything is touched, a bad tensor is left as it came
+  check_ragged(*tensor);
+
+  // Rows move both ways when some are shorter and some longer than the width, so the ragged
+  // tensor is copied aside first. The scratch keeps its capacity for the next call on this thread.
+  static thread_local Tensor ragged;
+  ragged.batch_size = tensor->batch_size;
+  ragged.dtype = tensor->dtype;
+  ragged.data.assign(tensor->data.data(), tensor->data.size());
+  ragged.row_splits.swap(tensor->row_splits);
+  tensor->row_splits.clear();
+
+  tensor->data.resize(row_width * data_type_size(tensor->dtype) * tensor->batch_size);
+  densify(ragged, row_width, tensor->data.data());
+}
+
+}  // namespace model_server
@@ -3,20 +3,165 @@
 #ifndef MODEL_SERVER_SRC_ENGINE_SAMPLE_H_
 #define MODEL_SERVER_SRC_ENGINE_SAMPLE_H_
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdexcept>
 #include <vector>
 #include <string>
 
 namespace model_server {
 
+// Tensor storage is aligned for the widest vector loads the engines use
+const size_t kTensorAlignment = 64;
+
+enum class DataType : int32_t {
+  kFloat    = 0,
+  kInt32    = 1,
+  kInt64    = 2,
+  kHalf     = 3,
+  kBFloat16 = 4,
+  kBool     = 5,
+};
+
+// 16 bit floats are only carried through, their bits are never interpreted here
+struct Half {
+  uint16_t bits;
+};
+struct BFloat16 {
+  uint16_t bits;
+};
+
+size_t data_type_size(DataType data_type) noexcept(false);
+std::string data_type_name(DataType data_type) noexcept(false);
+
+template <typename T> struct DataTypeOf;
+template <> struct DataTypeOf<float>    { static constexpr DataType value = DataType::kFloat; };
+template <> struct DataTypeOf<int32_t>  { static constexpr DataType value = DataType::kInt32; };
+template <> struct DataTypeOf<int64_t>  { static constexpr DataType value = DataType::kInt64; };
+template <> struct DataTypeOf<Half>     { static constexpr DataType value = DataType::kHalf; };
+template <> struct DataTypeOf<BFloat16> { static constexpr DataType value = DataType::kBFloat16; };
+template <> struct DataTypeOf<bool>     { static constexpr DataType value = DataType::kBool; };
+
+// Growable byte buffer aligned to kTensorAlignment, copies are deep
+class TensorBuffer {
+ public:
+  // Hands adopted memory back to its producer
+  using Releaser = void (*)(void *context) noexcept;
+
+  TensorBuffer() noexcept :
+    data_(nullptr), size_(0), capacity_(0), owned_(false), releaser_(nullptr), release_context_(nullptr) {}
+  virtual ~TensorBuffer();
+
+  TensorBuffer(const TensorBuffer& other) noexcept(false);
+  TensorBuffer& operator=(const TensorBuffer& other) noexcept(false);
+  TensorBuffer(TensorBuffer&& other) noexcept;
+  TensorBuffer& operator=(TensorBuffer&& other) noexcept;
+
+  char *data() noexcept { return data_; }
+  const char *data() const noexcept { return data_; }
+  size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return 0 == size_; }
+
+  // Keeps the leading bytes, new bytes are left uninitialized
+  void resize(size_t size) noexcept(false);
+  void reserve(size_t capacity) noexcept(false);
+  void assign(const void *data, size_t size) noexcept(false);
+  void append(const void *data, size_t size) noexcept(false);
+  void clear() noexcept { size_ = 0; }
+  size_t capacity() const noexcept { return capacity_; }
+  // Store into memory owned by someone else, e.g. an arena, which must outlive the buffer.
+  // The buffer only allocates once more than capacity bytes are needed.
+  void borrow(char *data, size_t capacity) noexcept;
+  // Take over memory of an engine's output, e.g. a TF tensor, and read it in place. The memory is
+  // never written, the first reserve, resize, assign or append moves the bytes to owned memory,
+  // and the releaser runs with the context then or once the buffer is dropped or replaced. The
+  // memory keeps the alignment of its producer, which callers check against kTensorAlignment.
+  void adopt(char *data, size_t size, size_t capacity, Releaser releaser, void *context) noexcept;
+
+  bool operator==(const TensorBuffer& other) const noexcept;
+
+ private:
+  void release() noexcept;
+
+  char     *data_;
+  size_t    size_;
+  size_t    capacity_;
+  bool      owned_;
+  Releaser  releaser_;
+  void     *release_context_;
+};
+
+// Rows of one input or output, batch_size rows of dtype values laid out row major. A ragged
+// tensor, e.g. variable length ids, stores its rows back to back without padding and row i
+// holds the values [row_splits[i], row_splits[i + 1]).
 struct Tensor {
-  std::string name;
-  int64_t batch_size;
-  std::vector<float> data;
+  std::string          name;
+  int64_t              batch_size = 0;
+  DataType             dtype = DataType::kFloat;
+  TensorBuffer         data;
+  std::vector<int64_t> row_splits;  // empty for a dense tensor, else batch_size + 1 offsets
+
+  // Number of values
+  size_t size() const noexcept(false) { return data.size() / data_type_size(dtype); }
+  void resize(size_t count) noexcept(false) { data.resize(count * data_type_size(dtype)); }
+
+  bool ragged() const noexcept { return !row_splits.empty(); }
+  // Byte range of a row, throws std::invalid_argument for a dense tensor without rows
+  size_t row_begin(int64_t row) const noexcept(false) {
+    if (ragged()) {
+      return row_splits[row] * data_type_size(dtype);
+    }
+    if (batch_size <= 0) {
+      throw std::invalid_argument("Tensor " + name + " has no rows");
+    }
+    return row * (data.size() / batch_size);
+  }
+  size_t row_end(int64_t row) const noexcept(false) {
+    return row_begin(row + 1);
+  }
+
+  template <typename T>
+  T *values() noexcept(false) {
+    check_dtype(DataTypeOf<T>::value);
+    return reinterpret_cast<T*>(data.data());
+  }
+  template <typename T>
+  const T *values() const noexcept(false) {
+    check_dtype(DataTypeOf<T>::value);
+    return reinterpret_cast<const T*>(data.data());
+  }
+  // Replace the content with the values, the dtype follows T
+  template <typename T>
+  void assign(const std::vector<T>& values) noexcept(false) {
+    dtype = DataTypeOf<T>::value;
+    data.assign(values.data(), values.size() * sizeof(T));
+  }
+
+ private:
+  void check_dtype(DataType expected) const noexcept(false) {
+    if (expected != dtype) {
+      throw std::invalid_argument("Tensor " + name + " holds " + data_type_name(dtype)
+        + ", not " + data_type_name(expected));
+    }
+  }
 };
 
+// Throws std::invalid_argument unless the row splits of a ragged tensor cover its values in order,
+// dense tensors always pass
+void check_ragged(const Tensor& tensor) noexcept(false);
+
+// Pads every row of a ragged tensor with zeros, or cuts it, to row_width values, either in place
+// or into the batch_size * row_width values of a dense buffer. Engines whose graphs take a fixed
+// width densify into a buffer they own, the caller's tensor is not theirs to rewrite. Both throw
+// as check_ragged does before writing anything.
+void densify(Tensor *tensor, int64_t row_width) noexcept(false);
+void densify(const Tensor& tensor, int64_t row_width, char *dense) noexcept(false);
+
 struct Instance {
   std::vector<Tensor> features;
+  // BoundSignature::id the features and the targets of the score are laid out by, 0 if none. Set
+  // by bind and arrange, whoever renames or reorders the tensors afterwards resets it.
+  uint64_t            signature_id = 0;
 };
 
 struct Score {
@@ -28,6 +173,15 @@ struct Sample {
   Score score;
 };
 
+// Scheduling class of a request. Engines able to prioritize run interactive requests ahead of
+// bulk ones, e.g. offline rescoring, the others serve every class alike.
+enum class Priority : int32_t {
+  kInteractive = 0,
+  kNormal      = 1,
+  kBulk        = 2,
+};
+const int32_t kNumPriorities = 3;
+
 }  // namespace model_server
 
 #endif  // MODEL_SERVER_SRC_ENGINE_SAMPLE_H_
@@ -0,0 +1,291 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/engine/sample_pool.h"
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "absl/container/flat_hash_map.h"
+#include "absl/log/log.h"
+
+namespace model_server {
+
+static const int32_t kThreadFreeListSlots = 4;
+static const int32_t kThreadFreeListSize  = 8;
+static const int32_t kArenaChunkSamples   = 16;
+
+// Pools still alive by id, a thread only hands cached samples back to a pool registered here
+struct LivePools {
+  std::mutex                                  mtx;
+  uint64_t                                    next_id = 1;
+  absl::flat_hash_map<uint64_t, SamplePool*>  pools;
+};
+
+static LivePools *live_pools() {
+  // Leaked on purpose, threads flush their free lists at exit, possibly after static destruction
+  static LivePools *live_pools = new LivePools();
+  return live_pools;
+}
+
+// Samples the thread returned lately, a slot serves one pool at a time
+struct ThreadFreeList {
+  uint64_t pool_id = 0;
+  int32_t  count   = 0;
+  Sample  *samples[kThreadFreeListSize];
+};
+
+struct ThreadFreeLists {
+  ThreadFreeList slots[kThreadFreeListSlots];
+
+  ~ThreadFreeLists() {
+    for (auto& slot : slots) {
+      SamplePool::flush(slot.pool_id, slot.samples, slot.count);
+    }
+  }
+};
+
+static thread_local ThreadFreeLists thread_free_lists;
+
+void SamplePool::Recycler::operator()(Sample *sample) const noexcept {
+  if (nullptr == pool) {
+    delete sample;
+    return;
+  }
+  pool->give_back(sample);
+}
+
+std::shared_ptr<SamplePool> SamplePool::create(Engine *engine, const SamplePoolConf& conf) noexcept(false) {
+  return std::shared_ptr<SamplePool>(new SamplePool(engine, conf));
+}
+
+SamplePool::SamplePool(Engine *engine, const SamplePoolConf& conf) noexcept(false) :
+  id_(0),
+  conf_(conf),
+  prototype_(),
+  feature_capacities_(),
+  target_capacities_(),
+  block_size_(0),
+  free_(std::max(conf.capacity, 2)),
+  arena_mtx_(),
+  arena_(),
+  arena_offset_(0),
+  samples_(),
+  pooled_(0) {
+  if (nullptr == engine) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Engine is nullptr";
+    throw std::runtime_error(err_msg);
+  }
+  if (conf_.max_batch_size <= 0 || conf_.capacity < 0) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Invalid sample pool conf: " + conf_.detail();
+    throw std::runtime_error(err_msg);
+  }
+
+  absl::flat_hash_map<std::string, std::vector<int64_t>> input_shapes;
+  engine->get_input_name_and_shape(&input_shapes);
+  absl::flat_hash_map<std::string, DataType> input_data_types;
+  engine->get_input_name_and_data_type(&input_data_types);
+  absl::flat_hash_map<std::string, std::vector<int64_t>> output_shapes;
+  engine->get_output_name_and_shape(&output_shapes);
+  // Pooled samples are laid out by slot when the engine is bound, so they fit infer_bound
+  std::vector<std::string> input_names = engine->signature().input_names;
+  if (input_names.empty()) {
+    for (const auto& input : input_shapes) {
+      input_names.push_back(input.first);
+    }
+  }
+  std::vector<std::string> output_names = engine->signature().output_names;
+  if (output_names.empty()) {
+    for (const auto& output : output_shapes) {
+      output_names.push_back(output.first);
+    }
+  }
+  // Output types are only known once scored, a target of wider values grows its buffer once
+  shape(input_names, input_shapes, input_data_types, conf_.max_batch_size,
+    &prototype_.instance.features, &feature_capacities_);
+  shape(output_names, output_shapes, {}, conf_.max_batch_size, &prototype_.score.targets, &target_capacities_);
+  // Handed out bound, a request decoded into a sample unbinds it until arrange has checked its names
+  const BoundSignature& signature = engine->signature();
+  if (input_names == signature.input_names && output_names == signature.output_names) {
+    prototype_.instance.signature_id = signature.id;
+  }
+  for (const auto& capacity : feature_capacities_) {
+    block_size_ += capacity;
+  }
+  for (const auto& capacity : target_capacities_) {
+    block_size_ += capacity;
+  }
+  samples_.reserve(conf_.capacity);
+
+  LivePools *registry = live_pools();
+  std::lock_guard lock(registry->mtx);
+  id_ = registry->next_id++;
+  registry->pools.emplace(id_, this);
+}
+
+SamplePool::~SamplePool() {
+  LivePools *registry = live_pools();
+  std::lock_guard lock(registry->mtx);
+  registry->pools.erase(id_);
+}
+
+SamplePool::Handle SamplePool::acquire() noexcept(false) {
+  Sample *sample = take();
+  if (nullptr == sample) {
+    sample = carve();
+  }
+  if (nullptr == sample) {
+    return Handle(new Sample(prototype_), Recycler{nullptr});
+  }
+  return Handle(sample, Recycler{shared_from_this()});
+}
+
+size_t SamplePool::pooled() const noexcept {
+  return pooled_.load(std::memory_order_relaxed);
+}
+
+Sample *SamplePool::take() noexcept {
+  for (auto& slot : thread_free_lists.slots) {
+    if (id_ == slot.pool_id && slot.count > 0) {
+      return slot.samples[--slot.count];
+    }
+  }
+  Sample *sample = nullptr;
+  return free_.try_pop(&sample) ? sample : nullptr;
+}
+
+void SamplePool::give_back(Sample *sample) noexcept {
+  try {
+    reshape(sample);
+  } catch (const std::exception& e) {
+    // Still owned by samples_, it is only lost for reuse
+    LOG(ERROR) << e.what();
+    return;
+  }
+
+  ThreadFreeList *vacant = nullptr;
+  for (auto& slot : thread_free_lists.slots) {
+    if (id_ == slot.pool_id) {
+      if (slot.count < kThreadFreeListSize) {
+        slot.samples[slot.count++] = sample;
+      } else {
+        free_.try_push(sample);
+      }
+      return;
+    }
+    if (0 == slot.count && nullptr == vacant) {
+      vacant = &slot;
+    }
+  }
+  if (nullptr == vacant) {
+    // Every slot serves another pool, hand the samples of the first one back to its owner
+    vacant = &thread_free_lists.slots[0];
+    flush(vacant->pool_id, vacant->samples, vacant->count);
+  }
+  vacant->pool_id = id_;
+  vacant->count = 0;
+  vacant->samples[vacant->count++] = sample;
+}
+
+void SamplePool::flush(uint64_t pool_id, Sample **samples, int32_t count) noexcept {
+  if (0 == count) {
+    return;
+  }
+  LivePools *registry = live_pools();
+  std::lock_guard lock(registry->mtx);
+  auto pool = registry->pools.find(pool_id);
+  if (registry->pools.end() == pool) {
+    return;
+  }
+  for (int32_t i = 0; i < count; ++i) {
+    // The shared list holds every pooled sample, it never rejects one
+    pool->second->free_.try_push(samples[i]);
+  }
+}
+
+Sample *SamplePool::carve() noexcept(false) {
+  std::lock_guard lock(arena_mtx_);
+  if (static_cast<int32_t>(samples_.size()) >= conf_.capacity) {
+    return nullptr;
+  }
+
+  if (arena_.empty() || arena_offset_ + block_size_ > block_size_ * kArenaChunkSamples) {
+    const size_t chunk_size = std::max(block_size_ * kArenaChunkSamples, kTensorAlignment);
+    arena_.emplace_back(static_cast<char*>(::operator new[](chunk_size, std::align_val_t(kTensorAlignment))));
+    arena_offset_ = 0;
+  }
+  char *block = arena_.back().get() + arena_offset_;
+  arena_offset_ += block_size_;
+
+  std::unique_ptr<Sample> sample(new Sample(prototype_));
+  for (size_t i = 0; i < sample->instance.features.size(); ++i) {
+    sample->instance.features[i].data.borrow(block, feature_capacities_[i]);
+    block += feature_capacities_[i];
+  }
+  for (size_t i = 0; i < sample->score.targets.size(); ++i) {
+    sample->score.targets[i].data.borrow(block, target_capacities_[i]);
+    block += target_capacities_[i];
+  }
+  samples_.push_back(std::move(sample));
+  pooled_.fetch_add(1, std::memory_order_relaxed);
+  return samples_.back().get();
+}
+
+void SamplePool::reshape(Sample *sample) noexcept(false) {
+  // Callers may rename or retype tensors, their buffers are kept either way
+  auto& features = sample->instance.features;
+  features.resize(prototype_.instance.features.size());
+  for (size_t i = 0; i < features.size(); ++i) {
+    features[i].name = prototype_.instance.features[i].name;
+    features[i].dtype = prototype_.instance.features[i].dtype;
+    features[i].batch_size = 0;
+    features[i].data.clear();
+    features[i].row_splits.clear();
+  }
+  auto& targets = sample->score.targets;
+  targets.resize(prototype_.score.targets.size());
+  for (size_t i = 0; i < targets.size(); ++i) {
+    targets[i].name = prototype_.score.targets[i].name;
+    targets[i].dtype = prototype_.score.targets[i].dtype;
+    targets[i].batch_size = 0;
+    targets[i].data.clear();
+    targets[i].row_splits.clear();
+  }
+  sample->instance.signature_id = prototype_.instance.signature_id;
+}
+
+void SamplePool::shape(
+  const std::vector<std::string>& names,
+  const absl::flat_hash_map<std::string, std::vector<int64_t>>& shapes,
+  const absl::flat_hash_map<std::string, DataType>& data_types,
+  int64_t max_batch_size, std::vector<Tensor> *tensors, std::vector<size_t> *capacities
+) noexcept(false) {  // NOLINT
+  tensors->resize(names.size());
+  capacities->resize(names.size());
+  size_t i = 0;
+  for (const auto& name : names) {
+    const auto& dims = shapes.at(name);
+    auto& tensor = (*tensors)[i];
+    tensor.name = name;
+    const auto data_type = data_types.find(name);
+    tensor.dtype = data_types.end() == data_type ? DataType::kFloat : data_type->second;
+    tensor.batch_size = 0;
+
+    // The leading dim is the batch, unknown inner dims count as 1
+    size_t row_size = data_type_size(tensor.dtype);
+    for (size_t j = 1; j < dims.size(); ++j) {
+      row_size *= dims[j] > 0 ? static_cast<size_t>(dims[j]) : 1;
+    }
+    (*capacities)[i] = (row_size * max_batch_size + kTensorAlignment - 1) / kTensorAlignment * kTensorAlignment;
+    ++i;
+  }
+}
+
+void SamplePool::ArenaDeleter::operator()(char *block) const noexcept {
+  ::operator delete[](block, std::align_val_t(kTensorAlignment));
+}
+
+}  // namespace model_server
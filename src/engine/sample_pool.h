@@ -0,0 +1,97 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_ENGINE_SAMPLE_POOL_H_
+#define MODEL_SERVER_SRC_ENGINE_SAMPLE_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <vector>
+#include "absl/container/flat_hash_map.h"
+#include "model_server/src/util/functional/mpmc_queue.h"
+#include "model_server/src/engine/sample.h"
+#include "model_server/src/engine/engine.h"
+
+namespace model_server {
+
+struct SamplePoolConf {
+  int32_t max_batch_size = 128;  // rows the tensors of a pooled sample hold without growing
+  int32_t capacity       = 256;  // samples kept for reuse, more are plain heap samples
+
+  std::string detail() const noexcept {
+    return "max_batch_size: " + std::to_string(max_batch_size)
+      + ", capacity: " + std::to_string(capacity);
+  }
+};
+
+// Recycles samples shaped for the inputs and outputs of one engine. The tensors of a pooled
+// sample store into one 64 byte aligned arena block sized for max_batch_size rows, so filling,
+// scoring and returning it allocates nothing once the pool is warm. Returned samples go to a
+// small free list of the returning thread first and to a shared lock-free list when it is full.
+class SamplePool : public std::enable_shared_from_this<SamplePool> {
+ public:
+  // Hands the sample back to the pool it came from, or deletes it if it came from the heap
+  struct Recycler {
+    std::shared_ptr<SamplePool> pool;
+    void operator()(Sample *sample) const noexcept;
+  };
+  using Handle = std::unique_ptr<Sample, Recycler>;
+
+  // Must be owned by a shared_ptr, handles keep the pool alive
+  static std::shared_ptr<SamplePool> create(Engine *engine, const SamplePoolConf& conf) noexcept(false);
+  virtual ~SamplePool();
+
+  SamplePool() = delete;
+  SamplePool& operator=(const SamplePool&) = delete;
+  SamplePool(const SamplePool&) = delete;
+
+  // A sample with every input and output named and typed, batch_size 0 and no data.
+  // It is bound to the engine signature if the engine has one.
+  Handle acquire() noexcept(false);
+
+  // Samples carved from the arena so far
+  size_t pooled() const noexcept;
+
+ private:
+  SamplePool(Engine *engine, const SamplePoolConf& conf) noexcept(false);
+
+  Sample *take() noexcept;
+  void give_back(Sample *sample) noexcept;
+  Sample *carve() noexcept(false);
+  void reshape(Sample *sample) noexcept(false);
+  static void flush(uint64_t pool_id, Sample **samples, int32_t count) noexcept;
+
+  static void shape(
+    const std::vector<std::string>& names,
+    const absl::flat_hash_map<std::string, std::vector<int64_t>>& shapes,
+    const absl::flat_hash_map<std::string, DataType>& data_types,
+    int64_t max_batch_size, std::vector<Tensor> *tensors, std::vector<size_t> *capacities
+  ) noexcept(false);  // NOLINT
+
+  struct ArenaDeleter {
+    void operator()(char *block) const noexcept;
+  };
+
+  uint64_t            id_;
+  SamplePoolConf      conf_;
+  Sample              prototype_;
+  std::vector<size_t> feature_capacities_;
+  std::vector<size_t> target_capacities_;
+  size_t              block_size_;
+  MPMCQueue<Sample*>  free_;
+
+  std::mutex                                         arena_mtx_;
+  std::vector<std::unique_ptr<char[], ArenaDeleter>> arena_;
+  size_t                                             arena_offset_;
+  std::vector<std::unique_ptr<Sample>>               samples_;
+  std::atomic<size_t>                                pooled_;
+
+  friend struct ThreadFreeLists;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_ENGINE_SAMPLE_POOL_H_
@@ -0,0 +1,204 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/engine/score_cache.h"
+#include <string.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "absl/hash/hash.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+
+namespace model_server {
+
+ScoreCache::ScoreCache(const ScoreCacheConf& score_cache_conf) noexcept(false) :
+  conf_(score_cache_conf),
+  cache_(score_cache_conf.capacity, absl::Milliseconds(score_cache_conf.ttl_ms), score_cache_conf.num_shards) {}
+
+void ScoreCache::infer(Instance *instance, Score *score, const Infer& infer) noexcept(false) {
+  const auto schema = std::make_shared<const std::string>(make_schema(*instance, *score));
+  std::vector<RowView> views;
+  make_views(*instance, *schema, &views);
+  const int64_t rows = static_cast<int64_t>(views.size());
+
+  std::vector<RowScore> row_scores(rows);
+  std::vector<int64_t> misses;
+  std::vector<RowKey> miss_keys;
+  for (int64_t row = 0; row < rows; ++row) {
+    if (!cache_.get(views[row], &row_scores[row])) {
+      misses.push_back(row);
+      // Copied before scoring, which may rewrite the request tensors the view reads
+      miss_keys.push_back(make_key(views[row], schema));
+    }
+  }
+
+  if (!misses.empty()) {
+    // Score only the missing rows, the whole instance goes as is when nothing hits
+    Instance miss_instance;
+    Score miss_score;
+    Instance *infer_instance = instance;
+    Score *infer_score = score;
+    if (static_cast<int64_t>(misses.size()) != rows) {
+      miss_instance.features.resize(instance->features.size());
+      for (size_t i = 0; i < instance->features.size(); ++i) {
+        const auto& feature = instance->features[i];
+        auto& miss_feature = miss_instance.features[i];
+        miss_feature.name = feature.name;
+        miss_feature.dtype = feature.dtype;
+        miss_feature.batch_size = static_cast<int64_t>(misses.size());
+        if (feature.ragged()) {
+          miss_feature.row_splits.push_back(0);
+        }
+        for (const auto& row : misses) {
+          const size_t begin = feature.row_begin(row);
+          miss_feature.data.append(feature.data.data() + begin, feature.row_end(row) - begin);
+          if (feature.ragged()) {
+            miss_feature.row_splits.push_back(static_cast<int64_t>(miss_feature.size()));
+          }
+        }
+      }
+      miss_score.targets.resize(score->targets.size());
+      for (size_t i = 0; i < score->targets.size(); ++i) {
+        miss_score.targets[i].name = score->targets[i].name;
+        miss_score.targets[i].batch_size = static_cast<int64_t>(misses.size());
+      }
+      // Same tensors in the same order, so bound as the request is
+      miss_instance.signature_id = instance->signature_id;
+      infer_instance = &miss_instance;
+      infer_score = &miss_score;
+    }
+    infer(infer_instance, infer_score);
+
+    for (const auto& target : infer_score->targets) {
+      if (0 != target.size() % misses.size()) {
+        const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+          + absl::StrFormat("Target %s of %d values is not divisible by %d rows",
+            target.name, target.size(), misses.size());
+        throw std::runtime_error(err_msg);
+      }
+    }
+    for (size_t j = 0; j < misses.size(); ++j) {
+      auto row_score = std::make_shared<std::vector<Tensor>>(infer_score->targets.size());
+      for (size_t i = 0; i < infer_score->targets.size(); ++i) {
+        const auto& target = infer_score->targets[i];
+        const size_t row_size = target.data.size() / misses.size();
+        auto& row_target = (*row_score)[i];
+        row_target.batch_size = 1;
+        row_target.dtype = target.dtype;
+        row_target.data.assign(target.data.data() + j * row_size, row_size);
+      }
+      row_scores[misses[j]] = row_score;
+      cache_.put(miss_keys[j], row_score);
+    }
+    if (infer_score == score) {
+      return;
+    }
+  }
+
+  for (size_t i = 0; i < score->targets.size(); ++i) {
+    auto& target = score->targets[i];
+    target.batch_size = rows;
+    target.dtype = (*row_scores.front())[i].dtype;
+    target.data.clear();
+    for (const auto& row_score : row_scores) {
+      const auto& slice = (*row_score)[i].data;
+      target.data.append(slice.data(), slice.size());
+    }
+  }
+}
+
+void ScoreCache::clear() noexcept {
+  cache_.clear();
+}
+
+size_t ScoreCache::size() const noexcept {
+  return cache_.size();
+}
+
+bool ScoreCache::RowEq::operator()(const RowKey& key, const RowView& view) const noexcept {
+  if (key.hash != view.hash || (key.schema.get() != view.schema && *key.schema != *view.schema)) {
+    return false;
+  }
+  // Walk the key bytes in the order make_key laid the row out
+  const char *bytes = key.bytes.data();
+  const char *end = bytes + key.bytes.size();
+  for (const auto& feature : view.instance->features) {
+    const size_t begin = feature.row_begin(view.row);
+    const size_t row_size = feature.row_end(view.row) - begin;
+    if (feature.ragged()) {
+      const uint64_t length = row_size;
+      if (static_cast<size_t>(end - bytes) < sizeof(length) || 0 != memcmp(bytes, &length, sizeof(length))) {
+        return false;
+      }
+      bytes += sizeof(length);
+    }
+    if (static_cast<size_t>(end - bytes) < row_size
+        || (row_size > 0 && 0 != memcmp(bytes, feature.data.data() + begin, row_size))) {
+      return false;
+    }
+    bytes += row_size;
+  }
+  return end == bytes;
+}
+
+std::string ScoreCache::make_schema(const Instance& instance, const Score& score) noexcept(false) {
+  if (instance.features.empty() || instance.features.front().batch_size <= 0) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Instance has no row";
+    throw std::runtime_error(err_msg);
+  }
+  const int64_t rows = instance.features.front().batch_size;
+
+  std::string schema;
+  for (const auto& feature : instance.features) {
+    check_ragged(feature);
+    if (feature.batch_size != rows || (!feature.ragged() && 0 != feature.size() % rows)) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Feature %s of %d values does not hold %d rows", feature.name, feature.size(), rows);
+      throw std::runtime_error(err_msg);
+    }
+    schema.append(feature.name).push_back(static_cast<char>(feature.dtype));
+    schema.push_back(feature.ragged() ? 'r' : 'd');
+  }
+  for (const auto& target : score.targets) {
+    schema.append(target.name).push_back('\0');
+  }
+  return schema;
+}
+
+void ScoreCache::make_views(const Instance& instance, const std::string& schema,
+    std::vector<RowView> *views) noexcept {
+  const int64_t rows = instance.features.front().batch_size;
+  // The schema is hashed once, every row only adds its own bytes
+  const size_t schema_hash = absl::HashOf(absl::string_view(schema));
+  views->resize(rows);
+  for (int64_t row = 0; row < rows; ++row) {
+    size_t hash = schema_hash;
+    for (const auto& feature : instance.features) {
+      const size_t begin = feature.row_begin(row);
+      // A string view hashes its length too, so ragged rows stay unambiguous
+      hash = absl::HashOf(hash, absl::string_view(feature.data.data() + begin, feature.row_end(row) - begin));
+    }
+    (*views)[row] = RowView{hash, &schema, &instance, row};
+  }
+}
+
+ScoreCache::RowKey ScoreCache::make_key(const RowView& view,
+    const std::shared_ptr<const std::string>& schema) noexcept(false) {
+  RowKey key{view.hash, schema, std::string()};
+  for (const auto& feature : view.instance->features) {
+    const size_t begin = feature.row_begin(view.row);
+    const size_t row_size = feature.row_end(view.row) - begin;
+    // Ragged rows vary in length, which has to be part of the key to keep the bytes unambiguous
+    if (feature.ragged()) {
+      const uint64_t length = row_size;
+      key.bytes.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    }
+    key.bytes.append(feature.data.data() + begin, row_size);
+  }
+  return key;
+}
+
+}  // namespace model_server
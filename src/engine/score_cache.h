@@ -0,0 +1,94 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_ENGINE_SCORE_CACHE_H_
+#define MODEL_SERVER_SRC_ENGINE_SCORE_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "model_server/src/util/functional/lru_cache.h"
+#include "model_server/src/engine/sample.h"
+
+namespace model_server {
+
+struct ScoreCacheConf {
+  int64_t capacity   = 0;  // rows, 0 disables the cache
+  int64_t ttl_ms     = 1000;
+  int32_t num_shards = 16;
+
+  std::string detail() const noexcept {
+    return "capacity: " + std::to_string(capacity)
+      + ", ttl_ms: " + std::to_string(ttl_ms)
+      + ", num_shards: " + std::to_string(num_shards);
+  }
+};
+
+// Remembers the score rows of recently seen feature rows of one model version.
+// Every row is keyed by its feature bytes together with the feature and target names,
+// only the rows missing from the cache are scored and the results spliced back in order.
+class ScoreCache {
+ public:
+  using Infer = std::function<void(Instance*, Score*)>;
+
+  explicit ScoreCache(const ScoreCacheConf& score_cache_conf) noexcept(false);
+  virtual ~ScoreCache() {}
+
+  ScoreCache() = delete;
+  ScoreCache& operator=(const ScoreCache&) = delete;
+  ScoreCache(const ScoreCache&) = delete;
+
+  // Fill the score from the cache, scoring the missing rows with infer
+  void infer(Instance *instance, Score *score, const Infer& infer) noexcept(false);
+  // Forget every row, must be called once the model behind infer changes
+  void clear() noexcept;
+
+  size_t size() const noexcept;
+
+ private:
+  // A request row read in place, only the rows put into the cache are copied into a RowKey
+  struct RowView {
+    size_t             hash;
+    const std::string *schema;
+    const Instance    *instance;
+    int64_t            row;
+  };
+  // The schema and row bytes are compared on lookup, so a hash collision never returns a foreign score.
+  // The schema is shared by the keys of one request.
+  struct RowKey {
+    size_t                             hash;
+    std::shared_ptr<const std::string> schema;
+    std::string                        bytes;
+  };
+  struct RowHash {
+    using is_transparent = void;
+
+    size_t operator()(const RowKey& key) const noexcept { return key.hash; }
+    size_t operator()(const RowView& view) const noexcept { return view.hash; }
+  };
+  struct RowEq {
+    using is_transparent = void;
+
+    bool operator()(const RowKey& a, const RowKey& b) const noexcept {
+      return a.hash == b.hash && (a.schema == b.schema || *a.schema == *b.schema) && a.bytes == b.bytes;
+    }
+    bool operator()(const RowKey& key, const RowView& view) const noexcept;
+    bool operator()(const RowView& view, const RowKey& key) const noexcept { return (*this)(key, view); }
+  };
+  // Score of one row, one single row tensor per target
+  using RowScore = std::shared_ptr<const std::vector<Tensor>>;
+
+  // Names and types of the request tensors, the same bytes fed to other inputs or asking other targets are other rows
+  static std::string make_schema(const Instance& instance, const Score& score) noexcept(false);
+  static void make_views(const Instance& instance, const std::string& schema, std::vector<RowView> *views) noexcept;
+  static RowKey make_key(const RowView& view, const std::shared_ptr<const std::string>& schema) noexcept(false);
+
+  ScoreCacheConf                                    conf_;
+  ShardedLRUCache<RowKey, RowScore, RowHash, RowEq> cache_;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_ENGINE_SCORE_CACHE_H_
@@ -2,32 +2,112 @@
 
 #include "model_server/src/engine/tf2_engine.h"
 
+#include <stdint.h>
+#include <string.h>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <utility>
 
 #include "absl/log/log.h"
 #include "absl/cleanup/cleanup.h"
+#include "absl/container/inlined_vector.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
 #include "tensorflow/c/c_api.h"
+#include "tensorflow/core/framework/allocation_description.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 
 namespace model_server {
 
+static tensorflow::DataType to_tf2_data_type(DataType data_type) noexcept(false) {
+  switch (data_type) {
+    case DataType::kFloat:    return tensorflow::DT_FLOAT;
+    case DataType::kInt32:    return tensorflow::DT_INT32;
+    case DataType::kInt64:    return tensorflow::DT_INT64;
+    case DataType::kHalf:     return tensorflow::DT_HALF;
+    case DataType::kBFloat16: return tensorflow::DT_BFLOAT16;
+    case DataType::kBool:     return tensorflow::DT_BOOL;
+  }
+  const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+    + "Unsupported data type " + data_type_name(data_type);
+  throw std::runtime_error(err_msg);
+}
+
+static DataType from_tf2_data_type(tensorflow::DataType tf_data_type) noexcept(false) {
+  switch (tf_data_type) {
+    case tensorflow::DT_FLOAT:    return DataType::kFloat;
+    case tensorflow::DT_INT32:    return DataType::kInt32;
+    case tensorflow::DT_INT64:    return DataType::kInt64;
+    case tensorflow::DT_HALF:     return DataType::kHalf;
+    case tensorflow::DT_BFLOAT16: return DataType::kBFloat16;
+    case tensorflow::DT_BOOL:     return DataType::kBool;
+    default:                      break;
+  }
+  const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+    + "Unsupported TF data type " + tensorflow::DataTypeString(tf_data_type);
+  throw std::runtime_error(err_msg);
+}
+
+// Lends the bytes of a feature to a TF tensor for one run, nothing is freed when the last reference goes.
+// The feeds hold a reference throughout the run, so TF never forwards the buffer to an output and
+// writes into it, the feature is only read.
+class BorrowedTensorBuffer : public tensorflow::TensorBuffer {
+ public:
+  BorrowedTensorBuffer(void *data, size_t size) noexcept : tensorflow::TensorBuffer(data), size_(size) {}
+
+  size_t size() const override {
+    return size_;
+  }
+  tensorflow::TensorBuffer *root_buffer() override {
+    return this;
+  }
+  void FillAllocationDescription(tensorflow::AllocationDescription *proto) const override {
+    proto->set_requested_bytes(size_);
+    proto->set_allocator_name("borrowed");
+  }
+  bool OwnsMemory() const override {
+    return false;
+  }
+
+ private:
+  size_t size_;
+};
+
 TF2Engine::TF2Engine(const EngineConf& engine_conf) noexcept(false) :
   Engine(engine_conf),
   // engine_mtx_(),
   tags_(),
   session_opts_(),
   run_opts_(),
-  model_bundle_() {
+  trace_run_opts_(),
+  model_bundle_(),
+  tf_model_meta_(),
+  has_callable_(false),
+  callable_(0),
+  feed_indices_(),
+  trace_sampler_(engine_conf.trace_every_n),
+  completion_queue_(this, engine_conf) {
 }
 
 TF2Engine::~TF2Engine() {
+  completion_queue_.stop();
   try {
     // std::unique_lock<std::shared_mutex> engine_lock(engine_mtx_);
     inited_ = false;
+
+    if (has_callable_ && nullptr != model_bundle_.GetSession()) {
+      tensorflow::Status status = model_bundle_.GetSession()->ReleaseCallable(callable_);
+      has_callable_ = false;
+      if (!status.ok()) {
+        const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+          + conf_.brief() + "] " + "Failed to release callable: " + status.ToString();
+        throw std::runtime_error(err_msg);
+      }
+      LOG(INFO) << "[" << conf_.brief() << "] Callable released";
+    }
   } catch (const std::exception& e) {
     LOG(ERROR) << e.what();
   } catch (...) {
@@ -57,11 +137,18 @@ void TF2Engine::infer(Instance *instance, Score *score) noexcept(false) {
     throw std::runtime_error(err_msg);
   }
 
-  std::vector<std::pair<std::string, tensorflow::Tensor>> input_tensors;
-  instance_to_tensor(*instance, &input_tensors);
-
   std::vector<tensorflow::Tensor> outputs;
-  tensorflow::Status status = model_bundle_.GetSession()->Run(input_tensors, conf_.output_nodes, {}, &outputs);
+  tensorflow::Status status;
+  std::vector<tensorflow::Tensor> feed_tensors;
+  if (trace_sampler_.sample()) {
+    status = run_traced(*instance, &outputs);
+  } else if (has_callable_ && instance_to_feed(*instance, &feed_tensors)) {
+    status = model_bundle_.GetSession()->RunCallable(callable_, feed_tensors, &outputs, nullptr);
+  } else {
+    std::vector<std::pair<std::string, tensorflow::Tensor>> input_tensors;
+    instance_to_tensor(*instance, &input_tensors);
+    status = model_bundle_.GetSession()->Run(input_tensors, conf_.output_nodes, {}, &outputs);
+  }
   if (!status.ok()) {
     const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
       + conf_.brief() + "] " + "Failed to run session: " + status.ToString();
@@ -78,7 +165,40 @@ void TF2Engine::trace(Instance *instance, Score *score) noexcept(false) {
       + conf_.brief() + "] " + "Engine not initialized";
     throw std::runtime_error(err_msg);
   }
-  infer(instance, score);
+
+  std::vector<tensorflow::Tensor> outputs;
+  tensorflow::Status status = run_traced(*instance, &outputs);
+  if (!status.ok()) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Failed to run session: " + status.ToString();
+    throw std::runtime_error(err_msg);
+  }
+
+  score_from_tensor(outputs, score);
+}
+
+void TF2Engine::infer_async(
+  Instance *instance, Score *score, InferCallback callback, Priority priority
+) noexcept(false) {  // NOLINT
+  completion_queue_.push(instance, score, std::move(callback), priority);
+}
+
+tensorflow::Status TF2Engine::run_traced(const Instance& instance, std::vector<tensorflow::Tensor> *outputs) {
+  // Callables fix their run options, a traced run goes by name
+  std::vector<std::pair<std::string, tensorflow::Tensor>> input_tensors;
+  instance_to_tensor(instance, &input_tensors);
+  tensorflow::RunMetadata run_metadata;
+  tensorflow::Status status = model_bundle_.GetSession()->Run(
+    trace_run_opts_, input_tensors, conf_.output_nodes, {}, outputs, &run_metadata
+  );  // NOLINT
+  if (status.ok()) {
+    Tracer::instance()->submit(std::unique_ptr<TraceRecord>(new TraceRecord{
+      .model = conf_.brief(),
+      .extension = "pb",
+      .payload = run_metadata.SerializeAsString()
+    }));
+  }
+  return status;
 }
 
 void TF2Engine::get_input_name_and_shape(
@@ -95,6 +215,20 @@ void TF2Engine::get_input_name_and_shape(
   }
 }
 
+void TF2Engine::get_input_name_and_data_type(
+  absl::flat_hash_map<std::string, DataType> *input_data_types
+) {
+  if (nullptr == input_data_types) {
+    std::string err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Input data types is nullptr";
+    throw std::runtime_error(err_msg);
+  }
+
+  for (const auto& tensor_info : tf_model_meta_.input_metas) {
+    (*input_data_types)[tensor_info.first] = from_tf2_data_type(tensor_info.second.data_type);
+  }
+}
+
 void TF2Engine::get_output_name_and_shape(
   absl::flat_hash_map<std::string, std::vector<int64_t>> *output_shapes
 ) {
@@ -142,6 +276,9 @@ void TF2Engine::set_session_options() {
   session_opts_.config.set_intra_op_parallelism_threads(conf_.intra_op_parallelism_threads);
   session_opts_.config.set_inter_op_parallelism_threads(conf_.inter_op_parallelism_threads);
   set_gpu(&(session_opts_.config));
+
+  trace_run_opts_ = run_opts_;
+  trace_run_opts_.set_trace_level(tensorflow::RunOptions_TraceLevel_FULL_TRACE);
 }
 
 void TF2Engine::set_gpu(tensorflow::ConfigProto *tf_session_conf) noexcept(false) {
@@ -178,6 +315,41 @@ void TF2Engine::sub_init() {
     const tensorflow::NodeDef& node = graph_def.node(i);
     DLOG(INFO) << "node: " << node.name() << " [op: " << node.op() << "] is placed on device: " << node.device();
   }
+
+  if (conf_.tf_use_callable) {
+    make_callable();
+  }
+}
+
+void TF2Engine::make_callable() {
+  if (nullptr == model_bundle_.GetSession()) {
+    LOG(WARNING) << "[" << conf_.brief() << "] No session, running by name";
+    return;
+  }
+
+  tensorflow::CallableOptions callable_opts;
+  for (const auto& input_node : conf_.input_nodes) {
+    if (tf_model_meta_.input_metas.end() == tf_model_meta_.input_metas.find(input_node)) {
+      continue;
+    }
+    feed_indices_[input_node] = static_cast<size_t>(callable_opts.feed_size());
+    callable_opts.add_feed(input_node);
+  }
+  for (const auto& output_node : conf_.output_nodes) {
+    callable_opts.add_fetch(output_node);
+  }
+  *(callable_opts.mutable_run_options()) = run_opts_;
+
+  tensorflow::Status status = model_bundle_.GetSession()->MakeCallable(callable_opts, &callable_);
+  if (!status.ok()) {
+    // Still served, only without the fast path
+    LOG(WARNING) << "[" << conf_.brief() << "] Failed to make callable, running by name: " << status.ToString();
+    feed_indices_.clear();
+    return;
+  }
+  has_callable_ = true;
+  LOG(INFO) << "[" << conf_.brief() << "] Callable made for " << feed_indices_.size() << " feeds and "
+            << conf_.output_nodes.size() << " fetches";
 }
 
 // Get TFTensorMeta by TF_Operation name
@@ -201,6 +373,10 @@ void TF2Engine::get_tf_tensor_meta_by_tf_operation_name(
       DLOG(INFO) << "name: " << node.name() << ", key: " << entry.first << ", value: " << entry.second.DebugString();
     }
 
+    if (node.attr().find("dtype") != node.attr().end()) {
+      tensor_meta.data_type = node.attr().at("dtype").type();
+    }
+
     if (node.attr().find("shape") != node.attr().end()) {
       const tensorflow::AttrValue& shape_attr = node.attr().at("shape");
       tensor_meta.num_dims = shape_attr.shape().dim_size();
@@ -227,43 +403,75 @@ void TF2Engine::get_tf_tensor_meta_by_tf_operation_name(
 void TF2Engine::instance_to_tensor(
   const Instance& instance, std::vector<std::pair<std::string, tensorflow::Tensor>> *input_tensors
 ) {
-  absl::flat_hash_map<std::string, std::vector<int64_t>> input_shapes;
-  get_input_name_and_shape(&input_shapes);
+  for (const auto& feature_tensor : instance.features) {
+    input_tensors->emplace_back(feature_tensor.name, feature_to_tensor(feature_tensor));
+  }
+}
 
+bool TF2Engine::instance_to_feed(
+  const Instance& instance, std::vector<tensorflow::Tensor> *feed_tensors
+) {
+  feed_tensors->resize(feed_indices_.size());
+  size_t fed = 0;
   for (const auto& feature_tensor : instance.features) {
-    // Find the shape for this feature tensor based on its name
-    auto it = input_shapes.find(feature_tensor.name);
-    if (it == input_shapes.end()) {
-      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
-        + "Shape for input tensor " + feature_tensor.name + " not found";
-      throw std::runtime_error(err_msg);
+    const auto it = feed_indices_.find(feature_tensor.name);
+    if (feed_indices_.end() == it) {
+      // Not a feed of the callable, let the named run report it
+      return false;
     }
-    std::vector<int64_t>& tensor_shape = it->second;
-    tensor_shape[0] = feature_tensor.batch_size;
-
-    // Create a TensorFlow tensor with the correct shape
-    tensorflow::TensorShape tf_tensor_shape(tensor_shape);
-    tensorflow::Tensor input_tensor(tensorflow::DT_FLOAT, tf_tensor_shape);
+    (*feed_tensors)[it->second] = feature_to_tensor(feature_tensor);
+    ++fed;
+  }
+  return fed == feed_indices_.size();
+}
 
-    // Directly copy data into the tensor using Eigen::TensorMap for zero-copy assignment
-    auto eigen_tensor = input_tensor.flat<float>();
-    Eigen::TensorMap<Eigen::Tensor<float, 1, Eigen::RowMajor>> eigen_tensor_map(
-      eigen_tensor.data(), eigen_tensor.size()
-    );  // NOLINT
-    eigen_tensor_map = Eigen::TensorMap<Eigen::Tensor<const float, 1, Eigen::RowMajor>>(
-      feature_tensor.data.data(), feature_tensor.data.size()
-    );  // NOLINT
+tensorflow::Tensor TF2Engine::feature_to_tensor(const Tensor& feature_tensor) {
+  // Find the shape for this feature tensor based on its name
+  const auto it = tf_model_meta_.input_metas.find(feature_tensor.name);
+  if (it == tf_model_meta_.input_metas.end()) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Shape for input tensor " + feature_tensor.name + " not found";
+    throw std::runtime_error(err_msg);
+  }
+  absl::InlinedVector<int64_t, 8> tensor_shape(it->second.shape.begin(), it->second.shape.end());
+  tensor_shape[0] = feature_tensor.batch_size;
+
+  tensorflow::TensorShape tf_tensor_shape(tensor_shape);
+  const tensorflow::DataType tf_data_type = to_tf2_data_type(feature_tensor.dtype);
+  const size_t tensor_data_size = tf_tensor_shape.num_elements() * tensorflow::DataTypeSize(tf_data_type);
+  // A dense feature is read in place, as TF1 does. Buffers aligned to kTensorAlignment satisfy
+  // EIGEN_MAX_ALIGN_BYTES, the others, e.g. borrowed ones, are copied.
+  const char *feature_data = feature_tensor.data.data();
+  if (!feature_tensor.ragged() && tensor_data_size > 0 && tensor_data_size == feature_tensor.data.size()
+    && 0 == reinterpret_cast<uintptr_t>(feature_data) % kTensorAlignment) {
+    BorrowedTensorBuffer *buffer = new BorrowedTensorBuffer(const_cast<char*>(feature_data), tensor_data_size);
+    tensorflow::Tensor input_tensor(tf_data_type, tf_tensor_shape, buffer);
+    // The tensor took its own reference
+    buffer->Unref();
+    return input_tensor;
+  }
 
-    input_tensors->emplace_back(feature_tensor.name, input_tensor);
+  // Create a TensorFlow tensor with the correct shape and copy the bytes in as they are
+  tensorflow::Tensor input_tensor(tf_data_type, tf_tensor_shape);
+  if (feature_tensor.ragged()) {
+    // Padded straight into the graph input, the rows are copied once either way
+    const int64_t row_width = feature_tensor.batch_size > 0
+      ? input_tensor.NumElements() / feature_tensor.batch_size : 0;
+    densify(feature_tensor, row_width, static_cast<char*>(input_tensor.data()));
+    return input_tensor;
   }
+  if (input_tensor.TotalBytes() != feature_tensor.data.size()) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Feature data size mismatch: " + feature_tensor.name;
+    throw std::runtime_error(err_msg);
+  }
+  memcpy(input_tensor.data(), feature_tensor.data.data(), feature_tensor.data.size());
+  return input_tensor;
 }
 
 void TF2Engine::score_from_tensor(
   const std::vector<tensorflow::Tensor>& output_tensors, Score *score
 ) {
-  absl::flat_hash_map<std::string, std::vector<int64_t>> output_shapes;
-  get_output_name_and_shape(&output_shapes);
-
   score->targets.clear();
   int32_t i = 0;
   for (const auto& output_tensor : output_tensors) {
@@ -273,9 +481,10 @@ void TF2Engine::score_from_tensor(
     target.name = tensor_name;
     target.batch_size = output_tensor.dim_size(0);  // Assuming the first dimension is batch size.
 
-    // Directly assign data to target.data
-    auto flat_tensor = output_tensor.flat<float>();
-    target.data.assign(flat_tensor.data(), flat_tensor.data() + flat_tensor.size());
+    // Copy the bytes out as they are, whatever the output type
+    const auto tensor_data = output_tensor.tensor_data();
+    target.dtype = from_tf2_data_type(output_tensor.dtype());
+    target.data.assign(tensor_data.data(), tensor_data.size());
 
     score->targets.push_back(target);
   }
@@ -284,8 +493,9 @@ void TF2Engine::score_from_tensor(
 std::string TF2TensorMeta::to_string() {
   std::string message;
   absl::StrAppendFormat(&message,
-    "  operation_name: %s\n  operation_type: %s\n  device: %s\n  num_dims: %d\n  shape: %s\n",
-    operation_name.c_str(), operation_type.c_str(), device.c_str(), num_dims, absl::StrJoin(shape, ", ").c_str()
+    "  operation_name: %s\n  operation_type: %s\n  device: %s\n  data_type: %s\n  num_dims: %d\n  shape: %s\n",
+    operation_name.c_str(), operation_type.c_str(), device.c_str(), tensorflow::DataTypeString(data_type).c_str(),
+    num_dims, absl::StrJoin(shape, ", ").c_str()
   );  // NOLINT
 
   return message;
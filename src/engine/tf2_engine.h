@@ -16,8 +16,11 @@
 #include "tensorflow/cc/client/client_session.h"
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/cc/saved_model/tag_constants.h"
+#include "tensorflow/core/public/session.h"
 
 #include "model_server/src/engine/engine.h"
+#include "model_server/src/engine/completion_queue.h"
+#include "model_server/src/engine/tracer.h"
 
 namespace model_server {
 
@@ -27,6 +30,7 @@ struct TF2TensorMeta {
   std::string          device;
   int32_t              num_dims;
   std::vector<int64_t> shape;
+  tensorflow::DataType data_type = tensorflow::DT_FLOAT;
 
   std::string to_string();
 };
@@ -59,6 +63,12 @@ class TF2Engine : public Engine {
   // Perform inference with trace using the TF runtime
   void trace(Instance *instance, Score *score) noexcept(false) override;
 
+  // Queued on the completion queue, a TF session has no asynchronous run
+  void infer_async(
+    Instance *instance, Score *score, InferCallback callback, Priority priority = Priority::kNormal
+  ) noexcept(false) override;  // NOLINT
+  using Engine::infer_async;
+
   // Get input name and shape
   void get_input_name_and_shape(
     absl::flat_hash_map<std::string, std::vector<int64_t>> *input_shapes
@@ -69,6 +79,11 @@ class TF2Engine : public Engine {
     absl::flat_hash_map<std::string, std::vector<int64_t>> *output_shapes
   ) noexcept(false) override;  // NOLINT
 
+  // Get input name and data type
+  void get_input_name_and_data_type(
+    absl::flat_hash_map<std::string, DataType> *input_data_types
+  ) noexcept(false) override;  // NOLINT
+
  protected:
   // Load the TensorFlow graph from the .pb file
   void load() override;
@@ -86,6 +101,9 @@ class TF2Engine : public Engine {
   // Sub initialization
   void sub_init() override;
 
+  // Make the callable of the feeds and fetches, engines without one run by name
+  void make_callable() noexcept(false);
+
   void get_tf_tensor_meta_by_tf_operation_name(
     const std::string& tf_operation_name,
     absl::flat_hash_map<std::string, TF2TensorMeta> *tf_tensor_meta
@@ -95,6 +113,17 @@ class TF2Engine : public Engine {
     const Instance& instance, std::vector<std::pair<std::string, tensorflow::Tensor>> *input_tensors
   );  // NOLINT
 
+  // Lay the features out in the feed order of the callable, false if some feed is missing
+  bool instance_to_feed(
+    const Instance& instance, std::vector<tensorflow::Tensor> *feed_tensors
+  );  // NOLINT
+
+  // Wraps the feature without a copy when it is dense and aligned, the feature has to outlive the run
+  tensorflow::Tensor feature_to_tensor(const Tensor& feature) noexcept(false);
+
+  // Run by name with a full trace and hand the RunMetadata to the tracer
+  tensorflow::Status run_traced(const Instance& instance, std::vector<tensorflow::Tensor> *outputs);
+
   void score_from_tensor(
     const std::vector<tensorflow::Tensor>& output_tensors, Score *score
   );  // NOLINT
@@ -106,9 +135,21 @@ class TF2Engine : public Engine {
   std::unordered_set<std::string> tags_;
   tensorflow::SessionOptions      session_opts_;
   tensorflow::RunOptions          run_opts_;
+  tensorflow::RunOptions          trace_run_opts_;
   tensorflow::SavedModelBundle    model_bundle_;
 
   TF2ModelMeta tf_model_meta_;
+
+  // Executor and names are resolved once in MakeCallable, not on every run
+  bool                                     has_callable_;
+  tensorflow::Session::CallableHandle      callable_;
+  absl::flat_hash_map<std::string, size_t> feed_indices_;
+
+  // Picks the requests run with trace_run_opts_
+  TraceSampler trace_sampler_;
+
+  // Serves infer_async, stopped first on destruction
+  CompletionQueue completion_queue_;
 };
 
 class TF2EngineFactory : public EngineFactory {
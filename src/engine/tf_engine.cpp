@@ -2,30 +2,106 @@
 
 #include "model_server/src/engine/tf_engine.h"
 
-#include <fstream>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include "absl/log/log.h"
 #include "absl/cleanup/cleanup.h"
+#include "absl/time/clock.h"
+#include "absl/container/inlined_vector.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
 #include "tensorflow/c/c_api.h"
+#include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/protobuf/config.pb.h"
+#include "model_server/src/util/os/resource_used.h"
+#include "model_server/src/engine/tf_graph_pruner.h"
+#include "model_server/src/engine/live_engines.h"
+#include "model_server/src/engine/tracer.h"
 
 namespace model_server {
 
+static TF_DataType to_tf_data_type(DataType data_type) noexcept(false) {
+  switch (data_type) {
+    case DataType::kFloat:    return TF_FLOAT;
+    case DataType::kInt32:    return TF_INT32;
+    case DataType::kInt64:    return TF_INT64;
+    case DataType::kHalf:     return TF_HALF;
+    case DataType::kBFloat16: return TF_BFLOAT16;
+    case DataType::kBool:     return TF_BOOL;
+  }
+  const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+    + "Unsupported data type " + data_type_name(data_type);
+  throw std::runtime_error(err_msg);
+}
+
+static DataType from_tf_data_type(TF_DataType tf_data_type) noexcept(false) {
+  switch (tf_data_type) {
+    case TF_FLOAT:    return DataType::kFloat;
+    case TF_INT32:    return DataType::kInt32;
+    case TF_INT64:    return DataType::kInt64;
+    case TF_HALF:     return DataType::kHalf;
+    case TF_BFLOAT16: return DataType::kBFloat16;
+    case TF_BOOL:     return DataType::kBool;
+    default:          break;
+  }
+  const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+    + "Unsupported TF data type " + std::to_string(static_cast<int32_t>(tf_data_type));
+  throw std::runtime_error(err_msg);
+}
+
+TFRunContext::TFRunContext(size_t num_inputs, size_t num_outputs) noexcept(false) :
+  status(TF_NewStatus()),
+  input_tensors(num_inputs, nullptr),
+  output_tensors(num_outputs, nullptr),
+  input_shells(num_inputs) {
+}
+
+TFRunContext::~TFRunContext() {
+  for (auto& input_shell : input_shells) {
+    if (nullptr != input_shell.tensor) {
+      TF_DeleteTensor(input_shell.tensor);
+    }
+  }
+  for (auto& output_tensor : output_tensors) {
+    if (nullptr != output_tensor) {
+      TF_DeleteTensor(output_tensor);
+    }
+  }
+  TF_DeleteStatus(status);
+}
+
+// Run handler priority by Priority, TF hands inter-op threads to the highest priority first
+static const int64_t kRunHandlerPriorities[kNumPriorities] = {2, 1, 0};
+
 TFEngine::TFEngine(const EngineConf& engine_conf) noexcept(false) :
   Engine(engine_conf),
   // engine_mtx_(),
+  load_rss_mb_(0.0),
+  load_time_(),
+  graph_file_(),
   graph_buffer_(nullptr),
   graph_(nullptr),
   session_opts_(nullptr),
   session_(nullptr),
-  default_run_option_buf_(nullptr),
-  warmup_run_option_buf_(nullptr) {
+  run_option_bufs_(kNumPriorities, nullptr),
+  trace_run_option_bufs_(kNumPriorities, nullptr),
+  warmup_run_option_buf_(nullptr),
+  trace_sampler_(engine_conf.trace_every_n),
+  id_(LiveEngines::acquire()),
+  run_contexts_mtx_(),
+  run_contexts_(),
+  completion_queue_(this, engine_conf) {
 }
 
 TFEngine::~TFEngine() {
+  completion_queue_.stop();
+  // Threads drop their contexts of this engine the next time they create one
+  LiveEngines::release(id_);
   try {
     // std::unique_lock<std::shared_mutex> engine_lock(engine_mtx_);
     inited_ = false;
@@ -70,11 +146,19 @@ TFEngine::~TFEngine() {
       LOG(INFO) << "[" << conf_.brief() << "] Graph buffer deleted";
     }
 
-    if (nullptr != default_run_option_buf_) {
-      TF_DeleteBuffer(default_run_option_buf_);
-      default_run_option_buf_ = nullptr;
-      LOG(INFO) << "[" << conf_.brief() << "] Default run option buffer deleted";
+    for (auto& run_option_buf : run_option_bufs_) {
+      if (nullptr != run_option_buf) {
+        TF_DeleteBuffer(run_option_buf);
+        run_option_buf = nullptr;
+      }
+    }
+    for (auto& run_option_buf : trace_run_option_bufs_) {
+      if (nullptr != run_option_buf) {
+        TF_DeleteBuffer(run_option_buf);
+        run_option_buf = nullptr;
+      }
     }
+    LOG(INFO) << "[" << conf_.brief() << "] Run option buffers deleted";
     if (nullptr != warmup_run_option_buf_) {
       TF_DeleteBuffer(warmup_run_option_buf_);
       warmup_run_option_buf_ = nullptr;
@@ -92,42 +176,23 @@ std::string TFEngine::brand() noexcept {
 }
 
 void TFEngine::instance_to_tensor(
-  Instance *instance, std::vector<TF_Tensor*> *input_tensors
+  Instance *instance, std::vector<TF_Tensor*> *input_tensors, std::vector<TFTensorShell> *input_shells
 ) {
   for (auto& feature : instance->features) {
-    const std::string& feature_name = feature.name;
-    const auto it = tf_model_meta_.input_metas.find(feature_name);
+    const auto it = tf_model_meta_.input_metas.find(feature.name);
     if (tf_model_meta_.input_metas.end() != it) {
-      const auto& tensor_num_dims  = it->second.num_dims;
-      const auto& tensor_data_type = it->second.data_type;
-
-      size_t tensor_data_size = it->second.instance_size * static_cast<size_t>(feature.batch_size);
-      DLOG(INFO) << "index: " << it->second.index << ", tensor_data_size: " << tensor_data_size
-                 << ", batch_size: " << feature.batch_size
-                 << ", tensor_num_dims: " << tensor_num_dims
-                 << ", feature_data_size: " << feature.data.size() * sizeof(feature.data[0]);
-      if (feature.data.size() * sizeof(feature.data[0]) != tensor_data_size) {
-        const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
-          + conf_.brief() + "] " + "Feature data size mismatch: " + feature_name;
-        throw std::runtime_error(err_msg);
-      }
-      std::vector<int64_t> tensor_shape = it->second.shape;
-      tensor_shape[0] = feature.batch_size;
-      void *feature_value = static_cast<void *>(feature.data.data());
-
-      TF_Tensor *tf_tensor = TF_NewTensor(
-        tensor_data_type, tensor_shape.data(), tensor_num_dims, feature_value, tensor_data_size,
-        [](void*, size_t, void*) {}, nullptr
+      const auto index = it->second.index;
+      (*input_tensors)[index] = feature_to_tensor(
+        &feature, it->second, nullptr == input_shells ? nullptr : &((*input_shells)[index])
       );  // NOLINT
-      (*input_tensors)[it->second.index] = tf_tensor;
     } else {
-      DLOG(INFO) << "Feature not found: " << feature_name;
+      DLOG(INFO) << "Feature not found: " << feature.name;
     }
   }
 }
 
 void TFEngine::score_from_tensor(
-  const std::vector<TF_Tensor*>& output_tensors, Score *score
+  std::vector<TF_Tensor*> *output_tensors, Score *score
 ) {
   // Convert TF_Output and TF_Tensor to BatchScore
   // score->targets.resize(tf_model_meta_.output_specs.size());
@@ -146,49 +211,130 @@ void TFEngine::score_from_tensor(
       //   + conf_.brief() + "] " + "Output not found: " + target.name;
       // throw std::runtime_error(err_msg);
     }
-    // assert(it->second.data_size == sizeof(*target.data.data())
-    const size_t data_size = it->second.instance_size * target.batch_size;
-    char *data = static_cast<char*>(TF_TensorData(output_tensors[it->second.index]));
-    target.data.resize(data_size / it->second.data_size);
-    memcpy(target.data.data(), data, data_size);
+    target_from_tensor(&((*output_tensors)[it->second.index]), it->second, &target);
   }
 }
 
-void TFEngine::warmup(Instance *instance, Score *score) noexcept(false) {
-  // std::shared_lock<std::shared_mutex> engine_lock(engine_mtx_);
-  if (!inited_) {
+void TFEngine::bound_instance_to_tensor(
+  Instance *instance, std::vector<TF_Tensor*> *input_tensors, std::vector<TFTensorShell> *input_shells
+) {
+  // Checked by the caller against the signature, names included
+  for (size_t i = 0; i < instance->features.size(); ++i) {
+    (*input_tensors)[i] = feature_to_tensor(
+      &(instance->features[i]), tf_model_meta_.input_slots[i], nullptr == input_shells ? nullptr : &((*input_shells)[i])
+    );  // NOLINT
+  }
+}
+
+void TFEngine::bound_score_from_tensor(
+  std::vector<TF_Tensor*> *output_tensors, Score *score
+) {
+  if (score->targets.size() != tf_model_meta_.output_slots.size()) {
     const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
-      + conf_.brief() + "] " + "Engine not initialized";
+      + conf_.brief() + "] " + absl::StrFormat(
+        "Bound target size mismatch: %d != %d", score->targets.size(), tf_model_meta_.output_slots.size()
+    );  // NOLINT
     throw std::runtime_error(err_msg);
   }
+  for (size_t i = 0; i < score->targets.size(); ++i) {
+    target_from_tensor(&((*output_tensors)[i]), tf_model_meta_.output_slots[i], &(score->targets[i]));
+  }
+}
 
-  // Convert BatchInstance to TF_Output and TF_Tensor
-  std::vector<TF_Tensor*> input_tensors;
-  input_tensors.resize(tf_model_meta_.input_specs.size(), nullptr);
-  auto input_tensors_cleanup = absl::MakeCleanup([&input_tensors]() {
-    for (auto& input_tensor : input_tensors) {
-      if (nullptr != input_tensor) {
-        TF_DeleteTensor(input_tensor);
-      }
-    }
-  });
+TF_Tensor *TFEngine::feature_to_tensor(
+  Tensor *feature, const TFTensorMeta& tf_tensor_meta, TFTensorShell *input_shell
+) {  // NOLINT
+  const auto& tensor_num_dims  = tf_tensor_meta.num_dims;
+  const auto& tensor_data_type = tf_tensor_meta.data_type;
+  if (to_tf_data_type(feature->dtype) != tensor_data_type) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Feature data type mismatch: " + feature->name + " is "
+      + data_type_name(feature->dtype) + ", graph wants " + std::to_string(static_cast<int32_t>(tensor_data_type));
+    throw std::runtime_error(err_msg);
+  }
 
-  std::vector<TF_Tensor*> output_tensors;
-  output_tensors.resize(tf_model_meta_.output_specs.size(), nullptr);
-  auto output_tensor_cleanup = absl::MakeCleanup([&output_tensors]() {
-    for (auto& output_tensor : output_tensors) {
-      if (nullptr != output_tensor) {
-        TF_DeleteTensor(output_tensor);
+  size_t tensor_data_size = tf_tensor_meta.instance_size * static_cast<size_t>(feature->batch_size);
+  absl::InlinedVector<int64_t, 8> tensor_shape(tf_tensor_meta.shape.begin(), tf_tensor_meta.shape.end());
+  tensor_shape[0] = feature->batch_size;
+  // Graph inputs are dense, a ragged feature is padded to the width of its input in a tensor TF owns.
+  // The caller's feature is left as it came, and a shell never feeds such a tensor again.
+  if (feature->ragged()) {
+    check_ragged(*feature);
+    TF_Tensor *tensor = TF_AllocateTensor(tensor_data_type, tensor_shape.data(), tensor_num_dims, tensor_data_size);
+    const int64_t row_width = tf_tensor_meta.instance_size / tf_tensor_meta.data_size;
+    densify(*feature, row_width, static_cast<char*>(TF_TensorData(tensor)));
+    if (nullptr != input_shell) {
+      if (nullptr != input_shell->tensor) {
+        TF_DeleteTensor(input_shell->tensor);
       }
+      input_shell->tensor = tensor;
+      input_shell->data = nullptr;
+      input_shell->size = tensor_data_size;
+      input_shell->batch_size = feature->batch_size;
     }
-  });
+    return tensor;
+  }
 
-  instance_to_tensor(instance, &input_tensors);
-  run_session(&input_tensors, &output_tensors, warmup_run_option_buf_);
-  score_from_tensor(output_tensors, score);
+  DLOG(INFO) << "index: " << tf_tensor_meta.index << ", tensor_data_size: " << tensor_data_size
+             << ", batch_size: " << feature->batch_size
+             << ", tensor_num_dims: " << tensor_num_dims
+             << ", feature_data_size: " << feature->data.size();
+  if (feature->data.size() != tensor_data_size) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Feature data size mismatch: " + feature->name;
+    throw std::runtime_error(err_msg);
+  }
+  void *feature_value = static_cast<void *>(feature->data.data());
+  // The shell only wraps the buffer, so a buffer fed again, e.g. of a pooled sample, needs no new tensor
+  if (nullptr != input_shell && nullptr != input_shell->tensor && feature_value == input_shell->data
+    && tensor_data_size == input_shell->size && feature->batch_size == input_shell->batch_size) {
+    return input_shell->tensor;
+  }
+
+  TF_Tensor *tensor = TF_NewTensor(
+    tensor_data_type, tensor_shape.data(), tensor_num_dims, feature_value, tensor_data_size,
+    [](void*, size_t, void*) {}, nullptr
+  );  // NOLINT
+  if (nullptr == input_shell) {
+    return tensor;
+  }
+
+  if (nullptr != input_shell->tensor) {
+    TF_DeleteTensor(input_shell->tensor);
+  }
+  input_shell->tensor = tensor;
+  // TF copies a buffer it can not align, such a tensor does not follow the buffer and is never fed again
+  const bool wrapped = nullptr != tensor && TF_TensorData(tensor) == feature_value;
+  input_shell->data = wrapped ? static_cast<const char*>(feature_value) : nullptr;
+  input_shell->size = tensor_data_size;
+  input_shell->batch_size = feature->batch_size;
+  return tensor;
 }
 
-void TFEngine::infer(Instance *instance, Score *score) noexcept(false) {
+void TFEngine::target_from_tensor(TF_Tensor **output_tensor, const TFTensorMeta& tf_tensor_meta, Tensor *target) {
+  const size_t data_size = tf_tensor_meta.instance_size * target->batch_size;
+  char *data = static_cast<char*>(TF_TensorData(*output_tensor));
+  const size_t tensor_byte_size = TF_TensorByteSize(*output_tensor);
+  if (tensor_byte_size < data_size) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + absl::StrFormat(
+        "Output %s holds %d bytes, %d rows need %d", target->name, tensor_byte_size, target->batch_size, data_size
+    );  // NOLINT
+    throw std::runtime_error(err_msg);
+  }
+  target->dtype = from_tf_data_type(tf_tensor_meta.data_type);
+  // TF aligns to EIGEN_MAX_ALIGN_BYTES, which may be less than targets promise
+  if (!conf_.zero_copy_output || 0 != reinterpret_cast<uintptr_t>(data) % kTensorAlignment) {
+    target->data.assign(data, data_size);
+    return;
+  }
+  target->data.adopt(data, data_size, tensor_byte_size, [](void *tensor) noexcept {
+    TF_DeleteTensor(static_cast<TF_Tensor*>(tensor));
+  }, *output_tensor);
+  *output_tensor = nullptr;
+}
+
+void TFEngine::warmup(Instance *instance, Score *score) noexcept(false) {
   // std::shared_lock<std::shared_mutex> engine_lock(engine_mtx_);
   if (!inited_) {
     const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
@@ -218,11 +364,19 @@ void TFEngine::infer(Instance *instance, Score *score) noexcept(false) {
   });
 
   instance_to_tensor(instance, &input_tensors);
-  run_session(&input_tensors, &output_tensors, default_run_option_buf_);
-  score_from_tensor(output_tensors, score);
+  run_session(&input_tensors, &output_tensors, warmup_run_option_buf_);
+  score_from_tensor(&output_tensors, score);
 }
 
-void TFEngine::trace(Instance *instance, Score *score) noexcept(false) {
+void TFEngine::infer(Instance *instance, Score *score) noexcept(false) {
+  infer(instance, score, Priority::kNormal);
+}
+
+void TFEngine::infer_bound(Instance *instance, Score *score) noexcept(false) {
+  infer_bound(instance, score, Priority::kNormal);
+}
+
+void TFEngine::infer(Instance *instance, Score *score, Priority priority) noexcept(false) {
   // std::shared_lock<std::shared_mutex> engine_lock(engine_mtx_);
   if (!inited_) {
     const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
@@ -230,60 +384,127 @@ void TFEngine::trace(Instance *instance, Score *score) noexcept(false) {
     throw std::runtime_error(err_msg);
   }
 
-  tensorflow::RunOptions tf_run_opts;
-  tf_run_opts.set_trace_level(tensorflow::RunOptions_TraceLevel_FULL_TRACE);
-  std::string tf_run_opts_str;
-  tf_run_opts.SerializeToString(&tf_run_opts_str);
-  TF_Buffer *tf_run_opts_data = TF_NewBufferFromString(
-    reinterpret_cast<void*>(tf_run_opts_str.data()), tf_run_opts_str.size()
-  );  // NOLINT
-  auto tf_run_opts_data_cleanup = absl::MakeCleanup([&tf_run_opts_data]() { TF_DeleteBuffer(tf_run_opts_data); });
+  run_with_context(instance, score, false, trace_sampler_.sample(), priority);
+}
 
-  TF_Buffer *tf_metadata = TF_NewBuffer();
-  auto tf_metadata_cleanup = absl::MakeCleanup([&tf_metadata]() { TF_DeleteBuffer(tf_metadata); });
+void TFEngine::infer_bound(Instance *instance, Score *score, Priority priority) noexcept(false) {
+  if (!inited_) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Engine not initialized";
+    throw std::runtime_error(err_msg);
+  }
 
-  std::vector<TF_Tensor*> input_tensors;
-  input_tensors.resize(tf_model_meta_.input_specs.size(), nullptr);
-  auto input_tensors_cleanup = absl::MakeCleanup([&input_tensors]() {
-    for (auto& input_tensor : input_tensors) {
-      if (nullptr != input_tensor) {
-        TF_DeleteTensor(input_tensor);
-      }
-    }
-  });
+  // Slots follow the index of the specs, so tensors are placed without any name lookup
+  run_with_context(instance, score, true, trace_sampler_.sample(), priority);
+}
 
-  std::vector<TF_Tensor*> output_tensors;
-  output_tensors.resize(tf_model_meta_.output_specs.size(), nullptr);
+void TFEngine::run_with_context(
+  Instance *instance, Score *score, bool bound, bool traced, Priority priority
+) noexcept(false) {  // NOLINT
+  const int32_t priority_index = static_cast<int32_t>(priority);
+  if (priority_index < 0 || priority_index >= kNumPriorities) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Unknown priority " + std::to_string(priority_index);
+    throw std::runtime_error(err_msg);
+  }
+  TFRunContext *run_context = this->run_context();
+  auto& input_tensors = run_context->input_tensors;
+  auto& output_tensors = run_context->output_tensors;
+  // Input tensors stay with the shells, outputs are TF's and handed back after every run
+  std::fill(input_tensors.begin(), input_tensors.end(), nullptr);
   auto output_tensors_cleanup = absl::MakeCleanup([&output_tensors]() {
     for (auto& output_tensor : output_tensors) {
       if (nullptr != output_tensor) {
         TF_DeleteTensor(output_tensor);
+        output_tensor = nullptr;
       }
     }
   });
 
-  instance_to_tensor(instance, &input_tensors);
-  run_session(&input_tensors, &output_tensors, tf_run_opts_data, tf_metadata);
-  score_from_tensor(output_tensors, score);
+  if (bound) {
+    check_bound_sample(*instance, *score);
+    bound_instance_to_tensor(instance, &input_tensors, &(run_context->input_shells));
+  } else {
+    instance_to_tensor(instance, &input_tensors, &(run_context->input_shells));
+  }
+  if (!traced) {
+    run_session(&input_tensors, &output_tensors, run_option_bufs_[priority_index], nullptr, run_context->status);
+  } else {
+    TF_Buffer *tf_metadata = TF_NewBuffer();
+    auto tf_metadata_cleanup = absl::MakeCleanup([&tf_metadata]() { TF_DeleteBuffer(tf_metadata); });
+    run_session(
+      &input_tensors, &output_tensors, trace_run_option_bufs_[priority_index], tf_metadata, run_context->status
+    );  // NOLINT
+    // The flusher writes it out, the request only pays for the copy
+    Tracer::instance()->submit(std::unique_ptr<TraceRecord>(new TraceRecord{
+      .model = conf_.brief(),
+      .extension = "pb",
+      .payload = std::string(static_cast<const char*>(tf_metadata->data), tf_metadata->length)
+    }));
+  }
+  if (bound) {
+    bound_score_from_tensor(&output_tensors, score);
+  } else {
+    score_from_tensor(&output_tensors, score);
+  }
+}
+
+TFRunContext *TFEngine::run_context() noexcept(false) {
+  // Contexts are owned by their engine, entries of destroyed engines are pruned where the map grows
+  static thread_local absl::flat_hash_map<uint64_t, TFRunContext*> run_contexts;
+  auto it = run_contexts.find(id_);
+  if (run_contexts.end() != it) {
+    return it->second;
+  }
+  LiveEngines::prune(&run_contexts);
+
+  auto run_context = std::make_unique<TFRunContext>(
+    tf_model_meta_.input_specs.size(), tf_model_meta_.output_specs.size()
+  );  // NOLINT
+  TFRunContext *ptr = run_context.get();
+  {
+    std::lock_guard<std::mutex> lock(run_contexts_mtx_);
+    run_contexts_.push_back(std::move(run_context));
+  }
+  run_contexts.emplace(id_, ptr);
+  return ptr;
+}
+
+void TFEngine::trace(Instance *instance, Score *score) noexcept(false) {
+  // std::shared_lock<std::shared_mutex> engine_lock(engine_mtx_);
+  if (!inited_) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Engine not initialized";
+    throw std::runtime_error(err_msg);
+  }
 
-  static std::mutex trace_data_mtx;
-  static std::atomic<int> trace_data_index = 0;
-  std::lock_guard<std::mutex> lock(trace_data_mtx);
-  trace_data_index.fetch_add(1);
-  std::string trace_data_str(reinterpret_cast<const char*>(tf_metadata->data), tf_metadata->length);
-  std::ofstream ofs("trace_data_" + std::to_string(trace_data_index.load()) + ".pb");
-  ofs << trace_data_str;
-  ofs.close();
+  run_with_context(instance, score, false, true, Priority::kNormal);
+}
+
+void TFEngine::infer_async(
+  Instance *instance, Score *score, InferCallback callback, Priority priority
+) noexcept(false) {  // NOLINT
+  completion_queue_.push(instance, score, std::move(callback), priority);
 }
 
 void TFEngine::run_session(
   std::vector<TF_Tensor*> *input_tensors,
   std::vector<TF_Tensor*> *output_tensors,
   TF_Buffer *tf_run_opts,
-  TF_Buffer *tf_metadata
+  TF_Buffer *tf_metadata,
+  TF_Status *tf_status
 ) {
-  TF_Status *tf_status = TF_NewStatus();
-  auto tf_status_cleanup = absl::MakeCleanup([&tf_status]() { TF_DeleteStatus(tf_status); });
+  TF_Status *own_tf_status = nullptr == tf_status ? TF_NewStatus() : nullptr;
+  auto tf_status_cleanup = absl::MakeCleanup([&own_tf_status]() {
+    if (nullptr != own_tf_status) {
+      TF_DeleteStatus(own_tf_status);
+    }
+  });
+  if (nullptr == tf_status) {
+    tf_status = own_tf_status;
+  } else {
+    TF_SetStatus(tf_status, TF_OK, "");
+  }
 
   TF_SessionRun(
     session_, tf_run_opts,
@@ -300,35 +521,62 @@ void TFEngine::run_session(
 }
 
 void TFEngine::load() {
+  ResourceUsed resource_used;
+  load_rss_mb_ = get_process_resource_used(&resource_used) ? resource_used.resident_mb : 0.0;
+  load_time_ = absl::Now();
+
   const std::string& graph_file = conf_.graph_file_loc;
-  std::ifstream file(graph_file, std::ios::binary | std::ios::ate);
-  if (!file.is_open()) {
+  // Mapped instead of read into the heap, so the file is not held twice while it is imported
+  if (!graph_file_.open(graph_file)) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Failed to map graph file: " + graph_file + ", " + strerror(errno);
+    throw std::runtime_error(err_msg);
+  }
+  graph_file_.advise_sequential();
+  LOG(INFO) << "[" << conf_.brief() << "] Graph file mapped: " << graph_file << ", " << graph_file_.size() << " bytes";
+
+  if (conf_.tf_prune_graph) {
+    prune();
+    return;
+  }
+
+  // The mapping owns the bytes, the buffer only points into it
+  graph_buffer_ = TF_NewBuffer();
+  graph_buffer_->data = graph_file_.data();
+  graph_buffer_->length = graph_file_.size();
+  graph_buffer_->data_deallocator = nullptr;
+}
+
+void TFEngine::prune() {
+  tensorflow::GraphDef graph_def;
+  if (graph_file_.size() > static_cast<size_t>(INT32_MAX)
+    || !graph_def.ParseFromArray(graph_file_.data(), static_cast<int32_t>(graph_file_.size()))) {
     const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
-      + conf_.brief() + "] " + "Failed to open graph file: " + graph_file;
+      + conf_.brief() + "] " + "Failed to parse graph file: " + conf_.graph_file_loc;
     throw std::runtime_error(err_msg);
   }
-  auto file_cleanup = absl::MakeCleanup([&file]() { file.close(); });
+  graph_file_.release_pages();
+  graph_file_.close();
 
-  std::streamsize size = file.tellg();
-  file.seekg(0, std::ios::beg);
+  TFGraphPruneReport report;
+  prune_graph(conf_.input_nodes, conf_.output_nodes, &graph_def, &report);
+  LOG(INFO) << "[" << conf_.brief() << "] Graph pruned, " << report.detail();
 
+  const size_t size = graph_def.ByteSizeLong();
   char *buffer_data = new char[size];
-  if (!file.read(buffer_data, size)) {
+  if (!graph_def.SerializeToArray(buffer_data, static_cast<int32_t>(size))) {
     delete[] buffer_data;
 
     const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
-      + conf_.brief() + "] " + "Failed to read graph file: " + graph_file;
+      + conf_.brief() + "] " + "Failed to serialize pruned graph";
     throw std::runtime_error(err_msg);
   }
-
-  graph_buffer_ = new TF_Buffer();
+  graph_buffer_ = TF_NewBuffer();
   graph_buffer_->data = buffer_data;
   graph_buffer_->length = size;
   graph_buffer_->data_deallocator = [](void *data, size_t length) {
     delete[] static_cast<char*>(data);
   };
-
-  LOG(INFO) << "[" << conf_.brief() << "] Graph file loaded: " << graph_file;
 }
 
 void TFEngine::build() {
@@ -347,6 +595,12 @@ void TFEngine::build() {
     throw std::runtime_error(err_msg);
   }
 
+  // The graph holds its own copy now, hand the pages of the file back
+  TF_DeleteBuffer(graph_buffer_);
+  graph_buffer_ = nullptr;
+  graph_file_.release_pages();
+  graph_file_.close();
+
   LOG(INFO) << "[" << conf_.brief() << "] Graph imported";
 }
 
@@ -421,15 +675,29 @@ void TFEngine::set_session_options() {
 
   tensorflow::RunOptions default_run_opt;
   default_run_opt.mutable_experimental()->set_use_run_handler_pool(true);
-  default_run_opt.mutable_experimental()->mutable_run_handler_pool_options()->set_priority(1);
+  default_run_opt.mutable_experimental()->mutable_run_handler_pool_options()->set_priority(
+    kRunHandlerPriorities[static_cast<int32_t>(Priority::kNormal)]
+  );  // NOLINT
   if (conf_.use_global_thread_pool) {
     default_run_opt.set_inter_op_thread_pool(1);
   }
   std::string default_run_opt_str;
-  default_run_opt.SerializeToString(&default_run_opt_str);
-  default_run_option_buf_ = TF_NewBufferFromString(
-    static_cast<void*>(default_run_opt_str.data()), default_run_opt_str.size()
-  );  // NOLINT
+  for (int32_t i = 0; i < kNumPriorities; ++i) {
+    // The run handler pool serves the inter-op work of every run, a higher priority gets its threads first
+    tensorflow::RunOptions run_opt = default_run_opt;
+    run_opt.mutable_experimental()->mutable_run_handler_pool_options()->set_priority(kRunHandlerPriorities[i]);
+    run_opt.SerializeToString(&default_run_opt_str);
+    run_option_bufs_[i] = TF_NewBufferFromString(
+      static_cast<void*>(default_run_opt_str.data()), default_run_opt_str.size()
+    );  // NOLINT
+
+    // Sampled requests run like the others, only fully traced
+    run_opt.set_trace_level(tensorflow::RunOptions_TraceLevel_FULL_TRACE);
+    run_opt.SerializeToString(&default_run_opt_str);
+    trace_run_option_bufs_[i] = TF_NewBufferFromString(
+      static_cast<void*>(default_run_opt_str.data()), default_run_opt_str.size()
+    );  // NOLINT
+  }
 
   LOG(INFO) << "[" << conf_.brief() << "] Session options set";
 
@@ -464,6 +732,12 @@ void TFEngine::create_session() {
   }
 
   LOG(INFO) << "[" << conf_.brief() << "] Session created";
+
+  // Compare runs with and without tf_prune_graph to see what pruning saves
+  ResourceUsed resource_used;
+  const double rss_mb = get_process_resource_used(&resource_used) ? resource_used.resident_mb : 0.0;
+  LOG(INFO) << "[" << conf_.brief() << "] Startup took " << absl::ToInt64Milliseconds(absl::Now() - load_time_)
+            << " ms, RSS " << load_rss_mb_ << " -> " << rss_mb << " MB";
 }
 
 void TFEngine::sub_init() {
@@ -489,6 +763,24 @@ void TFEngine::sub_init() {
     tf_model_meta_.output_specs[tensor_info.second.index] = (*(tensor_info.second.output));
   }
 
+  // Bind the signature in spec order, slot i feeds input_specs[i] and reads output_specs[i]
+  tf_model_meta_.input_slots.resize(tf_model_meta_.input_metas.size());
+  signature_.input_names.resize(tf_model_meta_.input_metas.size());
+  signature_.input_data_types.resize(tf_model_meta_.input_metas.size());
+  for (const auto& tensor_info : tf_model_meta_.input_metas) {
+    const int32_t slot = tensor_info.second.index;
+    tf_model_meta_.input_slots[slot] = tensor_info.second;
+    signature_.input_names[slot] = tensor_info.first;
+    signature_.input_data_types[slot] = from_tf_data_type(tensor_info.second.data_type);
+  }
+  tf_model_meta_.output_slots.resize(tf_model_meta_.output_metas.size());
+  signature_.output_names.resize(tf_model_meta_.output_metas.size());
+  for (const auto& tensor_info : tf_model_meta_.output_metas) {
+    const int32_t slot = tensor_info.second.index;
+    tf_model_meta_.output_slots[slot] = tensor_info.second;
+    signature_.output_names[slot] = tensor_info.first;
+  }
+
   LOG(INFO) << tf_model_meta_.to_string();
 }
 
@@ -588,6 +880,20 @@ void TFEngine::get_input_name_and_shape(
   }
 }
 
+void TFEngine::get_input_name_and_data_type(
+  absl::flat_hash_map<std::string, DataType> *input_data_types
+) {
+  if (nullptr == input_data_types) {
+    std::string err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Input data types is nullptr";
+    throw std::runtime_error(err_msg);
+  }
+
+  for (const auto& tensor_info : tf_model_meta_.input_metas) {
+    (*input_data_types)[tensor_info.first] = from_tf_data_type(tensor_info.second.data_type);
+  }
+}
+
 void TFEngine::get_output_name_and_shape(
   absl::flat_hash_map<std::string, std::vector<int64_t>> *output_shapes
 ) {
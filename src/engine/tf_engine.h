@@ -9,10 +9,15 @@
 #include <string>
 #include <functional>
 #include <shared_mutex>
+#include <mutex>  // NOLINT
 #include "absl/container/flat_hash_map.h"
+#include "absl/time/time.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow/c/c_api.h"
+#include "model_server/src/util/os/mapped_file.h"
 #include "model_server/src/engine/engine.h"
+#include "model_server/src/engine/completion_queue.h"
+#include "model_server/src/engine/tracer.h"
 
 namespace model_server {
 
@@ -39,10 +44,37 @@ struct TFModelMeta {
   absl::flat_hash_map<std::string, TFTensorMeta> output_metas;
   std::vector<TF_Output> input_specs;
   std::vector<TF_Output> output_specs;
+  // Metas by slot of the bound signature, which is their index
+  std::vector<TFTensorMeta> input_slots;
+  std::vector<TFTensorMeta> output_slots;
 
   std::string to_string();
 };
 
+// An input tensor wrapping a caller buffer, fed again as long as the slot sees the same buffer
+struct TFTensorShell {
+  TF_Tensor  *tensor     = nullptr;
+  const char *data       = nullptr;
+  size_t      size       = 0;
+  int64_t     batch_size = 0;
+};
+
+// What one thread needs to run one engine, kept between calls so small batches do not pay for
+// creating a status, the tensor arrays and the input tensors every time
+struct TFRunContext {
+  TF_Status                 *status;
+  std::vector<TF_Tensor*>    input_tensors;
+  std::vector<TF_Tensor*>    output_tensors;
+  std::vector<TFTensorShell> input_shells;
+
+  TFRunContext(size_t num_inputs, size_t num_outputs) noexcept(false);
+  virtual ~TFRunContext();
+
+  TFRunContext() = delete;
+  TFRunContext& operator=(const TFRunContext&) = delete;
+  TFRunContext(const TFRunContext&) = delete;
+};
+
 class TFEngine : public Engine {
  public:
   explicit TFEngine(const EngineConf& engine_conf) noexcept(false);
@@ -61,9 +93,22 @@ class TFEngine : public Engine {
   // Perform inference using the TF runtime
   void infer(Instance *instance, Score *score) noexcept(false) override;
 
+  // Perform inference on a bound sample using the TF runtime
+  void infer_bound(Instance *instance, Score *score) noexcept(false) override;
+
+  // Perform inference with the run handler priority of the class
+  void infer(Instance *instance, Score *score, Priority priority) noexcept(false) override;
+  void infer_bound(Instance *instance, Score *score, Priority priority) noexcept(false) override;
+
   // Perform inference with trace using the TF runtime
   void trace(Instance *instance, Score *score) noexcept(false) override;
 
+  // Queued on the completion queue, the TF C API has no asynchronous run
+  void infer_async(
+    Instance *instance, Score *score, InferCallback callback, Priority priority = Priority::kNormal
+  ) noexcept(false) override;  // NOLINT
+  using Engine::infer_async;
+
   // Get input name and shape
   void get_input_name_and_shape(
     absl::flat_hash_map<std::string, std::vector<int64_t>> *input_shapes
@@ -74,6 +119,11 @@ class TFEngine : public Engine {
     absl::flat_hash_map<std::string, std::vector<int64_t>> *output_shapes
   ) noexcept(false) override;  // NOLINT
 
+  // Get input name and data type
+  void get_input_name_and_data_type(
+    absl::flat_hash_map<std::string, DataType> *input_data_types
+  ) noexcept(false) override;  // NOLINT
+
  protected:
   // Load the TensorFlow graph from the .pb file
   void load() override;
@@ -91,12 +141,23 @@ class TFEngine : public Engine {
   // Sub initialization
   void sub_init() override;
 
-  // Run session
+  // Parse the mapped graph, prune it and import the pruned copy instead
+  void prune() noexcept(false);
+
+  // Run session, a status is created for the call unless one is given
   void run_session(
     std::vector<TF_Tensor*> *input_tensors, std::vector<TF_Tensor*> *output_tensors,
-    TF_Buffer *tf_run_opts = nullptr, TF_Buffer *tf_metadata = nullptr
+    TF_Buffer *tf_run_opts = nullptr, TF_Buffer *tf_metadata = nullptr, TF_Status *tf_status = nullptr
   );  // NOLINT
 
+  // Run context of the calling thread, created on its first call
+  TFRunContext *run_context() noexcept(false);
+  // Run with the context of the calling thread, bound or by name. A traced run hands its
+  // RunMetadata to the tracer.
+  void run_with_context(
+    Instance *instance, Score *score, bool bound, bool traced, Priority priority
+  ) noexcept(false);  // NOLINT
+
   // Iterate through the operations in the graph
   void iterate_through_operations(std::function<void(TF_Operation*)> do_something_with_operation);
 
@@ -118,11 +179,26 @@ class TFEngine : public Engine {
   // Print graph information
   // void print_graph_info();
 
+  // Input tensors go to the shells when given, which then own them
   void instance_to_tensor(
-    Instance *instance, std::vector<TF_Tensor*> *input_tensors
+    Instance *instance, std::vector<TF_Tensor*> *input_tensors, std::vector<TFTensorShell> *input_shells = nullptr
   ) noexcept(false);  // NOLINT
+  // Output tensors a target adopts are taken out of the vector
   void score_from_tensor(
-    const std::vector<TF_Tensor*>& output_tensors, Score *score
+    std::vector<TF_Tensor*> *output_tensors, Score *score
+  ) noexcept(false);  // NOLINT
+  void bound_instance_to_tensor(
+    Instance *instance, std::vector<TF_Tensor*> *input_tensors, std::vector<TFTensorShell> *input_shells = nullptr
+  ) noexcept(false);  // NOLINT
+  void bound_score_from_tensor(
+    std::vector<TF_Tensor*> *output_tensors, Score *score
+  ) noexcept(false);  // NOLINT
+  TF_Tensor *feature_to_tensor(
+    Tensor *feature, const TFTensorMeta& tf_tensor_meta, TFTensorShell *input_shell = nullptr
+  ) noexcept(false);  // NOLINT
+  // With zero_copy_output the target adopts the tensor and the slot is set to nullptr
+  void target_from_tensor(
+    TF_Tensor **output_tensor, const TFTensorMeta& tf_tensor_meta, Tensor *target
   ) noexcept(false);  // NOLINT
 
  protected:
@@ -131,12 +207,28 @@ class TFEngine : public Engine {
 
   TFModelMeta tf_model_meta_;
 
+  // Process RSS and time when loading started, startup is reported once the session is up
+  double             load_rss_mb_;
+  absl::Time         load_time_;
+  MappedFile         graph_file_;
   TF_Buffer         *graph_buffer_;
   TF_Graph          *graph_;
   TF_SessionOptions *session_opts_;
   TF_Session        *session_;
-  TF_Buffer         *default_run_option_buf_;
-  TF_Buffer         *warmup_run_option_buf_;
+  // Serialized RunOptions by Priority
+  std::vector<TF_Buffer*> run_option_bufs_;
+  std::vector<TF_Buffer*> trace_run_option_bufs_;
+  TF_Buffer              *warmup_run_option_buf_;
+  // Picks the requests run with trace_run_option_bufs_
+  TraceSampler            trace_sampler_;
+
+  // From LiveEngines, threads key their run contexts by it and prune those of destroyed engines
+  uint64_t                                   id_;
+  std::mutex                                 run_contexts_mtx_;
+  std::vector<std::unique_ptr<TFRunContext>> run_contexts_;
+
+  // Serves infer_async, stopped first on destruction
+  CompletionQueue completion_queue_;
 };
 
 class TFEngineFactory : public EngineFactory {
@@ -0,0 +1,207 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/engine/tf_graph_pruner.h"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/match.h"
+#include "tensorflow/core/framework/attr_value.pb.h"
+#include "tensorflow/core/framework/node_def.pb.h"
+
+namespace model_server {
+
+static const char kColocationAttr[]   = "_class";
+static const char kColocationPrefix[] = "loc:@";
+
+// Output 0 is input 0, whatever else the op does
+static bool is_pass_through(const tensorflow::NodeDef& node) noexcept {
+  const auto& op = node.op();
+  return op == "Identity" || op == "StopGradient" || op == "PreventGradient" || op == "Snapshot"
+    || op == "CheckNumerics" || op == "CheckNumericsV2" || op == "Print" || op == "DebugIdentity";
+}
+
+// No data output, only ever a control input of others
+static bool is_debug_sink(const tensorflow::NodeDef& node) noexcept {
+  const auto& op = node.op();
+  return op == "Assert" || op == "PrintV2";
+}
+
+// Forwards input 0 to one of its two outputs, the other one is dead
+static bool is_switch(const tensorflow::NodeDef& node) noexcept {
+  return node.op() == "Switch" || node.op() == "RefSwitch";
+}
+
+static bool is_control_input(const std::string& input) noexcept {
+  return !input.empty() && '^' == input[0];
+}
+
+// "^name", "name:1" and "name" all name the node "name"
+static std::string node_of(const std::string& input) noexcept(false) {
+  const size_t begin = is_control_input(input) ? 1 : 0;
+  const size_t end = input.find(':', begin);
+  return input.substr(begin, std::string::npos == end ? std::string::npos : end - begin);
+}
+
+void prune_graph(
+  const std::vector<std::string>& input_nodes, const std::vector<std::string>& output_nodes,
+  tensorflow::GraphDef *graph_def, TFGraphPruneReport *report
+) {
+  if (nullptr == graph_def || nullptr == report) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Graph def or report is nullptr";
+    throw std::runtime_error(err_msg);
+  }
+  report->nodes_before = graph_def->node_size();
+  report->bytes_before = static_cast<int64_t>(graph_def->ByteSizeLong());
+
+  absl::flat_hash_map<std::string, int32_t> node_indices;
+  for (int32_t i = 0; i < graph_def->node_size(); ++i) {
+    node_indices[graph_def->node(i).name()] = i;
+  }
+  absl::flat_hash_set<std::string> kept_anyway(input_nodes.begin(), input_nodes.end());
+  kept_anyway.insert(output_nodes.begin(), output_nodes.end());
+  for (const auto& name : kept_anyway) {
+    if (node_indices.end() == node_indices.find(name)) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + "Node not found in graph: " + name;
+      throw std::runtime_error(err_msg);
+    }
+  }
+
+  // Debug sinks go first, so pass through nodes held back by their control edges can go too
+  absl::flat_hash_set<std::string> debug_sinks;
+  for (const auto& node : graph_def->node()) {
+    if (is_debug_sink(node) && !kept_anyway.contains(node.name())) {
+      debug_sinks.insert(node.name());
+    }
+  }
+  // A control edge from a pass through node waits for its input only, never for the node it forwards from
+  absl::flat_hash_set<std::string> control_sources;
+  for (const auto& node : graph_def->node()) {
+    if (debug_sinks.contains(node.name())) {
+      continue;
+    }
+    for (const auto& input : node.input()) {
+      if (is_control_input(input)) {
+        control_sources.insert(node_of(input));
+      }
+    }
+  }
+  // Pass through node by the input it forwards
+  absl::flat_hash_map<std::string, std::string> bypasses;
+  for (const auto& node : graph_def->node()) {
+    if (!is_pass_through(node) || kept_anyway.contains(node.name()) || 0 == node.input_size()
+      || is_control_input(node.input(0)) || control_sources.contains(node.name())) {
+      continue;
+    }
+    // The Identity after a Switch output is what a cond branch hangs its control edges on, a control
+    // edge from the Switch itself would fire on the untaken branch too
+    const auto source = node_indices.find(node_of(node.input(0)));
+    if (node_indices.end() != source && is_switch(graph_def->node(source->second))) {
+      continue;
+    }
+    bool ordered = false;
+    for (int32_t i = 1; i < node.input_size(); ++i) {
+      ordered |= is_control_input(node.input(i)) && !debug_sinks.contains(node_of(node.input(i)));
+    }
+    // Dropping the node would drop the order its control inputs impose
+    if (!ordered) {
+      bypasses[node.name()] = node.input(0);
+    }
+  }
+  auto resolve = [&bypasses, &report](std::string input) {
+    for (int64_t hops = 0; hops <= report->nodes_before; ++hops) {
+      const auto it = bypasses.find(node_of(input));
+      if (bypasses.end() == it) {
+        break;
+      }
+      input = it->second;
+    }
+    return input;
+  };
+
+  for (auto& node : *(graph_def->mutable_node())) {
+    std::vector<std::string> node_inputs;
+    absl::flat_hash_set<std::string> control_inputs;
+    for (const auto& input : node.input()) {
+      if (!is_control_input(input)) {
+        node_inputs.push_back(bypasses.contains(node_of(input)) ? resolve(input) : input);
+        continue;
+      }
+      // Sources of control edges are never bypassed
+      if (debug_sinks.contains(node_of(input))) {
+        continue;
+      }
+      if (control_inputs.insert(input).second) {
+        node_inputs.push_back(input);
+      }
+    }
+    node.clear_input();
+    for (auto& input : node_inputs) {
+      node.add_input(std::move(input));
+    }
+  }
+
+  // Walk up from the outputs. The graph above a fed input is never run, but the import still
+  // needs the nodes the input reads from, so the walk goes on through inputs.
+  absl::flat_hash_set<std::string> reached;
+  std::vector<std::string> pending(output_nodes.begin(), output_nodes.end());
+  pending.insert(pending.end(), input_nodes.begin(), input_nodes.end());
+  while (!pending.empty()) {
+    std::string name = std::move(pending.back());
+    pending.pop_back();
+    if (!reached.insert(name).second) {
+      continue;
+    }
+    const auto it = node_indices.find(name);
+    if (node_indices.end() == it) {
+      continue;
+    }
+    for (const auto& input : graph_def->node(it->second).input()) {
+      pending.push_back(node_of(input));
+    }
+  }
+
+  google::protobuf::RepeatedPtrField<tensorflow::NodeDef> kept_nodes;
+  for (auto& node : *(graph_def->mutable_node())) {
+    if (reached.contains(node.name())) {
+      kept_nodes.Add()->Swap(&node);
+    } else if (bypasses.contains(node.name())) {
+      ++report->identities_removed;
+    } else if (debug_sinks.contains(node.name())) {
+      ++report->debug_removed;
+    } else {
+      ++report->unreachable_removed;
+    }
+  }
+  graph_def->mutable_node()->Swap(&kept_nodes);
+
+  // The import rejects colocation with a node that is gone
+  for (auto& node : *(graph_def->mutable_node())) {
+    auto attr = node.mutable_attr()->find(kColocationAttr);
+    if (node.mutable_attr()->end() == attr) {
+      continue;
+    }
+    auto *locations = attr->second.mutable_list()->mutable_s();
+    for (int32_t i = locations->size() - 1; i >= 0; --i) {
+      const auto& location = locations->Get(i);
+      if (absl::StartsWith(location, kColocationPrefix)
+        && !reached.contains(location.substr(sizeof(kColocationPrefix) - 1))) {
+        locations->DeleteSubrange(i, 1);
+      }
+    }
+    if (locations->empty()) {
+      node.mutable_attr()->erase(attr);
+    }
+  }
+
+  report->nodes_after = graph_def->node_size();
+  report->bytes_after = static_cast<int64_t>(graph_def->ByteSizeLong());
+}
+
+}  // namespace model_server
@@ -0,0 +1,44 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_ENGINE_TF_GRAPH_PRUNER_H_
+#define MODEL_SERVER_SRC_ENGINE_TF_GRAPH_PRUNER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "tensorflow/core/framework/graph.pb.h"
+
+namespace model_server {
+
+struct TFGraphPruneReport {
+  int64_t nodes_before        = 0;
+  int64_t nodes_after         = 0;
+  int64_t bytes_before        = 0;
+  int64_t bytes_after         = 0;
+  int64_t identities_removed  = 0;  // pass through nodes, debug ones included
+  int64_t debug_removed       = 0;  // debug nodes only run for their side effect
+  int64_t unreachable_removed = 0;  // nodes the outputs do not need
+
+  std::string detail() const noexcept {
+    return "nodes: " + std::to_string(nodes_before) + " -> " + std::to_string(nodes_after)
+      + ", bytes: " + std::to_string(bytes_before) + " -> " + std::to_string(bytes_after)
+      + ", identities_removed: " + std::to_string(identities_removed)
+      + ", debug_removed: " + std::to_string(debug_removed)
+      + ", unreachable_removed: " + std::to_string(unreachable_removed);
+  }
+};
+
+// Cut an exported graph down to what serving the outputs from the inputs needs, in place:
+//  - debug nodes only run for their side effect, e.g. Assert and PrintV2, are dropped
+//  - pass through nodes, e.g. Identity, StopGradient and CheckNumerics, are bypassed
+//  - nodes neither the outputs nor the inputs read from are dropped, e.g. training branches
+// Inputs and outputs themselves are always kept. Constants are left to the constant folding
+// of the session optimizer. Throws std::runtime_error if an input or output is not in the graph.
+void prune_graph(
+  const std::vector<std::string>& input_nodes, const std::vector<std::string>& output_nodes,
+  tensorflow::GraphDef *graph_def, TFGraphPruneReport *report
+) noexcept(false);  // NOLINT
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_ENGINE_TF_GRAPH_PRUNER_H_
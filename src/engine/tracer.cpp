@@ -0,0 +1,135 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/engine/tracer.h"
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <exception>
+#include <fstream>
+#include <string>
+#include <utility>
+#include "absl/log/log.h"
+
+namespace model_server {
+
+static const size_t kFlushBatch = 16;
+
+uint64_t TraceSampler::seed() noexcept {
+  const uint64_t seed = std::hash<std::thread::id>()(std::this_thread::get_id())
+    ^ static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+  // xorshift never leaves 0
+  return 0 == seed ? 0x9E3779B97F4A7C15ull : seed;
+}
+
+Tracer::Tracer(const TracerConf& conf) noexcept(false) :
+  conf_(conf),
+  ring_(std::max(conf.capacity, 2)),
+  written_(0),
+  dropped_(0),
+  flush_mtx_(),
+  next_collector_id_(1),
+  collectors_(),
+  next_seq_(0),
+  stop_mtx_(),
+  stop_cv_(),
+  stop_(false),
+  flusher_() {
+  flusher_ = std::thread(&Tracer::flush_loop, this);
+  LOG(INFO) << "Tracer started, " << conf_.detail();
+}
+
+Tracer::~Tracer() {
+  {
+    std::lock_guard<std::mutex> lock(stop_mtx_);
+    stop_ = true;
+  }
+  stop_cv_.notify_all();
+  if (flusher_.joinable()) {
+    flusher_.join();
+  }
+  flush();
+}
+
+Tracer *Tracer::instance() {
+  static Tracer instance(TracerConf{});
+  return &instance;
+}
+
+bool Tracer::submit(std::unique_ptr<TraceRecord> record) noexcept {
+  if (!ring_.try_push(std::move(record))) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+uint64_t Tracer::add_collector(std::function<void()> collector) noexcept(false) {
+  std::lock_guard<std::mutex> lock(flush_mtx_);
+  const uint64_t id = next_collector_id_++;
+  collectors_.emplace(id, std::move(collector));
+  return id;
+}
+
+void Tracer::remove_collector(uint64_t id) noexcept {
+  std::lock_guard<std::mutex> lock(flush_mtx_);
+  collectors_.erase(id);
+}
+
+void Tracer::flush() noexcept {
+  std::lock_guard<std::mutex> lock(flush_mtx_);
+  for (auto& collector : collectors_) {
+    try {
+      collector.second();
+    } catch (const std::exception& e) {
+      LOG(ERROR) << e.what();
+    } catch (...) {
+      LOG(ERROR) << "Unknown exception";
+    }
+  }
+
+  std::unique_ptr<TraceRecord> records[kFlushBatch];
+  size_t count = 0;
+  while ((count = ring_.try_pop_batch(records, kFlushBatch)) > 0) {
+    for (size_t i = 0; i < count; ++i) {
+      try {
+        write(*records[i]);
+      } catch (const std::exception& e) {
+        LOG(ERROR) << e.what();
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+      }
+      records[i].reset();
+    }
+  }
+}
+
+void Tracer::flush_loop() noexcept {
+  std::unique_lock<std::mutex> lock(stop_mtx_);
+  while (!stop_) {
+    stop_cv_.wait_for(lock, std::chrono::milliseconds(conf_.flush_interval_ms), [this]() { return stop_; });
+    if (stop_) {
+      break;
+    }
+    lock.unlock();
+    flush();
+    lock.lock();
+  }
+}
+
+void Tracer::write(const TraceRecord& record) noexcept(false) {
+  // The brief is name:version, keep the file name free of separators
+  std::string model = record.model;
+  std::replace(model.begin(), model.end(), ':', '_');
+  std::replace(model.begin(), model.end(), '/', '_');
+  const std::string& path = conf_.dir + "/trace_" + model + "_" + std::to_string(next_seq_++) + "." + record.extension;
+
+  std::ofstream ofs(path, std::ios::binary);
+  ofs.write(record.payload.data(), record.payload.size());
+  ofs.close();
+  if (!ofs) {
+    LOG(WARNING) << "Failed to write trace to " << path;
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  written_.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace model_server
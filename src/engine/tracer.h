@@ -0,0 +1,122 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_ENGINE_TRACER_H_
+#define MODEL_SERVER_SRC_ENGINE_TRACER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>  // NOLINT
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include "absl/container/flat_hash_map.h"
+#include "model_server/src/util/functional/mpmc_queue.h"
+
+namespace model_server {
+
+struct TracerConf {
+  std::string dir               = ".";   // trace files are written here
+  int32_t     capacity          = 256;   // traces held until flushed, more are dropped
+  int32_t     flush_interval_ms = 1000;
+
+  std::string detail() const noexcept {
+    return "dir: " + dir + ", capacity: " + std::to_string(capacity)
+      + ", flush_interval_ms: " + std::to_string(flush_interval_ms);
+  }
+};
+
+// One captured trace, e.g. the RunMetadata of a TF run or an ORT profile
+struct TraceRecord {
+  std::string model;      // brief of the engine
+  std::string extension;  // of the file it is written to, "pb" or "json"
+  std::string payload;
+};
+
+// Picks 1 in every_n requests at random. Each thread draws from its own xorshift generator,
+// so a request not sampled costs a few arithmetic ops and touches no shared cache line.
+class TraceSampler {
+ public:
+  explicit TraceSampler(int32_t every_n) noexcept : every_n_(every_n > 0 ? every_n : 0) {}
+
+  bool enabled() const noexcept {
+    return 0 != every_n_;
+  }
+
+  bool sample() const noexcept {
+    if (0 == every_n_) {
+      return false;
+    }
+    static thread_local uint64_t state = seed();
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return 0 == state % every_n_;
+  }
+
+ private:
+  static uint64_t seed() noexcept;
+
+  uint64_t every_n_;
+};
+
+// Process-wide sink of sampled traces. Request threads hand records over to a bounded lock-free
+// ring without blocking or touching the disk, a background thread writes them out as
+// <dir>/trace_<model>_<seq>.<extension> every flush interval. Records beyond the capacity are
+// dropped and counted.
+class Tracer {
+ public:
+  explicit Tracer(const TracerConf& conf) noexcept(false);
+  virtual ~Tracer();
+
+  Tracer() = delete;
+  Tracer& operator=(const Tracer&) = delete;
+  Tracer(const Tracer&) = delete;
+
+  // Shared instance writing to the working directory
+  static Tracer *instance();
+
+  // Queue a record for the flusher, false if the ring is full and it was dropped
+  bool submit(std::unique_ptr<TraceRecord> record) noexcept;
+
+  // Collectors run on the flusher before each flush, to submit what an engine gathered on its own,
+  // e.g. an ORT profile. Once remove_collector returns the collector is not running and never runs again.
+  uint64_t add_collector(std::function<void()> collector) noexcept(false);
+  void remove_collector(uint64_t id) noexcept;
+
+  // Run the collectors and write every queued record, blocking until done
+  void flush() noexcept;
+
+  size_t written() const noexcept {
+    return written_.load(std::memory_order_relaxed);
+  }
+  size_t dropped() const noexcept {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void flush_loop() noexcept;
+  void write(const TraceRecord& record) noexcept(false);
+
+  TracerConf                              conf_;
+  MPMCQueue<std::unique_ptr<TraceRecord>> ring_;
+  std::atomic<size_t>                     written_;
+  std::atomic<size_t>                     dropped_;
+
+  // Held while flushing, so the flusher and flush() never write at once, guards what follows
+  std::mutex                                           flush_mtx_;
+  uint64_t                                             next_collector_id_;
+  absl::flat_hash_map<uint64_t, std::function<void()>> collectors_;
+  uint64_t                                             next_seq_;
+
+  std::mutex              stop_mtx_;
+  std::condition_variable stop_cv_;
+  bool                    stop_;
+  std::thread             flusher_;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_ENGINE_TRACER_H_
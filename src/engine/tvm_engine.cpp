@@ -13,6 +13,28 @@
 
 namespace model_server {
 
+// Values in a row of a tensor of the shape, the leading dim is the batch
+static int64_t row_width_of(const std::vector<int64_t>& shape) noexcept {
+  int64_t row_width = 1;
+  for (size_t i = 1; i < shape.size(); ++i) {
+    row_width *= shape[i];
+  }
+  return row_width;
+}
+
+// Graph inputs are dense, a ragged feature is padded into scratch of the calling thread instead of
+// in place, so the caller's feature is left as it came. The scratch is only valid until the next call.
+static const TensorBuffer& dense_data_of(const Tensor& feature, int64_t row_width) noexcept(false) {
+  if (!feature.ragged()) {
+    return feature.data;
+  }
+  static thread_local TensorBuffer dense;
+  check_ragged(feature);
+  dense.resize(row_width * data_type_size(feature.dtype) * feature.batch_size);
+  densify(feature, row_width, dense.data());
+  return dense;
+}
+
 TVMEngine::TVMEngine(const EngineConf& engine_conf) noexcept(false) :
   Engine(engine_conf),
   // engine_mtx_(),
@@ -27,10 +49,14 @@ TVMEngine::TVMEngine(const EngineConf& engine_conf) noexcept(false) :
   get_output_(),
   input_shapes_(),
   output_shapes_(),
-  release_() {
+  release_(),
+  input_slots_(),
+  output_slots_(),
+  completion_queue_(this, engine_conf) {
 }
 
 TVMEngine::~TVMEngine() {
+  completion_queue_.stop();
   try {
     // std::unique_lock<std::shared_mutex> engine_lock(engine_mtx_);
     // release_();
@@ -65,6 +91,14 @@ void TVMEngine::infer(Instance *instance, Score *score) noexcept(false) {
           + conf_.brief() + "] " + "Batch size mismatch";
         throw std::runtime_error(err_msg);
       }
+      // The graph executor is created for float tensors only
+      if (DataType::kFloat != feature.dtype) {
+        const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+          + conf_.brief() + "] " + "Feature data type mismatch: " + feature.name + " is "
+          + data_type_name(feature.dtype);
+        throw std::runtime_error(err_msg);
+      }
+      const TensorBuffer& feature_data = dense_data_of(feature, row_width_of(tensor_shape));
       input_tensors.push_back(nullptr);
 
       const std::string& feature_name = it->first + ":0";
@@ -73,7 +107,7 @@ void TVMEngine::infer(Instance *instance, Score *score) noexcept(false) {
         dtype_code_, dtype_bits_, dtype_lanes_,
         device_type_, device_id_, &(input_tensors.back())
       );  // NOLINT
-      TVMArrayCopyFromBytes(input_tensors.back(), feature.data.data(), feature.data.size());
+      TVMArrayCopyFromBytes(input_tensors.back(), feature_data.data(), feature_data.size());
       set_input_(feature_name, input_tensors.back());
     }
   }
@@ -102,9 +136,10 @@ void TVMEngine::infer(Instance *instance, Score *score) noexcept(false) {
       output_size *= dim;
     }
     const std::string& target_name = it->first + ":0";
-    target.data.resize(output_size);
+    target.dtype = DataType::kFloat;
+    target.resize(output_size);
     get_output_(output_tensors.size() - 1, output_tensors.back());
-    TVMArrayCopyToBytes(output_tensors.back(), target.data.data(), target.data.size() * sizeof(float));
+    TVMArrayCopyToBytes(output_tensors.back(), target.data.data(), target.data.size());
   }
 
   for (auto& tensor : input_tensors) {
@@ -115,6 +150,64 @@ void TVMEngine::infer(Instance *instance, Score *score) noexcept(false) {
   }
 }
 
+void TVMEngine::infer_bound(Instance *instance, Score *score) noexcept(false) {
+  if (!inited_) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + conf_.brief() + "] " + "Engine not initialized";
+    throw std::runtime_error(err_msg);
+  }
+  check_bound_sample(*instance, *score);
+
+  std::vector<DLTensor *> input_tensors(input_slots_.size(), nullptr);
+  std::vector<DLTensor *> output_tensors(output_slots_.size(), nullptr);
+  auto tensors_cleanup = absl::MakeCleanup([&input_tensors, &output_tensors]() {
+    for (auto& tensor : input_tensors) {
+      if (nullptr != tensor) {
+        TVMArrayFree(tensor);
+      }
+    }
+    for (auto& tensor : output_tensors) {
+      if (nullptr != tensor) {
+        TVMArrayFree(tensor);
+      }
+    }
+  });
+
+  for (size_t i = 0; i < input_slots_.size(); ++i) {
+    const auto& slot = input_slots_[i];
+    auto& feature = instance->features[i];
+    if (slot.shape[0] != feature.batch_size || DataType::kFloat != feature.dtype) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+        + conf_.brief() + "] " + "Feature batch size or data type mismatch: " + feature.name;
+      throw std::runtime_error(err_msg);
+    }
+    const TensorBuffer& feature_data = dense_data_of(feature, row_width_of(slot.shape));
+    TVMArrayAlloc(
+      slot.shape.data(), slot.shape.size(),
+      dtype_code_, dtype_bits_, dtype_lanes_,
+      device_type_, device_id_, &(input_tensors[i])
+    );  // NOLINT
+    TVMArrayCopyFromBytes(input_tensors[i], feature_data.data(), feature_data.size());
+    set_input_(slot.node_name, input_tensors[i]);
+  }
+
+  run_();
+
+  for (size_t i = 0; i < output_slots_.size(); ++i) {
+    const auto& slot = output_slots_[i];
+    auto& target = score->targets[i];
+    TVMArrayAlloc(
+      slot.shape.data(), slot.shape.size(),
+      dtype_code_, dtype_bits_, dtype_lanes_,
+      device_type_, device_id_, &(output_tensors[i])
+    );  // NOLINT
+    target.dtype = DataType::kFloat;
+    target.resize(slot.size);
+    get_output_(static_cast<int32_t>(i), output_tensors[i]);
+    TVMArrayCopyToBytes(output_tensors[i], target.data.data(), target.data.size());
+  }
+}
+
 void TVMEngine::trace(Instance *instance, Score *score) noexcept(false) {
   // std::shared_lock<std::shared_mutex> engine_lock(engine_mtx_);
   if (!inited_) {
@@ -125,6 +218,12 @@ void TVMEngine::trace(Instance *instance, Score *score) noexcept(false) {
   infer(instance, score);
 }
 
+void TVMEngine::infer_async(
+  Instance *instance, Score *score, InferCallback callback, Priority priority
+) noexcept(false) {  // NOLINT
+  completion_queue_.push(instance, score, std::move(callback), priority);
+}
+
 void TVMEngine::load() {
   dtype_code_  = kDLFloat;
   dtype_bits_  = 32;
@@ -165,6 +264,8 @@ void TVMEngine::load() {
   std::unique_ptr<Engine> onnx_engine(ONNXEngineFactory::instance()->create(onnx_engine_conf));
   onnx_engine->get_input_name_and_shape(&input_shapes_);
   onnx_engine->get_output_name_and_shape(&output_shapes_);
+  // The module is compiled from the ONNX graph, so their slots are the same
+  signature_ = onnx_engine->signature();
 
   // print input shapes
   for (const auto& input : input_shapes_) {
@@ -188,6 +289,24 @@ void TVMEngine::create_session() {
 }
 
 void TVMEngine::sub_init() {
+  for (const auto& input_name : signature_.input_names) {
+    input_slots_.push_back(TVMTensorSlot{
+      .node_name = input_name + ":0",
+      .shape     = input_shapes_.at(input_name),
+      .size      = 0
+    });
+  }
+  for (const auto& output_name : signature_.output_names) {
+    TVMTensorSlot slot{
+      .node_name = output_name + ":0",
+      .shape     = output_shapes_.at(output_name),
+      .size      = 1
+    };
+    for (const auto& dim : slot.shape) {
+      slot.size *= dim;
+    }
+    output_slots_.push_back(slot);
+  }
 }
 
 void TVMEngine::get_input_name_and_shape(
@@ -12,9 +12,17 @@
 #include "tvm/runtime/packed_func.h"
 #include "tvm/runtime/registry.h"
 #include "model_server/src/engine/engine.h"
+#include "model_server/src/engine/completion_queue.h"
 
 namespace model_server {
 
+// An input or output slot of the bound signature, resolved to its graph node
+struct TVMTensorSlot {
+  std::string          node_name;
+  std::vector<int64_t> shape;
+  int64_t              size;
+};
+
 class TVMEngine : public Engine {
  public:
   explicit TVMEngine(const EngineConf& engine_conf) noexcept(false);
@@ -30,9 +38,18 @@ class TVMEngine : public Engine {
   // Perform inference using the ONNX runtime
   void infer(Instance *instance, Score *score) noexcept(false) override;
 
+  // Perform inference on a bound sample using the TVM runtime
+  void infer_bound(Instance *instance, Score *score) noexcept(false) override;
+
   // Perform inference with trace using the ONNX runtime
   void trace(Instance *instance, Score *score) noexcept(false) override;
 
+  // Queued on the completion queue, the TVM graph executor has no asynchronous run
+  void infer_async(
+    Instance *instance, Score *score, InferCallback callback, Priority priority = Priority::kNormal
+  ) noexcept(false) override;  // NOLINT
+  using Engine::infer_async;
+
   // Get input name and shape
   void get_input_name_and_shape(
     absl::flat_hash_map<std::string, std::vector<int64_t>> *input_shapes
@@ -76,6 +93,11 @@ class TVMEngine : public Engine {
 
   absl::flat_hash_map<std::string, std::vector<int64_t>> input_shapes_;
   absl::flat_hash_map<std::string, std::vector<int64_t>> output_shapes_;
+  std::vector<TVMTensorSlot> input_slots_;
+  std::vector<TVMTensorSlot> output_slots_;
+
+  // Serves infer_async, stopped first on destruction
+  CompletionQueue completion_queue_;
 };
 
 class TVMEngineFactory : public EngineFactory {
@@ -1,34 +1,259 @@
 // Copyright (C) 2023 zh.luxu1986@gmail.com
 
 #include "model_server/src/population/lifecycle.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <memory>
+#include <mutex>  // NOLINT
+#include <shared_mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include "absl/cleanup/cleanup.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/log/log.h"
+#include "absl/strings/str_join.h"
+#include "model_server/src/util/functional/timer.h"
+#include "model_server/src/util/os/numa.h"
+#include "model_server/src/util/os/thread_cpu.h"
 #include "model_server/src/engine/tf_engine.h"
 #include "model_server/src/engine/onnx_engine.h"
 
 namespace model_server {
 
-Lifecycle::Lifecycle(const IndivadualInfo& indivadual_info) noexcept(false) :
-  indivadual_info_(indivadual_info) {
+static EngineFactory *engine_factory(const IndivadualInfo& indivadual_info) noexcept(false) {
+  if (kBrandTF == indivadual_info.brand) {
+    return TFEngineFactory::instance();
+  }
+  if (kBrandONNX == indivadual_info.brand) {
+    return ONNXEngineFactory::instance();
+  }
+  const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+    + indivadual_info.name + "] " + "Unsupported engine brand: " + indivadual_info.brand;
+  throw std::runtime_error(err_msg);
+}
+
+static const int32_t kUnpinned = -1;
+// Cached replicas of a thread, dropped at once when it has seen this many replica sets
+static const size_t kMaxThreadReplicas = 64;
+
+static uint64_t next_replicas_generation() noexcept {
+  static std::atomic<uint64_t> *generation = new std::atomic<uint64_t>(0);
+  return generation->fetch_add(1) + 1;
+}
+
+Lifecycle::Lifecycle(const IndivadualInfo& indivadual_info, bool workers_pinned_to_numa) noexcept(false) :
+  indivadual_info_(indivadual_info),
+  replicas_generation_(next_replicas_generation()),
+  workers_pinned_to_numa_(workers_pinned_to_numa) {
   model_meta_.load(indivadual_info_.model_conf_loc());
 
   engine_conf_.name = indivadual_info_.name;
   engine_conf_.version = indivadual_info_.age;
   engine_conf_.graph_file_loc = indivadual_info.graph_file_loc();
+  engine_conf_.trace_every_n = indivadual_info_.trace_every_n;
+  engine_conf_.ort_model_cache_dir = indivadual_info_.ort_model_cache_dir;
+  engine_conf_.ort_quantize_dynamic = indivadual_info_.ort_quantize_dynamic;
+  engine_conf_.ort_quantize_script = indivadual_info_.ort_quantize_script;
+  engine_conf_.tf_prune_graph = indivadual_info_.tf_prune_graph;
   // engine_conf_.input_nodes = ;
   // engine_conf_.output_nodes = ;
   // engine_conf_.opt_level;
   // engine_conf_.jit_level;
   // engine_conf_.inter_op_parallelism_threads;
   // engine_conf_.intra_op_parallelism_threads;
-  engine_ = std::unique_ptr<TFEngine>(new TFEngine(engine_conf_));
+  admission_ = std::unique_ptr<Admission>(new Admission(indivadual_info_.admission_conf));
+  replicas_ = build_replicas(indivadual_info_, engine_conf_);
+  if (replicas_.size() > 1) {
+    for (size_t i = 0; i < replicas_.size(); ++i) {
+      for (const auto& cpu : replicas_[i].cpus) {
+        if (static_cast<size_t>(cpu) >= replica_of_cpu_.size()) {
+          replica_of_cpu_.resize(cpu + 1, 0);
+        }
+        replica_of_cpu_[cpu] = static_cast<int32_t>(i);
+      }
+    }
+  }
+  if (indivadual_info_.score_cache_conf.capacity > 0) {
+    score_cache_ = std::unique_ptr<ScoreCache>(new ScoreCache(indivadual_info_.score_cache_conf));
+  }
+  sample_pool_ = SamplePool::create(replicas_[0].engine.get(), SamplePoolConf());
+}
+
+Lifecycle::~Lifecycle() {
+  // Each replica drains its batcher before the engine it feeds goes away
+  replicas_.clear();
+}
+
+std::vector<Lifecycle::Replica> Lifecycle::build_replicas(
+  const IndivadualInfo& indivadual_info, const EngineConf& engine_conf
+) {
+  std::vector<std::vector<int64_t>> node_cpus;
+  if (!indivadual_info.numa_replicas || !get_numa_node_cpus(&node_cpus) || node_cpus.size() < 2) {
+    node_cpus.assign(1, std::vector<int64_t>());
+  }
+  if (node_cpus.size() > 1 && !workers_pinned_to_numa_) {
+    LOG(WARNING) << "Model " << engine_conf.name << " has numa_replicas but workers are not pinned to NUMA nodes, "
+                 << "requests go to the replica of whichever CPU they happen to run on. Set --pin_workers_to_numa.";
+  }
+
+  EngineFactory *factory = engine_factory(indivadual_info);
+  std::vector<Replica> replicas(node_cpus.size());
+  for (size_t i = 0; i < replicas.size(); ++i) {
+    Replica& replica = replicas[i];
+    replica.cpus = node_cpus[i];
+    auto build = [&replica, &indivadual_info, &engine_conf, factory]() {
+      replica.engine = std::unique_ptr<Engine>(factory->create(engine_conf));
+      if (indivadual_info.enable_batching) {
+        replica.batcher = std::unique_ptr<Batcher>(new Batcher(replica.engine.get(), indivadual_info.batcher_conf));
+      }
+    };
+    if (replica.cpus.empty()) {
+      build();
+      continue;
+    }
+
+    std::exception_ptr error;
+    std::thread builder([&]() {
+      try {
+        if (!set_thread_cpus(replica.cpus)) {
+          LOG(WARNING) << "Failed to pin the builder of " << engine_conf.name << " to node " << i;
+        }
+        build();
+      } catch (...) {
+        error = std::current_exception();
+        return;
+      }
+      // TF materializes constants on the first run, which has to happen on this node too
+      try {
+        std::vector<Sample> samples;
+        replica.engine->random_sample_gen(&samples, 1, 1, true);
+        replica.engine->warmup(&(samples[0].instance), &(samples[0].score));
+      } catch (const std::exception& e) {
+        LOG(WARNING) << "Failed to warm up " << engine_conf.name << " on node " << i << ": " << e.what();
+      }
+    });
+    builder.join();
+    if (nullptr != error) {
+      std::rethrow_exception(error);
+    }
+    LOG(INFO) << "Model " << engine_conf.name << " replica " << i << " built on cpus "
+              << absl::StrJoin(replica.cpus, ",");
+  }
+  return replicas;
 }
 
-Lifecycle::~Lifecycle() = default;
+Lifecycle::Replica& Lifecycle::local_replica() noexcept {
+  if (replicas_.size() < 2) {
+    return replicas_[0];
+  }
+  // Affinity is read once per thread, a worker is pinned when it starts and stays so
+  thread_local absl::flat_hash_map<uint64_t, int32_t> thread_replicas;
+  auto it = thread_replicas.find(replicas_generation_);
+  if (thread_replicas.end() == it) {
+    if (thread_replicas.size() >= kMaxThreadReplicas) {
+      thread_replicas.clear();
+    }
+    it = thread_replicas.emplace(replicas_generation_, pinned_replica()).first;
+  }
+  if (kUnpinned != it->second) {
+    return replicas_[it->second];
+  }
+  int64_t cpu = 0;
+  if (get_current_cpu(&cpu) && static_cast<size_t>(cpu) < replica_of_cpu_.size()) {
+    return replicas_[replica_of_cpu_[cpu]];
+  }
+  return replicas_[0];
+}
+
+int32_t Lifecycle::pinned_replica() const noexcept {
+  std::vector<int64_t> cpus;
+  if (!get_thread_cpus(&cpus)) {
+    return kUnpinned;
+  }
+  int32_t replica = kUnpinned;
+  for (const auto& cpu : cpus) {
+    if (static_cast<size_t>(cpu) >= replica_of_cpu_.size()) {
+      return kUnpinned;
+    }
+    if (kUnpinned != replica && replica != replica_of_cpu_[cpu]) {
+      return kUnpinned;
+    }
+    replica = replica_of_cpu_[cpu];
+  }
+  return replica;
+}
+
+void Lifecycle::age(const std::string& new_age) noexcept(false) {
+  if (new_age == indivadual_info_.age) {
+    return;
+  }
+
+  // Load the new version aside, serving goes on with the old one meanwhile
+  IndivadualInfo indivadual_info = indivadual_info_;
+  indivadual_info.age = new_age;
+  EngineConf engine_conf = engine_conf_;
+  engine_conf.version = new_age;
+  engine_conf.graph_file_loc = indivadual_info.graph_file_loc();
+  std::vector<Replica> replicas = build_replicas(indivadual_info, engine_conf);
+  // Samples out of the old pool keep it alive until they are handed back
+  std::shared_ptr<SamplePool> sample_pool = SamplePool::create(replicas[0].engine.get(), SamplePoolConf());
+
+  {
+    std::unique_lock lock(version_mtx_);
+    std::swap(indivadual_info_, indivadual_info);
+    engine_conf_ = engine_conf;
+    replicas_.swap(replicas);
+    replicas_generation_ = next_replicas_generation();
+    sample_pool_.swap(sample_pool);
+    // Scores of the old version must not outlive it
+    if (nullptr != score_cache_) {
+      score_cache_->clear();
+    }
+  }
+  LOG(INFO) << "Model " << indivadual_info_.name << " aged from " << indivadual_info.age << " to " << new_age;
+}
+
+void Lifecycle::undertake(
+  Instance *instance, Score *score, absl::Time deadline, Priority priority
+) noexcept(false) {  // NOLINT
+  admission_->admit(deadline);
+  bool succeeded = false;
+  Timer timer;
+  auto admission_cleanup = absl::MakeCleanup([&]() {
+    admission_->release(absl::Nanoseconds(timer.i64_elapsed_ns()), succeeded);
+  });
+
+  std::shared_lock lock(version_mtx_);
+  // Requests naming exactly the graph's inputs and outputs are put in slot order and marked bound for
+  // the bound path, which feeds tensors by index. Partial requests go on by name.
+  replicas_[0].engine->signature().arrange(instance, score);
+  if (nullptr != score_cache_) {
+    score_cache_->infer(instance, score, [this, priority](Instance *miss_instance, Score *miss_score) {
+      this->infer(miss_instance, miss_score, priority);
+    });
+  } else {
+    infer(instance, score, priority);
+  }
+  succeeded = true;
+}
+
+SamplePool::Handle Lifecycle::acquire_sample() noexcept(false) {
+  std::shared_lock lock(version_mtx_);
+  return sample_pool_->acquire();
+}
 
-void Lifecycle::age(const std::string& new_age) noexcept(false) {}
-void Lifecycle::undertake(Instance *instance, Score *score) noexcept(false) {
-  engine_->infer(instance, score);
+void Lifecycle::infer(Instance *instance, Score *score, Priority priority) noexcept(false) {
+  Replica& replica = local_replica();
+  if (nullptr != replica.batcher) {
+    replica.batcher->infer(instance, score, priority);
+  } else if (replica.engine->signature().bound(*instance, *score)) {
+    replica.engine->infer_bound(instance, score, priority);
+  } else {
+    replica.engine->infer(instance, score, priority);
+  }
 }
 
 }  // namespace model_server
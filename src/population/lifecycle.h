@@ -3,11 +3,18 @@
 #ifndef MODEL_SERVER_SRC_POPULATION_LIFECYCLE_H_
 #define MODEL_SERVER_SRC_POPULATION_LIFECYCLE_H_
 
+#include <stdint.h>
 #include <memory>
+#include <shared_mutex>
 #include <vector>
 #include <string>
+#include "absl/time/time.h"
 #include "model_server/src/engine/sample.h"
 #include "model_server/src/engine/engine.h"
+#include "model_server/src/engine/batcher.h"
+#include "model_server/src/engine/admission.h"
+#include "model_server/src/engine/score_cache.h"
+#include "model_server/src/engine/sample_pool.h"
 #include "model_server/src/embedding/embedding.h"
 #include "model_server/src/population/roster.h"
 #include "model_server/src/population/model_spec.h"
@@ -16,23 +23,58 @@ namespace model_server {
 
 class Lifecycle {
  public:
-  explicit Lifecycle(const IndivadualInfo& indivadual_info) noexcept(false);
+  // Workers pinned to NUMA nodes keep to the replica of theirs, others go by the CPU they run on
+  explicit Lifecycle(const IndivadualInfo& indivadual_info, bool workers_pinned_to_numa = false) noexcept(false);
   virtual ~Lifecycle();
 
   Lifecycle& operator=(const Lifecycle&) = delete;
   Lifecycle(const Lifecycle&) = delete;
 
+  // Switch to another version of the model, requests in flight finish on the old one
   void age(const std::string& new_age) noexcept(false);
-  void undertake(Instance *instance, Score *score) noexcept(false);
+  // Throws AdmissionRejected, before the engine is touched, if the request can not finish by the deadline
+  void undertake(
+    Instance *instance, Score *score, absl::Time deadline = absl::InfiniteFuture(),
+    Priority priority = Priority::kNormal
+  ) noexcept(false);  // NOLINT
+  // A sample shaped for the current version, handing it back to undertake allocates nothing once warm
+  SamplePool::Handle acquire_sample() noexcept(false);
 
  private:
-  std::vector<std::string>   memories_;
-  std::string                age_;
-  IndivadualInfo             indivadual_info_;
-  ModelMeta                  model_meta_;
-  EngineConf                 engine_conf_;
-  std::unique_ptr<Engine>    engine_;
-  std::unique_ptr<Embedding> embedding_;
+  // An engine and its batcher. Built by a thread pinned to the CPUs of its node, so the
+  // weights are first touched there and the threads the engine spawns stay there.
+  struct Replica {
+    std::vector<int64_t>     cpus;
+    std::unique_ptr<Engine>  engine;
+    std::unique_ptr<Batcher> batcher;
+  };
+
+  void infer(Instance *instance, Score *score, Priority priority) noexcept(false);
+  // One replica per NUMA node with numa_replicas, else a single unpinned one
+  std::vector<Replica> build_replicas(
+    const IndivadualInfo& indivadual_info, const EngineConf& engine_conf
+  ) noexcept(false);  // NOLINT
+  // The replica of the node the calling thread is pinned to, resolved once per thread and replica
+  // set. Threads not pinned within one node get the replica of the CPU they run on at the call.
+  Replica& local_replica() noexcept;
+  // Replica holding every CPU the calling thread may run on, or kUnpinned
+  int32_t pinned_replica() const noexcept;
+
+  std::vector<std::string>    memories_;
+  std::string                 age_;
+  IndivadualInfo              indivadual_info_;
+  ModelMeta                   model_meta_;
+  EngineConf                  engine_conf_;
+  std::vector<Replica>        replicas_;
+  std::vector<int32_t>        replica_of_cpu_;
+  // Tells replica sets apart in the per thread cache of local_replica, unique across lifecycles
+  uint64_t                    replicas_generation_;
+  bool                        workers_pinned_to_numa_;
+  std::unique_ptr<Admission>  admission_;
+  std::unique_ptr<ScoreCache> score_cache_;
+  std::shared_ptr<SamplePool> sample_pool_;
+  std::shared_mutex           version_mtx_;
+  std::unique_ptr<Embedding>  embedding_;
 };
 
 }  // namespace model_server
@@ -9,8 +9,10 @@ namespace model_server {
 static const char kPopulationConfFileName[] = "__list__.json";
 static const int32_t kEvolveThreadNum = 4;
 
-Population::Population(const std::string& settlement_path) noexcept :
-  settlement_path_(settlement_path) {}
+Population::Population(const std::string& settlement_path, bool workers_pinned_to_numa) noexcept :
+  settlement_path_(settlement_path),
+  workers_pinned_to_numa_(workers_pinned_to_numa),
+  roster_(new Roster()) {}
 
 Population::~Population() {}
 
@@ -76,7 +78,7 @@ void Population::evolve() noexcept(false) {
 }
 
 void Population::born(const std::string& name, const IndivadualInfo& indivadual_info) noexcept(false) {
-  std::shared_ptr<Lifecycle> womb = std::make_shared<Lifecycle>(indivadual_info);
+  std::shared_ptr<Lifecycle> womb = std::make_shared<Lifecycle>(indivadual_info, workers_pinned_to_numa_);
   {
     std::unique_lock lock(population_mutex_);
     indivaduals_.try_emplace(name, womb);
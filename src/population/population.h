@@ -15,7 +15,8 @@ namespace model_server {
 
 class Population {
  public:
-  explicit Population(const std::string& settlement_path) noexcept;
+  // Tell it whether the workers calling summon are pinned to NUMA nodes, numa_replicas relies on that
+  explicit Population(const std::string& settlement_path, bool workers_pinned_to_numa = false) noexcept;
   virtual ~Population();
 
   Population& operator=(const Population&) = delete;
@@ -31,6 +32,7 @@ class Population {
   std::mutex evolvement_mutex_;
   std::shared_mutex population_mutex_;
   std::string settlement_path_;
+  bool workers_pinned_to_numa_;
   std::unique_ptr<Roster> roster_;
   absl::flat_hash_map<std::string, std::shared_ptr<Lifecycle>> indivaduals_;
 };
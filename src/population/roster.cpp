@@ -1,9 +1,37 @@
 // Copyright (C) 2023 zh.luxu1986@gmail.com
 
 #include "model_server/src/population/roster.h"
+#include <fstream>
+#include <string>
+#include "absl/cleanup/cleanup.h"
+#include "nlohmann/json.hpp"
 
 namespace model_server {
 
+static const char kRosterFieldName[]              = "all";
+static const char kRosterVersionFieldName[]       = "version";
+static const char kRosterBatchingFieldName[]      = "batching";
+static const char kBatchingMaxBatchSizeName[]     = "max_batch_size";
+static const char kBatchingMaxQueueDelayUsName[]  = "max_queue_delay_us";
+static const char kBatchingNumBatchThreadsName[]  = "num_batch_threads";
+static const char kRosterAdmissionFieldName[]     = "admission";
+static const char kAdmissionInitialLimitName[]    = "initial_limit";
+static const char kAdmissionMinLimitName[]        = "min_limit";
+static const char kAdmissionMaxLimitName[]        = "max_limit";
+static const char kAdmissionTargetLatencyUsName[] = "target_latency_us";
+static const char kAdmissionBackoffRatioName[]    = "backoff_ratio";
+static const char kRosterScoreCacheFieldName[]    = "score_cache";
+static const char kScoreCacheCapacityName[]       = "capacity";
+static const char kScoreCacheTtlMsName[]         = "ttl_ms";
+static const char kScoreCacheNumShardsName[]      = "num_shards";
+static const char kRosterBrandFieldName[]         = "brand";
+static const char kRosterNumaReplicasFieldName[]  = "numa_replicas";
+static const char kRosterTraceEveryNFieldName[]   = "trace_every_n";
+static const char kRosterModelCacheDirFieldName[] = "ort_model_cache_dir";
+static const char kRosterQuantizeFieldName[]      = "ort_quantize_dynamic";
+static const char kRosterQuantizeScriptName[]     = "ort_quantize_script";
+static const char kRosterPruneGraphFieldName[]    = "tf_prune_graph";
+
 std::string IndivadualInfo::graph_file_loc() const noexcept(false) {
   return home_path + "/" + name + "/" + age + "/graph";
 }
@@ -12,6 +40,82 @@ std::string IndivadualInfo::model_conf_loc() const noexcept(false) {
   return home_path + "/" + name + "/model_conf.json";
 }
 
-void Roster::load(const std::string& path) noexcept(false) {}
+void Roster::load(const std::string& path) noexcept(false) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("Failed to open roster file: " + path);
+  }
+  auto file_cleanup = absl::MakeCleanup([&file](){ file.close(); });
+
+  nlohmann::json conf = nlohmann::json::parse(file);
+  if ((!conf.contains(kRosterFieldName)) || (!conf[kRosterFieldName].is_object())) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+      + path + "] " + "kRosterFieldName format error, " + conf.dump();
+    throw std::runtime_error(err_msg);
+  }
+
+  const std::string& home_path = path.substr(0, path.find_last_of('/'));
+  absl::flat_hash_map<std::string, IndivadualInfo> roster;
+  for (const auto& [name, item] : conf[kRosterFieldName].items()) {
+    if (!item.contains(kRosterVersionFieldName)) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "]["
+        + path + "] " + "kRosterVersionFieldName format error, " + item.dump();
+      throw std::runtime_error(err_msg);
+    }
+
+    IndivadualInfo info;
+    info.name = name;
+    const auto& version = item[kRosterVersionFieldName];
+    info.age = version.is_string() ? version.get<std::string>() : version.dump();
+    info.home_path = home_path;
+
+    if (item.contains(kRosterBatchingFieldName)) {
+      const auto& batching = item[kRosterBatchingFieldName];
+      info.enable_batching = true;
+      info.batcher_conf.max_batch_size =
+        batching.value(kBatchingMaxBatchSizeName, info.batcher_conf.max_batch_size);
+      info.batcher_conf.max_queue_delay_us =
+        batching.value(kBatchingMaxQueueDelayUsName, info.batcher_conf.max_queue_delay_us);
+      info.batcher_conf.num_batch_threads =
+        batching.value(kBatchingNumBatchThreadsName, info.batcher_conf.num_batch_threads);
+    }
+
+    if (item.contains(kRosterAdmissionFieldName)) {
+      const auto& admission = item[kRosterAdmissionFieldName];
+      info.admission_conf.initial_limit =
+        admission.value(kAdmissionInitialLimitName, info.admission_conf.initial_limit);
+      info.admission_conf.min_limit =
+        admission.value(kAdmissionMinLimitName, info.admission_conf.min_limit);
+      info.admission_conf.max_limit =
+        admission.value(kAdmissionMaxLimitName, info.admission_conf.max_limit);
+      info.admission_conf.target_latency_us =
+        admission.value(kAdmissionTargetLatencyUsName, info.admission_conf.target_latency_us);
+      info.admission_conf.backoff_ratio =
+        admission.value(kAdmissionBackoffRatioName, info.admission_conf.backoff_ratio);
+    }
+
+    if (item.contains(kRosterScoreCacheFieldName)) {
+      const auto& score_cache = item[kRosterScoreCacheFieldName];
+      info.score_cache_conf.capacity =
+        score_cache.value(kScoreCacheCapacityName, info.score_cache_conf.capacity);
+      info.score_cache_conf.ttl_ms =
+        score_cache.value(kScoreCacheTtlMsName, info.score_cache_conf.ttl_ms);
+      info.score_cache_conf.num_shards =
+        score_cache.value(kScoreCacheNumShardsName, info.score_cache_conf.num_shards);
+    }
+
+    info.brand = item.value(kRosterBrandFieldName, info.brand);
+    info.numa_replicas = item.value(kRosterNumaReplicasFieldName, info.numa_replicas);
+    info.trace_every_n = item.value(kRosterTraceEveryNFieldName, info.trace_every_n);
+    info.ort_model_cache_dir = item.value(kRosterModelCacheDirFieldName, info.ort_model_cache_dir);
+    info.ort_quantize_dynamic = item.value(kRosterQuantizeFieldName, info.ort_quantize_dynamic);
+    info.ort_quantize_script = item.value(kRosterQuantizeScriptName, info.ort_quantize_script);
+    info.tf_prune_graph = item.value(kRosterPruneGraphFieldName, info.tf_prune_graph);
+
+    roster.try_emplace(name, info);
+  }
+
+  indivaduals.swap(roster);
+}
 
 }  // namespace model_server
@@ -6,6 +6,10 @@
 #include <vector>
 #include <string>
 #include "absl/container/flat_hash_map.h"
+#include "model_server/src/engine/engine.h"
+#include "model_server/src/engine/batcher.h"
+#include "model_server/src/engine/admission.h"
+#include "model_server/src/engine/score_cache.h"
 
 namespace model_server {
 
@@ -14,6 +18,33 @@ struct IndivadualInfo {
   std::string age;
   std::string home_path;
 
+  // Engine serving the graph, kBrandTF or kBrandONNX
+  std::string brand = kBrandTF;
+
+  bool        enable_batching = false;
+  BatcherConf batcher_conf;
+
+  AdmissionConf admission_conf;
+
+  ScoreCacheConf score_cache_conf;
+
+  // One engine per NUMA node, each serving the threads running on its node
+  bool numa_replicas = false;
+
+  // Trace 1 in every n requests, 0 disables it
+  int32_t trace_every_n = 0;
+
+  // Cache of ORT optimized models, empty disables it
+  std::string ort_model_cache_dir;
+
+  // ORT serves a dynamically int8 quantized variant of the graph
+  bool ort_quantize_dynamic = false;
+  // Script building the int8 variant
+  std::string ort_quantize_script = "script/ort_quantize_dynamic.py";
+
+  // TF prunes the graph to what the inputs and outputs need before importing it
+  bool tf_prune_graph = false;
+
   std::string graph_file_loc() const noexcept(false);
   std::string model_conf_loc() const noexcept(false);
 };
@@ -0,0 +1,137 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/server/client.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "absl/cleanup/cleanup.h"
+#include "model_server/src/engine/admission.h"
+
+namespace model_server {
+
+Client::Client(const std::string& host, int32_t port) noexcept(false) :
+  fd_(-1),
+  next_id_(1),
+  frame_(),
+  response_() {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo *addrs = nullptr;
+  const std::string& service = std::to_string(port);
+  const int32_t ret = getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &addrs);
+  if (0 != ret) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Failed to resolve " + host + ": " + gai_strerror(ret);
+    throw std::runtime_error(err_msg);
+  }
+  auto addrs_cleanup = absl::MakeCleanup([addrs]() { freeaddrinfo(addrs); });
+
+  std::string last_error = "no address";
+  for (struct addrinfo *addr = addrs; nullptr != addr; addr = addr->ai_next) {
+    int32_t fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+    if (fd < 0) {
+      last_error = strerror(errno);
+      continue;
+    }
+    if (0 != connect(fd, addr->ai_addr, addr->ai_addrlen)) {
+      last_error = strerror(errno);
+      close(fd);
+      continue;
+    }
+    fd_ = fd;
+    break;
+  }
+  if (fd_ < 0) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Failed to connect " + host + ":" + service + ": " + last_error;
+    throw std::runtime_error(err_msg);
+  }
+
+  int32_t on = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+Client::~Client() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void Client::call(
+  const std::string& model, Instance *instance, Score *score, absl::Duration timeout, Priority priority
+) noexcept(false) {  // NOLINT
+  const uint64_t id = next_id_++;
+  const int64_t timeout_us = absl::InfiniteDuration() == timeout ? 0 : std::max<int64_t>(
+    absl::ToInt64Microseconds(timeout), 1
+  );  // NOLINT
+  frame_.clear();
+  encode_request(id, model, timeout_us, priority, *instance, *score, &frame_);
+  write_all(frame_.data(), frame_.size());
+
+  frame_.resize(sizeof(FrameHeader));
+  read_all(frame_.data(), sizeof(FrameHeader));
+  uint32_t body_size = 0;
+  parse_frame_header(frame_.data(), frame_.size(), &body_size);
+  frame_.resize(body_size);
+  read_all(frame_.data(), body_size);
+  decode_response(frame_.data(), frame_.size(), &response_);
+
+  if (id != response_.id) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Response " + std::to_string(response_.id) + " does not match request " + std::to_string(id);
+    throw std::runtime_error(err_msg);
+  }
+  if (kStatusRejected == response_.status) {
+    throw AdmissionRejected("[" + model + "] " + response_.message);
+  }
+  if (kStatusOk != response_.status) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "[" + model + "] status " + std::to_string(response_.status) + ": " + response_.message;
+    throw std::runtime_error(err_msg);
+  }
+  score->targets.swap(response_.score.targets);
+}
+
+void Client::write_all(const char *data, size_t size) noexcept(false) {
+  while (size > 0) {
+    const ssize_t n = ::send(fd_, data, size, MSG_NOSIGNAL);
+    if (n < 0 && EINTR == errno) {
+      continue;
+    }
+    if (n <= 0) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + "Failed to send: " + strerror(errno);
+      throw std::runtime_error(err_msg);
+    }
+    data += n;
+    size -= n;
+  }
+}
+
+void Client::read_all(char *data, size_t size) noexcept(false) {
+  while (size > 0) {
+    const ssize_t n = ::recv(fd_, data, size, 0);
+    if (n < 0 && EINTR == errno) {
+      continue;
+    }
+    if (n <= 0) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + (0 == n ? std::string("Connection closed by server") : "Failed to receive: " + std::string(strerror(errno)));
+      throw std::runtime_error(err_msg);
+    }
+    data += n;
+    size -= n;
+  }
+}
+
+}  // namespace model_server
@@ -0,0 +1,43 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_SERVER_CLIENT_H_
+#define MODEL_SERVER_SRC_SERVER_CLIENT_H_
+
+#include <stdint.h>
+#include <string>
+#include "absl/time/time.h"
+#include "model_server/src/engine/sample.h"
+#include "model_server/src/server/protocol.h"
+
+namespace model_server {
+
+// Blocking client over one connection, not thread safe, use one client per thread
+class Client {
+ public:
+  Client(const std::string& host, int32_t port) noexcept(false);
+  virtual ~Client();
+
+  Client() = delete;
+  Client& operator=(const Client&) = delete;
+  Client(const Client&) = delete;
+
+  // Send the instance to the named model and wait for the score, server side errors are thrown.
+  // The server sheds the request with AdmissionRejected if it can not be answered within timeout.
+  void call(
+    const std::string& model, Instance *instance, Score *score, absl::Duration timeout = absl::InfiniteDuration(),
+    Priority priority = Priority::kNormal
+  ) noexcept(false);  // NOLINT
+
+ private:
+  void write_all(const char *data, size_t size) noexcept(false);
+  void read_all(char *data, size_t size) noexcept(false);
+
+  int32_t     fd_;
+  uint64_t    next_id_;
+  std::string frame_;
+  Response    response_;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_SERVER_CLIENT_H_
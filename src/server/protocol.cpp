@@ -0,0 +1,279 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/server/protocol.h"
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "absl/strings/str_format.h"
+
+namespace model_server {
+
+namespace {
+
+class WireWriter {
+ public:
+  explicit WireWriter(std::string *frame) : frame_(frame), header_offset_(frame->size()) {
+    frame_->resize(header_offset_ + sizeof(FrameHeader));
+  }
+
+  template <typename T>
+  void put(T value) {
+    frame_->append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  void put_string(const std::string& value) {
+    put<uint32_t>(static_cast<uint32_t>(value.size()));
+    frame_->append(value);
+  }
+
+  void put_tensor_data(const Tensor& tensor) {
+    put<int32_t>(static_cast<int32_t>(tensor.dtype));
+    put<uint32_t>(static_cast<uint32_t>(tensor.data.size()));
+    frame_->append(tensor.data.data(), tensor.data.size());
+    put<uint32_t>(static_cast<uint32_t>(tensor.row_splits.size()));
+    frame_->append(reinterpret_cast<const char*>(tensor.row_splits.data()), tensor.row_splits.size() * sizeof(int64_t));
+  }
+
+  // Fill in the header once the body is complete
+  void finish() noexcept(false) {
+    const size_t body_size = frame_->size() - header_offset_ - sizeof(FrameHeader);
+    if (body_size > kMaxFrameBodySize) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Frame body size %d exceeds %d", body_size, kMaxFrameBodySize);
+      throw std::runtime_error(err_msg);
+    }
+    FrameHeader header {
+      .magic = kFrameMagic,
+      .body_size = static_cast<uint32_t>(body_size)
+    };
+    memcpy(frame_->data() + header_offset_, &header, sizeof(header));
+  }
+
+ private:
+  std::string *frame_;
+  size_t       header_offset_;
+};
+
+class WireReader {
+ public:
+  WireReader(const char *data, size_t size, size_t offset = 0) : data_(data), size_(size), offset_(offset) {}
+
+  size_t offset() const noexcept { return offset_; }
+
+  template <typename T>
+  T get() noexcept(false) {
+    T value;
+    memcpy(&value, take(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  void get_string(std::string *value) noexcept(false) {
+    const uint32_t size = get<uint32_t>();
+    value->assign(take(size), size);
+  }
+
+  void get_tensor_data(Tensor *tensor) noexcept(false) {
+    tensor->dtype = static_cast<DataType>(get<int32_t>());
+    const uint32_t size = get<uint32_t>();
+    if (0 != size % data_type_size(tensor->dtype)) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Tensor %s of %d bytes does not hold whole %s values",
+          tensor->name, size, data_type_name(tensor->dtype));
+      throw std::runtime_error(err_msg);
+    }
+    tensor->data.assign(take(size), size);
+
+    const uint32_t num_row_splits = get<uint32_t>();
+    const char *row_splits = take(static_cast<size_t>(num_row_splits) * sizeof(int64_t));
+    tensor->row_splits.resize(num_row_splits);
+    if (num_row_splits > 0) {
+      memcpy(tensor->row_splits.data(), row_splits, num_row_splits * sizeof(int64_t));
+      check_ragged(*tensor);
+    }
+  }
+
+  void expect_end() noexcept(false) {
+    if (offset_ != size_) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Frame body has %d trailing bytes", size_ - offset_);
+      throw std::runtime_error(err_msg);
+    }
+  }
+
+ private:
+  const char *take(size_t size) noexcept(false) {
+    if (size > size_ - offset_) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Frame body truncated, need %d bytes at offset %d of %d", size, offset_, size_);
+      throw std::runtime_error(err_msg);
+    }
+    const char *data = data_ + offset_;
+    offset_ += size;
+    return data;
+  }
+
+  const char *data_;
+  size_t      size_;
+  size_t      offset_;
+};
+
+}  // namespace
+
+bool parse_frame_header(const char *data, size_t size, uint32_t *body_size) noexcept(false) {
+  if (size < sizeof(FrameHeader)) {
+    return false;
+  }
+
+  FrameHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (kFrameMagic != header.magic) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + absl::StrFormat("Bad frame magic 0x%08x", header.magic);
+    throw std::runtime_error(err_msg);
+  }
+  if (header.body_size > kMaxFrameBodySize) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + absl::StrFormat("Frame body size %d exceeds %d", header.body_size, kMaxFrameBodySize);
+    throw std::runtime_error(err_msg);
+  }
+  *body_size = header.body_size;
+  return true;
+}
+
+void encode_request(
+  uint64_t id, const std::string& model, int64_t timeout_us, Priority priority, const Instance& instance,
+  const Score& score, std::string *frame
+) noexcept(false) {  // NOLINT
+  WireWriter writer(frame);
+  writer.put<uint64_t>(id);
+  writer.put_string(model);
+  writer.put<int64_t>(timeout_us);
+  writer.put<int32_t>(static_cast<int32_t>(priority));
+  writer.put<uint32_t>(static_cast<uint32_t>(instance.features.size()));
+  for (const auto& feature : instance.features) {
+    writer.put_string(feature.name);
+    writer.put<int64_t>(feature.batch_size);
+    writer.put_tensor_data(feature);
+  }
+  writer.put<uint32_t>(static_cast<uint32_t>(score.targets.size()));
+  for (const auto& target : score.targets) {
+    writer.put_string(target.name);
+    writer.put<int64_t>(target.batch_size);
+  }
+  writer.finish();
+}
+
+void encode_response(
+  uint64_t id, int32_t status, const std::string& message, const Score& score, std::string *frame
+) noexcept(false) {  // NOLINT
+  WireWriter writer(frame);
+  writer.put<uint64_t>(id);
+  writer.put<int32_t>(status);
+  writer.put_string(message);
+  writer.put<uint32_t>(static_cast<uint32_t>(score.targets.size()));
+  for (const auto& target : score.targets) {
+    writer.put_string(target.name);
+    writer.put<int64_t>(target.batch_size);
+    writer.put_tensor_data(target);
+  }
+  writer.finish();
+}
+
+size_t decode_request_head(const char *body, size_t size, Request *request) noexcept(false) {
+  WireReader reader(body, size);
+  request->id = reader.get<uint64_t>();
+  reader.get_string(&request->model);
+  request->timeout_us = reader.get<int64_t>();
+  const int32_t priority = reader.get<int32_t>();
+  if (priority < 0 || priority >= kNumPriorities) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + absl::StrFormat("Bad priority %d", priority);
+    throw std::runtime_error(err_msg);
+  }
+  request->priority = static_cast<Priority>(priority);
+  return reader.offset();
+}
+
+void decode_request_tensors(
+  const char *body, size_t size, size_t head_size, Instance *instance, Score *score
+) noexcept(false) {  // NOLINT
+  WireReader reader(body, size, head_size);
+  const uint32_t num_features = reader.get<uint32_t>();
+  if (num_features > size) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + absl::StrFormat("Bad feature count %d", num_features);
+    throw std::runtime_error(err_msg);
+  }
+  if (0 == num_features) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Request has no feature";
+    throw std::runtime_error(err_msg);
+  }
+  // Names come off the wire, whatever layout the sample had is gone
+  instance->signature_id = 0;
+  instance->features.resize(num_features);
+  for (auto& feature : instance->features) {
+    reader.get_string(&feature.name);
+    feature.batch_size = reader.get<int64_t>();
+    // Every feature holds the rows of the request, batching and splitting scores rely on it
+    const int64_t rows = instance->features.front().batch_size;
+    if (feature.batch_size <= 0 || feature.batch_size != rows) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Feature %s has batch size %d, the request %d", feature.name, feature.batch_size, rows);
+      throw std::runtime_error(err_msg);
+    }
+    // Ragged splits were checked against the rows as they were read, dense values must fill them
+    reader.get_tensor_data(&feature);
+    if (!feature.ragged() && 0 != feature.size() % rows) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + absl::StrFormat("Feature %s has %d values, not a multiple of its %d rows", feature.name, feature.size(),
+          rows);
+      throw std::invalid_argument(err_msg);
+    }
+  }
+
+  const uint32_t num_targets = reader.get<uint32_t>();
+  if (num_targets > size) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + absl::StrFormat("Bad target count %d", num_targets);
+    throw std::runtime_error(err_msg);
+  }
+  score->targets.resize(num_targets);
+  for (auto& target : score->targets) {
+    reader.get_string(&target.name);
+    // Targets are filled for the rows of the features, whatever the client asked
+    reader.get<int64_t>();
+    target.batch_size = instance->features.front().batch_size;
+    target.data.clear();
+    target.row_splits.clear();
+  }
+  reader.expect_end();
+}
+
+void decode_request(const char *body, size_t size, Request *request) noexcept(false) {
+  decode_request_tensors(body, size, decode_request_head(body, size, request), &request->instance, &request->score);
+}
+
+void decode_response(const char *body, size_t size, Response *response) noexcept(false) {
+  WireReader reader(body, size);
+  response->id = reader.get<uint64_t>();
+  response->status = reader.get<int32_t>();
+  reader.get_string(&response->message);
+
+  const uint32_t num_targets = reader.get<uint32_t>();
+  if (num_targets > size) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + absl::StrFormat("Bad target count %d", num_targets);
+    throw std::runtime_error(err_msg);
+  }
+  response->score.targets.resize(num_targets);
+  for (auto& target : response->score.targets) {
+    reader.get_string(&target.name);
+    target.batch_size = reader.get<int64_t>();
+    reader.get_tensor_data(&target);
+  }
+  reader.expect_end();
+}
+
+}  // namespace model_server
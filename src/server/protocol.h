@@ -0,0 +1,78 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_SERVER_PROTOCOL_H_
+#define MODEL_SERVER_SRC_SERVER_PROTOCOL_H_
+
+#include <stdint.h>
+#include <string>
+#include "model_server/src/engine/sample.h"
+
+namespace model_server {
+
+// Every message on the wire is a frame: a fixed header followed by body_size bytes of body.
+// Integers and tensor values are in host byte order, client and server are expected to share it.
+//
+// request body:  u64 id | str model | i64 timeout_us | i32 priority | u32 n | n * (str name | i64 batch_size | data)
+//                                                  | u32 k | k * (str name | i64 batch_size)
+// response body: u64 id | i32 status | str message | u32 k | k * (str name | i64 batch_size | data)
+// str is u32 length followed by the bytes, data is i32 DataType | u32 m | m bytes of values
+// | u32 r | r * i64 row splits, r is 0 for a dense tensor. A timeout_us of 0 means no deadline,
+// priority is a Priority.
+struct FrameHeader {
+  uint32_t magic;
+  uint32_t body_size;
+};
+
+const uint32_t kFrameMagic       = 0x4d534652;
+const uint32_t kMaxFrameBodySize = 64 << 20;
+
+enum ResponseStatus : int32_t {
+  kStatusOk         = 0,
+  kStatusBadRequest = 1,
+  kStatusError      = 2,
+  kStatusRejected   = 3,  // shed by admission control, the model never saw it
+};
+
+struct Request {
+  uint64_t    id = 0;
+  std::string model;
+  int64_t     timeout_us = 0;
+  Priority    priority   = Priority::kNormal;
+  Instance    instance;
+  Score       score;
+};
+
+struct Response {
+  uint64_t    id     = 0;
+  int32_t     status = kStatusOk;
+  std::string message;
+  Score       score;
+};
+
+// Parse the header at the front of data, return false if it has not fully arrived yet
+bool parse_frame_header(const char *data, size_t size, uint32_t *body_size) noexcept(false);
+
+// Append a whole frame to the end of frame
+void encode_request(
+  uint64_t id, const std::string& model, int64_t timeout_us, Priority priority, const Instance& instance,
+  const Score& score, std::string *frame
+) noexcept(false);  // NOLINT
+void encode_response(
+  uint64_t id, int32_t status, const std::string& message, const Score& score, std::string *frame
+) noexcept(false);  // NOLINT
+
+// Decode a frame body, feature and target values are copied straight into the tensors. A request
+// needs at least one feature and all of them must hold the same positive number of rows.
+void decode_request(const char *body, size_t size, Request *request) noexcept(false);
+// The two halves of decode_request: the head holds everything ahead of the tensors and returns its size,
+// so a request already out of time is answered before any value is copied. The tensors may go to
+// another sample than the request's own, e.g. a pooled one, whose buffers are then reused.
+size_t decode_request_head(const char *body, size_t size, Request *request) noexcept(false);
+void decode_request_tensors(
+  const char *body, size_t size, size_t head_size, Instance *instance, Score *score
+) noexcept(false);  // NOLINT
+void decode_response(const char *body, size_t size, Response *response) noexcept(false);
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_SERVER_PROTOCOL_H_
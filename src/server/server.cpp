@@ -0,0 +1,513 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/server/server.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <mutex>  // NOLINT
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "absl/cleanup/cleanup.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/log/log.h"
+#include "absl/time/clock.h"
+#include "model_server/src/engine/admission.h"
+#include "model_server/src/util/os/numa.h"
+#include "model_server/src/util/os/thread_cpu.h"
+
+namespace model_server {
+
+static const int32_t kMaxEpollEvents = 256;
+static const size_t  kReadChunkSize  = 64 << 10;
+static const size_t  kMaxTaskBatch   = 16;
+
+struct Server::Connection {
+  explicit Connection(int32_t socket_fd) :
+    fd(socket_fd), in(std::make_shared<std::string>()), out_mtx(), out(), out_offset(0), closed(false) {}
+
+  int32_t                      fd;
+  // Touched by the owning IO thread only. Queued tasks share it, so it is replaced rather than
+  // written to once a frame has been handed out of it.
+  std::shared_ptr<std::string> in;
+
+  std::mutex  out_mtx;
+  std::string out;
+  size_t      out_offset;
+  bool        closed;
+};
+
+struct Server::IOThread {
+  int32_t     epoll_fd  = -1;
+  int32_t     wakeup_fd = -1;
+  std::thread thread;
+  absl::flat_hash_map<int32_t, std::shared_ptr<Connection>> connections;
+};
+
+Server::Server(const ServerConf& server_conf, Dispatcher dispatcher, Acquirer acquirer) noexcept(false) :
+  conf_(server_conf),
+  dispatcher_(std::move(dispatcher)),
+  acquirer_(std::move(acquirer)),
+  running_(false),
+  listen_fd_(-1),
+  bound_port_(-1),
+  io_threads_(),
+  workers_(),
+  tasks_(std::max(server_conf.queue_capacity, 2)),
+  tasks_ready_(0) {
+  if (!dispatcher_) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Dispatcher is empty";
+    throw std::runtime_error(err_msg);
+  }
+  if (conf_.num_io_threads <= 0 || conf_.num_workers <= 0 || conf_.queue_capacity < 2
+    || conf_.port < 0 || conf_.port > 65535) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Invalid server conf: " + conf_.detail();
+    throw std::runtime_error(err_msg);
+  }
+}
+
+Server::~Server() {
+  stop();
+}
+
+void Server::start() noexcept(false) {
+  if (listen_fd_ >= 0) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Server already started";
+    throw std::runtime_error(err_msg);
+  }
+  listen_on();
+  running_ = true;
+
+  std::vector<std::vector<int64_t>> node_cpus;
+  if (conf_.pin_workers_to_numa && !get_numa_node_cpus(&node_cpus)) {
+    LOG(WARNING) << "Failed to get NUMA nodes, workers are not pinned";
+  }
+  for (int32_t i = 0; i < conf_.num_workers; ++i) {
+    if (node_cpus.empty()) {
+      workers_.emplace_back(&Server::work_loop, this);
+      continue;
+    }
+    workers_.emplace_back([this, cpus = node_cpus[i % node_cpus.size()], i]() {
+      if (!set_thread_cpus(cpus)) {
+        LOG(WARNING) << "Failed to pin worker " << i;
+      }
+      work_loop();
+    });
+  }
+
+  for (int32_t i = 0; i < conf_.num_io_threads; ++i) {
+    std::unique_ptr<IOThread> io_thread(new IOThread());
+    io_thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    io_thread->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (io_thread->epoll_fd < 0 || io_thread->wakeup_fd < 0) {
+      const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+        + "Failed to create epoll: " + strerror(errno);
+      io_threads_.push_back(std::move(io_thread));
+      stop();
+      throw std::runtime_error(err_msg);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = io_thread->wakeup_fd;
+    epoll_ctl(io_thread->epoll_fd, EPOLL_CTL_ADD, io_thread->wakeup_fd, &event);
+    // Every IO thread waits on the listening socket, EPOLLEXCLUSIVE wakes only one of them per connection
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.fd = listen_fd_;
+    epoll_ctl(io_thread->epoll_fd, EPOLL_CTL_ADD, listen_fd_, &event);
+
+    io_thread->thread = std::thread(&Server::io_loop, this, io_thread.get());
+    io_threads_.push_back(std::move(io_thread));
+  }
+  LOG(INFO) << "[" << conf_.detail() << "] Server listening on port " << bound_port_;
+}
+
+void Server::stop() noexcept {
+  running_ = false;
+  for (auto& io_thread : io_threads_) {
+    if (io_thread->thread.joinable()) {
+      uint64_t one = 1;
+      if (write(io_thread->wakeup_fd, &one, sizeof(one)) < 0) {
+        LOG(ERROR) << "Failed to wake up IO thread: " << strerror(errno);
+      }
+      io_thread->thread.join();
+    }
+  }
+
+  // No new request can arrive now, let the queued ones answer before the sockets go away.
+  // A worker takes exactly one count per wakeup and leaves once it sees running_ off.
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    tasks_ready_.post();
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+
+  for (auto& io_thread : io_threads_) {
+    std::vector<std::shared_ptr<Connection>> connections;
+    for (auto& [fd, connection] : io_thread->connections) {
+      connections.push_back(connection);
+    }
+    for (auto& connection : connections) {
+      close_connection(io_thread.get(), connection);
+    }
+    if (io_thread->epoll_fd >= 0) {
+      close(io_thread->epoll_fd);
+    }
+    if (io_thread->wakeup_fd >= 0) {
+      close(io_thread->wakeup_fd);
+    }
+  }
+  io_threads_.clear();
+
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+    LOG(INFO) << "[" << conf_.detail() << "] Server stopped";
+  }
+}
+
+void Server::listen_on() noexcept(false) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  struct addrinfo *addrs = nullptr;
+  const std::string& service = std::to_string(conf_.port);
+  const int32_t ret = getaddrinfo(conf_.host.empty() ? nullptr : conf_.host.c_str(), service.c_str(), &hints, &addrs);
+  if (0 != ret) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Failed to resolve " + conf_.host + ": " + gai_strerror(ret);
+    throw std::runtime_error(err_msg);
+  }
+  auto addrs_cleanup = absl::MakeCleanup([addrs]() { freeaddrinfo(addrs); });
+
+  std::string last_error = "no address";
+  for (struct addrinfo *addr = addrs; nullptr != addr; addr = addr->ai_next) {
+    int32_t fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol);
+    if (fd < 0) {
+      last_error = strerror(errno);
+      continue;
+    }
+    int32_t on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (0 != bind(fd, addr->ai_addr, addr->ai_addrlen) || 0 != listen(fd, SOMAXCONN)) {
+      last_error = strerror(errno);
+      close(fd);
+      continue;
+    }
+    listen_fd_ = fd;
+    break;
+  }
+  if (listen_fd_ < 0) {
+    const std::string& err_msg = "[" + std::string(__FILE__) + ":" + std::to_string(__LINE__) + "] "
+      + "Failed to listen on " + conf_.host + ":" + service + ": " + last_error;
+    throw std::runtime_error(err_msg);
+  }
+
+  struct sockaddr_storage bound_addr;
+  socklen_t bound_addr_len = sizeof(bound_addr);
+  getsockname(listen_fd_, reinterpret_cast<struct sockaddr*>(&bound_addr), &bound_addr_len);
+  if (AF_INET6 == bound_addr.ss_family) {
+    bound_port_ = ntohs(reinterpret_cast<struct sockaddr_in6*>(&bound_addr)->sin6_port);
+  } else {
+    bound_port_ = ntohs(reinterpret_cast<struct sockaddr_in*>(&bound_addr)->sin_port);
+  }
+}
+
+void Server::io_loop(IOThread *io_thread) noexcept {
+  std::vector<struct epoll_event> events(kMaxEpollEvents);
+  while (running_) {
+    const int32_t num_events = epoll_wait(io_thread->epoll_fd, events.data(), kMaxEpollEvents, -1);
+    if (num_events < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      LOG(ERROR) << "epoll_wait failed: " << strerror(errno);
+      break;
+    }
+
+    for (int32_t i = 0; i < num_events; ++i) {
+      const int32_t fd = events[i].data.fd;
+      if (fd == io_thread->wakeup_fd) {
+        uint64_t count = 0;
+        while (read(fd, &count, sizeof(count)) > 0) {}
+        continue;
+      }
+      if (fd == listen_fd_) {
+        accept_all(io_thread);
+        continue;
+      }
+
+      auto connection = io_thread->connections.find(fd);
+      if (io_thread->connections.end() == connection) {
+        continue;
+      }
+      // Keep it alive through close_connection below
+      std::shared_ptr<Connection> current = connection->second;
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        close_connection(io_thread, current);
+        continue;
+      }
+      if (events[i].events & EPOLLOUT) {
+        std::lock_guard<std::mutex> lock(current->out_mtx);
+        if (!flush(current.get())) {
+          shutdown(current->fd, SHUT_RDWR);
+        }
+      }
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+        read_all(io_thread, current);
+      }
+    }
+  }
+}
+
+void Server::accept_all(IOThread *io_thread) noexcept {
+  while (true) {
+    const int32_t fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      if (EAGAIN != errno && EWOULDBLOCK != errno) {
+        LOG(ERROR) << "accept failed: " << strerror(errno);
+      }
+      return;
+    }
+
+    int32_t on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    // Edge triggered, EPOLLOUT only fires when a full send buffer drains again
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = fd;
+    if (0 != epoll_ctl(io_thread->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+      LOG(ERROR) << "epoll_ctl failed: " << strerror(errno);
+      close(fd);
+      continue;
+    }
+    io_thread->connections[fd] = std::make_shared<Connection>(fd);
+  }
+}
+
+void Server::read_all(IOThread *io_thread, const std::shared_ptr<Connection>& connection) noexcept {
+  bool eof = false;
+  std::string& in = *connection->in;
+  while (true) {
+    const size_t size = in.size();
+    in.resize(size + kReadChunkSize);
+    const ssize_t n = read(connection->fd, in.data() + size, kReadChunkSize);
+    in.resize(size + (n > 0 ? n : 0));
+    if (n > 0) {
+      continue;
+    }
+    if (n < 0 && EINTR == errno) {
+      continue;
+    }
+    if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+      break;
+    }
+    eof = true;
+    break;
+  }
+
+  size_t offset = 0;
+  const absl::Time arrival = absl::Now();
+  try {
+    uint32_t body_size = 0;
+    while (parse_frame_header(in.data() + offset, in.size() - offset, &body_size)
+      && in.size() - offset - sizeof(FrameHeader) >= body_size) {
+      enqueue(Task {
+        .connection = connection,
+        .buffer = connection->in,
+        .body_offset = offset + sizeof(FrameHeader),
+        .body_size = body_size,
+        .arrival = arrival
+      });  // NOLINT
+      offset += sizeof(FrameHeader) + body_size;
+    }
+  } catch (const std::exception& e) {
+    LOG(ERROR) << e.what();
+    eof = true;
+  }
+  if (offset > 0) {
+    // Only the partial frame at the tail is copied, the workers keep reading the complete ones in place
+    auto rest = std::make_shared<std::string>();
+    rest->reserve(std::max(in.size() - offset, kReadChunkSize));
+    rest->append(in, offset, std::string::npos);
+    connection->in = std::move(rest);
+  }
+
+  if (eof) {
+    close_connection(io_thread, connection);
+  }
+}
+
+void Server::enqueue(Task&& task) noexcept {
+  // A full queue pushes back on the IO thread, which in turn stops draining its sockets
+  while (!tasks_.try_push(std::move(task))) {
+    if (!running_) {
+      return;
+    }
+    std::this_thread::yield();
+  }
+  tasks_ready_.post();
+}
+
+void Server::work_loop() noexcept {
+  std::vector<Task> tasks(kMaxTaskBatch);
+  // Reused across tasks, decoding into it keeps the capacity of its names and tensors
+  Request request;
+  while (true) {
+    tasks_ready_.wait();
+
+    // Take a fair share of the backlog at once, a worker hoarding it would idle the others.
+    // Counts of the extra tasks are left behind, they only cause a spurious wakeup later.
+    while (true) {
+      const size_t share = tasks_.size() / conf_.num_workers;
+      const size_t count = tasks_.try_pop_batch(tasks.data(), std::clamp(share, size_t(1), kMaxTaskBatch));
+      if (0 == count) {
+        break;
+      }
+      for (size_t i = 0; i < count; ++i) {
+        handle(tasks[i], &request);
+        tasks[i] = Task();
+      }
+    }
+
+    if (!running_) {
+      break;
+    }
+  }
+}
+
+void Server::handle(const Task& task, Request *scratch) noexcept {
+  Request& request = *scratch;
+  request.id = 0;
+  const char *body = task.buffer->data() + task.body_offset;
+  std::string frame;
+  try {
+    size_t head_size = 0;
+    try {
+      head_size = decode_request_head(body, task.body_size, &request);
+    } catch (const std::exception& e) {
+      encode_response(request.id, kStatusBadRequest, e.what(), Score(), &frame);
+      send(task.connection, &frame);
+      return;
+    }
+
+    // Checked before the tensors are decoded, a request that waited too long is not worth copying
+    const absl::Time deadline = request.timeout_us > 0
+      ? task.arrival + absl::Microseconds(request.timeout_us) : absl::InfiniteFuture();
+    if (absl::Now() >= deadline) {
+      encode_response(request.id, kStatusRejected, "Deadline exceeded while queueing", Score(), &frame);
+      send(task.connection, &frame);
+      return;
+    }
+    // A pooled sample of the model keeps the tensor buffers of its last request, the scratch those
+    // of whatever model the worker served last
+    SamplePool::Handle sample;
+    try {
+      if (acquirer_) {
+        sample = acquirer_(request.model);
+      }
+    } catch (const std::exception& e) {
+      encode_response(request.id, kStatusError, e.what(), Score(), &frame);
+      send(task.connection, &frame);
+      return;
+    }
+    Instance *instance = nullptr == sample ? &request.instance : &sample->instance;
+    Score *score = nullptr == sample ? &request.score : &sample->score;
+    try {
+      decode_request_tensors(body, task.body_size, head_size, instance, score);
+    } catch (const std::exception& e) {
+      encode_response(request.id, kStatusBadRequest, e.what(), Score(), &frame);
+      send(task.connection, &frame);
+      return;
+    }
+
+    try {
+      dispatcher_(request.model, deadline, request.priority, instance, score);
+      encode_response(request.id, kStatusOk, "", *score, &frame);
+    } catch (const AdmissionRejected& e) {
+      frame.clear();
+      encode_response(request.id, kStatusRejected, e.what(), Score(), &frame);
+    } catch (const std::exception& e) {
+      frame.clear();
+      encode_response(request.id, kStatusError, e.what(), Score(), &frame);
+    } catch (...) {
+      frame.clear();
+      encode_response(request.id, kStatusError, "Unknown exception", Score(), &frame);
+    }
+    send(task.connection, &frame);
+  } catch (const std::exception& e) {
+    LOG(ERROR) << e.what();
+  }
+}
+
+void Server::send(const std::shared_ptr<Connection>& connection, std::string *frame) noexcept {
+  std::lock_guard<std::mutex> lock(connection->out_mtx);
+  if (connection->closed) {
+    return;
+  }
+  if (connection->out_offset == connection->out.size()) {
+    connection->out.swap(*frame);
+    connection->out_offset = 0;
+  } else {
+    connection->out.append(*frame);
+  }
+  // Whatever does not fit into the socket now is left to the owning IO thread on EPOLLOUT
+  if (!flush(connection.get())) {
+    shutdown(connection->fd, SHUT_RDWR);
+  }
+}
+
+bool Server::flush(Connection *connection) noexcept {
+  std::string& out = connection->out;
+  while (connection->out_offset < out.size()) {
+    const ssize_t n = ::send(
+      connection->fd, out.data() + connection->out_offset, out.size() - connection->out_offset, MSG_NOSIGNAL
+    );  // NOLINT
+    if (n > 0) {
+      connection->out_offset += n;
+      continue;
+    }
+    if (n < 0 && EINTR == errno) {
+      continue;
+    }
+    return n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno);
+  }
+  out.clear();
+  connection->out_offset = 0;
+  return true;
+}
+
+void Server::close_connection(IOThread *io_thread, const std::shared_ptr<Connection>& connection) noexcept {
+  io_thread->connections.erase(connection->fd);
+  epoll_ctl(io_thread->epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+
+  // Workers may still hold the connection, closed keeps them off a reused fd
+  std::lock_guard<std::mutex> lock(connection->out_mtx);
+  if (!connection->closed) {
+    connection->closed = true;
+    close(connection->fd);
+  }
+}
+
+}  // namespace model_server
@@ -0,0 +1,114 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_SERVER_SERVER_H_
+#define MODEL_SERVER_SRC_SERVER_SERVER_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+#include "absl/time/time.h"
+#include "model_server/src/util/functional/mpmc_queue.h"
+#include "model_server/src/util/os/semaphore.h"
+#include "model_server/src/engine/sample.h"
+#include "model_server/src/engine/sample_pool.h"
+#include "model_server/src/server/protocol.h"
+
+namespace model_server {
+
+struct ServerConf {
+  std::string host           = "";
+  int32_t     port           = 8610;
+  int32_t     num_io_threads = 1;
+  int32_t     num_workers    = 16;
+  int32_t     queue_capacity = 4096;
+  // Pin worker i to the CPUs of NUMA node i % nodes, so models with numa_replicas serve it locally
+  bool        pin_workers_to_numa = false;
+
+  std::string detail() const noexcept {
+    return "host: " + host + ", port: " + std::to_string(port)
+      + ", num_io_threads: " + std::to_string(num_io_threads)
+      + ", num_workers: " + std::to_string(num_workers)
+      + ", queue_capacity: " + std::to_string(queue_capacity)
+      + ", pin_workers_to_numa: " + std::to_string(pin_workers_to_numa);
+  }
+};
+
+// Serves framed requests over TCP. IO threads own the sockets and only move bytes,
+// every complete frame is handed to the inference workers through a lock-free queue.
+// The worker decodes, dispatches and writes the response back itself, so a slow model
+// never stalls the event loops.
+class Server {
+ public:
+  // Fill the score of the named model by the deadline, any exception is returned to the client as an error
+  // and AdmissionRejected as kStatusRejected
+  using Dispatcher = std::function<
+    void(const std::string& model, absl::Time deadline, Priority priority, Instance *instance, Score *score)
+  >;  // NOLINT
+  // A pooled sample shaped for the named model to decode its request into, or an empty handle to decode
+  // into the worker's own scratch
+  using Acquirer = std::function<SamplePool::Handle(const std::string& model)>;
+
+  Server(const ServerConf& server_conf, Dispatcher dispatcher, Acquirer acquirer = nullptr) noexcept(false);
+  virtual ~Server();
+
+  Server() = delete;
+  Server& operator=(const Server&) = delete;
+  Server(const Server&) = delete;
+
+  // Bind, listen and spawn the IO threads, returns immediately
+  void start() noexcept(false);
+
+  // Stop accepting, wait for inflight requests and close all connections
+  void stop() noexcept;
+
+  // The port actually bound, differs from the conf when it asks for port 0
+  int32_t port() const noexcept { return bound_port_; }
+
+ private:
+  struct Connection;
+  struct IOThread;
+
+  // The body is a slice of the read buffer it arrived in, which stays alive until every task on it is done
+  struct Task {
+    std::shared_ptr<Connection>        connection;
+    std::shared_ptr<const std::string> buffer;
+    size_t                             body_offset;
+    size_t                             body_size;
+    absl::Time                         arrival;  // the request timeout counts from here, queueing included
+  };
+
+  void listen_on() noexcept(false);
+  void io_loop(IOThread *io_thread) noexcept;
+  void accept_all(IOThread *io_thread) noexcept;
+  void read_all(IOThread *io_thread, const std::shared_ptr<Connection>& connection) noexcept;
+  void enqueue(Task&& task) noexcept;
+  void work_loop() noexcept;
+  void handle(const Task& task, Request *scratch) noexcept;
+  void send(const std::shared_ptr<Connection>& connection, std::string *frame) noexcept;
+  void close_connection(IOThread *io_thread, const std::shared_ptr<Connection>& connection) noexcept;
+
+  static bool flush(Connection *connection) noexcept;
+
+  ServerConf conf_;
+  Dispatcher dispatcher_;
+  Acquirer   acquirer_;
+
+  std::atomic<bool> running_;
+  int32_t           listen_fd_;
+  int32_t           bound_port_;
+
+  std::vector<std::unique_ptr<IOThread>> io_threads_;
+  std::vector<std::thread>               workers_;
+
+  // One semaphore count per queued task, workers sleep on it when the queue runs dry
+  MPMCQueue<Task> tasks_;
+  Semaphore       tasks_ready_;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_SERVER_SERVER_H_
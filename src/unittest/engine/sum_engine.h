@@ -0,0 +1,147 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_UNITTEST_ENGINE_SUM_ENGINE_H_
+#define MODEL_SERVER_SRC_UNITTEST_ENGINE_SUM_ENGINE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "absl/container/flat_hash_map.h"
+#include "model_server/src/engine/engine.h"
+
+namespace model_server {
+
+// Scores every row with the sum of its values over all features, and counts the calls it receives,
+// those on the bound path separately.
+// Ragged rows are cut or padded to 4 values, like a graph input of shape [-1, 4] would be.
+class SumEngine : public Engine {
+ public:
+  static constexpr int64_t kRaggedWidth = 4;
+
+  explicit SumEngine(const EngineConf& engine_conf) : Engine(engine_conf), calls(0), bound_calls(0), mixed(false) {
+    signature_.output_names = {"predict_node"};
+  }
+
+  // Appends an input slot to the signature, for tests running over bound or pooled samples
+  void declare_input(const std::string& name, DataType data_type, int64_t row_width) {
+    signature_.input_names.push_back(name);
+    signature_.input_data_types.push_back(data_type);
+    input_shapes_[name] = {-1, row_width};
+    input_data_types_[name] = data_type;
+    signature_.seal();
+  }
+
+  std::string brand() noexcept override { return "Sum"; }
+
+  void infer(Instance *instance, Score *score) noexcept(false) override {
+    calls.fetch_add(1, std::memory_order_relaxed);
+    const int64_t rows = instance->features[0].batch_size;
+    if (rows <= 0) {
+      throw std::invalid_argument("Sum engine takes no empty batch");
+    }
+    for (auto& target : score->targets) {
+      target.batch_size = rows;
+      target.resize(rows);
+      for (int64_t i = 0; i < rows; ++i) {
+        target.values<float>()[i] = 0.0f;
+      }
+    }
+    // Ragged features are densified into scratch, the caller's instance is left as it came
+    thread_local std::vector<char> scratch;
+    for (const auto& feature : instance->features) {
+      const char *data = feature.data.data();
+      size_t row_size = feature.size() / rows;
+      if (feature.ragged()) {
+        scratch.resize(rows * kRaggedWidth * data_type_size(feature.dtype));
+        densify(feature, kRaggedWidth, scratch.data());
+        data = scratch.data();
+        row_size = kRaggedWidth;
+      }
+      for (auto& target : score->targets) {
+        for (int64_t i = 0; i < rows; ++i) {
+          for (size_t j = 0; j < row_size; ++j) {
+            target.values<float>()[i] += DataType::kInt64 == feature.dtype
+              ? static_cast<float>(reinterpret_cast<const int64_t *>(data)[i * row_size + j])
+              : reinterpret_cast<const float *>(data)[i * row_size + j];
+          }
+        }
+      }
+    }
+  }
+
+  void infer_bound(Instance *instance, Score *score) noexcept(false) override {
+    check_bound_sample(*instance, *score);
+    bound_calls.fetch_add(1, std::memory_order_relaxed);
+    infer(instance, score);
+  }
+
+  // Bulk rows are made negative by the tests, so a batch mixing classes is caught here
+  void infer(Instance *instance, Score *score, Priority priority) noexcept(false) override {
+    const auto& feature = instance->features[0];
+    if (DataType::kFloat == feature.dtype) {
+      for (size_t i = 0; i < feature.size(); ++i) {
+        if ((Priority::kBulk == priority) != (feature.values<float>()[i] < 0.0f)) {
+          mixed.store(true);
+        }
+      }
+    }
+    infer(instance, score);
+  }
+
+  void trace(Instance *instance, Score *score) noexcept(false) override {
+    infer(instance, score);
+  }
+
+  void get_input_name_and_shape(
+    absl::flat_hash_map<std::string, std::vector<int64_t>> *input_shapes
+  ) noexcept(false) override {  // NOLINT
+    *input_shapes = input_shapes_;
+  }
+
+  void get_output_name_and_shape(
+    absl::flat_hash_map<std::string, std::vector<int64_t>> *output_shapes
+  ) noexcept(false) override {  // NOLINT
+    (*output_shapes)["predict_node"] = {-1, 1};
+  }
+
+  void get_input_name_and_data_type(
+    absl::flat_hash_map<std::string, DataType> *input_data_types
+  ) noexcept(false) override {  // NOLINT
+    *input_data_types = input_data_types_;
+  }
+
+  std::atomic<int32_t> calls;
+  std::atomic<int32_t> bound_calls;
+  std::atomic<bool>    mixed;
+
+ protected:
+  void load() override {}
+  void build() override {}
+  void set_session_options() override {}
+  void create_session() override {}
+
+ private:
+  absl::flat_hash_map<std::string, std::vector<int64_t>> input_shapes_;
+  absl::flat_hash_map<std::string, DataType>             input_data_types_;
+};
+
+// A float feature "dense" of rows x 4 whose row i holds base + i, and the target "predict_node"
+inline void make_sample(int64_t rows, float base, Sample *sample) {
+  sample->instance.features.resize(1);
+  auto& feature = sample->instance.features[0];
+  feature.name = "dense";
+  feature.batch_size = rows;
+  feature.resize(rows * 4);
+  for (size_t i = 0; i < feature.size(); ++i) {
+    feature.values<float>()[i] = base + static_cast<float>(i / 4);
+  }
+  sample->score.targets.resize(1);
+  sample->score.targets[0].name = "predict_node";
+  sample->score.targets[0].batch_size = rows;
+}
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_UNITTEST_ENGINE_SUM_ENGINE_H_
@@ -0,0 +1,101 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "absl/log/log.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/engine/admission.h"
+
+TEST(Admission, DeadlineOnly) {
+  model_server::Admission admission(model_server::AdmissionConf{});
+  ASSERT_THROW(admission.admit(absl::Now() - absl::Milliseconds(1)), model_server::AdmissionRejected);
+
+  // No concurrency limit without max_limit
+  for (int32_t i = 0; i < 1000; ++i) {
+    admission.admit(absl::InfiniteFuture());
+  }
+  ASSERT_EQ(admission.inflight(), 1000);
+  for (int32_t i = 0; i < 1000; ++i) {
+    admission.release(absl::Milliseconds(10), true);
+  }
+  ASSERT_EQ(admission.inflight(), 0);
+
+  // A deadline closer than the observed latency is hopeless
+  ASSERT_GE(admission.expected_latency(), absl::Milliseconds(9));
+  ASSERT_THROW(admission.admit(absl::Now() + absl::Milliseconds(1)), model_server::AdmissionRejected);
+  admission.admit(absl::Now() + absl::Seconds(1));
+  admission.release(absl::Milliseconds(10), true);
+}
+
+TEST(Admission, RecoversFromLatencySpike) {
+  model_server::Admission admission(model_server::AdmissionConf{});
+  admission.admit(absl::InfiniteFuture());
+  admission.release(absl::Milliseconds(1), true);
+  admission.admit(absl::InfiniteFuture());
+  admission.release(absl::Seconds(10), true);
+  ASSERT_GE(admission.expected_latency(), absl::Milliseconds(900));
+
+  // Nothing is admitted to refresh the estimate, the rejections alone bring it back under the deadline
+  int32_t rejections = 0;
+  while (rejections < 100) {
+    try {
+      admission.admit(absl::Now() + absl::Milliseconds(20));
+      break;
+    } catch (const model_server::AdmissionRejected& e) {
+      ++rejections;
+    }
+  }
+  ASSERT_GT(rejections, 0);
+  ASSERT_LT(rejections, 100);
+  ASSERT_EQ(admission.inflight(), 1);
+  admission.release(absl::Milliseconds(1), true);
+}
+
+TEST(Admission, ConcurrencyLimit) {
+  model_server::AdmissionConf admission_conf {
+    .initial_limit = 4,
+    .min_limit = 2,
+    .max_limit = 8,
+    .target_latency_us = 1000,
+    .backoff_ratio = 0.5
+  };
+  model_server::Admission admission(admission_conf);
+  ASSERT_EQ(admission.limit(), 4);
+  for (int32_t i = 0; i < 4; ++i) {
+    admission.admit(absl::InfiniteFuture());
+  }
+  ASSERT_THROW(admission.admit(absl::InfiniteFuture()), model_server::AdmissionRejected);
+
+  // Additive increase of about one per limit requests finished within target
+  for (int32_t i = 0; i < 4; ++i) {
+    admission.release(absl::Microseconds(100), true);
+  }
+  admission.admit(absl::InfiniteFuture());
+  admission.release(absl::Microseconds(100), true);
+  ASSERT_EQ(admission.limit(), 5);
+  for (int32_t i = 0; i < 1000; ++i) {
+    admission.admit(absl::InfiniteFuture());
+    admission.release(absl::Microseconds(100), true);
+  }
+  ASSERT_EQ(admission.limit(), 8);
+
+  // Multiplicative decrease once latency exceeds target, bounded by min_limit
+  admission.admit(absl::InfiniteFuture());
+  admission.release(absl::Microseconds(50000), true);
+  ASSERT_EQ(admission.limit(), 4);
+  admission.admit(absl::InfiniteFuture());
+  admission.release(absl::Microseconds(50000), false);
+  ASSERT_EQ(admission.limit(), 4);
+  absl::SleepFor(admission.expected_latency());
+  admission.admit(absl::InfiniteFuture());
+  admission.release(absl::Microseconds(50000), false);
+  ASSERT_EQ(admission.limit(), 2);
+}
+
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
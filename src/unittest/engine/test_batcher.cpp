@@ -0,0 +1,310 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <atomic>
+#include <exception>
+#include <thread>  // NOLINT
+#include <vector>
+#include "absl/log/log.h"
+#include "gtest/gtest.h"
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/engine/batcher.h"
+#include "model_server/src/engine/completion_queue.h"
+#include "model_server/src/unittest/engine/sum_engine.h"
+
+using model_server::SumEngine;
+using model_server::make_sample;
+
+TEST(Batcher, MergeAndSplit) {
+  SumEngine engine(model_server::EngineConf{});
+  model_server::BatcherConf batcher_conf {
+    .max_batch_size = 64,
+    .max_queue_delay_us = 20000,
+    .num_batch_threads = 1
+  };
+  model_server::Batcher batcher(&engine, batcher_conf);
+
+  const int32_t kCallers = 16;
+  std::vector<model_server::Sample> samples(kCallers);
+  std::vector<std::thread> callers;
+  for (int32_t i = 0; i < kCallers; ++i) {
+    make_sample(1 + i % 3, 100.0f * i, &samples[i]);
+    callers.emplace_back([&batcher, &samples, i]() {
+      batcher.infer(&samples[i].instance, &samples[i].score);
+    });
+  }
+  for (auto& caller : callers) {
+    caller.join();
+  }
+
+  for (int32_t i = 0; i < kCallers; ++i) {
+    const auto& target = samples[i].score.targets[0];
+    ASSERT_EQ(target.batch_size, 1 + i % 3);
+    ASSERT_EQ(static_cast<int64_t>(target.size()), target.batch_size);
+    for (int64_t row = 0; row < target.batch_size; ++row) {
+      ASSERT_FLOAT_EQ(target.values<float>()[row], 4.0f * (100.0f * i + row));
+    }
+  }
+  ASSERT_LT(engine.calls.load(), kCallers);
+}
+
+TEST(Batcher, LargeRequestBypassesQueue) {
+  SumEngine engine(model_server::EngineConf{});
+  model_server::BatcherConf batcher_conf {
+    .max_batch_size = 8,
+    .max_queue_delay_us = 1000000,
+    .num_batch_threads = 1
+  };
+  model_server::Batcher batcher(&engine, batcher_conf);
+
+  model_server::Sample sample;
+  make_sample(8, 0.0f, &sample);
+  batcher.infer(&sample.instance, &sample.score);
+  ASSERT_EQ(engine.calls.load(), 1);
+  ASSERT_FLOAT_EQ(sample.score.targets[0].values<float>()[7], 28.0f);
+}
+
+TEST(Batcher, SplitByPriority) {
+  SumEngine engine(model_server::EngineConf{});
+  model_server::BatcherConf batcher_conf {
+    .max_batch_size = 64,
+    .max_queue_delay_us = 20000,
+    .num_batch_threads = 1
+  };
+  model_server::Batcher batcher(&engine, batcher_conf);
+
+  const int32_t kCallers = 8;
+  std::vector<model_server::Sample> samples(kCallers);
+  std::vector<std::thread> callers;
+  for (int32_t i = 0; i < kCallers; ++i) {
+    const bool bulk = 0 == i % 2;
+    make_sample(1, bulk ? -100.0f * (i + 1) : 100.0f * i, &samples[i]);
+    callers.emplace_back([&batcher, &samples, i, bulk]() {
+      batcher.infer(
+        &samples[i].instance, &samples[i].score,
+        bulk ? model_server::Priority::kBulk : model_server::Priority::kInteractive
+      );  // NOLINT
+    });
+  }
+  for (auto& caller : callers) {
+    caller.join();
+  }
+
+  ASSERT_FALSE(engine.mixed.load());
+  ASSERT_GE(engine.calls.load(), 2);
+  for (int32_t i = 0; i < kCallers; ++i) {
+    const float base = 0 == i % 2 ? -100.0f * (i + 1) : 100.0f * i;
+    ASSERT_FLOAT_EQ(samples[i].score.targets[0].values<float>()[0], 4.0f * base);
+  }
+}
+
+TEST(Batcher, RaggedMerge) {
+  SumEngine engine(model_server::EngineConf{});
+  model_server::BatcherConf batcher_conf {
+    .max_batch_size = 4,
+    .max_queue_delay_us = 1000000,
+    .num_batch_threads = 1
+  };
+  model_server::Batcher batcher(&engine, batcher_conf);
+
+  // Rows of 1 + 2 values and of 0 + 6 values, the last one is cut to 4
+  std::vector<model_server::Sample> samples(2);
+  const std::vector<std::vector<float>> values({{1.0f, 2.0f, 3.0f}, {4.0f, 5.0f, 6.0f, 7.0f, 8.0f, 9.0f}});
+  const std::vector<std::vector<int64_t>> row_splits({{0, 1, 3}, {0, 0, 6}});
+  for (int32_t i = 0; i < 2; ++i) {
+    make_sample(2, 0.0f, &samples[i]);
+    samples[i].instance.features[0].assign(values[i]);
+    samples[i].instance.features[0].row_splits = row_splits[i];
+  }
+  std::vector<std::thread> callers;
+  for (int32_t i = 0; i < 2; ++i) {
+    callers.emplace_back([&batcher, &samples, i]() {
+      batcher.infer(&samples[i].instance, &samples[i].score);
+    });
+  }
+  for (auto& caller : callers) {
+    caller.join();
+  }
+
+  ASSERT_EQ(engine.calls.load(), 1);
+  ASSERT_FLOAT_EQ(samples[0].score.targets[0].values<float>()[0], 1.0f);
+  ASSERT_FLOAT_EQ(samples[0].score.targets[0].values<float>()[1], 5.0f);
+  ASSERT_FLOAT_EQ(samples[1].score.targets[0].values<float>()[0], 0.0f);
+  ASSERT_FLOAT_EQ(samples[1].score.targets[0].values<float>()[1], 22.0f);
+
+  // Splits that do not cover the values never reach a batch
+  model_server::Sample bad;
+  make_sample(2, 0.0f, &bad);
+  bad.instance.features[0].row_splits = {0, 3, 7};
+  ASSERT_THROW(batcher.infer(&bad.instance, &bad.score), std::invalid_argument);
+}
+
+TEST(Batcher, BadBatchSize) {
+  SumEngine engine(model_server::EngineConf{});
+  model_server::BatcherConf batcher_conf {
+    .max_batch_size = 64,
+    .max_queue_delay_us = 1000,
+    .num_batch_threads = 1
+  };
+  model_server::Batcher batcher(&engine, batcher_conf);
+
+  // Empty requests would merge into a batch of no rows, rows of opposite sign into one that looks empty
+  model_server::Sample empty;
+  make_sample(0, 0.0f, &empty);
+  ASSERT_THROW(batcher.infer(&empty.instance, &empty.score), std::invalid_argument);
+  model_server::Sample negative;
+  make_sample(3, 0.0f, &negative);
+  negative.instance.features[0].batch_size = -3;
+  ASSERT_THROW(batcher.infer(&negative.instance, &negative.score), std::invalid_argument);
+
+  model_server::Sample mismatched;
+  make_sample(2, 0.0f, &mismatched);
+  mismatched.instance.features.push_back(mismatched.instance.features[0]);
+  mismatched.instance.features[1].name = "other";
+  mismatched.instance.features[1].batch_size = 1;
+  ASSERT_THROW(batcher.infer(&mismatched.instance, &mismatched.score), std::invalid_argument);
+  ASSERT_EQ(engine.calls.load(), 0);
+}
+
+TEST(Batcher, UnevenRowsFailAlone) {
+  SumEngine engine(model_server::EngineConf{});
+  model_server::BatcherConf batcher_conf {
+    .max_batch_size = 64,
+    .max_queue_delay_us = 20000,
+    .num_batch_threads = 1
+  };
+  model_server::Batcher batcher(&engine, batcher_conf);
+
+  // Request 0 holds 7 values for 2 rows, the others wait in the same window and must not notice
+  const int32_t kCallers = 8;
+  std::vector<model_server::Sample> samples(kCallers);
+  std::vector<int32_t> failed(kCallers, 0);
+  std::vector<std::thread> callers;
+  for (int32_t i = 0; i < kCallers; ++i) {
+    make_sample(2, 100.0f * i, &samples[i]);
+  }
+  samples[0].instance.features[0].resize(7);
+  for (int32_t i = 0; i < kCallers; ++i) {
+    callers.emplace_back([&batcher, &samples, &failed, i]() {
+      try {
+        batcher.infer(&samples[i].instance, &samples[i].score);
+      } catch (const std::invalid_argument& e) {
+        failed[i] = 1;
+      }
+    });
+  }
+  for (auto& caller : callers) {
+    caller.join();
+  }
+
+  ASSERT_EQ(failed[0], 1);
+  for (int32_t i = 1; i < kCallers; ++i) {
+    ASSERT_EQ(failed[i], 0);
+    for (int64_t row = 0; row < 2; ++row) {
+      ASSERT_FLOAT_EQ(samples[i].score.targets[0].values<float>()[row], 4.0f * (100.0f * i + row));
+    }
+  }
+}
+
+TEST(Batcher, BoundPath) {
+  SumEngine engine(model_server::EngineConf{});
+  engine.declare_input("ids", model_server::DataType::kInt64, 2);
+  engine.declare_input("dense", model_server::DataType::kFloat, 4);
+  const auto& signature = engine.signature();
+  model_server::BatcherConf batcher_conf {
+    .max_batch_size = 64,
+    .max_queue_delay_us = 1000,
+    .num_batch_threads = 1
+  };
+  model_server::Batcher batcher(&engine, batcher_conf);
+
+  // Holding every slot, only out of order
+  model_server::Sample sample;
+  make_sample(2, 1.0f, &sample);
+  sample.instance.features.emplace_back();
+  sample.instance.features[1].name = "ids";
+  sample.instance.features[1].batch_size = 2;
+  sample.instance.features[1].assign(std::vector<int64_t>({1, 2, 3, 4}));
+  ASSERT_FALSE(signature.matches(sample.instance, sample.score));
+  ASSERT_TRUE(signature.arrange(&sample.instance, &sample.score));
+  ASSERT_EQ(sample.instance.features[0].name, "ids");
+  ASSERT_EQ(sample.instance.features[1].name, "dense");
+  ASSERT_TRUE(signature.bound(sample.instance, sample.score));
+  batcher.infer(&sample.instance, &sample.score);
+  ASSERT_EQ(engine.bound_calls.load(), 1);
+  ASSERT_FLOAT_EQ(sample.score.targets[0].values<float>()[1], 4.0f * 2.0f + 7.0f);
+
+  // Past arrange names are not compared again, a sample in slot order that skipped it goes by name
+  model_server::Sample unarranged = sample;
+  unarranged.instance.signature_id = 0;
+  ASSERT_TRUE(signature.matches(unarranged.instance, unarranged.score));
+  ASSERT_FALSE(signature.bound(unarranged.instance, unarranged.score));
+  batcher.infer(&unarranged.instance, &unarranged.score);
+  ASSERT_EQ(engine.bound_calls.load(), 1);
+  ASSERT_EQ(engine.calls.load(), 2);
+
+  // Missing a slot, or holding another tensor in its place, goes by name and is left as it came
+  model_server::Sample partial;
+  make_sample(2, 1.0f, &partial);
+  ASSERT_FALSE(signature.arrange(&partial.instance, &partial.score));
+  partial.instance.features.push_back(partial.instance.features[0]);
+  partial.instance.features[0].name = "other";
+  ASSERT_FALSE(signature.arrange(&partial.instance, &partial.score));
+  ASSERT_EQ(partial.instance.features[0].name, "other");
+  batcher.infer(&partial.instance, &partial.score);
+  ASSERT_EQ(engine.bound_calls.load(), 1);
+  ASSERT_EQ(engine.calls.load(), 3);
+  ASSERT_THROW(engine.infer_bound(&partial.instance, &partial.score), std::runtime_error);
+}
+
+TEST(Batcher, CompletionQueue) {
+  SumEngine engine(model_server::EngineConf{});
+  model_server::EngineConf engine_conf;
+  engine_conf.async_threads = 1;
+  engine_conf.async_max_batch_size = 64;
+  model_server::CompletionQueue completion_queue(&engine, engine_conf);
+
+  // One thread pushes them all, what gathers while a batch runs goes out as the next one
+  const int32_t kRequests = 256;
+  std::vector<model_server::Sample> samples(kRequests);
+  std::atomic<int32_t> done(0);
+  std::atomic<int32_t> failed(0);
+  for (int32_t i = 0; i < kRequests; ++i) {
+    make_sample(1 + i % 3, 100.0f * i, &samples[i]);
+    completion_queue.push(
+      &samples[i].instance, &samples[i].score,
+      [&done, &failed](std::exception_ptr error) {
+        if (error) {
+          ++failed;
+        }
+        ++done;
+      },
+      model_server::Priority::kNormal
+    );  // NOLINT
+  }
+  while (done.load() < kRequests) {
+    std::this_thread::yield();
+  }
+
+  ASSERT_EQ(failed.load(), 0);
+  for (int32_t i = 0; i < kRequests; ++i) {
+    const auto& target = samples[i].score.targets[0];
+    ASSERT_EQ(target.batch_size, 1 + i % 3);
+    ASSERT_FLOAT_EQ(target.values<float>()[0], 4.0f * 100.0f * i);
+  }
+  ASSERT_LT(engine.calls.load(), kRequests);
+
+  // Stopped, requests fail on push and never reach a callback
+  completion_queue.stop();
+  ASSERT_THROW(
+    completion_queue.push(&samples[0].instance, &samples[0].score, [](std::exception_ptr) {},
+      model_server::Priority::kNormal),
+    std::runtime_error
+  );  // NOLINT
+}
+
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -1,7 +1,13 @@
 // Copyright (C) 2023 zh.luxu1986@gmail.com
 
+#include <dirent.h>
+#include <stdlib.h>
+#include <memory>
+#include <string>
+#include <vector>
 #include "absl/log/log.h"
 #include "gtest/gtest.h"
+#include "model_server/src/util/os/resource_used.h"
 #include "model_server/src/util/process/process_initiator.h"
 #include "model_server/src/engine/onnx_engine.h"
 
@@ -39,6 +45,311 @@ TEST(ONNXEngine, LoadFailNonExistentGraph) {
   });
 }
 
+TEST(ONNXEngine, BoundMatchesNamed) {
+  model_server::EngineConf onnx_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.onnx",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 0,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1
+  };
+  std::unique_ptr<model_server::Engine> engine(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+  const auto& signature = engine->signature();
+  ASSERT_EQ(signature.input_names.size(), signature.input_data_types.size());
+  ASSERT_FALSE(signature.input_names.empty());
+  ASSERT_FALSE(signature.output_names.empty());
+
+  // Generated samples are laid out by slot
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, 1, 4, true);
+  for (size_t i = 0; i < signature.input_names.size(); ++i) {
+    ASSERT_EQ(samples[0].instance.features[i].name, signature.input_names[i]);
+  }
+  model_server::Sample named = samples[0];
+  engine->infer(&named.instance, &named.score);
+  engine->infer_bound(&samples[0].instance, &samples[0].score);
+  for (size_t i = 0; i < signature.output_names.size(); ++i) {
+    ASSERT_EQ(samples[0].score.targets[i].name, signature.output_names[i]);
+    ASSERT_EQ(samples[0].score.targets[i].data, named.score.targets[i].data);
+  }
+
+  samples[0].instance.features.pop_back();
+  ASSERT_THROW(engine->infer_bound(&samples[0].instance, &samples[0].score), std::runtime_error);
+}
+
+TEST(ONNXEngine, IoBindingFollowsBatchSize) {
+  model_server::EngineConf onnx_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.onnx",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 0,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1,
+    .ort_use_io_binding = true
+  };
+  std::unique_ptr<model_server::Engine> engine(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+
+  // Outputs are rebound on every change of the batch size, and reused while it stays
+  for (int64_t batch_size : {4, 16, 16, 1, 4}) {
+    std::vector<model_server::Sample> samples;
+    engine->random_sample_gen(&samples, 1, batch_size, true);
+    model_server::Sample named = samples[0];
+    engine->infer(&named.instance, &named.score);
+    engine->infer_bound(&samples[0].instance, &samples[0].score);
+    for (size_t i = 0; i < named.score.targets.size(); ++i) {
+      ASSERT_EQ(samples[0].score.targets[i].batch_size, batch_size);
+      ASSERT_EQ(samples[0].score.targets[i].dtype, named.score.targets[i].dtype);
+      ASSERT_EQ(samples[0].score.targets[i].data, named.score.targets[i].data);
+    }
+  }
+}
+
+TEST(ONNXEngine, SharedGlobalThreadPool) {
+  model_server::EngineConf onnx_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.onnx",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 0,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 4,
+    .intra_op_parallelism_threads = 4,
+    .use_global_thread_pool = true
+  };
+  std::vector<std::unique_ptr<model_server::Engine>> engines;
+  engines.emplace_back(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+  ResourceUsed res;
+  ASSERT_TRUE(get_process_resource_used(&res));
+  const int64_t num_threads = res.num_threads;
+
+  // More models share the pools of the first
+  for (int32_t i = 0; i < 3; ++i) {
+    engines.emplace_back(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+  }
+  ASSERT_TRUE(get_process_resource_used(&res));
+  ASSERT_EQ(res.num_threads, num_threads);
+
+  for (auto& engine : engines) {
+    std::vector<model_server::Sample> samples;
+    engine->random_sample_gen(&samples, 1, 4, true);
+    engine->infer(&samples[0].instance, &samples[0].score);
+    ASSERT_FALSE(samples[0].score.targets[0].data.empty());
+  }
+}
+
+TEST(ONNXEngine, OptimizedModelCache) {
+  const std::string& cache_dir = testing::TempDir() + "/ort_model_cache";
+  model_server::EngineConf onnx_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.onnx",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 1,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1,
+    .ort_model_cache_dir = cache_dir
+  };
+  auto cached_models = [&cache_dir]() {
+    std::vector<std::string> names;
+    DIR *dir = opendir(cache_dir.c_str());
+    if (nullptr == dir) {
+      return names;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+      if ('.' != entry->d_name[0]) {
+        names.push_back(entry->d_name);
+      }
+    }
+    closedir(dir);
+    return names;
+  };
+
+  // The cold start fills the cache, the warm one loads from it and scores alike
+  std::unique_ptr<model_server::Engine> cold(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+  const std::vector<std::string>& names = cached_models();
+  ASSERT_EQ(names.size(), 1);
+  std::unique_ptr<model_server::Engine> warm(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+  ASSERT_EQ(cached_models(), names);
+
+  std::vector<model_server::Sample> samples;
+  cold->random_sample_gen(&samples, 1, 4, true);
+  model_server::Sample warm_sample = samples[0];
+  cold->infer(&samples[0].instance, &samples[0].score);
+  warm->infer(&warm_sample.instance, &warm_sample.score);
+  for (size_t i = 0; i < samples[0].score.targets.size(); ++i) {
+    ASSERT_EQ(warm_sample.score.targets[i].data, samples[0].score.targets[i].data);
+  }
+
+  // Another level is another key
+  onnx_engine_conf.opt_level = 2;
+  std::unique_ptr<model_server::Engine> other(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+  ASSERT_EQ(cached_models().size(), 2);
+}
+
+TEST(ONNXEngine, SharedPrepackedWeights) {
+  model_server::EngineConf onnx_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.onnx",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 1,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1
+  };
+  const int32_t kReplicas = 4;
+  std::vector<model_server::Sample> samples;
+  std::vector<model_server::Score> scores;
+  for (bool share : {false, true}) {
+    onnx_engine_conf.ort_share_prepacked_weights = share;
+    std::vector<std::unique_ptr<model_server::Engine>> engines;
+    engines.emplace_back(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+    ResourceUsed res;
+    ASSERT_TRUE(get_process_resource_used(&res));
+    const double rss_mb = res.resident_mb;
+    for (int32_t i = 1; i < kReplicas; ++i) {
+      engines.emplace_back(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+    }
+    ASSERT_TRUE(get_process_resource_used(&res));
+    LOG(INFO) << "RSS per extra replica, prepacked weights " << (share ? "shared" : "private") << ": "
+      << (res.resident_mb - rss_mb) / (kReplicas - 1) << " MB";
+
+    if (samples.empty()) {
+      engines[0]->random_sample_gen(&samples, 1, 4, true);
+    }
+    for (auto& engine : engines) {
+      model_server::Sample sample = samples[0];
+      engine->infer(&sample.instance, &sample.score);
+      scores.push_back(sample.score);
+    }
+  }
+  for (const auto& score : scores) {
+    for (size_t i = 0; i < score.targets.size(); ++i) {
+      ASSERT_EQ(score.targets[i].data, scores[0].targets[i].data);
+    }
+  }
+}
+
+TEST(ONNXEngine, QuantizeDynamic) {
+  if (0 != system("python3 -c 'import onnxruntime.quantization' 2>/dev/null")) {
+    GTEST_SKIP() << "onnxruntime.quantization is not installed";
+  }
+  model_server::EngineConf onnx_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.onnx",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 1,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1
+  };
+  std::unique_ptr<model_server::Engine> fp32(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+  std::vector<model_server::Sample> samples;
+  fp32->random_sample_gen(&samples, 1, 4, true);
+  model_server::Sample fp32_sample = samples[0];
+  fp32->infer(&fp32_sample.instance, &fp32_sample.score);
+  auto files_with_suffix = [](const std::string& path, const std::string& suffix) {
+    int32_t count = 0;
+    DIR *dir = opendir(path.c_str());
+    if (nullptr == dir) {
+      return count;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+      const std::string name = entry->d_name;
+      count += name.size() >= suffix.size() && 0 == name.compare(name.size() - suffix.size(), suffix.size(), suffix);
+    }
+    closedir(dir);
+    return count;
+  };
+
+  // Within tolerance the int8 variant is kept on disk and served
+  onnx_engine_conf.ort_quantize_dynamic = true;
+  onnx_engine_conf.ort_quantize_tolerance = 1.0f;
+  onnx_engine_conf.ort_model_cache_dir = testing::TempDir() + "/ort_quantize_kept";
+  std::unique_ptr<model_server::Engine> int8(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+  ASSERT_EQ(files_with_suffix(onnx_engine_conf.ort_model_cache_dir, "_int8.onnx"), 1);
+  model_server::Sample int8_sample = samples[0];
+  int8->infer(&int8_sample.instance, &int8_sample.score);
+  for (size_t i = 0; i < fp32_sample.score.targets.size(); ++i) {
+    const auto& fp32_target = fp32_sample.score.targets[i];
+    const auto& int8_target = int8_sample.score.targets[i];
+    ASSERT_EQ(int8_target.size(), fp32_target.size());
+    for (size_t j = 0; j < fp32_target.size(); ++j) {
+      ASSERT_NEAR(int8_target.values<float>()[j], fp32_target.values<float>()[j], 1.0f);
+    }
+  }
+
+  // Beyond it the variant is dropped, remembered, and fp32 served
+  onnx_engine_conf.ort_quantize_tolerance = -1.0f;
+  onnx_engine_conf.ort_model_cache_dir = testing::TempDir() + "/ort_quantize_rejected";
+  for (int32_t start = 0; start < 2; ++start) {
+    std::unique_ptr<model_server::Engine> rejected(
+      model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf)
+    );  // NOLINT
+    ASSERT_EQ(files_with_suffix(onnx_engine_conf.ort_model_cache_dir, "_int8.onnx"), 0);
+    ASSERT_EQ(files_with_suffix(onnx_engine_conf.ort_model_cache_dir, ".rejected"), 1);
+    model_server::Sample rejected_sample = samples[0];
+    rejected->infer(&rejected_sample.instance, &rejected_sample.score);
+    for (size_t i = 0; i < fp32_sample.score.targets.size(); ++i) {
+      ASSERT_EQ(rejected_sample.score.targets[i].data, fp32_sample.score.targets[i].data);
+    }
+  }
+}
+
+TEST(ONNXEngine, SampledTrace) {
+  model_server::EngineConf onnx_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.onnx",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 0,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1,
+    .trace_every_n = 1
+  };
+  std::unique_ptr<model_server::Engine> engine(model_server::ONNXEngineFactory::instance()->create(onnx_engine_conf));
+
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, 1, 4, true);
+  model_server::Tracer *tracer = model_server::Tracer::instance();
+  tracer->flush();
+  const size_t written = tracer->written();
+  engine->infer(&samples[0].instance, &samples[0].score);
+  engine->infer_bound(&samples[0].instance, &samples[0].score);
+  // Runs land in one profile until the flusher collects it
+  tracer->flush();
+  const size_t collected = tracer->written();
+  ASSERT_GT(collected, written);
+  const auto& op_timings = dynamic_cast<model_server::ONNXEngine*>(engine.get())->op_timings();
+  ASSERT_FALSE(op_timings.empty());
+  for (const auto& op_timing : op_timings) {
+    ASSERT_GT(op_timing.second.calls, 0);
+    ASSERT_GE(op_timing.second.total_us, 0);
+  }
+
+  // The fresh profiling session serves the next sample, its profile is submitted with the engine
+  engine->infer_bound(&samples[0].instance, &samples[0].score);
+  ASSERT_FALSE(samples[0].score.targets[0].data.empty());
+  engine.reset();
+  tracer->flush();
+  ASSERT_GT(tracer->written(), collected);
+}
+
 int main(int argc, char **argv) {
   model_server::init(argc, argv);
   testing::InitGoogleTest(&argc, argv);
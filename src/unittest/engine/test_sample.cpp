@@ -0,0 +1,141 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <stdint.h>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "absl/log/log.h"
+#include "gtest/gtest.h"
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/engine/sample.h"
+
+TEST(TensorBuffer, AlignedGrowth) {
+  model_server::TensorBuffer buffer;
+  ASSERT_TRUE(buffer.empty());
+  for (int32_t i = 0; i < 100; ++i) {
+    buffer.append(&i, sizeof(i));
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(buffer.data()) % model_server::kTensorAlignment, 0);
+  }
+  ASSERT_EQ(buffer.size(), 100 * sizeof(int32_t));
+  ASSERT_EQ(reinterpret_cast<const int32_t*>(buffer.data())[99], 99);
+
+  model_server::TensorBuffer copy(buffer);
+  ASSERT_NE(copy.data(), buffer.data());
+  ASSERT_EQ(copy, buffer);
+  model_server::TensorBuffer moved(std::move(copy));
+  ASSERT_TRUE(copy.empty());
+  ASSERT_EQ(moved, buffer);
+
+  buffer.resize(4);
+  ASSERT_EQ(reinterpret_cast<const int32_t*>(buffer.data())[0], 0);
+  ASSERT_FALSE(moved == buffer);
+}
+
+TEST(TensorBuffer, Adopt) {
+  static int32_t released = 0;
+  alignas(model_server::kTensorAlignment) static char memory[256];
+  const model_server::TensorBuffer::Releaser releaser = [](void *context) noexcept {
+    ASSERT_EQ(context, memory);
+    ++released;
+  };
+  for (int32_t i = 0; i < 4; ++i) {
+    reinterpret_cast<int32_t*>(memory)[i] = i;
+  }
+
+  model_server::TensorBuffer buffer;
+  buffer.adopt(memory, 4 * sizeof(int32_t), sizeof(memory), releaser, memory);
+  ASSERT_EQ(buffer.data(), memory);
+  ASSERT_EQ(reinterpret_cast<const int32_t*>(buffer.data())[3], 3);
+  model_server::TensorBuffer copy(buffer);
+  ASSERT_NE(copy.data(), memory);
+  ASSERT_EQ(copy, buffer);
+  ASSERT_EQ(released, 0);
+
+  model_server::TensorBuffer moved(std::move(buffer));
+  ASSERT_EQ(moved.data(), memory);
+  // Even within the capacity, a write goes to owned memory and the adopted one is handed back
+  moved.resize(2 * sizeof(int32_t));
+  ASSERT_NE(moved.data(), memory);
+  ASSERT_EQ(released, 1);
+  ASSERT_EQ(reinterpret_cast<const int32_t*>(moved.data())[1], 1);
+  moved.append(copy.data(), sizeof(int32_t));
+  ASSERT_EQ(released, 1);
+  ASSERT_EQ(reinterpret_cast<const int32_t*>(moved.data())[2], 0);
+
+  const model_server::TensorBuffer::Releaser untouched = [](void *context) noexcept {
+    ASSERT_EQ(context, memory);
+    ++released;
+    // Nothing was written to the adopted memory before it was handed back
+    ASSERT_EQ(reinterpret_cast<const int32_t*>(memory)[0], 0);
+  };
+  model_server::TensorBuffer assigned;
+  assigned.adopt(memory, 4 * sizeof(int32_t), sizeof(memory), untouched, memory);
+  const int32_t value = 7;
+  assigned.assign(&value, sizeof(value));
+  ASSERT_EQ(released, 2);
+  ASSERT_NE(assigned.data(), memory);
+  ASSERT_EQ(reinterpret_cast<const int32_t*>(assigned.data())[0], 7);
+
+  {
+    model_server::TensorBuffer dropped;
+    dropped.adopt(memory, 0, sizeof(memory), releaser, memory);
+  }
+  ASSERT_EQ(released, 3);
+}
+
+TEST(Tensor, TypedValues) {
+  model_server::Tensor tensor;
+  tensor.name = "ids";
+  tensor.batch_size = 2;
+  tensor.assign(std::vector<int64_t>({(1LL << 53) + 1, -1}));
+  ASSERT_EQ(tensor.dtype, model_server::DataType::kInt64);
+  ASSERT_EQ(tensor.size(), 2);
+  ASSERT_EQ(tensor.values<int64_t>()[0], (1LL << 53) + 1);
+  ASSERT_THROW(tensor.values<float>(), std::invalid_argument);
+
+  tensor.dtype = model_server::DataType::kHalf;
+  ASSERT_EQ(tensor.size(), 8);
+  tensor.dtype = model_server::DataType::kBool;
+  tensor.resize(3);
+  ASSERT_EQ(tensor.data.size(), 3);
+  ASSERT_EQ(model_server::data_type_name(tensor.dtype), "bool");
+}
+
+TEST(Tensor, Densify) {
+  model_server::Tensor tensor;
+  tensor.name = "ids";
+  tensor.batch_size = 3;
+  tensor.assign(std::vector<int64_t>({1, 2, 3, 4, 5, 6, 7, 8}));
+  tensor.row_splits = {0, 3, 3, 8};
+  ASSERT_TRUE(tensor.ragged());
+  ASSERT_EQ(tensor.row_begin(2), 3 * sizeof(int64_t));
+  ASSERT_EQ(tensor.row_end(2), 8 * sizeof(int64_t));
+  ASSERT_NO_THROW(model_server::check_ragged(tensor));
+
+  std::vector<int64_t> dense(12, -1);
+  model_server::densify(tensor, 4, reinterpret_cast<char*>(dense.data()));
+  ASSERT_EQ(dense, std::vector<int64_t>({1, 2, 3, 0, 0, 0, 0, 0, 4, 5, 6, 7}));
+  model_server::densify(&tensor, 4);
+  ASSERT_FALSE(tensor.ragged());
+  ASSERT_EQ(tensor.size(), 12);
+  ASSERT_EQ(std::vector<int64_t>(tensor.values<int64_t>(), tensor.values<int64_t>() + 12), dense);
+  ASSERT_EQ(tensor.row_begin(1), 4 * sizeof(int64_t));
+  tensor.batch_size = 0;
+  ASSERT_THROW(tensor.row_begin(0), std::invalid_argument);
+  tensor.batch_size = 3;
+
+  tensor.row_splits = {0, 5, 4, 12};
+  ASSERT_THROW(model_server::check_ragged(tensor), std::invalid_argument);
+  tensor.row_splits = {0, 12};
+  ASSERT_THROW(model_server::densify(&tensor, 4), std::invalid_argument);
+  // A tensor that fails validation is left as it came
+  ASSERT_EQ(tensor.row_splits, std::vector<int64_t>({0, 12}));
+  ASSERT_EQ(std::vector<int64_t>(tensor.values<int64_t>(), tensor.values<int64_t>() + 12), dense);
+}
+
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,196 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <thread>  // NOLINT
+#include <vector>
+#include "absl/log/log.h"
+#include "gtest/gtest.h"
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/engine/sample_pool.h"
+#include "model_server/src/unittest/engine/sum_engine.h"
+
+// Heap allocations of the current thread are counted while enabled
+static thread_local bool count_allocations = false;
+static std::atomic<int64_t> allocations(0);
+
+static void *counted_alloc(size_t size, size_t alignment) {
+  if (count_allocations) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  void *ptr = nullptr;
+  if (alignment <= alignof(std::max_align_t)) {
+    ptr = malloc(0 == size ? 1 : size);
+  } else if (0 != posix_memalign(&ptr, alignment, 0 == size ? alignment : size)) {
+    ptr = nullptr;
+  }
+  if (nullptr == ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void *operator new(size_t size) { return counted_alloc(size, 0); }
+void *operator new[](size_t size) { return counted_alloc(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) {
+  return counted_alloc(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return counted_alloc(size, static_cast<size_t>(alignment));
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+
+using model_server::SumEngine;
+
+// Takes int64 ids of 2 values and a dense float input of 4 values per row
+static void declare_inputs(SumEngine *engine) {
+  engine->declare_input("ids", model_server::DataType::kInt64, 2);
+  engine->declare_input("dense", model_server::DataType::kFloat, 4);
+}
+
+// Fills rows so that row i sums up to base + i * 6
+static void fill(int64_t rows, float base, model_server::Sample *sample) {
+  for (auto& feature : sample->instance.features) {
+    feature.batch_size = rows;
+    if (feature.name == "dense") {
+      feature.resize(rows * 4);
+      for (int64_t i = 0; i < rows * 4; ++i) {
+        feature.values<float>()[i] = i % 4 == 0 ? base + static_cast<float>(i / 4 * 6) : 0.0f;
+      }
+    } else {
+      feature.resize(rows * 2);
+      for (int64_t i = 0; i < rows * 2; ++i) {
+        feature.values<int64_t>()[i] = 0;
+      }
+    }
+  }
+}
+
+TEST(SamplePool, NoAllocationOnceWarm) {
+  SumEngine engine(model_server::EngineConf{});
+  declare_inputs(&engine);
+  auto pool = model_server::SamplePool::create(&engine, model_server::SamplePoolConf{
+    .max_batch_size = 8,
+    .capacity = 4
+  });
+
+  {
+    auto sample = pool->acquire();
+    ASSERT_EQ(sample->instance.features.size(), 2);
+    ASSERT_EQ(sample->score.targets.size(), 1);
+    // Laid out by the signature, not by the order of the shape map
+    ASSERT_EQ(sample->instance.features[0].name, "ids");
+    ASSERT_EQ(sample->instance.features[1].name, "dense");
+    for (const auto& feature : sample->instance.features) {
+      ASSERT_EQ(feature.batch_size, 0);
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(feature.data.data()) % model_server::kTensorAlignment, 0);
+      ASSERT_EQ(feature.dtype, feature.name == "ids" ? model_server::DataType::kInt64 : model_server::DataType::kFloat);
+    }
+    fill(8, 1.0f, sample.get());
+    engine.infer(&sample->instance, &sample->score);
+  }
+
+  // Only the pool and the sample are covered here. Real engines are not: the TF C API and ORT
+  // allocate their own output tensors and run state on every call, whatever sample they are given.
+  allocations = 0;
+  count_allocations = true;
+  float checksum = 0.0f;
+  for (int32_t i = 0; i < 1000; ++i) {
+    auto sample = pool->acquire();
+    fill(8, static_cast<float>(i), sample.get());
+    engine.infer_bound(&sample->instance, &sample->score);
+    checksum += sample->score.targets[0].values<float>()[7];
+  }
+  count_allocations = false;
+  ASSERT_EQ(allocations.load(), 0);
+  ASSERT_GT(checksum, 0.0f);
+  ASSERT_EQ(pool->pooled(), 1);
+}
+
+TEST(SamplePool, CapacityAndLifetime) {
+  SumEngine engine(model_server::EngineConf{});
+  declare_inputs(&engine);
+  auto pool = model_server::SamplePool::create(&engine, model_server::SamplePoolConf{
+    .max_batch_size = 4,
+    .capacity = 2
+  });
+
+  std::vector<model_server::SamplePool::Handle> samples;
+  for (int32_t i = 0; i < 3; ++i) {
+    samples.push_back(pool->acquire());
+  }
+  ASSERT_EQ(pool->pooled(), 2);
+  ASSERT_NE(samples[0].get_deleter().pool, nullptr);
+  ASSERT_EQ(samples[2].get_deleter().pool, nullptr);
+
+  // Rows beyond max_batch_size grow the buffer out of the arena
+  fill(16, 1.0f, samples[0].get());
+  engine.infer(&samples[0]->instance, &samples[0]->score);
+  ASSERT_EQ(samples[0]->score.targets[0].values<float>()[15], 91.0f);
+  samples.clear();
+  for (int32_t i = 0; i < 2; ++i) {
+    samples.push_back(pool->acquire());
+  }
+  ASSERT_EQ(pool->pooled(), 2);
+  for (const auto& sample : samples) {
+    ASSERT_EQ(sample->instance.features[0].batch_size, 0);
+    ASSERT_TRUE(sample->instance.features[0].data.empty());
+  }
+
+  // Handed out samples keep the pool alive
+  pool.reset();
+  fill(2, 1.0f, samples[1].get());
+  engine.infer(&samples[1]->instance, &samples[1]->score);
+  ASSERT_EQ(samples[1]->score.targets[0].values<float>()[1], 7.0f);
+  samples.clear();
+}
+
+TEST(SamplePool, ConcurrentReuse) {
+  SumEngine engine(model_server::EngineConf{});
+  declare_inputs(&engine);
+  auto pool = model_server::SamplePool::create(&engine, model_server::SamplePoolConf{
+    .max_batch_size = 8,
+    .capacity = 16
+  });
+
+  const int32_t kThreads = 8;
+  std::atomic<int32_t> wrong(0);
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int32_t i = 0; i < 2000; ++i) {
+        auto first = pool->acquire();
+        auto second = pool->acquire();
+        fill(1 + i % 8, static_cast<float>(t), first.get());
+        fill(8, static_cast<float>(i), second.get());
+        engine.infer(&first->instance, &first->score);
+        engine.infer(&second->instance, &second->score);
+        if (first->score.targets[0].values<float>()[i % 8] != static_cast<float>(t + i % 8 * 6)
+          || second->score.targets[0].values<float>()[0] != static_cast<float>(i)) {
+          wrong.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(wrong.load(), 0);
+  ASSERT_LE(pool->pooled(), 16);
+}
+
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
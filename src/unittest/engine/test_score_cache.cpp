@@ -0,0 +1,149 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <stdint.h>
+#include <stdexcept>
+#include <vector>
+#include "absl/log/log.h"
+#include "gtest/gtest.h"
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/engine/sample.h"
+#include "model_server/src/engine/score_cache.h"
+
+static void make_sample(const std::vector<float>& row_bases, model_server::Sample *sample) {
+  sample->instance.features.resize(1);
+  auto& feature = sample->instance.features[0];
+  feature.name = "dense";
+  feature.batch_size = static_cast<int64_t>(row_bases.size());
+  std::vector<float> values;
+  for (const auto& base : row_bases) {
+    values.insert(values.end(), {base, base + 1.0f});
+  }
+  feature.assign(values);
+  sample->score.targets.resize(1);
+  sample->score.targets[0].name = "predict_node";
+  sample->score.targets[0].batch_size = feature.batch_size;
+  sample->score.targets[0].data.clear();
+}
+
+static std::vector<float> values_of(const model_server::Tensor& tensor) {
+  const float *values = tensor.values<float>();
+  return std::vector<float>(values, values + tensor.size());
+}
+
+TEST(ScoreCache, OnlyMissesAreScored) {
+  model_server::ScoreCacheConf conf;
+  conf.capacity = 64;
+  model_server::ScoreCache cache(conf);
+
+  // Two values per row, the sum and the row count of the call it was scored in
+  std::vector<int64_t> inferred_rows;
+  auto infer = [&inferred_rows](model_server::Instance *instance, model_server::Score *score) {
+    const auto& feature = instance->features[0];
+    const float *values = feature.values<float>();
+    inferred_rows.push_back(feature.batch_size);
+    std::vector<float> scores;
+    for (int64_t i = 0; i < feature.batch_size; ++i) {
+      scores.push_back(values[i * 2] + values[i * 2 + 1]);
+      scores.push_back(static_cast<float>(feature.batch_size));
+    }
+    score->targets[0].assign(scores);
+  };
+
+  model_server::Sample sample;
+  make_sample({1.0f, 2.0f, 3.0f}, &sample);
+  cache.infer(&sample.instance, &sample.score, infer);
+  ASSERT_EQ(inferred_rows, std::vector<int64_t>({3}));
+  ASSERT_EQ(cache.size(), 3);
+
+  make_sample({2.0f, 7.0f, 3.0f, 9.0f}, &sample);
+  cache.infer(&sample.instance, &sample.score, infer);
+  ASSERT_EQ(inferred_rows, std::vector<int64_t>({3, 2}));
+  const std::vector<float> expected({5.0f, 3.0f, 15.0f, 2.0f, 7.0f, 3.0f, 19.0f, 2.0f});
+  ASSERT_EQ(sample.score.targets[0].batch_size, 4);
+  ASSERT_EQ(values_of(sample.score.targets[0]), expected);
+
+  // All hits never reach the engine
+  make_sample({9.0f, 1.0f}, &sample);
+  cache.infer(&sample.instance, &sample.score, infer);
+  ASSERT_EQ(inferred_rows.size(), 2);
+  ASSERT_EQ(values_of(sample.score.targets[0]), std::vector<float>({19.0f, 2.0f, 3.0f, 3.0f}));
+
+  // Asking another target is another row
+  sample.score.targets[0].name = "other_node";
+  cache.infer(&sample.instance, &sample.score, infer);
+  ASSERT_EQ(inferred_rows.size(), 3);
+
+  cache.clear();
+  ASSERT_EQ(cache.size(), 0);
+  make_sample({1.0f}, &sample);
+  cache.infer(&sample.instance, &sample.score, infer);
+  ASSERT_EQ(inferred_rows.size(), 4);
+}
+
+TEST(ScoreCache, RaggedRows) {
+  model_server::ScoreCacheConf conf;
+  conf.capacity = 64;
+  model_server::ScoreCache cache(conf);
+
+  // Scores every row with the sum of its values
+  std::vector<int64_t> inferred_rows;
+  auto infer = [&inferred_rows](model_server::Instance *instance, model_server::Score *score) {
+    const auto& feature = instance->features[0];
+    inferred_rows.push_back(feature.batch_size);
+    std::vector<float> scores;
+    for (int64_t i = 0; i < feature.batch_size; ++i) {
+      float sum = 0.0f;
+      for (int64_t j = feature.row_splits[i]; j < feature.row_splits[i + 1]; ++j) {
+        sum += feature.values<float>()[j];
+      }
+      scores.push_back(sum);
+    }
+    score->targets[0].assign(scores);
+  };
+
+  model_server::Sample sample;
+  make_sample({1.0f}, &sample);
+  auto& feature = sample.instance.features[0];
+  feature.batch_size = 2;
+  feature.assign(std::vector<float>({1.0f, 2.0f, 3.0f}));
+  feature.row_splits = {0, 1, 3};
+  sample.score.targets[0].batch_size = 2;
+  cache.infer(&sample.instance, &sample.score, infer);
+  ASSERT_EQ(values_of(sample.score.targets[0]), std::vector<float>({1.0f, 5.0f}));
+
+  // The same values split another way are other rows, only those are scored
+  feature.batch_size = 3;
+  feature.assign(std::vector<float>({2.0f, 3.0f, 1.0f, 2.0f, 3.0f}));
+  feature.row_splits = {0, 2, 4, 5};
+  sample.score.targets[0].batch_size = 3;
+  cache.infer(&sample.instance, &sample.score, infer);
+  ASSERT_EQ(inferred_rows, std::vector<int64_t>({2, 2}));
+  ASSERT_EQ(values_of(sample.score.targets[0]), std::vector<float>({5.0f, 3.0f, 3.0f}));
+}
+
+TEST(ScoreCache, BadInstance) {
+  model_server::ScoreCacheConf conf;
+  conf.capacity = 64;
+  model_server::ScoreCache cache(conf);
+  auto infer = [](model_server::Instance *instance, model_server::Score *score) {};
+
+  model_server::Sample sample;
+  make_sample({1.0f, 2.0f}, &sample);
+  sample.instance.features[0].resize(3);
+  ASSERT_THROW(cache.infer(&sample.instance, &sample.score, infer), std::runtime_error);
+
+  // A score that does not split into rows is not cached
+  make_sample({1.0f, 2.0f}, &sample);
+  auto bad_infer = [](model_server::Instance *instance, model_server::Score *score) {
+    score->targets[0].assign(std::vector<float>(3, 0.0f));
+  };
+  ASSERT_THROW(cache.infer(&sample.instance, &sample.score, bad_infer), std::runtime_error);
+  ASSERT_EQ(cache.size(), 0);
+}
+
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
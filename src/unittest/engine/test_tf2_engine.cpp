@@ -0,0 +1,127 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/engine/tf2_engine.h"
+
+namespace model_server {
+
+// Never loads a graph, the input metas are set by hand
+class FeatureTF2Engine : public TF2Engine {
+ public:
+  explicit FeatureTF2Engine(const EngineConf& engine_conf) : TF2Engine(engine_conf) {
+    TF2TensorMeta meta;
+    meta.num_dims = 2;
+    meta.shape = {-1, 4};
+    meta.data_type = tensorflow::DT_FLOAT;
+    tf_model_meta_.input_metas["dense"] = meta;
+  }
+
+  using TF2Engine::feature_to_tensor;
+};
+
+}  // namespace model_server
+
+static model_server::EngineConf feature_engine_conf() {
+  return model_server::EngineConf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .input_nodes = {"dense"},
+    .output_nodes = {"predict_node"}
+  };
+}
+
+// A float feature "dense" of rows x 4 holding 0, 1, 2, ...
+static void make_dense(int64_t rows, model_server::Tensor *feature) {
+  feature->name = "dense";
+  feature->dtype = model_server::DataType::kFloat;
+  feature->batch_size = rows;
+  feature->resize(rows * 4);
+  for (size_t i = 0; i < feature->size(); ++i) {
+    feature->values<float>()[i] = static_cast<float>(i);
+  }
+}
+
+TEST(TF2Engine, FeatureAlignedIsBorrowed) {
+  model_server::FeatureTF2Engine engine(feature_engine_conf());
+  model_server::Tensor feature;
+  make_dense(3, &feature);
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(feature.data.data()) % model_server::kTensorAlignment, 0u);
+
+  const tensorflow::Tensor tensor = engine.feature_to_tensor(feature);
+  ASSERT_EQ(tensor.dim_size(0), 3);
+  ASSERT_EQ(tensor.dim_size(1), 4);
+  ASSERT_EQ(tensor.tensor_data().data(), feature.data.data());
+}
+
+TEST(TF2Engine, FeatureMisalignedIsCopied) {
+  model_server::FeatureTF2Engine engine(feature_engine_conf());
+  model_server::Tensor aligned;
+  make_dense(3, &aligned);
+  // One float past an aligned block, as a borrowed producer buffer may be
+  std::vector<char> bytes(aligned.data.size() + model_server::kTensorAlignment);
+  char *misaligned = bytes.data();
+  while (reinterpret_cast<uintptr_t>(misaligned) % model_server::kTensorAlignment != sizeof(float)) {
+    ++misaligned;
+  }
+  memcpy(misaligned, aligned.data.data(), aligned.data.size());
+  model_server::Tensor feature;
+  feature.name = "dense";
+  feature.dtype = model_server::DataType::kFloat;
+  feature.batch_size = 3;
+  feature.data.borrow(misaligned, aligned.data.size());
+  feature.data.resize(aligned.data.size());
+  ASSERT_EQ(feature.data.data(), misaligned);
+
+  const tensorflow::Tensor tensor = engine.feature_to_tensor(feature);
+  ASSERT_NE(tensor.tensor_data().data(), feature.data.data());
+  const auto values = tensor.flat<float>();
+  for (int64_t i = 0; i < values.size(); ++i) {
+    ASSERT_EQ(values(i), aligned.values<float>()[i]);
+  }
+}
+
+TEST(TF2Engine, FeatureMissizedThrows) {
+  model_server::FeatureTF2Engine engine(feature_engine_conf());
+  model_server::Tensor feature;
+  make_dense(3, &feature);
+  // Rows of 4 floats, but one value short, so it can be neither borrowed nor copied
+  feature.resize(3 * 4 - 1);
+  ASSERT_THROW(engine.feature_to_tensor(feature), std::runtime_error);
+}
+
+TEST(TF2Engine, FeatureRaggedIsPadded) {
+  model_server::FeatureTF2Engine engine(feature_engine_conf());
+  model_server::Tensor feature;
+  feature.name = "dense";
+  feature.dtype = model_server::DataType::kFloat;
+  feature.batch_size = 3;
+  feature.row_splits = {0, 2, 2, 7};
+  feature.resize(7);
+  for (size_t i = 0; i < feature.size(); ++i) {
+    feature.values<float>()[i] = static_cast<float>(i + 1);
+  }
+
+  // Short rows are padded with zeros and long ones cut to the width of the graph input
+  const tensorflow::Tensor tensor = engine.feature_to_tensor(feature);
+  ASSERT_EQ(tensor.dim_size(0), 3);
+  ASSERT_EQ(tensor.dim_size(1), 4);
+  ASSERT_NE(tensor.tensor_data().data(), feature.data.data());
+  const std::vector<float> expected = {1, 2, 0, 0, 0, 0, 0, 0, 3, 4, 5, 6};
+  const auto values = tensor.flat<float>();
+  for (int64_t i = 0; i < values.size(); ++i) {
+    ASSERT_EQ(values(i), expected[i]);
+  }
+}
+
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -1,9 +1,15 @@
 // Copyright (C) 2023 zh.luxu1986@gmail.com
 
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "absl/container/flat_hash_map.h"
 #include "absl/log/log.h"
 #include "gtest/gtest.h"
 #include "model_server/src/util/process/process_initiator.h"
 #include "model_server/src/engine/tf_engine.h"
+#include "model_server/src/engine/tf_graph_pruner.h"
 
 TEST(TFEngine, LoadSuccess) {
   model_server::EngineConf tf_engine_conf {
@@ -39,6 +45,273 @@ TEST(TFEngine, LoadFailNonExistentGraph) {
   }, std::runtime_error);
 }
 
+TEST(TFEngine, BoundMatchesNamed) {
+  model_server::EngineConf tf_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.pb",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 0,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1
+  };
+  std::unique_ptr<model_server::Engine> engine(model_server::TFEngineFactory::instance()->create(tf_engine_conf));
+  const auto& signature = engine->signature();
+  ASSERT_EQ(signature.input_names.size(), signature.input_data_types.size());
+  ASSERT_FALSE(signature.input_names.empty());
+  ASSERT_FALSE(signature.output_names.empty());
+
+  // Generated samples are laid out by slot
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, 1, 4, true);
+  for (size_t i = 0; i < signature.input_names.size(); ++i) {
+    ASSERT_EQ(samples[0].instance.features[i].name, signature.input_names[i]);
+  }
+  model_server::Sample named = samples[0];
+  engine->infer(&named.instance, &named.score);
+  engine->infer_bound(&samples[0].instance, &samples[0].score);
+  for (size_t i = 0; i < signature.output_names.size(); ++i) {
+    ASSERT_EQ(samples[0].score.targets[i].name, signature.output_names[i]);
+    ASSERT_EQ(samples[0].score.targets[i].data, named.score.targets[i].data);
+  }
+
+  samples[0].instance.features.pop_back();
+  ASSERT_THROW(engine->infer_bound(&samples[0].instance, &samples[0].score), std::runtime_error);
+}
+
+TEST(TFEngine, RunContextFollowsBuffers) {
+  model_server::EngineConf tf_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.pb",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 0,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1
+  };
+  std::unique_ptr<model_server::Engine> engine(model_server::TFEngineFactory::instance()->create(tf_engine_conf));
+
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, 2, 4, true);
+  // The second run feeds the same buffers with the values of the other sample, the third fewer rows
+  model_server::Sample reused = samples[0];
+  engine->infer_bound(&reused.instance, &reused.score);
+  for (size_t i = 0; i < reused.instance.features.size(); ++i) {
+    auto& feature = reused.instance.features[i];
+    memcpy(feature.data.data(), samples[1].instance.features[i].data.data(), feature.data.size());
+  }
+  engine->infer_bound(&reused.instance, &reused.score);
+  engine->infer_bound(&samples[1].instance, &samples[1].score);
+  for (size_t i = 0; i < reused.score.targets.size(); ++i) {
+    ASSERT_EQ(reused.score.targets[i].data, samples[1].score.targets[i].data);
+  }
+
+  for (auto& feature : reused.instance.features) {
+    feature.batch_size = 2;
+    feature.data.resize(feature.data.size() / 2);
+  }
+  for (auto& feature : samples[1].instance.features) {
+    feature.batch_size = 2;
+    feature.data.resize(feature.data.size() / 2);
+  }
+  for (auto& sample : {&reused, &samples[1]}) {
+    for (auto& target : sample->score.targets) {
+      target.batch_size = 2;
+    }
+  }
+  engine->infer_bound(&reused.instance, &reused.score);
+  engine->infer(&samples[1].instance, &samples[1].score);
+  for (size_t i = 0; i < reused.score.targets.size(); ++i) {
+    ASSERT_EQ(reused.score.targets[i].batch_size, 2);
+    ASSERT_EQ(reused.score.targets[i].data, samples[1].score.targets[i].data);
+  }
+}
+
+TEST(TFEngine, ZeroCopyOutput) {
+  model_server::EngineConf tf_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.pb",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 0,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1
+  };
+  std::unique_ptr<model_server::Engine> engine(model_server::TFEngineFactory::instance()->create(tf_engine_conf));
+  tf_engine_conf.zero_copy_output = true;
+  std::unique_ptr<model_server::Engine> zero_copy_engine(
+    model_server::TFEngineFactory::instance()->create(tf_engine_conf)
+  );  // NOLINT
+
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, 1, 4, true);
+  model_server::Sample adopted = samples[0];
+  engine->infer(&samples[0].instance, &samples[0].score);
+  zero_copy_engine->infer(&adopted.instance, &adopted.score);
+  for (size_t i = 0; i < adopted.score.targets.size(); ++i) {
+    ASSERT_EQ(adopted.score.targets[i].data, samples[0].score.targets[i].data);
+  }
+  // Targets outlive the engine that produced them
+  zero_copy_engine.reset();
+  model_server::Sample copied = adopted;
+  ASSERT_EQ(copied.score.targets[0].data, samples[0].score.targets[0].data);
+}
+
+TEST(TFEngine, SampledTrace) {
+  model_server::EngineConf tf_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.pb",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 0,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1
+  };
+  std::unique_ptr<model_server::Engine> engine(model_server::TFEngineFactory::instance()->create(tf_engine_conf));
+  tf_engine_conf.trace_every_n = 1;
+  std::unique_ptr<model_server::Engine> traced_engine(
+    model_server::TFEngineFactory::instance()->create(tf_engine_conf)
+  );  // NOLINT
+
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, 1, 4, true);
+  model_server::Sample traced = samples[0];
+  model_server::Tracer *tracer = model_server::Tracer::instance();
+  tracer->flush();
+  const size_t written = tracer->written();
+  engine->infer(&samples[0].instance, &samples[0].score);
+  traced_engine->infer(&traced.instance, &traced.score);
+  traced_engine->infer_bound(&traced.instance, &traced.score);
+  for (size_t i = 0; i < traced.score.targets.size(); ++i) {
+    ASSERT_EQ(traced.score.targets[i].data, samples[0].score.targets[i].data);
+  }
+  tracer->flush();
+  ASSERT_EQ(tracer->written() - written, 2);
+}
+
+static void add_node(
+  const std::string& name, const std::string& op, const std::vector<std::string>& inputs,
+  tensorflow::GraphDef *graph_def
+) {  // NOLINT
+  auto *node = graph_def->add_node();
+  node->set_name(name);
+  node->set_op(op);
+  for (const auto& input : inputs) {
+    node->add_input(input);
+  }
+}
+
+TEST(TFEngine, PruneGraph) {
+  // raw -> x -> check -> id -> add(w) -> out, with an Assert ordering id and a training branch on out
+  tensorflow::GraphDef graph_def;
+  add_node("raw", "Placeholder", {}, &graph_def);
+  add_node("x", "Identity", {"raw"}, &graph_def);
+  add_node("check", "CheckNumerics", {"x"}, &graph_def);
+  add_node("assert", "Assert", {"check"}, &graph_def);
+  add_node("id", "Identity", {"check:0", "^assert"}, &graph_def);
+  add_node("w", "Const", {}, &graph_def);
+  add_node("w_read", "Identity", {"w"}, &graph_def);
+  add_node("add", "AddV2", {"id", "w_read"}, &graph_def);
+  add_node("out", "Identity", {"add"}, &graph_def);
+  add_node("label", "Placeholder", {}, &graph_def);
+  add_node("loss", "SquaredDifference", {"out", "label"}, &graph_def);
+  add_node("train", "NoOp", {"^loss"}, &graph_def);
+  (*graph_def.mutable_node(7)->mutable_attr())["_class"].mutable_list()->add_s("loc:@w_read");
+
+  model_server::TFGraphPruneReport report;
+  model_server::prune_graph({"x"}, {"out"}, &graph_def, &report);
+  ASSERT_EQ(report.nodes_before, 12);
+  ASSERT_EQ(report.nodes_after, 5);
+  ASSERT_EQ(report.identities_removed, 3);
+  ASSERT_EQ(report.debug_removed, 1);
+  ASSERT_EQ(report.unreachable_removed, 3);
+  ASSERT_LT(report.bytes_after, report.bytes_before);
+
+  std::vector<std::string> names;
+  for (const auto& node : graph_def.node()) {
+    names.push_back(node.name());
+  }
+  ASSERT_EQ(names, std::vector<std::string>({"raw", "x", "w", "add", "out"}));
+  const auto& add = graph_def.node(3);
+  ASSERT_EQ(add.input_size(), 2);
+  ASSERT_EQ(add.input(0), "x");
+  ASSERT_EQ(add.input(1), "w");
+  ASSERT_TRUE(add.attr().end() == add.attr().find("_class"));
+
+  ASSERT_THROW(model_server::prune_graph({"x"}, {"missing"}, &graph_def, &report), std::runtime_error);
+}
+
+TEST(TFEngine, PruneGraphKeepsCond) {
+  // tf.cond(pred, lambda: 1, lambda: 0) on x, the merge waits for ready, and out reads it through y
+  tensorflow::GraphDef graph_def;
+  add_node("x", "Placeholder", {}, &graph_def);
+  add_node("pred", "Placeholder", {}, &graph_def);
+  add_node("cond/Switch", "Switch", {"x", "pred"}, &graph_def);
+  add_node("cond/switch_t", "Identity", {"cond/Switch:1"}, &graph_def);
+  add_node("cond/switch_f", "Identity", {"cond/Switch"}, &graph_def);
+  add_node("cond/one", "Const", {"^cond/switch_t"}, &graph_def);
+  add_node("cond/zero", "Const", {"^cond/switch_f"}, &graph_def);
+  add_node("ready", "Identity", {"x"}, &graph_def);
+  add_node("cond/Merge", "Merge", {"cond/zero", "cond/one", "^ready"}, &graph_def);
+  add_node("y", "Identity", {"cond/Merge"}, &graph_def);
+  add_node("out", "Identity", {"y"}, &graph_def);
+
+  model_server::TFGraphPruneReport report;
+  model_server::prune_graph({"x"}, {"out"}, &graph_def, &report);
+  // Only y goes, the branch identities and ready are sources of control edges
+  ASSERT_EQ(report.nodes_before, 11);
+  ASSERT_EQ(report.nodes_after, 10);
+  ASSERT_EQ(report.identities_removed, 1);
+
+  absl::flat_hash_map<std::string, std::vector<std::string>> inputs;
+  for (const auto& node : graph_def.node()) {
+    inputs[node.name()].assign(node.input().begin(), node.input().end());
+  }
+  ASSERT_FALSE(inputs.contains("y"));
+  ASSERT_EQ(inputs["cond/switch_t"], std::vector<std::string>({"cond/Switch:1"}));
+  ASSERT_EQ(inputs["cond/switch_f"], std::vector<std::string>({"cond/Switch"}));
+  ASSERT_EQ(inputs["cond/one"], std::vector<std::string>({"^cond/switch_t"}));
+  ASSERT_EQ(inputs["cond/zero"], std::vector<std::string>({"^cond/switch_f"}));
+  ASSERT_EQ(inputs["cond/Merge"], std::vector<std::string>({"cond/zero", "cond/one", "^ready"}));
+  ASSERT_EQ(inputs["out"], std::vector<std::string>({"cond/Merge"}));
+}
+
+TEST(TFEngine, PrunedMatchesFull) {
+  model_server::EngineConf tf_engine_conf {
+    .name = "model_1",
+    .version = "1.0.0",
+    .graph_file_loc = "data/models/model_1/2/graph.pb",
+    .input_nodes = {"dense", "sparse_input_unfolded"},
+    .output_nodes = {"predict_node", "p0_click", "p0_atc", "p0_order"},
+    .opt_level = 0,
+    .jit_level = 0,
+    .inter_op_parallelism_threads = 1,
+    .intra_op_parallelism_threads = 1
+  };
+  std::unique_ptr<model_server::Engine> engine(model_server::TFEngineFactory::instance()->create(tf_engine_conf));
+  tf_engine_conf.tf_prune_graph = true;
+  std::unique_ptr<model_server::Engine> pruned_engine(
+    model_server::TFEngineFactory::instance()->create(tf_engine_conf)
+  );  // NOLINT
+
+  std::vector<model_server::Sample> samples;
+  engine->random_sample_gen(&samples, 1, 4, true);
+  model_server::Sample pruned = samples[0];
+  engine->infer(&samples[0].instance, &samples[0].score);
+  pruned_engine->infer(&pruned.instance, &pruned.score);
+  for (size_t i = 0; i < pruned.score.targets.size(); ++i) {
+    ASSERT_EQ(pruned.score.targets[i].data, samples[0].score.targets[i].data);
+  }
+}
+
 int main(int argc, char **argv) {
   model_server::init(argc, argv);
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,104 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <stdint.h>
+#include <chrono>  // NOLINT
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT
+#include "absl/log/log.h"
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/engine/tracer.h"
+
+static std::unique_ptr<model_server::TraceRecord> make_record(const std::string& payload) {
+  return std::unique_ptr<model_server::TraceRecord>(new model_server::TraceRecord{
+    .model = "model_1:1.0.0",
+    .extension = "pb",
+    .payload = payload
+  });
+}
+
+static std::string read_file(const std::string& path) {
+  std::ifstream ifs(path, std::ios::binary);
+  std::stringstream content;
+  content << ifs.rdbuf();
+  return content.str();
+}
+
+TEST(Tracer, SampleRate) {
+  ASSERT_FALSE(model_server::TraceSampler(0).sample());
+  ASSERT_FALSE(model_server::TraceSampler(-1).enabled());
+  ASSERT_TRUE(model_server::TraceSampler(1).sample());
+
+  model_server::TraceSampler sampler(100);
+  int32_t sampled = 0;
+  for (int32_t i = 0; i < 100000; ++i) {
+    sampled += sampler.sample() ? 1 : 0;
+  }
+  ASSERT_GT(sampled, 700);
+  ASSERT_LT(sampled, 1300);
+}
+
+TEST(Tracer, DropWhenFull) {
+  model_server::Tracer tracer(model_server::TracerConf{
+    .dir = testing::TempDir(),
+    .capacity = 4,
+    .flush_interval_ms = 60000
+  });
+
+  for (int32_t i = 0; i < 6; ++i) {
+    tracer.submit(make_record("trace " + std::to_string(i)));
+  }
+  ASSERT_EQ(tracer.dropped(), 2);
+  tracer.flush();
+  ASSERT_EQ(tracer.written(), 4);
+  ASSERT_EQ(read_file(testing::TempDir() + "/trace_model_1_1.0.0_0.pb"), "trace 0");
+  ASSERT_EQ(read_file(testing::TempDir() + "/trace_model_1_1.0.0_3.pb"), "trace 3");
+}
+
+TEST(Tracer, Collector) {
+  model_server::Tracer tracer(model_server::TracerConf{
+    .dir = testing::TempDir(),
+    .capacity = 4,
+    .flush_interval_ms = 60000
+  });
+
+  int32_t collected = 0;
+  const uint64_t id = tracer.add_collector([&]() {
+    tracer.submit(make_record("collected"));
+    ++collected;
+  });
+  tracer.flush();
+  ASSERT_EQ(collected, 1);
+  ASSERT_EQ(tracer.written(), 1);
+
+  tracer.remove_collector(id);
+  tracer.flush();
+  ASSERT_EQ(collected, 1);
+  ASSERT_EQ(tracer.written(), 1);
+}
+
+TEST(Tracer, FlushInBackground) {
+  model_server::Tracer tracer(model_server::TracerConf{
+    .dir = testing::TempDir(),
+    .capacity = 4,
+    .flush_interval_ms = 10
+  });
+
+  tracer.submit(make_record("background"));
+  const absl::Time deadline = absl::Now() + absl::Seconds(5);
+  while (0 == tracer.written() && absl::Now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  ASSERT_EQ(tracer.written(), 1);
+}
+
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,270 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+#include "absl/log/log.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "model_server/src/util/process/process_initiator.h"
+#include "model_server/src/engine/admission.h"
+#include "model_server/src/server/protocol.h"
+#include "model_server/src/server/server.h"
+#include "model_server/src/server/client.h"
+#include "model_server/src/unittest/engine/sum_engine.h"
+
+static const char kModelName[] = "sum";
+
+using model_server::make_sample;
+
+// The model served by the tests, taking the dense feature of make_sample
+static model_server::SumEngine *sum_engine() {
+  static model_server::SumEngine *engine = []() {
+    auto *engine = new model_server::SumEngine(model_server::EngineConf{});
+    engine->declare_input("dense", model_server::DataType::kFloat, 4);
+    return engine;
+  }();
+  return engine;
+}
+
+// Scores every row with the sum of its feature values
+static void sum_dispatcher(
+  const std::string& model, absl::Time deadline, model_server::Priority priority,
+  model_server::Instance *instance, model_server::Score *score
+) {  // NOLINT
+  if (kModelName != model) {
+    throw std::runtime_error("Model " + model + " not found");
+  }
+  sum_engine()->infer(instance, score);
+}
+
+TEST(Protocol, RequestRoundTrip) {
+  model_server::Sample sample;
+  make_sample(3, 1.0f, &sample);
+  // Ids beyond 2^24 would not survive a float round trip
+  sample.instance.features.emplace_back();
+  sample.instance.features[1].name = "ids";
+  sample.instance.features[1].batch_size = 3;
+  sample.instance.features[1].assign(std::vector<int64_t>({(1LL << 40) + 1, 7, -3}));
+  sample.instance.features[1].row_splits = {0, 2, 2, 3};
+
+  std::string frame;
+  model_server::encode_request(
+    7, kModelName, 2000, model_server::Priority::kBulk, sample.instance, sample.score, &frame
+  );  // NOLINT
+  uint32_t body_size = 0;
+  ASSERT_FALSE(model_server::parse_frame_header(frame.data(), 4, &body_size));
+  ASSERT_TRUE(model_server::parse_frame_header(frame.data(), frame.size(), &body_size));
+  ASSERT_EQ(sizeof(model_server::FrameHeader) + body_size, frame.size());
+
+  model_server::Request request;
+  model_server::decode_request(frame.data() + sizeof(model_server::FrameHeader), body_size, &request);
+  ASSERT_EQ(request.id, 7);
+  ASSERT_EQ(request.model, kModelName);
+  ASSERT_EQ(request.timeout_us, 2000);
+  ASSERT_EQ(request.priority, model_server::Priority::kBulk);
+  ASSERT_EQ(request.instance.features.size(), 2);
+  ASSERT_EQ(request.instance.features[0].name, "dense");
+  ASSERT_EQ(request.instance.features[0].batch_size, 3);
+  ASSERT_EQ(request.instance.features[0].dtype, model_server::DataType::kFloat);
+  ASSERT_EQ(request.instance.features[0].data, sample.instance.features[0].data);
+  ASSERT_EQ(request.instance.features[1].dtype, model_server::DataType::kInt64);
+  ASSERT_EQ(request.instance.features[1].values<int64_t>()[0], (1LL << 40) + 1);
+  ASSERT_EQ(request.instance.features[1].data, sample.instance.features[1].data);
+  ASSERT_EQ(request.instance.features[1].row_splits, sample.instance.features[1].row_splits);
+  ASSERT_FALSE(request.instance.features[0].ragged());
+  ASSERT_EQ(request.score.targets.size(), 1);
+  ASSERT_EQ(request.score.targets[0].name, "predict_node");
+
+  ASSERT_THROW(
+    model_server::decode_request(frame.data() + sizeof(model_server::FrameHeader), body_size - 1, &request),
+    std::runtime_error
+  );  // NOLINT
+
+  // Row splits past the values are a bad request
+  sample.instance.features[1].row_splits = {0, 2, 2, 4};
+  frame.clear();
+  model_server::encode_request(
+    7, kModelName, 2000, model_server::Priority::kNormal, sample.instance, sample.score, &frame
+  );  // NOLINT
+  ASSERT_THROW(
+    model_server::decode_request(frame.data() + sizeof(model_server::FrameHeader), body_size, &request),
+    std::invalid_argument
+  );  // NOLINT
+
+  // And dense values that do not fill whole rows
+  sample.instance.features[1].row_splits = {0, 2, 2, 3};
+  const model_server::Tensor dense = sample.instance.features[0];
+  sample.instance.features[0].resize(3 * 4 - 1);
+  frame.clear();
+  model_server::encode_request(
+    7, kModelName, 2000, model_server::Priority::kNormal, sample.instance, sample.score, &frame
+  );  // NOLINT
+  ASSERT_TRUE(model_server::parse_frame_header(frame.data(), frame.size(), &body_size));
+  ASSERT_THROW(
+    model_server::decode_request(frame.data() + sizeof(model_server::FrameHeader), body_size, &request),
+    std::invalid_argument
+  );  // NOLINT
+  sample.instance.features[0] = dense;
+
+  // So is a priority out of range
+  frame.clear();
+  model_server::encode_request(
+    7, kModelName, 2000, static_cast<model_server::Priority>(model_server::kNumPriorities), sample.instance,
+    sample.score, &frame
+  );  // NOLINT
+  ASSERT_THROW(
+    model_server::decode_request(frame.data() + sizeof(model_server::FrameHeader), body_size, &request),
+    std::runtime_error
+  );  // NOLINT
+
+  // As are features without rows or disagreeing on them
+  for (const int64_t batch_size : {0, -3, 2}) {
+    sample.instance.features[1].batch_size = batch_size;
+    frame.clear();
+    model_server::encode_request(
+      7, kModelName, 2000, model_server::Priority::kNormal, sample.instance, sample.score, &frame
+    );  // NOLINT
+    ASSERT_TRUE(model_server::parse_frame_header(frame.data(), frame.size(), &body_size));
+    ASSERT_THROW(
+      model_server::decode_request(frame.data() + sizeof(model_server::FrameHeader), body_size, &request),
+      std::runtime_error
+    );  // NOLINT
+  }
+  frame[0] = ~frame[0];
+  ASSERT_THROW(model_server::parse_frame_header(frame.data(), frame.size(), &body_size), std::runtime_error);
+}
+
+TEST(Server, Loopback) {
+  model_server::ServerConf server_conf {
+    .host = "127.0.0.1",
+    .port = 0,
+    .num_io_threads = 2,
+    .num_workers = 4
+  };
+  // Requests are decoded into pooled samples, unknown models into the worker's scratch
+  auto pool = model_server::SamplePool::create(sum_engine(), model_server::SamplePoolConf{
+    .max_batch_size = 8,
+    .capacity = 16
+  });
+  model_server::Server server(server_conf, &sum_dispatcher, [&pool](const std::string& model) {
+    return kModelName == model ? pool->acquire() : model_server::SamplePool::Handle();
+  });
+  server.start();
+
+  const int32_t kClients = 8;
+  const int32_t kCallsPerClient = 50;
+  std::atomic<int32_t> failures(0);
+  std::vector<std::thread> clients;
+  for (int32_t i = 0; i < kClients; ++i) {
+    clients.emplace_back([&server, &failures, i]() {
+      model_server::Client client("127.0.0.1", server.port());
+      for (int32_t j = 0; j < kCallsPerClient; ++j) {
+        model_server::Sample sample;
+        const int64_t rows = 1 + (i + j) % 5;
+        const float base = 100.0f * i + j;
+        make_sample(rows, base, &sample);
+        client.call(kModelName, &sample.instance, &sample.score);
+
+        const auto& target = sample.score.targets[0];
+        if (target.batch_size != rows || static_cast<int64_t>(target.size()) != rows) {
+          failures.fetch_add(1);
+          continue;
+        }
+        for (int64_t row = 0; row < rows; ++row) {
+          if (target.values<float>()[row] != 4.0f * (base + row)) {
+            failures.fetch_add(1);
+          }
+        }
+      }
+    });
+  }
+  for (auto& client : clients) {
+    client.join();
+  }
+  ASSERT_EQ(failures.load(), 0);
+  server.stop();
+  ASSERT_GT(pool->pooled(), 0);
+  ASSERT_LE(pool->pooled(), server_conf.num_workers);
+}
+
+TEST(Server, DispatchError) {
+  model_server::ServerConf server_conf {
+    .host = "127.0.0.1",
+    .port = 0,
+    .num_io_threads = 1,
+    .num_workers = 1
+  };
+  model_server::Server server(server_conf, &sum_dispatcher);
+  server.start();
+
+  model_server::Client client("127.0.0.1", server.port());
+  model_server::Sample sample;
+  make_sample(2, 0.0f, &sample);
+  ASSERT_THROW(client.call("unknown", &sample.instance, &sample.score), std::runtime_error);
+
+  // Refused by the decoder with a bad request status, the model never sees it
+  model_server::Sample uneven;
+  make_sample(2, 0.0f, &uneven);
+  uneven.instance.features[0].resize(7);
+  try {
+    client.call(kModelName, &uneven.instance, &uneven.score);
+    FAIL();
+  } catch (const std::runtime_error& e) {
+    ASSERT_NE(std::string(e.what()).find("status " + std::to_string(model_server::kStatusBadRequest)),
+      std::string::npos);
+  }
+
+  // The connection survives a failed request
+  client.call(kModelName, &sample.instance, &sample.score);
+  ASSERT_FLOAT_EQ(sample.score.targets[0].values<float>()[1], 4.0f);
+}
+
+TEST(Server, Rejected) {
+  model_server::ServerConf server_conf {
+    .host = "127.0.0.1",
+    .port = 0,
+    .num_io_threads = 1,
+    .num_workers = 1
+  };
+  // Holds the only worker long enough for a queued request to run out of time
+  model_server::Server server(server_conf, [](
+    const std::string& model, absl::Time deadline, model_server::Priority priority,
+    model_server::Instance *instance, model_server::Score *score
+  ) {  // NOLINT
+    if ("shed" == model) {
+      throw model_server::AdmissionRejected("Concurrency limit reached");
+    }
+    absl::SleepFor(absl::Milliseconds(50));
+    sum_dispatcher(kModelName, deadline, priority, instance, score);
+  });  // NOLINT
+  server.start();
+
+  model_server::Client client("127.0.0.1", server.port());
+  model_server::Sample sample;
+  make_sample(1, 0.0f, &sample);
+  ASSERT_THROW(client.call("shed", &sample.instance, &sample.score), model_server::AdmissionRejected);
+
+  std::thread slow([&server]() {
+    model_server::Client client("127.0.0.1", server.port());
+    model_server::Sample sample;
+    make_sample(1, 0.0f, &sample);
+    client.call(kModelName, &sample.instance, &sample.score);
+  });
+  absl::SleepFor(absl::Milliseconds(10));
+  ASSERT_THROW(
+    client.call(kModelName, &sample.instance, &sample.score, absl::Milliseconds(5)),
+    model_server::AdmissionRejected
+  );  // NOLINT
+  slow.join();
+}
+
+int main(int argc, char **argv) {
+  model_server::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -1,6 +1,10 @@
 // Copyright (C) 2021 zh.luxu1986@gmail.com
 
+#include <algorithm>
+#include <atomic>
 #include <string>
+#include <thread>  // NOLINT
+#include <vector>
 #include "gtest/gtest.h"
 #include "absl/log/log.h"
 #include "absl/time/clock.h"
@@ -9,8 +13,12 @@
 #include "model_server/src/util/os/network.h"
 #include "model_server/src/util/os/resource_used.h"
 #include "model_server/src/util/os/semaphore.h"
+#include "model_server/src/util/os/mapped_file.h"
+#include "model_server/src/util/os/numa.h"
 #include "model_server/src/util/io.h"
 #include "model_server/src/util/comm.h"
+#include "model_server/src/util/functional/mpmc_queue.h"
+#include "model_server/src/util/functional/lru_cache.h"
 #include "model_server/src/util/process/process_status.h"
 #include "model_server/src/util/process/process_initiator.h"
 
@@ -33,6 +41,22 @@ TEST(UTIL_OS_THREAD_CPU, SET_THREAD_CPU) {
   ASSERT_EQ(get_cpu_id, set_cpu_id);
 }
 
+TEST(UTIL_OS_THREAD_CPU, CURRENT_CPU_IS_ALLOWED) {
+  std::vector<int64_t> cpu_ids;
+  ASSERT_TRUE(get_thread_cpus(&cpu_ids));
+  std::thread pinned([&cpu_ids]() {
+    // Pinned to one CPU, the thread can only be running there
+    ASSERT_TRUE(set_thread_cpus({cpu_ids.back()}));
+    std::vector<int64_t> pinned_cpu_ids;
+    ASSERT_TRUE(get_thread_cpus(&pinned_cpu_ids));
+    ASSERT_EQ(pinned_cpu_ids, std::vector<int64_t>({cpu_ids.back()}));
+    int64_t cpu_id = -1;
+    ASSERT_TRUE(get_current_cpu(&cpu_id));
+    ASSERT_EQ(cpu_id, cpu_ids.back());
+  });
+  pinned.join();
+}
+
 TEST(UTIL_OS_NETWORK, GET_HOST_IP) {
   string ip;
   ASSERT_TRUE(get_host_ip(&ip));
@@ -62,6 +86,49 @@ TEST(UTIL_OS_VPOPEN, VPOPEN) {
   ASSERT_NE(vpclose(fp), -1);
 }
 
+TEST(UTIL_OS_NUMA, CPU_LIST) {
+  std::vector<int64_t> cpu_ids;
+  ASSERT_TRUE(parse_cpu_list("0-3,8,10-11\n", &cpu_ids));
+  ASSERT_EQ(cpu_ids, std::vector<int64_t>({0, 1, 2, 3, 8, 10, 11}));
+  ASSERT_TRUE(parse_cpu_list("", &cpu_ids));
+  ASSERT_TRUE(cpu_ids.empty());
+  ASSERT_FALSE(parse_cpu_list("3-1", &cpu_ids));
+  ASSERT_FALSE(parse_cpu_list("a", &cpu_ids));
+}
+
+TEST(UTIL_OS_NUMA, NODES) {
+  std::vector<std::vector<int64_t>> node_cpus;
+  ASSERT_TRUE(get_numa_node_cpus(&node_cpus));
+  ASSERT_FALSE(node_cpus.empty());
+  for (const auto& cpu_ids : node_cpus) {
+    ASSERT_FALSE(cpu_ids.empty());
+  }
+
+  // Pinned to a node, the thread only runs there
+  std::thread thread([&node_cpus]() {
+    ASSERT_TRUE(set_thread_cpus(node_cpus.back()));
+    int64_t cpu_id = -1;
+    ASSERT_TRUE(get_thread_cpu(&cpu_id));
+    ASSERT_NE(std::find(node_cpus.back().begin(), node_cpus.back().end(), cpu_id), node_cpus.back().end());
+  });
+  thread.join();
+}
+
+TEST(UTIL_OS_MAPPED_FILE, MAP) {
+  MappedFile file;
+  ASSERT_FALSE(file.open("data/files/not_exist"));
+  ASSERT_EQ(file.data(), nullptr);
+
+  ASSERT_TRUE(file.open("data/files/hello"));
+  file.advise_sequential();
+  ASSERT_EQ(string(file.data(), file.size()), "Hello world!\nAnd c++!\nbazel!\n");
+  // Released pages are read back in from the file
+  file.release_pages();
+  ASSERT_EQ(string(file.data(), file.size()), "Hello world!\nAnd c++!\nbazel!\n");
+  file.close();
+  ASSERT_EQ(file.size(), 0);
+}
+
 TEST(UTIL_IO, READ_LINE) {
   FILE *fp = fopen("data/files/hello", "r");
   ASSERT_NE(fp, nullptr);
@@ -100,6 +167,17 @@ TEST(UTIL_COMM, EXECUTE_SPAWN) {
   ASSERT_STREQ(out.c_str(), "hello world\n");
 }
 
+TEST(UTIL_COMM, EXECUTE_ARGV) {
+  // Arguments reach the program as they are, quotes and all
+  string err;
+  ASSERT_TRUE(model_server::execute_argv({"sh", "-c", "echo \"$0\" >&2", "it's"}, &err));
+  ASSERT_STREQ(err.c_str(), "it's\n");
+
+  ASSERT_FALSE(model_server::execute_argv({"sh", "-c", "echo failed >&2; exit 3"}, &err));
+  ASSERT_STREQ(err.c_str(), "failed\n");
+  ASSERT_FALSE(model_server::execute_argv({"model_server_no_such_program"}, nullptr));
+}
+
 TEST(UTIL_PROCESS, STATUS) {
   model_server::ProcessStatus process_status;
   absl::SleepFor(absl::Seconds(10));
@@ -111,8 +189,93 @@ TEST(UTIL_FUNCTIONAL, SEMAPHORE) {
   s.post();
 }
 
+TEST(UTIL_FUNCTIONAL, MPMC_QUEUE_BOUNDED) {
+  model_server::MPMCQueue<int64_t> queue(3);
+  ASSERT_EQ(queue.capacity(), 4);
+  for (int64_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(queue.try_push(i));
+  }
+  ASSERT_FALSE(queue.try_push(4));
+
+  int64_t values[8];
+  ASSERT_EQ(queue.try_pop_batch(values, 3), 3);
+  ASSERT_EQ(values[0], 0);
+  ASSERT_EQ(values[2], 2);
+  ASSERT_TRUE(queue.try_push(4));
+  ASSERT_EQ(queue.try_pop_batch(values, 8), 2);
+  ASSERT_EQ(values[1], 4);
+  ASSERT_FALSE(queue.try_pop(values));
+}
+
+TEST(UTIL_FUNCTIONAL, MPMC_QUEUE_CONCURRENT) {
+  const int32_t kProducers = 4;
+  const int32_t kConsumers = 4;
+  const int64_t kItemsPerProducer = 100000;
+  const int64_t kTotal = kProducers * kItemsPerProducer;
+  model_server::MPMCQueue<int64_t> queue(1024);
+
+  std::atomic<int64_t> popped(0);
+  std::vector<int64_t> sums(kConsumers, 0);
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < kProducers; ++i) {
+    threads.emplace_back([&queue, i]() {
+      for (int64_t j = 1; j <= kItemsPerProducer; ++j) {
+        while (!queue.try_push(i * kItemsPerProducer + j)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (int32_t i = 0; i < kConsumers; ++i) {
+    threads.emplace_back([&queue, &popped, &sums, i]() {
+      int64_t values[16];
+      while (popped.load() < kTotal) {
+        const size_t count = queue.try_pop_batch(values, 1 + i * 5);
+        for (size_t j = 0; j < count; ++j) {
+          sums[i] += values[j];
+        }
+        popped.fetch_add(count);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  int64_t sum = 0;
+  for (auto& consumer_sum : sums) {
+    sum += consumer_sum;
+  }
+  ASSERT_EQ(popped.load(), kTotal);
+  ASSERT_EQ(sum, kTotal * (kTotal + 1) / 2);
+}
+
 int32_t main(int32_t argc, char *argv[]) {
   model_server::init(argc, argv);
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }
+
+TEST(UTIL_FUNCTIONAL, LRU_CACHE) {
+  model_server::ShardedLRUCache<int64_t, std::string> cache(2, absl::Milliseconds(50), 1);
+  std::string value;
+  ASSERT_FALSE(cache.get(1, &value));
+  cache.put(1, "one");
+  cache.put(2, "two");
+  ASSERT_TRUE(cache.get(1, &value));
+  ASSERT_EQ(value, "one");
+
+  // 2 is the least recently used one now
+  cache.put(3, "three");
+  ASSERT_EQ(cache.size(), 2);
+  ASSERT_FALSE(cache.get(2, &value));
+  ASSERT_TRUE(cache.get(3, &value));
+  ASSERT_EQ(value, "three");
+
+  absl::SleepFor(absl::Milliseconds(60));
+  ASSERT_FALSE(cache.get(1, &value));
+  cache.put(4, "four");
+  ASSERT_TRUE(cache.get(4, &value));
+  cache.clear();
+  ASSERT_EQ(cache.size(), 0);
+}
@@ -14,6 +14,8 @@
 #include "model_server/src/util/os/vpopen.h"
 #include "model_server/src/util/io.h"
 
+extern char **environ;
+
 using std::string;
 using std::mutex;
 using std::lock_guard;
@@ -198,6 +200,78 @@ bool execute(const string& cmd, string *stdo, string *stde) {
   return ret;
 }
 
+bool execute_argv(const std::vector<string>& args, string *stde) {
+  if (args.empty()) {
+    return false;
+  }
+
+  bool ret = true;
+  int32_t exit_code = 0;
+
+  posix_spawn_file_actions_t action;
+  exit_code = posix_spawn_file_actions_init(&action);
+  if (0 != exit_code) {
+    return false;
+  }
+
+  int32_t cerr_pipe[2] = {-1, -1};
+  do {
+    if (nullptr != stde) {
+      stde->clear();
+      if (pipe(cerr_pipe)) {
+        ret = false;
+        break;
+      }
+      if (0 != posix_spawn_file_actions_addclose(&action, cerr_pipe[0])
+          || 0 != posix_spawn_file_actions_adddup2(&action, cerr_pipe[1], 2)
+          || 0 != posix_spawn_file_actions_addclose(&action, cerr_pipe[1])) {
+        ret = false;
+        break;
+      }
+    }
+
+    std::vector<char *> argv;
+    argv.reserve(args.size() + 1);
+    for (const auto& arg : args) {
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    pid_t pid;
+    exit_code = posix_spawnp(&pid, argv[0], &action, nullptr, argv.data(), environ);
+    if (0 != exit_code) {
+      ret = false;
+      break;
+    }
+
+    // Drained before waiting, a child filling the pipe would never exit otherwise
+    if (nullptr != stde) {
+      close(cerr_pipe[1]);
+      cerr_pipe[1] = -1;
+      if (!read_file(cerr_pipe[0], stde)) {
+        ret = false;
+      }
+    }
+
+    int32_t status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+        ret = false;
+        break;
+      }
+    }
+    ret = ret && WIFEXITED(status) && 0 == WEXITSTATUS(status);
+  } while (0);
+
+  for (const auto& fd : cerr_pipe) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  posix_spawn_file_actions_destroy(&action);
+
+  return ret;
+}
+
 static mutex g_pipe_mtx;
 
 // popen and pclose are not thread-safe
@@ -4,6 +4,7 @@
 #define MODEL_SERVER_SRC_UTIL_COMM_H_
 
 #include <string>
+#include <vector>
 
 namespace model_server {
 
@@ -21,6 +22,13 @@ bool execute(
   std::string *stde
 ); // NOLINT
 
+// Run argv[0], looked up in PATH, with the arguments as they are, no shell in between. True if it
+// exited with 0. What it wrote to stderr goes to stde unless that is null.
+bool execute_argv(
+  const std::vector<std::string>& args,
+  std::string *stde
+); // NOLINT
+
 bool execute_vfork(
   const std::string& cmd,
   std::string *res = nullptr,
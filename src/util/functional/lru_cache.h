@@ -0,0 +1,127 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_UTIL_FUNCTIONAL_LRU_CACHE_H_
+#define MODEL_SERVER_SRC_UTIL_FUNCTIONAL_LRU_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace model_server {
+
+// Concurrent LRU cache whose entries also expire ttl after they were put.
+// Keys are spread over independently locked shards by their hash, each shard
+// evicts its least recently used entry once it holds capacity / num_shards entries.
+// With a transparent Hash and Eq, get takes any key type they accept without building a K.
+template <typename K, typename V, typename Hash = absl::Hash<K>, typename Eq = std::equal_to<K>>
+class ShardedLRUCache {
+ public:
+  ShardedLRUCache(size_t capacity, absl::Duration ttl, size_t num_shards) noexcept(false) :
+    ttl_(ttl),
+    shard_capacity_(num_shards > 0 ? (capacity + num_shards - 1) / num_shards : 0),
+    num_shards_(num_shards) {
+    if (0 == capacity || 0 == num_shards) {
+      throw std::invalid_argument("ShardedLRUCache capacity and num_shards must be positive, got "
+        + std::to_string(capacity) + " and " + std::to_string(num_shards));
+    }
+    shards_ = std::unique_ptr<Shard[]>(new Shard[num_shards_]);
+  }
+  virtual ~ShardedLRUCache() {}
+
+  ShardedLRUCache() = delete;
+  ShardedLRUCache& operator=(const ShardedLRUCache&) = delete;
+  ShardedLRUCache(const ShardedLRUCache&) = delete;
+
+  // Copy the value out and mark it as most recently used, expired entries are dropped on the way
+  template <typename L = K>
+  bool get(const L& key, V *value) noexcept(false) {
+    Shard& shard = shard_of(key);
+    std::lock_guard lock(shard.mtx);
+    auto found = shard.index.find(key);
+    if (shard.index.end() == found) {
+      return false;
+    }
+    if (absl::Now() >= found->second->expire_time) {
+      shard.entries.erase(found->second);
+      shard.index.erase(found);
+      return false;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+    *value = found->second->value;
+    return true;
+  }
+
+  void put(const K& key, V value) noexcept(false) {
+    const absl::Time expire_time = absl::Now() + ttl_;
+    Shard& shard = shard_of(key);
+    std::lock_guard lock(shard.mtx);
+    auto found = shard.index.find(key);
+    if (shard.index.end() != found) {
+      found->second->value = std::move(value);
+      found->second->expire_time = expire_time;
+      shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+      return;
+    }
+    if (shard.entries.size() >= shard_capacity_) {
+      shard.index.erase(shard.entries.back().key);
+      shard.entries.pop_back();
+    }
+    shard.entries.push_front(Entry{key, std::move(value), expire_time});
+    shard.index.emplace(key, shard.entries.begin());
+  }
+
+  void clear() noexcept {
+    for (size_t i = 0; i < num_shards_; ++i) {
+      std::lock_guard lock(shards_[i].mtx);
+      shards_[i].index.clear();
+      shards_[i].entries.clear();
+    }
+  }
+
+  size_t size() const noexcept {
+    size_t size = 0;
+    for (size_t i = 0; i < num_shards_; ++i) {
+      std::lock_guard lock(shards_[i].mtx);
+      size += shards_[i].entries.size();
+    }
+    return size;
+  }
+
+ private:
+  struct Entry {
+    K          key;
+    V          value;
+    absl::Time expire_time;
+  };
+
+  struct Shard {
+    mutable std::mutex                                                      mtx;
+    std::list<Entry>                                                        entries;
+    absl::flat_hash_map<K, typename std::list<Entry>::iterator, Hash, Eq>  index;
+  };
+
+  template <typename L>
+  Shard& shard_of(const L& key) noexcept {
+    // The high bits pick the shard, the table inside uses the low ones
+    return shards_[(Hash{}(key) >> 32) % num_shards_];
+  }
+
+  absl::Duration           ttl_;
+  size_t                   shard_capacity_;
+  size_t                   num_shards_;
+  std::unique_ptr<Shard[]> shards_;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_UTIL_FUNCTIONAL_LRU_CACHE_H_
@@ -0,0 +1,161 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_UTIL_FUNCTIONAL_MPMC_QUEUE_H_
+#define MODEL_SERVER_SRC_UTIL_FUNCTIONAL_MPMC_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace model_server {
+
+const size_t kCacheLineSize = 64;
+
+// Bounded lock-free multi-producer multi-consumer ring buffer (Dmitry Vyukov's design).
+// Every cell carries a sequence number telling which lap may write or read it next,
+// so producers and consumers only contend on their own position counter. The counters
+// and cells are padded to cache lines to keep producers and consumers from false sharing.
+template <typename T>
+class MPMCQueue {
+  static_assert(std::is_nothrow_move_constructible<T>::value, "T must be nothrow move constructible");
+
+ public:
+  // Capacity is rounded up to a power of two
+  explicit MPMCQueue(size_t capacity) noexcept(false) :
+    mask_(round_up_pow2(capacity) - 1),
+    cells_(new Cell[mask_ + 1]),
+    enqueue_pos_(0),
+    dequeue_pos_(0) {
+    if (capacity < 2) {
+      throw std::invalid_argument("MPMCQueue capacity must be at least 2, got " + std::to_string(capacity));
+    }
+    for (size_t i = 0; i <= mask_; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  virtual ~MPMCQueue() {
+    const size_t enqueue_pos = enqueue_pos_.load(std::memory_order_acquire);
+    for (size_t pos = dequeue_pos_.load(std::memory_order_acquire); pos != enqueue_pos; ++pos) {
+      Cell *cell = &cells_[pos & mask_];
+      if (cell->sequence.load(std::memory_order_acquire) == pos + 1) {
+        std::launder(reinterpret_cast<T*>(cell->storage))->~T();
+      }
+    }
+  }
+
+  MPMCQueue() = delete;
+  MPMCQueue& operator=(const MPMCQueue&) = delete;
+  MPMCQueue(const MPMCQueue&) = delete;
+
+  // Return false without blocking if the queue is full
+  template <typename U>
+  bool try_push(U&& value) noexcept(std::is_nothrow_constructible<T, U&&>::value) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell *cell = nullptr;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (0 == diff) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    new (cell->storage) T(std::forward<U>(value));
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Return false without blocking if the queue is empty
+  bool try_pop(T *value) noexcept {
+    return 1 == try_pop_batch(value, 1);
+  }
+
+  // Pop up to max_count consecutive items into values, return how many were popped
+  size_t try_pop_batch(T *values, size_t max_count) noexcept {
+    if (0 == max_count) {
+      return 0;
+    }
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    size_t count = 0;
+    while (true) {
+      // Count the published cells from pos on, then claim them all with a single CAS
+      count = 0;
+      while (count < max_count) {
+        const size_t sequence = cells_[(pos + count) & mask_].sequence.load(std::memory_order_acquire);
+        if (sequence != pos + count + 1) {
+          break;
+        }
+        ++count;
+      }
+      if (0 == count) {
+        const size_t sequence = cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1) < 0) {
+          return 0;
+        }
+        // Another consumer moved past pos
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      Cell *cell = &cells_[(pos + i) & mask_];
+      T *item = std::launder(reinterpret_cast<T*>(cell->storage));
+      values[i] = std::move(*item);
+      item->~T();
+      cell->sequence.store(pos + i + mask_ + 1, std::memory_order_release);
+    }
+    return count;
+  }
+
+  size_t capacity() const noexcept {
+    return mask_ + 1;
+  }
+
+  // Only a snapshot, it may be stale as soon as it returns
+  size_t size() const noexcept {
+    const size_t enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+    const size_t dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+  }
+
+ private:
+  struct alignas(kCacheLineSize) Cell {
+    std::atomic<size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  static size_t round_up_pow2(size_t value) noexcept {
+    size_t pow2 = 2;
+    while (pow2 < value) {
+      pow2 <<= 1;
+    }
+    return pow2;
+  }
+
+  const size_t            mask_;
+  std::unique_ptr<Cell[]> cells_;
+
+  alignas(kCacheLineSize) std::atomic<size_t> enqueue_pos_;
+  alignas(kCacheLineSize) std::atomic<size_t> dequeue_pos_;
+};
+
+}  // namespace model_server
+
+#endif  // MODEL_SERVER_SRC_UTIL_FUNCTIONAL_MPMC_QUEUE_H_
@@ -0,0 +1,73 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/util/os/mapped_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() : data_(nullptr), size_(0) {
+}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+bool MappedFile::open(const std::string& path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    return false;
+  }
+  struct stat st;
+  if (-1 == fstat(fd, &st)) {
+    int err = errno;
+    ::close(fd);
+    errno = err;
+    return false;
+  }
+  if (0 == st.st_size) {
+    ::close(fd);
+    return true;
+  }
+
+  void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  int err = errno;
+  // The mapping holds its own reference to the file
+  ::close(fd);
+  if (MAP_FAILED == data) {
+    errno = err;
+    return false;
+  }
+  data_ = static_cast<char*>(data);
+  size_ = static_cast<size_t>(st.st_size);
+  return true;
+}
+
+void MappedFile::close() {
+  if (nullptr != data_) {
+    munmap(data_, size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
+void MappedFile::advise_sequential() {
+  if (nullptr == data_) {
+    return;
+  }
+  // Hints only, the mapping reads the same without them
+  madvise(data_, size_, MADV_SEQUENTIAL);
+  madvise(data_, size_, MADV_WILLNEED);
+}
+
+void MappedFile::release_pages() {
+  if (nullptr == data_) {
+    return;
+  }
+  // Clean private file pages are simply read again from the file if touched later
+  madvise(data_, size_, MADV_DONTNEED);
+}
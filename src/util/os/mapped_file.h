@@ -0,0 +1,36 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_UTIL_OS_MAPPED_FILE_H_
+#define MODEL_SERVER_SRC_UTIL_OS_MAPPED_FILE_H_
+
+#include <stddef.h>
+#include <string>
+
+// Read only mapping of a whole file. Pages are read in on first touch and stay backed by the
+// page cache, so loading a large file neither copies it into the heap nor holds two copies.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Map the file, errno tells why when it fails. An empty file maps to no data.
+  bool open(const std::string& path);
+  void close();
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // The mapping is about to be read once front to back, read ahead aggressively
+  void advise_sequential();
+  // Done reading, drop the pages from this process while the mapping stays valid
+  void release_pages();
+
+ private:
+  char   *data_;
+  size_t  size_;
+};
+
+#endif  // MODEL_SERVER_SRC_UTIL_OS_MAPPED_FILE_H_
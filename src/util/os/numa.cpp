@@ -0,0 +1,114 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#include "model_server/src/util/os/numa.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <utility>
+
+bool parse_cpu_list(const std::string& cpu_list, std::vector<int64_t> *cpu_ids) {
+  if (nullptr == cpu_ids) {
+    return false;
+  }
+  cpu_ids->clear();
+  size_t begin = 0;
+  while (begin < cpu_list.size()) {
+    size_t end = cpu_list.find(',', begin);
+    if (std::string::npos == end) {
+      end = cpu_list.size();
+    }
+    const std::string range = cpu_list.substr(begin, end - begin);
+    begin = end + 1;
+    if (range.empty() || "\n" == range) {
+      continue;
+    }
+
+    char *rest = nullptr;
+    const int64_t first = strtoll(range.c_str(), &rest, 10);
+    if (rest == range.c_str() || first < 0) {
+      return false;
+    }
+    int64_t last = first;
+    if ('-' == *rest) {
+      const char *last_begin = rest + 1;
+      last = strtoll(last_begin, &rest, 10);
+      if (rest == last_begin || last < first) {
+        return false;
+      }
+    }
+    if ('\0' != *rest && '\n' != *rest) {
+      return false;
+    }
+    for (int64_t cpu_id = first; cpu_id <= last; ++cpu_id) {
+      cpu_ids->push_back(cpu_id);
+    }
+  }
+  return true;
+}
+
+static bool get_online_cpus(std::vector<std::vector<int64_t>> *node_cpus) {
+  const int64_t num = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num <= 0) {
+    return false;
+  }
+  node_cpus->assign(1, std::vector<int64_t>());
+  for (int64_t i = 0; i < num; ++i) {
+    (*node_cpus)[0].push_back(i);
+  }
+  return true;
+}
+
+#ifdef __APPLE__
+
+bool get_numa_node_cpus(std::vector<std::vector<int64_t>> *node_cpus) {
+  if (nullptr == node_cpus) {
+    return false;
+  }
+  return get_online_cpus(node_cpus);
+}
+
+#elif defined(__linux__)
+
+static const char kNumaOnlinePath[] = "/sys/devices/system/node/online";
+static const char kNumaNodePath[]   = "/sys/devices/system/node/node";
+
+bool get_numa_node_cpus(std::vector<std::vector<int64_t>> *node_cpus) {
+  if (nullptr == node_cpus) {
+    return false;
+  }
+  node_cpus->clear();
+  // Node ids may be sparse, e.g. "0-1,3" once a node is offlined, so walk the online list
+  std::ifstream online(kNumaOnlinePath);
+  if (!online.is_open()) {
+    return get_online_cpus(node_cpus);
+  }
+  std::string node_list;
+  std::getline(online, node_list);
+  std::vector<int64_t> nodes;
+  if (!parse_cpu_list(node_list, &nodes)) {
+    return false;
+  }
+  for (const auto& node : nodes) {
+    std::ifstream file(kNumaNodePath + std::to_string(node) + "/cpulist");
+    if (!file.is_open()) {
+      return false;
+    }
+    std::string cpu_list;
+    std::getline(file, cpu_list);
+    std::vector<int64_t> cpu_ids;
+    if (!parse_cpu_list(cpu_list, &cpu_ids)) {
+      return false;
+    }
+    // Memory only nodes have no CPUs, there is nothing to pin to them
+    if (!cpu_ids.empty()) {
+      node_cpus->push_back(std::move(cpu_ids));
+    }
+  }
+  if (node_cpus->empty()) {
+    return get_online_cpus(node_cpus);
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,17 @@
+// Copyright (C) 2023 zh.luxu1986@gmail.com
+
+#ifndef MODEL_SERVER_SRC_UTIL_OS_NUMA_H_
+#define MODEL_SERVER_SRC_UTIL_OS_NUMA_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// CPUs of every online NUMA node holding any, in node id order. A host without NUMA, or without a
+// way to tell, is one node holding every online CPU.
+bool get_numa_node_cpus(std::vector<std::vector<int64_t>> *node_cpus);
+
+// Parse a kernel CPU or node list such as "0-3,8,10-11"
+bool parse_cpu_list(const std::string& cpu_list, std::vector<int64_t> *cpu_ids);
+
+#endif  // MODEL_SERVER_SRC_UTIL_OS_NUMA_H_
@@ -24,6 +24,7 @@ bool get_process_resource_used(struct ResourceUsed *res) {
                    + static_cast<double>(t_info.user_time.microseconds) / 1000.0;
   res->system_time = static_cast<double>(t_info.system_time.seconds)
                    + static_cast<double>(t_info.system_time.microseconds) / 1000.0;
+  res->num_threads = 0;
 
   return true;
 }
@@ -54,6 +55,7 @@ bool get_system_resource_used(struct ResourceUsed *res) {
     * static_cast<double>(page_size) / 1024.0 / 1024.0;
   res->user_time   = 0.0;
   res->system_time = 0.0;
+  res->num_threads = 0;
 
   return true;
 }
@@ -78,7 +80,7 @@ bool get_process_resource_used(struct ResourceUsed *res) {
   // useless fields
   string pid, comm, state, ppid, pgrp, session, tty_nr,
          tpgid, flags, minflt, cminflt, majflt, cmajflt,
-         cutime, cstime, priority, nice, num_threads,
+         cutime, cstime, priority, nice,
          itrealvalue, starttime, rsslim, startcode, endcode,
          startstack, kstkesp, kstkeip, signal, blocked,
          sigignore, sigcatch, wchan, nswap, cnswap, exit_signal,
@@ -88,7 +90,7 @@ bool get_process_resource_used(struct ResourceUsed *res) {
          exit_code;
 
   // useful fields
-  int64_t utime, stime, vsize, rss;
+  int64_t utime, stime, num_threads, vsize, rss;
 
   ifstream stat_stream("/proc/self/stat", ios_base::in);
   stat_stream >> pid >> comm >> state >> ppid >> pgrp >> session >> tty_nr
@@ -103,6 +105,7 @@ bool get_process_resource_used(struct ResourceUsed *res) {
   res->resident_mb = rss * page_size_mb;
   res->user_time   = utime / sysconf(_SC_CLK_TCK);
   res->system_time  = stime / sysconf(_SC_CLK_TCK);
+  res->num_threads = num_threads;
 
   return true;
 }
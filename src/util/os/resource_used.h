@@ -3,10 +3,13 @@
 #ifndef MODEL_SERVER_SRC_UTIL_OS_RESOURCE_USED_H_
 #define MODEL_SERVER_SRC_UTIL_OS_RESOURCE_USED_H_
 
+#include <stdint.h>
+
 struct ResourceUsed {
   double resident_mb;
   double user_time;
   double system_time;
+  int64_t num_threads;  // of the process, 0 where unknown
 };
 
 bool get_process_resource_used(struct ResourceUsed *res);
@@ -62,8 +62,22 @@ bool set_thread_cpu(int64_t cpu_id) {
   return true;
 }
 
+bool set_thread_cpus(const std::vector<int64_t>& cpu_ids) {
+  // Only affinity tags, which are hints, exist here
+  return false;
+}
+
+bool get_thread_cpus(std::vector<int64_t> *cpu_ids) {
+  return false;
+}
+
+bool get_current_cpu(int64_t *cpu_id) {
+  return false;
+}
+
 #elif defined(__linux__)
 
+#include <sched.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <iostream>
@@ -112,4 +126,49 @@ bool set_thread_cpu(int64_t cpu_id) {
   return true;
 }
 
+bool set_thread_cpus(const std::vector<int64_t>& cpu_ids) {
+  if (cpu_ids.empty()) {
+    return false;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (const auto& cpu_id : cpu_ids) {
+    if (cpu_id < 0 || cpu_id >= CPU_SETSIZE) {
+      return false;
+    }
+    CPU_SET(cpu_id, &cpu_set);
+  }
+  return 0 == pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+}
+
+bool get_thread_cpus(std::vector<int64_t> *cpu_ids) {
+  if (nullptr == cpu_ids) {
+    return false;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (0 != pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set)) {
+    return false;
+  }
+  cpu_ids->clear();
+  for (int64_t cpu_id = 0; cpu_id < CPU_SETSIZE; ++cpu_id) {
+    if (CPU_ISSET(cpu_id, &cpu_set)) {
+      cpu_ids->push_back(cpu_id);
+    }
+  }
+  return !cpu_ids->empty();
+}
+
+bool get_current_cpu(int64_t *cpu_id) {
+  if (nullptr == cpu_id) {
+    return false;
+  }
+  const int cpu = sched_getcpu();
+  if (cpu < 0) {
+    return false;
+  }
+  *cpu_id = cpu;
+  return true;
+}
+
 #endif
@@ -4,9 +4,18 @@
 #define MODEL_SERVER_SRC_UTIL_OS_THREAD_CPU_H_
 
 #include <stdint.h>
+#include <vector>
 
 bool get_physical_cpu_num(int32_t *num);
 bool get_thread_cpu(int64_t *cpu_id);
 bool set_thread_cpu(int64_t cpu_id);
+// Let the calling thread run on any of the CPUs, threads it spawns afterwards inherit them.
+// get_thread_cpu then tells the first of them.
+bool set_thread_cpus(const std::vector<int64_t>& cpu_ids);
+// CPUs the calling thread may run on
+bool get_thread_cpus(std::vector<int64_t> *cpu_ids);
+// CPU the calling thread runs on right now, which may change at any time unless it is pinned to one.
+// Served by the vDSO where there is one, so cheap enough for every request.
+bool get_current_cpu(int64_t *cpu_id);
 
 #endif  // MODEL_SERVER_SRC_UTIL_OS_THREAD_CPU_H_